@@ -7,6 +7,9 @@
 #include <list>
 #include <algorithm>
 #include <mutex>
+#include <atomic>
+#include <string>
+#include <rte_pause.h>
 #include <arpa/inet.h>
 #include "Logger.hpp"
 
@@ -14,6 +17,7 @@ using std::equal;
 using std::list;
 using std::lock_guard;
 using std::mutex;
+using std::atomic;
 /**
  * @brief arp的数据结构,根据协议RFC826定义,协议文档地址:https://www.rfc-editor.org/rfc/pdfrfc/rfc826.txt.pdf
  */
@@ -30,10 +34,83 @@ struct ArpHeader
     bool operator==(const ArpHeader &other) const;
 };
 
+#define ARP_TABLE_BITS 12                        ///< 哈希表槽位数量的位数
+#define ARP_TABLE_SIZE (1u << ARP_TABLE_BITS)    ///< 哈希表槽位数量
+#define ARP_TABLE_MAX_ENTRIES (ARP_TABLE_SIZE / 4 * 3) ///< 最多存储的条目数量,保证开放寻址的探测长度
+#define ARP_BULK_MAX 64                          ///< 批量查找一次最多查找的地址数量
+
 /**
- * @brief 存储arp地址的类,单例模式，有插入、查找、移除的功能
+ * @brief 邻居条目的状态,参考RFC 4861 7.3.2
  */
+enum class ARP_STATE : uint8_t
+{
+    ARP_STATE_INCOMPLETE = 0, ///< 已发出广播请求,还没有收到应答,没有可用的MAC地址
+    ARP_STATE_REACHABLE,      ///< 最近收到过应答,MAC地址可信
+    ARP_STATE_STALE,          ///< 可达时间已过,MAC地址仍可使用,等待下一次发送触发确认
+    ARP_STATE_DELAY,          ///< 有报文使用了过期条目,等待一段时间后开始单播探测
+    ARP_STATE_PROBE,          ///< 正在向缓存的MAC地址发送单播请求确认可达性
+    ARP_STATE_PERMANENT,      ///< 配置的静态条目,不老化,也不会被学习到的地址覆盖
+};
 
+/**
+ * @brief 邻居状态机的各项定时参数(毫秒)
+ */
+struct ArpTimers
+{
+    uint64_t reachableMs = 30000; ///< REACHABLE状态的持续时间
+    uint64_t delayMs = 5000;      ///< DELAY状态等待上层确认的时间
+    uint64_t retransMs = 1000;    ///< 请求的重传间隔,广播解析每次重传后加倍
+    uint64_t retransMaxMs = 8000; ///< 广播解析重传间隔的上限
+    uint64_t staleGcMs = 60000;   ///< STALE状态没有被使用时的最长保留时间
+    uint32_t ucastProbes = 3;     ///< PROBE状态最多发送的单播请求数量
+    uint32_t mcastProbes = 3;     ///< INCOMPLETE状态最多发送的广播请求数量
+};
+
+/**
+ * @brief 定时器需要发出的ARP请求
+ */
+struct ArpProbe
+{
+    uint32_t ip;                     ///< 需要解析的IP地址
+    uint8_t mac[RTE_ETHER_ADDR_LEN]; ///< 单播请求的目的MAC地址
+    bool unicast;                    ///< true为单播确认,false为广播解析
+};
+
+/**
+ * @brief 缓存在连接或socket中的下一跳MAC地址
+ *
+ * 全零表示无效。ARP表中已有条目的MAC地址变化或者条目被删除时,表的邻居代数(generation)递增,
+ * 所有缓存随之失效;新增条目和状态迁移不影响已有的缓存。
+ */
+struct ArpCacheEntry
+{
+    uint32_t ip = 0;                     ///< 缓存对应的下一跳IP地址
+    uint32_t generation = 0;             ///< 缓存时ARP表的邻居代数
+    uint32_t slot = 0;                   ///< 条目所在的槽位,用于命中时设置使用标记
+    uint8_t mac[RTE_ETHER_ADDR_LEN] = {0}; ///< 缓存的MAC地址
+};
+
+/**
+ * @brief 哈希表的一个槽位,读者会访问的字段都是原子变量
+ */
+struct ArpSlot
+{
+    std::atomic<uint64_t> key{0};  ///< 低32位为IP地址,第32位为占用标记,0表示空槽位
+    std::atomic<uint64_t> hw{0};   ///< 低48位为MAC地址,高16位为硬件类型
+    std::atomic<uint8_t> state{0}; ///< 邻居状态,取值为ARP_STATE
+    std::atomic<uint8_t> used{0};  ///< 查找命中时置1,由定时器清零,用于STALE到DELAY的转换
+    uint8_t probes = 0;            ///< 当前状态下已发送的请求数量,只在持有写锁时访问
+    uint64_t deadline = 0;         ///< 当前状态的超时时间(毫秒),只在持有写锁时访问
+};
+
+/**
+ * @brief 存储arp地址的类,单例模式，有插入、查找、移除的功能
+ *
+ * 使用线性探测的开放寻址哈希表,按IP地址查找为O(1)。
+ * 写操作(插入、移除、清空、状态迁移)之间用互斥锁串行化,并通过全局版本号(seqlock)通知读者;
+ * 读操作不加锁,读到一半遇到写操作时重试,查到的MAC地址拷贝给调用者,不会返回表内部的指针。
+ * 条目的老化和重新确认由控制核上的定时器周期性调用tick完成,查找路径只额外设置一个使用标记。
+ */
 class ArpTable
 {
 public:
@@ -44,30 +121,129 @@ public:
     static ArpTable &getInstance();
 
     /**
-     * @brief 插入arp数据到队列尾部
-     * @return 成功时返回0
+     * @brief 设置邻居状态机的定时参数
+     */
+    static void setTimers(const ArpTimers &timers);
+
+    /**
+     * @brief 插入收到应答确认过的arp数据,IP地址已存在时更新其MAC地址,条目进入REACHABLE状态
+     * @return 成功时返回0,表已满返回-1
      */
     static int pushBack(ArpHeader arpHeader);
 
+    /**
+     * @brief 插入静态条目,IP地址已存在时覆盖原条目
+     * @return 成功时返回0,表已满返回-1
+     */
+    static int addStatic(ArpHeader arpHeader);
+
+    /**
+     * @brief 根据未经确认的arp数据(如对方发来的请求)更新条目
+     *
+     * 条目不存在时以STALE状态插入;INCOMPLETE条目或者MAC地址发生变化的条目更新MAC地址并进入STALE状态。
+     * @return 成功时返回0,表已满返回-1
+     */
+    static int update(ArpHeader arpHeader);
+
+    /**
+     * @brief 查找不到MAC地址时开始解析,条目不存在时插入INCOMPLETE条目
+     * @param dip 需要解析的IP地址
+     * @return 新插入条目返回0,调用者需要发出第一个广播请求;条目已存在(解析正在进行)返回1;表已满返回-1
+     */
+    static int resolve(uint32_t dip);
+
     /**
      * @brief 移除某个arp数据
-     * @return 成功时返回0,存储队列为空或者找不到要移除的数据则返回-1
+     * @return 成功时返回0,找不到要移除的数据则返回-1
      */
     static int remove(const ArpHeader &arpHeader);
 
     /**
-     * @brief 查找某个IP对应的MAC地址
+     * @brief 查找某个IP对应的MAC地址,INCOMPLETE条目视为找不到
      * @param dip 需要查找的IP地址
-     * @return 如果找到则返回对应的MAC地址,否则返回nullptr
+     * @param mac 输出参数,找到时拷贝MAC地址,长度为RTE_ETHER_ADDR_LEN
+     * @return 找到返回true,否则返回false
      */
-    static uint8_t *search(const uint32_t &dip);
+    static bool lookup(uint32_t dip, uint8_t *mac);
 
     /**
-     * @brief 清空队列中的所有数据
-     * @return 成功时返回0, 如果列表本来就是空则返回-1
+     * @brief 批量查找一批IP对应的MAC地址,用于发送一整批报文前一次性解析
+     * @param dips 需要查找的IP地址数组
+     * @param nb 地址数量,不超过ARP_BULK_MAX
+     * @param macs 输出参数,第i个地址找到时拷贝到macs[i]
+     * @return 命中掩码,第i位为1表示第i个地址找到
+     */
+    static uint64_t lookupBulk(const uint32_t *dips, unsigned nb, uint8_t (*macs)[RTE_ETHER_ADDR_LEN]);
+
+    /**
+     * @brief 带缓存的查找,缓存有效时不访问哈希表,失效时重新查找并更新缓存
+     * @param dip 需要查找的IP地址
+     * @param cache 调用者持有的缓存,命中时cache->mac即为目的MAC地址
+     * @return 找到返回true,否则返回false
+     */
+    static bool lookupCached(uint32_t dip, ArpCacheEntry *cache)
+    {
+        if (cache->ip == dip && cache->generation == _generation.load(std::memory_order_acquire))
+        {
+            // 走缓存也要让状态机知道该条目仍在使用
+            ArpSlot &slot = _slots[cache->slot];
+            if (!slot.used.load(std::memory_order_relaxed))
+                slot.used.store(1, std::memory_order_relaxed);
+            return true;
+        }
+        return lookupBulkCached(&dip, 1, &cache, &cache->mac) & 1;
+    }
+
+    /**
+     * @brief 带缓存的批量查找,只有缓存失效的地址才访问哈希表
+     * @param dips 需要查找的IP地址数组
+     * @param nb 地址数量,不超过ARP_BULK_MAX
+     * @param caches 每个地址对应的缓存,查找成功时更新
+     * @param macs 输出参数,第i个地址找到时拷贝到macs[i]
+     * @return 命中掩码,第i位为1表示第i个地址找到
+     */
+    static uint64_t lookupBulkCached(const uint32_t *dips, unsigned nb, ArpCacheEntry **caches, uint8_t (*macs)[RTE_ETHER_ADDR_LEN]);
+
+    /**
+     * @brief 查询某个IP对应条目的状态
+     * @return 条目存在时返回ARP_STATE的取值,否则返回-1
+     */
+    static int getState(uint32_t dip);
+
+    /**
+     * @brief 推进所有条目的状态机,由控制核上的定时器周期性调用
+     * @param nowMs 当前时间(毫秒),单调递增
+     * @param probes 输出参数,需要发出的ARP请求
+     * @param maxProbes probes的容量,放不下的请求推迟到下一次调用
+     * @return 需要发出的ARP请求数量
+     */
+    static unsigned tick(uint64_t nowMs, ArpProbe *probes, unsigned maxProbes);
+
+    /**
+     * @brief 把学习到的条目(不含INCOMPLETE和静态条目)通过mmap写入快照文件,用于重启后预热
+     * @param path 快照文件路径
+     * @return 成功时返回写入的条目数量,失败返回-1
+     */
+    static int saveSnapshot(const std::string &path);
+
+    /**
+     * @brief 从快照文件加载条目,加载的条目处于STALE状态,首次使用时会单播确认
+     * @param path 快照文件路径
+     * @return 成功时返回加载的条目数量,文件不存在或格式错误返回-1
+     */
+    static int loadSnapshot(const std::string &path);
+
+    /**
+     * @brief 清空表中的所有数据
+     * @return 成功时返回0
      */
     static int clear();
 
+    /**
+     * @brief 当前存储的条目数量
+     */
+    static unsigned size();
+
 private:
     ArpTable() {};
     ~ArpTable() {};
@@ -76,9 +252,58 @@ private:
     ArpTable &operator=(const ArpTable &) = delete;
     ArpTable &operator=(ArpTable &&) = delete;
 
+    static uint32_t slotIndex(uint32_t ip)
+    {
+        return (ip * 0x9e3779b1u) >> (32 - ARP_TABLE_BITS);
+    }
+    static uint64_t makeKey(uint32_t ip) { return (1ULL << 32) | ip; }
+    static uint64_t packHw(const ArpHeader &arpHeader);
+
+    /**
+     * @brief 查找IP所在的槽位,调用者需要持有写锁或者处于读临界区中
+     * @return 找到返回槽位下标,否则返回-1
+     */
+    static int probe(uint32_t ip);
+
+    /**
+     * @brief 插入新条目,调用者需要持有写锁且已确认IP不存在
+     * @return 成功返回槽位下标,表已满返回-1
+     */
+    static int insertLocked(uint32_t ip, uint64_t hw, ARP_STATE state, uint64_t deadline);
+
+    /**
+     * @brief 删除某个槽位的条目,调用者需要持有写锁并处于写临界区中
+     */
+    static void eraseLocked(uint32_t idx);
+
+    /**
+     * @brief 已有条目的MAC地址变化或条目位置变化时调用,使所有ArpCacheEntry失效,调用者需要处于写临界区中
+     */
+    static void invalidateCaches()
+    {
+        _generation.store(_generation.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+    }
+
+    static void setState(ArpSlot &slot, ARP_STATE state, uint64_t deadline)
+    {
+        slot.state.store((uint8_t)state, std::memory_order_relaxed);
+        slot.deadline = deadline;
+        slot.probes = 0;
+    }
+
+    static uint32_t readBegin();
+    static bool readRetry(uint32_t version);
+    static void writeBegin();
+    static void writeEnd();
+
 private:
-    static list<ArpHeader> _list; ///< 存储arp数据
-    static mutex _mutex;           ///< 互斥锁,用于实现线程安全
+    static ArpSlot _slots[ARP_TABLE_SIZE]; ///< 哈希表槽位
+    static atomic<uint32_t> _version;      ///< 写操作版本号,奇数表示正在写
+    static atomic<uint32_t> _generation;   ///< 邻居代数,从1开始,已有条目变化时递增
+    static unsigned _count;                ///< 已存储的条目数量,只在持有写锁时修改
+    static ArpTimers _timers;              ///< 状态机定时参数
+    static uint64_t _nowMs;                ///< 最近一次tick的时间,只在持有写锁时访问
+    static mutex _mutex;                   ///< 互斥锁,串行化写操作
 };
 
 #endif
@@ -2,8 +2,13 @@
 #define ARP_PROCESS_HPP
 #include <rte_mbuf.h>
 #include <rte_ethdev.h>
-#include <rte_ethdev.h>
+#include <rte_timer.h>
 #include <arpa/inet.h>
+#include <unordered_map>
+#include <deque>
+#include <mutex>
+#include <vector>
+#include <string>
 
 #include "Processor.hpp"
 #include "Arp.hpp"
@@ -11,6 +16,8 @@
 #include "Ring.hpp"
 #include "PktProcess.hpp"
 
+#define ARP_TIMER_MAX_PROBES 64 ///< 每次定时器触发最多发出的ARP请求数量
+
 class ArpProcessor : public Processor
 {
 public:
@@ -23,6 +30,55 @@ public:
                                    uint8_t *dstMac, uint32_t dstIp);
     int handlePacket(struct rte_mempool *mbufPool, struct rte_mbuf *mbufs, struct inout_ring *ring);
     void getDefaultArpMac(uint8_t *copy);
+
+    /**
+     * @brief 启动邻居状态机定时器,定时器在调用者所在的lcore上运行,需要该lcore周期性调用rte_timer_manage
+     * @param mbufPool 构造ARP请求使用的内存池
+     * @param out 发送ARP请求的输出环
+     * @param periodMs 定时器周期(毫秒)
+     * @return 成功返回0,失败返回-1
+     */
+    int startTimer(struct rte_mempool *mbufPool, struct rte_ring *out, uint64_t periodMs);
+
+    /**
+     * @brief 把配置中的静态条目加入ARP表
+     * @param entries (IP, MAC)字符串列表,格式错误的条目会被跳过
+     * @return 成功加入的条目数量
+     */
+    int addStaticEntries(const std::vector<std::pair<std::string, std::string>> &entries);
+
+    /**
+     * @brief 端口启动后发送免费ARP,让对端尽快刷新本机的MAC地址
+     *
+     * 第一个立即发出,其余的由ARP定时器按间隔发出,必须在startTimer之后调用。
+     * @param count 发送数量,0表示不发送
+     * @param intervalMs 发送间隔(毫秒)
+     */
+    void announce(unsigned count, uint64_t intervalMs);
+
+    /**
+     * @brief 设置每个未解析地址最多缓存的报文数量
+     */
+    void setPendingDepth(unsigned depth) { _pendingDepth = depth; }
+
+    /**
+     * @brief 目的MAC地址未知时的发送入口
+     *
+     * 报文放入该下一跳的等待队列,新开始解析时发出第一个广播请求,之后的重传由ARP定时器按指数退避负责。
+     * 队列已满时丢弃最早的报文。
+     * @param mbufPool 构造ARP请求使用的内存池
+     * @param out 输出环
+     * @param nextHop 下一跳IP地址
+     * @param mbuf 已构造好的报文,以太网目的地址在解析完成后填写
+     * @return 报文已缓存返回0,无法解析被丢弃返回-1
+     */
+    int queuePending(struct rte_mempool *mbufPool, struct rte_ring *out, uint32_t nextHop, struct rte_mbuf *mbuf);
+
+    /**
+     * @brief 某个地址解析完成后,填写目的MAC地址并把等待的报文一次性发出
+     * @return 发出的报文数量
+     */
+    unsigned flushPending(uint32_t ip, const uint8_t *mac, struct rte_ring *out);
     /**
      * @brief 编码arp包到msg中
      * @param msg 指向要编码的缓冲区
@@ -40,6 +96,35 @@ protected:
     int setNextProcessor(std::shared_ptr<Processor> nextProcessor) override;
 
 private:
+    /**
+     * @brief 定时器回调,推进ARP表状态机并发出需要的单播确认和广播解析请求
+     */
+    static void arpTimerCallback(struct rte_timer *timer, void *arg);
+
+    /**
+     * @brief 释放解析失败(条目已被删除)的地址上等待的报文,并发出已经解析完成的地址上等待的报文
+     */
+    void expirePending();
+
+    /**
+     * @brief 把发给本机的ARP请求原地改写为应答,交换地址并修改操作码
+     * @param mbuf 独占的单段ARP请求报文
+     * @param srcMac 本机MAC地址
+     */
+    void reflectRequest(struct rte_mbuf *mbuf, const uint8_t *srcMac);
+
+    /**
+     * @brief 发送一个免费ARP请求,发送方和目标IP都是本机地址
+     */
+    void sendGratuitous();
+
+    /**
+     * @brief 从通往目标地址的接口发送ARP请求,源地址使用该接口的主地址
+     * @param dstMac 目标MAC地址,广播请求为defaultArpMac
+     * @param targetIp 要解析的地址
+     */
+    void sendRequest(struct rte_mempool *mbufPool, struct rte_ring *out, uint8_t *dstMac, uint32_t targetIp);
+
     ArpProcessor();
     ~ArpProcessor();
     ArpProcessor(const ArpProcessor &) = delete;
@@ -50,6 +135,16 @@ private:
 private:
     const uint8_t defaultArpMac[RTE_ETHER_ADDR_LEN] = {0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF}; ///< 默认的广播MAC地址
     std::shared_ptr<Processor> _nextProcessor;
+    struct rte_timer _arpTimer;                ///< 邻居状态机定时器
+    struct rte_mempool *_timerPool = nullptr;  ///< 定时器构造ARP请求使用的内存池
+    struct rte_ring *_timerOut = nullptr;      ///< 定时器发出ARP请求的输出环
+    std::unordered_map<uint32_t, std::deque<struct rte_mbuf *>> _pending; ///< 每个未解析地址上等待的报文
+    std::mutex _pendingMutex;                  ///< 保护_pending,未命中是慢路径
+    unsigned _pendingDepth = 16;               ///< 每个地址最多缓存的报文数量
+    uint64_t _pendingDropped = 0;              ///< 因队列满或解析失败丢弃的报文数量
+    unsigned _garpRemaining = 0;               ///< 还需要发送的免费ARP数量
+    uint64_t _garpIntervalMs = 0;              ///< 免费ARP的发送间隔(毫秒)
+    uint64_t _garpNextMs = 0;                  ///< 下一个免费ARP的发送时间(毫秒)
 };
 
 #endif
\ No newline at end of file
@@ -2,9 +2,12 @@
 #define BASE_NETWORK_HPP
 #include <rte_mbuf.h>
 #include <rte_ether.h>
+#include <sys/socket.h>
 #include <list>
 #include <memory>
 
+#define MAX_FD_COUNT 1024 ///< 文件描述符的上限
+
 class BaseNetwork
 {
 public:
@@ -15,6 +18,14 @@ public:
     int freeFdFromBitMap(int fd);
 
 protected:
+    /**
+     * @brief 解析设置DSCP的socket选项:AF_INET的IPPROTO_IP/IP_TOS或AF_INET6的IPPROTO_IPV6/IPV6_TCLASS
+     * @param family 地址族
+     * @param tos 解析出的服务类型字节,ECN位清零
+     * @return 合法的服务类型选项返回0;选项值非法返回-1并设置errno;不是服务类型选项返回1
+     */
+    static int parseTosOption(int family, int level, int optname, const void *optval, socklen_t optlen, uint8_t *tos);
+
     static unsigned char _fdTable[1024]; ///< 文件描述符位图
 
 private:
@@ -2,6 +2,9 @@
 #include <fstream>
 #include "Json.hpp"
 #include <mutex>
+#include <vector>
+#include <utility>
+#include <tuple>
 #include <arpa/inet.h>
 
 // 使用 nlohmann/json 的命名空间
@@ -34,12 +37,88 @@ public:
         _ring_size = _json["RING_SIZE"].get<int>();
         _timer_resolution_cycles = _json["TIMER_RESOLUTION_CYCLES"].get<unsigned long long>();
         _local_ip = _json["LOCAL_IP"].get<std::string>();
-        struct in_addr addr;
+        struct in_addr addr = {};
         inet_pton(AF_INET, _local_ip.c_str(), &addr); // addr.s_addr 现在是网络字节序
-        _local_addr = MAKE_IPV4_ADDR(192, 168, 0, 104);
+        _local_addr = addr.s_addr;
         _dpdk_port_id = _json["DPDK_PORT_ID"].get<int>();
         _max_packet_size = _json["MAX_PACKET_SIZE"].get<int>();
         _enable_kni = _json["ENABLE_KNI"].get<bool>();
+        _rps_workers = _json.value("RPS_WORKERS", 1);
+        _rps_stats_interval_sec = _json.value("RPS_STATS_INTERVAL_SEC", 10);
+        _rps_mode = _json.value("RPS_MODE", std::string("hash"));
+        _reorder_enable = _json.value("REORDER_ENABLE", false);
+        _reorder_buffer_size = _json.value("REORDER_BUFFER_SIZE", 1024);
+        _reorder_max_hold_us = _json.value("REORDER_MAX_HOLD_US", 500);
+        _enable_ddos_detect = _json.value("ENABLE_DDOS_DETECT", true);
+        _enable_rx_cksum_offload = _json.value("ENABLE_RX_CKSUM_OFFLOAD", false);
+        _arp_timer_ms = _json.value("ARP_TIMER_MS", 100);
+        _arp_reachable_ms = _json.value("ARP_REACHABLE_MS", 30000);
+        _arp_delay_ms = _json.value("ARP_DELAY_MS", 5000);
+        _arp_retrans_ms = _json.value("ARP_RETRANS_MS", 1000);
+        _arp_retrans_max_ms = _json.value("ARP_RETRANS_MAX_MS", 8000);
+        _arp_pending_depth = _json.value("ARP_PENDING_DEPTH", 16);
+        _arp_stale_gc_ms = _json.value("ARP_STALE_GC_MS", 60000);
+        _arp_ucast_probes = _json.value("ARP_UCAST_PROBES", 3);
+        _arp_mcast_probes = _json.value("ARP_MCAST_PROBES", 3);
+        _arp_static_entries.clear();
+        if (_json.contains("ARP_STATIC_ENTRIES"))
+        {
+            for (auto &entry : _json["ARP_STATIC_ENTRIES"])
+                _arp_static_entries.emplace_back(entry["IP"].get<std::string>(), entry["MAC"].get<std::string>());
+        }
+        _arp_snapshot_path = _json.value("ARP_SNAPSHOT_PATH", std::string(""));
+        _garp_count = _json.value("GARP_COUNT", 3);
+        _garp_interval_ms = _json.value("GARP_INTERVAL_MS", 1000);
+        _icmp_error_rate = _json.value("ICMP_ERROR_RATE", 1000);
+        _icmp_error_burst = _json.value("ICMP_ERROR_BURST", 100);
+        _icmp_error_src_rate = _json.value("ICMP_ERROR_SRC_RATE", 10);
+        _icmp_error_src_burst = _json.value("ICMP_ERROR_SRC_BURST", 10);
+        _pmtu_expire_ms = _json.value("PMTU_EXPIRE_MS", 600000);
+        _reassembly_max_entries = _json.value("REASSEMBLY_MAX_ENTRIES", 256);
+        _reassembly_bucket_entries = _json.value("REASSEMBLY_BUCKET_ENTRIES", 16);
+        _reassembly_timeout_ms = _json.value("REASSEMBLY_TIMEOUT_MS", 2000);
+        _local_prefix_len = _json.value("LOCAL_PREFIX_LEN", 24);
+        _local_ips = _json.value("LOCAL_IPS", std::vector<std::string>());
+        _routes.clear();
+        if (_json.contains("ROUTES"))
+        {
+            for (auto &entry : _json["ROUTES"])
+                _routes.emplace_back(entry["DST"].get<std::string>(), entry.value("GATEWAY", std::string("")));
+        }
+        _route_max_rules = _json.value("ROUTE_MAX_RULES", 1024);
+        _route_number_tbl8 = _json.value("ROUTE_NUMBER_TBL8", 256);
+        _enable_ipv6 = _json.value("ENABLE_IPV6", true);
+        _local_ipv6 = _json.value("LOCAL_IPV6", std::vector<std::string>());
+        _ipv6_gateway = _json.value("IPV6_GATEWAY", std::string(""));
+        _vlans.clear();
+        if (_json.contains("VLANS"))
+        {
+            for (auto &entry : _json["VLANS"])
+                _vlans.emplace_back(entry["ID"].get<uint16_t>(), entry["ADDR"].get<std::string>());
+        }
+        _vxlan_udp_port = _json.value("VXLAN_UDP_PORT", 4789);
+        _vxlans.clear();
+        if (_json.contains("VXLANS"))
+        {
+            for (auto &entry : _json["VXLANS"])
+                _vxlans.emplace_back(entry["VNI"].get<uint32_t>(), entry["ADDR"].get<std::string>(),
+                                     entry["REMOTE"].get<std::string>());
+        }
+        _igmp_version = _json.value("IGMP_VERSION", 3);
+        _qos_enable = _json.value("QOS_ENABLE", false);
+        _qos_queue_size = _json.value("QOS_QUEUE_SIZE", 1024);
+        _qos_wrr_weights = _json.value("QOS_WRR_WEIGHTS", std::vector<unsigned>{4, 2, 1});
+        _ip_forward = _json.value("IP_FORWARD", false);
+        _nat_enable = _json.value("NAT_ENABLE", false);
+        _nat_external_ips = _json.value("NAT_EXTERNAL_IPS", std::vector<std::string>());
+        _nat_internal_nets = _json.value("NAT_INTERNAL_NETS", std::vector<std::string>());
+        _nat_port_min = _json.value("NAT_PORT_MIN", 1024);
+        _nat_port_max = _json.value("NAT_PORT_MAX", 65535);
+        _nat_max_sessions = _json.value("NAT_MAX_SESSIONS", 65536);
+        _nat_udp_timeout_ms = _json.value("NAT_UDP_TIMEOUT_MS", 120000);
+        _nat_tcp_est_timeout_ms = _json.value("NAT_TCP_EST_TIMEOUT_MS", 7440000);
+        _nat_tcp_trans_timeout_ms = _json.value("NAT_TCP_TRANS_TIMEOUT_MS", 240000);
+        _udp_rx_zero_copy = _json.value("UDP_RX_ZERO_COPY", false);
         return true;
     }
 
@@ -52,7 +131,62 @@ public:
             << "NUM_MBUFS: " << _num_mbufs << "\n"
             << "BURST_SIZE: " << _burst_size << "\n"
             << "RING_SIZE: " << _ring_size << "\n"
-            << "TIMER_RESOLUTION_CYCLES: " << _timer_resolution_cycles;
+            << "TIMER_RESOLUTION_CYCLES: " << _timer_resolution_cycles << "\n"
+            << "RPS_WORKERS: " << _rps_workers << "\n"
+            << "RPS_STATS_INTERVAL_SEC: " << _rps_stats_interval_sec << "\n"
+            << "RPS_MODE: " << _rps_mode << "\n"
+            << "REORDER_ENABLE: " << (_reorder_enable ? "true" : "false") << "\n"
+            << "REORDER_BUFFER_SIZE: " << _reorder_buffer_size << "\n"
+            << "REORDER_MAX_HOLD_US: " << _reorder_max_hold_us << "\n"
+            << "ENABLE_DDOS_DETECT: " << (_enable_ddos_detect ? "true" : "false") << "\n"
+            << "ENABLE_RX_CKSUM_OFFLOAD: " << (_enable_rx_cksum_offload ? "true" : "false") << "\n"
+            << "ARP_TIMER_MS: " << _arp_timer_ms << "\n"
+            << "ARP_REACHABLE_MS: " << _arp_reachable_ms << "\n"
+            << "ARP_DELAY_MS: " << _arp_delay_ms << "\n"
+            << "ARP_RETRANS_MS: " << _arp_retrans_ms << "\n"
+            << "ARP_RETRANS_MAX_MS: " << _arp_retrans_max_ms << "\n"
+            << "ARP_PENDING_DEPTH: " << _arp_pending_depth << "\n"
+            << "ARP_STALE_GC_MS: " << _arp_stale_gc_ms << "\n"
+            << "ARP_UCAST_PROBES: " << _arp_ucast_probes << "\n"
+            << "ARP_MCAST_PROBES: " << _arp_mcast_probes << "\n"
+            << "ARP_STATIC_ENTRIES: " << _arp_static_entries.size() << "\n"
+            << "ARP_SNAPSHOT_PATH: " << _arp_snapshot_path << "\n"
+            << "GARP_COUNT: " << _garp_count << "\n"
+            << "GARP_INTERVAL_MS: " << _garp_interval_ms << "\n"
+            << "ICMP_ERROR_RATE: " << _icmp_error_rate << "\n"
+            << "ICMP_ERROR_BURST: " << _icmp_error_burst << "\n"
+            << "ICMP_ERROR_SRC_RATE: " << _icmp_error_src_rate << "\n"
+            << "ICMP_ERROR_SRC_BURST: " << _icmp_error_src_burst << "\n"
+            << "PMTU_EXPIRE_MS: " << _pmtu_expire_ms << "\n"
+            << "REASSEMBLY_MAX_ENTRIES: " << _reassembly_max_entries << "\n"
+            << "REASSEMBLY_BUCKET_ENTRIES: " << _reassembly_bucket_entries << "\n"
+            << "REASSEMBLY_TIMEOUT_MS: " << _reassembly_timeout_ms << "\n"
+            << "LOCAL_PREFIX_LEN: " << _local_prefix_len << "\n"
+            << "LOCAL_IPS: " << _local_ips.size() << "\n"
+            << "ROUTES: " << _routes.size() << "\n"
+            << "ROUTE_MAX_RULES: " << _route_max_rules << "\n"
+            << "ROUTE_NUMBER_TBL8: " << _route_number_tbl8 << "\n"
+            << "ENABLE_IPV6: " << (_enable_ipv6 ? "true" : "false") << "\n"
+            << "LOCAL_IPV6: " << _local_ipv6.size() << "\n"
+            << "IPV6_GATEWAY: " << _ipv6_gateway << "\n"
+            << "VLANS: " << _vlans.size() << "\n"
+            << "VXLAN_UDP_PORT: " << _vxlan_udp_port << "\n"
+            << "VXLANS: " << _vxlans.size() << "\n"
+            << "IGMP_VERSION: " << _igmp_version << "\n"
+            << "QOS_ENABLE: " << (_qos_enable ? "true" : "false") << "\n"
+            << "QOS_QUEUE_SIZE: " << _qos_queue_size << "\n"
+            << "QOS_WRR_WEIGHTS: " << _qos_wrr_weights.size() << "\n"
+            << "IP_FORWARD: " << (_ip_forward ? "true" : "false") << "\n"
+            << "NAT_ENABLE: " << (_nat_enable ? "true" : "false") << "\n"
+            << "NAT_EXTERNAL_IPS: " << _nat_external_ips.size() << "\n"
+            << "NAT_INTERNAL_NETS: " << _nat_internal_nets.size() << "\n"
+            << "NAT_PORT_MIN: " << _nat_port_min << "\n"
+            << "NAT_PORT_MAX: " << _nat_port_max << "\n"
+            << "NAT_MAX_SESSIONS: " << _nat_max_sessions << "\n"
+            << "NAT_UDP_TIMEOUT_MS: " << _nat_udp_timeout_ms << "\n"
+            << "NAT_TCP_EST_TIMEOUT_MS: " << _nat_tcp_est_timeout_ms << "\n"
+            << "NAT_TCP_TRANS_TIMEOUT_MS: " << _nat_tcp_trans_timeout_ms << "\n"
+            << "UDP_RX_ZERO_COPY: " << (_udp_rx_zero_copy ? "true" : "false");
 
         return oss.str();
     }
@@ -69,6 +203,61 @@ public:
     uint8_t *getSrcMac() { return _src_mac; }
     uint8_t getMaxPacketSize() const { return _max_packet_size; }
     bool isKniEnabled() const { return _enable_kni; }
+    uint32_t getRpsWorkers() const { return _rps_workers; }
+    uint32_t getRpsStatsIntervalSec() const { return _rps_stats_interval_sec; }
+    const std::string &getRpsMode() const { return _rps_mode; }
+    bool isReorderEnabled() const { return _reorder_enable; }
+    uint32_t getReorderBufferSize() const { return _reorder_buffer_size; }
+    uint32_t getReorderMaxHoldUs() const { return _reorder_max_hold_us; }
+    bool isDdosDetectEnabled() const { return _enable_ddos_detect; }
+    bool isRxCksumOffloadEnabled() const { return _enable_rx_cksum_offload; }
+    uint32_t getArpTimerMs() const { return _arp_timer_ms; }
+    uint32_t getArpReachableMs() const { return _arp_reachable_ms; }
+    uint32_t getArpDelayMs() const { return _arp_delay_ms; }
+    uint32_t getArpRetransMs() const { return _arp_retrans_ms; }
+    uint32_t getArpRetransMaxMs() const { return _arp_retrans_max_ms; }
+    uint32_t getArpPendingDepth() const { return _arp_pending_depth; }
+    uint32_t getArpStaleGcMs() const { return _arp_stale_gc_ms; }
+    uint32_t getArpUcastProbes() const { return _arp_ucast_probes; }
+    uint32_t getArpMcastProbes() const { return _arp_mcast_probes; }
+    const std::vector<std::pair<std::string, std::string>> &getArpStaticEntries() const { return _arp_static_entries; }
+    const std::string &getArpSnapshotPath() const { return _arp_snapshot_path; }
+    uint32_t getGarpCount() const { return _garp_count; }
+    uint32_t getGarpIntervalMs() const { return _garp_interval_ms; }
+    uint32_t getIcmpErrorRate() const { return _icmp_error_rate; }
+    uint32_t getIcmpErrorBurst() const { return _icmp_error_burst; }
+    uint32_t getIcmpErrorSrcRate() const { return _icmp_error_src_rate; }
+    uint32_t getIcmpErrorSrcBurst() const { return _icmp_error_src_burst; }
+    uint32_t getPmtuExpireMs() const { return _pmtu_expire_ms; }
+    uint32_t getReassemblyMaxEntries() const { return _reassembly_max_entries; }
+    uint32_t getReassemblyBucketEntries() const { return _reassembly_bucket_entries; }
+    uint32_t getReassemblyTimeoutMs() const { return _reassembly_timeout_ms; }
+    uint32_t getLocalPrefixLen() const { return _local_prefix_len; }
+    const std::vector<std::string> &getLocalIps() const { return _local_ips; }
+    const std::vector<std::pair<std::string, std::string>> &getRoutes() const { return _routes; }
+    uint32_t getRouteMaxRules() const { return _route_max_rules; }
+    uint32_t getRouteNumberTbl8() const { return _route_number_tbl8; }
+    bool isIpv6Enabled() const { return _enable_ipv6; }
+    const std::vector<std::string> &getLocalIpv6() const { return _local_ipv6; }
+    const std::string &getIpv6Gateway() const { return _ipv6_gateway; }
+    const std::vector<std::pair<uint16_t, std::string>> &getVlans() const { return _vlans; }
+    uint16_t getVxlanUdpPort() const { return _vxlan_udp_port; }
+    const std::vector<std::tuple<uint32_t, std::string, std::string>> &getVxlans() const { return _vxlans; }
+    unsigned getIgmpVersion() const { return _igmp_version; }
+    bool isQosEnabled() const { return _qos_enable; }
+    uint32_t getQosQueueSize() const { return _qos_queue_size; }
+    const std::vector<unsigned> &getQosWrrWeights() const { return _qos_wrr_weights; }
+    bool isIpForwardEnabled() const { return _ip_forward; }
+    bool isNatEnabled() const { return _nat_enable; }
+    const std::vector<std::string> &getNatExternalIps() const { return _nat_external_ips; }
+    const std::vector<std::string> &getNatInternalNets() const { return _nat_internal_nets; }
+    uint16_t getNatPortMin() const { return _nat_port_min; }
+    uint16_t getNatPortMax() const { return _nat_port_max; }
+    uint32_t getNatMaxSessions() const { return _nat_max_sessions; }
+    uint64_t getNatUdpTimeoutMs() const { return _nat_udp_timeout_ms; }
+    uint64_t getNatTcpEstTimeoutMs() const { return _nat_tcp_est_timeout_ms; }
+    uint64_t getNatTcpTransTimeoutMs() const { return _nat_tcp_trans_timeout_ms; }
+    bool isUdpRxZeroCopy() const { return _udp_rx_zero_copy; }
 
 private:
     // 私有构造函数
@@ -91,4 +280,59 @@ private:
     uint8_t _src_mac[RTE_ETHER_ADDR_LEN] = {0x00, 0x00, 0x00, 0x00, 0x00, 0x00};
     uint8_t _max_packet_size = 0;
     bool _enable_kni = false;
+    uint32_t _rps_workers = 1;            ///< 软件RPS的pkt_process工作核数量
+    uint32_t _rps_stats_interval_sec = 10; ///< RPS负载均衡统计的打印周期(秒),0表示关闭
+    std::string _rps_mode = "hash";       ///< RPS分发模式,hash按流分发,spray把无状态报文轮询喷洒到各工作核
+    bool _reorder_enable = false;         ///< 是否开启多工作核的出口保序
+    uint32_t _reorder_buffer_size = 1024; ///< 出口保序最多缓存的报文数量
+    uint32_t _reorder_max_hold_us = 500;  ///< 出口保序单个报文的最长缓存时间(微秒)
+    bool _enable_ddos_detect = true;      ///< 是否对收到的报文做DDoS检测
+    bool _enable_rx_cksum_offload = false; ///< 是否开启网卡RX校验和卸载
+    uint32_t _arp_timer_ms = 100;          ///< ARP状态机定时器周期(毫秒)
+    uint32_t _arp_reachable_ms = 30000;    ///< ARP条目REACHABLE状态的持续时间(毫秒)
+    uint32_t _arp_delay_ms = 5000;         ///< ARP条目DELAY状态的持续时间(毫秒)
+    uint32_t _arp_retrans_ms = 1000;       ///< ARP请求的重传间隔(毫秒)
+    uint32_t _arp_retrans_max_ms = 8000;   ///< 广播解析指数退避的最大重传间隔(毫秒)
+    uint32_t _arp_pending_depth = 16;      ///< 每个未解析地址最多缓存的待发送报文数量
+    uint32_t _arp_stale_gc_ms = 60000;     ///< 未被使用的STALE条目的保留时间(毫秒)
+    uint32_t _arp_ucast_probes = 3;        ///< 单播确认的最大请求次数
+    uint32_t _arp_mcast_probes = 3;        ///< 广播解析的最大请求次数
+    std::vector<std::pair<std::string, std::string>> _arp_static_entries; ///< 静态ARP条目,(IP, MAC)字符串
+    std::string _arp_snapshot_path;        ///< ARP表快照文件路径,为空表示不保存也不加载
+    uint32_t _garp_count = 3;              ///< 端口启动后发送的免费ARP数量
+    uint32_t _garp_interval_ms = 1000;     ///< 免费ARP的发送间隔(毫秒)
+    uint32_t _icmp_error_rate = 1000;      ///< ICMP差错和RST的全局速率(个/秒)
+    uint32_t _icmp_error_burst = 100;      ///< ICMP差错和RST的全局突发数量
+    uint32_t _icmp_error_src_rate = 10;    ///< 单个源地址能触发的ICMP差错和RST速率(个/秒)
+    uint32_t _icmp_error_src_burst = 10;   ///< 单个源地址能触发的ICMP差错和RST突发数量
+    uint32_t _pmtu_expire_ms = 600000;     ///< 学习到的路径MTU的有效期(毫秒)
+    uint32_t _reassembly_max_entries = 256; ///< 每个工作核同时重组的最大数据报数量,0表示关闭重组
+    uint32_t _reassembly_bucket_entries = 16; ///< 分片表每个哈希桶的条目数量
+    uint32_t _reassembly_timeout_ms = 2000; ///< 分片的最长等待时间(毫秒)
+    uint32_t _local_prefix_len = 24;       ///< 本机所在网段的前缀长度,用于生成直连路由
+    std::vector<std::string> _local_ips;   ///< LOCAL_IP之外的本机地址(VIP),点分十进制
+    std::vector<std::pair<std::string, std::string>> _routes; ///< 静态路由,(目的网段CIDR, 网关)字符串
+    uint32_t _route_max_rules = 1024;      ///< 路由表最多的路由条数
+    uint32_t _route_number_tbl8 = 256;     ///< 路由表中前缀长于24位的路由可用的tbl8组数量
+    bool _enable_ipv6 = true;              ///< 是否处理IPv6报文
+    std::vector<std::string> _local_ipv6;  ///< 本机IPv6全局地址,格式为"地址/前缀长度",链路本地地址自动生成
+    std::string _ipv6_gateway;             ///< IPv6默认网关,为空表示只能访问直连网段
+    std::vector<std::pair<uint16_t, std::string>> _vlans; ///< VLAN子接口,(VLAN ID, "地址/前缀长度"),为空表示端口不带标签
+    uint16_t _vxlan_udp_port = 4789;       ///< VXLAN使用的UDP端口
+    std::vector<std::tuple<uint32_t, std::string, std::string>> _vxlans; ///< VXLAN隧道,(VNI, "地址/前缀长度", 对端VTEP地址)
+    unsigned _igmp_version = 3;            ///< 加入组播组时使用的IGMP版本,2或3,收到旧版本查询时自动降级
+    bool _qos_enable = false;              ///< 是否按DSCP调度出口报文
+    uint32_t _qos_queue_size = 1024;       ///< 每个QoS类别队列的容量
+    std::vector<unsigned> _qos_wrr_weights{4, 2, 1}; ///< 1~3号QoS类别的WRR权重
+    bool _ip_forward = false;              ///< 是否转发目的地址不是本机的IPv4报文
+    bool _nat_enable = false;              ///< 是否对内部网段转发出去的报文做NAT44,需要同时打开IP_FORWARD
+    std::vector<std::string> _nat_external_ips;  ///< NAT外部地址,点分十进制
+    std::vector<std::string> _nat_internal_nets; ///< NAT内部网段,格式为"地址/前缀长度"
+    uint16_t _nat_port_min = 1024;         ///< NAT分配的外部端口下限
+    uint16_t _nat_port_max = 65535;        ///< NAT分配的外部端口上限
+    uint32_t _nat_max_sessions = 65536;    ///< 每个工作核最多的NAT会话数量,上限为NAT_MAX_SESSIONS
+    uint64_t _nat_udp_timeout_ms = 120000; ///< UDP会话的空闲超时(毫秒)
+    uint64_t _nat_tcp_est_timeout_ms = 7440000;  ///< 已建立TCP会话的空闲超时(毫秒)
+    uint64_t _nat_tcp_trans_timeout_ms = 240000; ///< 握手中或已关闭TCP会话的空闲超时(毫秒)
+    bool _udp_rx_zero_copy = false;        ///< UDP接收队列是否直接存放mbuf,应用可以零拷贝读取负载
 };
@@ -0,0 +1,53 @@
+#ifndef DATAPATH_HPP
+#define DATAPATH_HPP
+#include <rte_mbuf.h>
+#include <cstdint>
+#include <atomic>
+#include "Ring.hpp"
+
+#define DATAPATH_MAX_BURST 64 ///< 编译期特化支持的最大burst大小
+
+/**
+ * @brief 主核收发循环的参数
+ */
+struct MainLoopParams
+{
+    uint16_t portId;         ///< DPDK端口号
+    struct inout_ring *ring; ///< 0号工作核的收发环,out为所有工作核共享的输出环
+    uint64_t statsCycles;    ///< 统计信息打印周期(时钟周期),0表示关闭
+    uint64_t timerCycles;    ///< 调用rte_timer_manage的间隔(时钟周期)
+    const std::atomic<bool> *quit; ///< 置位后主循环返回,由信号处理函数设置
+};
+
+using PktProcessFn = int (*)(void *arg);
+using MainLoopFn = int (*)(struct MainLoopParams *params);
+
+/**
+ * @brief 把配置的burst大小对齐到编译期特化的取值{8, 16, 32, 64},向上取整,超过64按64处理
+ * @param burstSize 配置文件中的BURST_SIZE
+ * @return 实际使用的burst大小
+ */
+unsigned datapathBurstSize(unsigned burstSize);
+
+/**
+ * @brief 启动时选择pkt_process工作核的特化实现
+ *
+ * burst大小、是否开启KNI、是否使用网卡RX校验和卸载都作为模板参数,
+ * 报文循环中不再读取配置,编译器可以展开循环并去掉无用分支。
+ * @param burstSize 经过datapathBurstSize对齐后的burst大小
+ * @param enableKni 是否把收到的报文全部交给KNI
+ * @param enableOffload 是否信任网卡给出的校验和结果
+ * @return 工作核入口函数,参数为PktProcessParams
+ */
+PktProcessFn selectPktProcess(unsigned burstSize, bool enableKni, bool enableOffload);
+
+/**
+ * @brief 启动时选择主核收发循环的特化实现
+ * @param burstSize 经过datapathBurstSize对齐后的burst大小
+ * @param enableDdos 是否对收到的报文做DDoS检测
+ * @param enableVlan 是否配置了VLAN子接口
+ * @return 主核收发循环函数
+ */
+MainLoopFn selectMainLoop(unsigned burstSize, bool enableDdos, bool enableVlan);
+
+#endif
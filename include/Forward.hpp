@@ -0,0 +1,122 @@
+#ifndef FORWARD_HPP
+#define FORWARD_HPP
+#include <rte_mbuf.h>
+#include <rte_ether.h>
+#include <rte_ip.h>
+#include <cstdint>
+#include "Ring.hpp"
+#include "Route.hpp"
+#include "Datapath.hpp"
+#include "Utils.hpp"
+
+/**
+ * @brief 转发路径丢弃报文的原因
+ */
+enum FWD_DROP_REASON
+{
+    FWD_DROP_ADDR = 0, ///< 目的MAC不是本机(KNI使网卡处于混杂模式),或目的地址不可转发(RFC 1812 5.3.7)
+    FWD_DROP_TTL,      ///< TTL耗尽,已回复超时差错
+    FWD_DROP_NO_ROUTE, ///< 没有到目的地址的路由,已回复网络不可达
+    FWD_DROP_TOO_BIG,  ///< 超过出接口MTU,设置了DF时已回复需要分片
+    FWD_DROP_NEIGH,    ///< 下一跳的ARP表或待解析队列已满
+    FWD_DROP_MAX,
+};
+
+/**
+ * @brief 不以本机为目的地址的IPv4报文的转发,单例模式
+ *
+ * 工作核把这类报文暂存在自己的批次中,处理完一批入站报文后统一转发:
+ * 按LPM路由查出接口和下一跳,TTL减一并增量更新首部校验和(RFC 1624),
+ * 一次批量查询ARP表改写以太网头部,最后整批放入输出环,不经过任何socket。
+ * 出接口可以是物理端口、VLAN子接口或VXLAN隧道接口,标签和外层封装由主核发送前完成。
+ * 下一跳MAC未知的报文交给ARP模块缓存,解析完成后由ARP模块填写目的MAC并发出。
+ * 超过出接口MTU的报文不在转发路径上分片。
+ */
+class Ipv4Forwarder
+{
+public:
+    static Ipv4Forwarder &getInstance()
+    {
+        static Ipv4Forwarder instance;
+        return instance;
+    }
+
+    /**
+     * @brief 打开转发,必须在工作核启动前调用
+     * @param srcMac 本机MAC地址,所有接口共用
+     */
+    void init(const uint8_t *srcMac);
+
+    bool isEnabled() const { return _enabled; }
+
+    /**
+     * @brief 暂存一个需要转发的报文,批次已满时先转发已暂存的报文
+     * @param workerId 工作核编号
+     */
+    void stage(unsigned workerId, struct rte_mempool *mbufPool, struct rte_ring *out, struct rte_mbuf *mbuf)
+    {
+        WorkerState &state = _workers[workerId];
+        if (state.nbPending == DATAPATH_MAX_BURST)
+            flush(workerId, mbufPool, out);
+        state.pending[state.nbPending++] = mbuf;
+    }
+
+    /**
+     * @brief 转发工作核暂存的报文,工作核每处理完一批报文调用一次
+     * @param mbufPool 构造ICMP差错和ARP请求使用的内存池
+     * @param out 输出环
+     */
+    void flush(unsigned workerId, struct rte_mempool *mbufPool, struct rte_ring *out);
+
+    /**
+     * @brief TTL减一并增量更新首部校验和,TTL与协议在同一个16位字中
+     */
+    static void decrementTtl(struct rte_ipv4_hdr *iphdr)
+    {
+        uint16_t oldTtl = *(uint16_t *)&iphdr->time_to_live;
+        iphdr->time_to_live--;
+        iphdr->hdr_checksum = checksumAdjust(iphdr->hdr_checksum, oldTtl, *(uint16_t *)&iphdr->time_to_live);
+    }
+
+    /**
+     * @brief 打印转发的报文数量、速率(Mpps)和丢弃原因
+     */
+    void dumpStats();
+
+private:
+    Ipv4Forwarder() = default;
+    ~Ipv4Forwarder() = default;
+    Ipv4Forwarder(const Ipv4Forwarder &) = delete;
+    Ipv4Forwarder &operator=(const Ipv4Forwarder &) = delete;
+    Ipv4Forwarder(Ipv4Forwarder &&) = delete;
+    Ipv4Forwarder &operator=(Ipv4Forwarder &&) = delete;
+
+    /**
+     * @brief 目的地址是否可以转发:不是0.0.0.0/8、127.0.0.0/8、240.0.0.0/4和受限广播地址
+     * @param dst 目的地址,网络字节序
+     */
+    static bool isForwardable(uint32_t dst)
+    {
+        const uint32_t addr = rte_be_to_cpu_32(dst);
+        const uint8_t first = addr >> 24;
+        return first != 0 && first != 127 && first < 240;
+    }
+
+private:
+    struct alignas(RTE_CACHE_LINE_SIZE) WorkerState
+    {
+        struct rte_mbuf *pending[DATAPATH_MAX_BURST]; ///< 暂存的待转发报文
+        unsigned nbPending = 0;                       ///< 暂存的报文数量
+        RouteCacheEntry route;                        ///< 最近一个目的地址的路由,连续的同一条流不再查询LPM
+        uint64_t forwarded = 0;                       ///< 转发的报文数量
+        uint64_t drops[FWD_DROP_MAX] = {0};           ///< 每种原因丢弃的报文数量
+    };
+
+    bool _enabled = false;                        ///< 是否开启转发
+    struct rte_ether_addr _srcMac = {};           ///< 本机MAC地址,VLAN和VXLAN接口使用同一个地址
+    WorkerState _workers[RING_MAX_WORKERS];       ///< 每个工作核的状态,只由该工作核修改
+    uint64_t _lastForwarded = 0;                  ///< 上次打印时的转发总数,只由主核访问
+    uint64_t _lastStatsCycles = 0;                ///< 上次打印的时间(时钟周期),只由主核访问
+};
+
+#endif
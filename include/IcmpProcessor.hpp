@@ -1,8 +1,23 @@
 #ifndef ICMP__HPP
 #define ICMP__HPP
 #include <rte_memory.h>
+#include <rte_ether.h>
+#include <rte_ip.h>
+#include <rte_icmp.h>
+#include <rte_spinlock.h>
 #include "Processor.hpp"
 
+#define ICMP_TYPE_DEST_UNREACHABLE 3     ///< 目的不可达
+#define ICMP_TYPE_TIME_EXCEEDED 11       ///< 超时
+#define ICMP_CODE_NET_UNREACHABLE 0      ///< 网络不可达
+#define ICMP_CODE_PROTO_UNREACHABLE 2    ///< 协议不可达
+#define ICMP_CODE_PORT_UNREACHABLE 3     ///< 端口不可达
+#define ICMP_CODE_FRAG_NEEDED 4          ///< 需要分片但设置了DF
+#define ICMP_CODE_TTL_EXCEEDED 0         ///< 传输中TTL耗尽
+#define ICMP_CODE_REASSEMBLY_EXCEEDED 1  ///< 分片重组超时
+#define ICMP_ERROR_QUOTE_MAX 548         ///< 差错报文最多引用的原始数据报长度,保证整个IP报文不超过576字节
+#define ICMP_SRC_BUCKETS 1024            ///< 按源地址限速的令牌桶数量,必须是2的幂
+
 class IcmpProcessor : public Processor
 {
 public:
@@ -19,15 +34,66 @@ public:
      * @brief  处理一个入站报文（回调函数）
      *
      * 若 IP 上层协议为 ICMP 且类型为 Echo Request，
-     * 则构造 Echo Reply 并发往 @p ring->out ，最后释放原报文。
+     * 则构造 Echo Reply 并发往 @p ring->out 。独占的单段报文原地改写后直接发回，
+     * 否则分配新报文并释放原报文。
      *
      * @param[in]     mbufPool  用于分配回复包的内存池
-     * @param[in,out] mbuf      入站报文（函数内会 free）
+     * @param[in,out] mbuf      入站报文（函数内会 free 或原地改写后发送）
      * @param[in]     ring      输出环，回复包将入队到 ring->out
      * @return 0 成功；<0 失败
      */
     int handlePacket(struct rte_mempool *mbufPool, struct rte_mbuf *mbuf, struct inout_ring *ring);
 
+    /**
+     * @brief  初始化差错报文生成器：预先构造以太网/IP/ICMP头部模板，并设置限速参数
+     *
+     * 必须在获取到本机 MAC 地址之后调用。全局令牌桶限制差错报文的总速率，
+     * 按源地址哈希的令牌桶限制单个源能触发的速率，防止对关闭端口的洪泛被放大。
+     * @param[in] rate      全局速率（个/秒）
+     * @param[in] burst     全局突发数量
+     * @param[in] srcRate   单个源地址的速率（个/秒）
+     * @param[in] srcBurst  单个源地址的突发数量
+     */
+    void initErrorGenerator(uint32_t rate, uint32_t burst, uint32_t srcRate, uint32_t srcBurst);
+
+    /**
+     * @brief  检查是否允许向 @p srcIp 发送一个差错报文或 RST，允许时消耗令牌
+     * @param[in] srcIp  触发差错的报文的源地址
+     * @return 允许返回 true
+     */
+    bool allowError(uint32_t srcIp);
+
+    /**
+     * @brief  针对入站报文生成 ICMP 差错报文（RFC 1122/1812）
+     *
+     * 不对 ICMP 差错报文、非首片分片、广播/组播报文生成差错，超过限速时也不生成。
+     * 原报文不会被释放。
+     * @param[in] mbufPool  内存池
+     * @param[in] out       输出环
+     * @param[in] mbuf      触发差错的入站报文
+     * @param[in] type      ICMP 类型
+     * @param[in] code      ICMP 代码
+     * @param[in] info      类型相关的4字节字段（如需要分片时的下一跳MTU），网络字节序
+     * @return 0 已发送；-1 被过滤或限速
+     */
+    int sendError(struct rte_mempool *mbufPool, struct rte_ring *out, struct rte_mbuf *mbuf,
+                  uint8_t type, uint8_t code, uint32_t info = 0);
+
+    /**
+     * @brief  处理"需要分片"的目的不可达差错，把下一跳 MTU 记入 PMTU 缓存
+     * @param[in] mbuf     入站差错报文
+     * @param[in] icmphdr  差错报文的 ICMP 头部
+     */
+    void handleFragNeeded(struct rte_mbuf *mbuf, struct rte_icmp_hdr *icmphdr);
+
+    /**
+     * @brief  把 Echo Request 原地改写为 Echo Reply
+     *
+     * 交换 MAC 和 IP 地址，修改 ICMP 类型，校验和按 RFC 1624 增量更新，不拷贝负载。
+     * @param[in,out] mbuf 独占的单段入站报文
+     */
+    void reflectEchoRequest(struct rte_mbuf *mbuf);
+
     /**
      * @brief  构造 ICMP Echo Reply 报文（mbuf 级别）
      *
@@ -81,8 +147,33 @@ private:
     IcmpProcessor(IcmpProcessor &&) = delete;
     IcmpProcessor &operator=(IcmpProcessor &&) = delete;
 
+private:
+    /**
+     * @brief 令牌桶，令牌数放大 hz 倍保存，避免按时钟周期补充时的除法
+     */
+    struct TokenBucket
+    {
+        uint64_t tokens = 0;  ///< 当前令牌数 × hz
+        uint64_t last = 0;    ///< 上次补充的时间（时钟周期）
+    };
+
+    /**
+     * @brief  补充令牌并尝试消耗一个
+     */
+    bool consume(TokenBucket &bucket, uint64_t now, uint32_t rate, uint32_t burst);
+
 private:
     std::shared_ptr<Processor> _nextProcessor; ///< 下游处理器（预留）
+    uint8_t _errorTemplate[sizeof(struct rte_ether_hdr) + sizeof(struct rte_ipv4_hdr) + sizeof(struct rte_icmp_hdr)]; ///< 差错报文头部模板
+    uint64_t _hz = 0;                          ///< 时钟频率
+    uint32_t _rate = 1000;                     ///< 全局差错速率（个/秒）
+    uint32_t _burst = 100;                     ///< 全局突发数量
+    uint32_t _srcRate = 10;                    ///< 单个源地址的差错速率（个/秒）
+    uint32_t _srcBurst = 10;                   ///< 单个源地址的突发数量
+    TokenBucket _globalBucket;                 ///< 全局令牌桶
+    TokenBucket _srcBuckets[ICMP_SRC_BUCKETS]; ///< 按源地址哈希的令牌桶，冲突的源共享一个桶
+    rte_spinlock_t _limitLock = RTE_SPINLOCK_INITIALIZER; ///< 保护令牌桶，差错生成是慢路径
+    uint64_t _limited = 0;                     ///< 因限速被抑制的差错数量
 };
 
 #endif
\ No newline at end of file
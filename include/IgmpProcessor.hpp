@@ -0,0 +1,170 @@
+#ifndef IGMP_PROCESSOR_HPP
+#define IGMP_PROCESSOR_HPP
+#include <rte_mbuf.h>
+#include <rte_ether.h>
+#include <rte_ip.h>
+#include <rte_timer.h>
+#include <rte_cycles.h>
+#include <cstdint>
+#include <atomic>
+#include <mutex>
+#include "LocalAddr.hpp"
+
+#define IGMP_MAX_GROUPS 64                  ///< 所有接口上最多加入的组数量
+#define IGMP_TYPE_QUERY 0x11                ///< 成员关系查询
+#define IGMP_TYPE_V1_REPORT 0x12            ///< IGMPv1成员关系报告
+#define IGMP_TYPE_V2_REPORT 0x16            ///< IGMPv2成员关系报告
+#define IGMP_TYPE_V2_LEAVE 0x17             ///< IGMPv2离开组
+#define IGMP_TYPE_V3_REPORT 0x22            ///< IGMPv3成员关系报告
+#define IGMP_V3_MODE_IS_EXCLUDE 2           ///< 当前状态记录:排除模式,应答查询时使用
+#define IGMP_V3_CHANGE_TO_INCLUDE 3         ///< 状态变化记录:切换到包含模式,源列表为空表示离开
+#define IGMP_V3_CHANGE_TO_EXCLUDE 4         ///< 状态变化记录:切换到排除模式,源列表为空表示加入
+#define IGMP_ALL_HOSTS RTE_IPV4(224, 0, 0, 1)     ///< 所有主机组,通用查询的目的地址(主机字节序)
+#define IGMP_ALL_ROUTERS RTE_IPV4(224, 0, 0, 2)   ///< 所有路由器组,IGMPv2离开报文的目的地址(主机字节序)
+#define IGMP_V3_ROUTERS RTE_IPV4(224, 0, 0, 22)   ///< IGMPv3报告的目的地址(主机字节序)
+#define IGMP_ROBUSTNESS 2                   ///< 主动报告和离开报文的发送次数,RFC 3376默认的健壮性变量
+#define IGMP_UNSOLICITED_MS 1000            ///< 主动报告的重传间隔(毫秒)
+#define IGMP_OLDER_QUERIER_MS 260000        ///< 收到旧版本查询后保持兼容模式的时间(毫秒),健壮性×查询间隔+查询响应间隔
+#define IGMP_V2_MAX_RESP_MS 10000           ///< IGMPv1查询没有最大响应时间字段时使用的值(毫秒)
+#define IGMP_IP_HDR_LEN 24                  ///< 带路由器告警选项的IP头部长度
+
+/**
+ * @brief IPv4组播组成员关系,单例模式
+ *
+ * 按(组地址, 接口)记录加入的组,多个socket加入同一个组时只计数。
+ * 第一次加入时发出主动报告,最后一个socket离开时发出离开报文,两者都按健壮性变量重传;
+ * 收到查询后在最大响应时间内随机延迟应答。默认使用IGMPv3,在接口上收到旧版本查询后按RFC 3376 7.2降级到IGMPv2。
+ * 物理端口和VLAN子接口上的组通过McastFilter写入网卡的组播MAC过滤表。
+ * 报文都由主核上的定时器发出,加入/离开和查询只修改待发送状态。
+ * 成员关系表每个槽位是一个64位原子变量,工作核查询时不加锁;其余状态由_mutex保护。
+ */
+class IgmpProcessor
+{
+public:
+    static IgmpProcessor &getInstance()
+    {
+        static IgmpProcessor instance;
+        return instance;
+    }
+
+    /**
+     * @brief 设置本机MAC和使用的协议版本,必须在startTimer之前调用
+     * @param srcMac 本机MAC地址
+     * @param version 最高使用的IGMP版本,2或3
+     */
+    void init(const uint8_t *srcMac, unsigned version);
+
+    /**
+     * @brief 启动发送报告的定时器,定时器在调用者所在的lcore上运行,需要该lcore周期性调用rte_timer_manage
+     * @param mbufPool 构造IGMP报文使用的内存池
+     * @param out 输出环
+     * @param periodMs 定时器周期(毫秒)
+     * @return 成功返回0,失败返回-1
+     */
+    int startTimer(struct rte_mempool *mbufPool, struct rte_ring *out, uint64_t periodMs);
+
+    /**
+     * @brief 在接口上加入组,可以由任意线程调用
+     * @param group 组地址,网络字节序
+     * @param ifIndex 接口编号
+     * @return 成功返回0,不是组播地址或表已满返回-1
+     */
+    int join(uint32_t group, uint16_t ifIndex);
+
+    /**
+     * @brief 离开接口上的组,加入次数减到0时才真正离开
+     * @return 成功返回0,没有加入返回-1
+     */
+    int leave(uint32_t group, uint16_t ifIndex);
+
+    /**
+     * @brief 接口上是否加入了该组,由工作核在收包时调用
+     * @param group 组地址,网络字节序
+     */
+    bool isMember(uint32_t group, uint16_t ifIndex) const
+    {
+        const uint64_t key = memberKey(group, ifIndex);
+        for (unsigned i = 0; i < IGMP_MAX_GROUPS; i++)
+        {
+            if (_members[i].load(std::memory_order_acquire) == key)
+                return true;
+        }
+        return false;
+    }
+
+    /**
+     * @brief 处理收到的IGMP报文:按查询安排应答,IGMPv2兼容模式下其他主机的报告抑制本机的应答,函数内总是释放报文
+     */
+    void handlePacket(struct rte_mbuf *mbuf);
+
+private:
+    IgmpProcessor() = default;
+    ~IgmpProcessor() = default;
+    IgmpProcessor(const IgmpProcessor &) = delete;
+    IgmpProcessor &operator=(const IgmpProcessor &) = delete;
+    IgmpProcessor(IgmpProcessor &&) = delete;
+    IgmpProcessor &operator=(IgmpProcessor &&) = delete;
+
+    enum ReportKind : uint8_t
+    {
+        REPORT_NONE = 0, ///< 没有待发送的报文
+        REPORT_JOIN,     ///< 加入组的主动报告
+        REPORT_CURRENT,  ///< 应答查询的当前状态报告
+        REPORT_LEAVE,    ///< 离开报文
+    };
+
+    struct Group
+    {
+        uint32_t group = 0;           ///< 组地址,网络字节序
+        uint16_t ifIndex = 0;         ///< 加入的接口
+        unsigned users = 0;           ///< 加入该组的次数,0且没有待发送的离开报文时槽位空闲
+        ReportKind pending = REPORT_NONE; ///< 待发送的报文类型
+        uint8_t retransLeft = 0;      ///< 主动报告或离开报文剩余的重传次数
+        uint64_t dueMs = 0;           ///< 待发送报文的发送时间(毫秒)
+    };
+
+    static constexpr uint64_t MEMBER_USED = 1ULL << 48; ///< 成员关系槽位存有组
+
+    static uint64_t memberKey(uint32_t group, uint16_t ifIndex) { return MEMBER_USED | ((uint64_t)ifIndex << 32) | group; }
+
+    static uint64_t nowMs() { return rte_get_timer_cycles() / (rte_get_timer_hz() / 1000); }
+
+    /**
+     * @brief 定时器回调,发出到期的报告和离开报文
+     */
+    static void igmpTimerCallback(struct rte_timer *timer, void *arg);
+
+    /**
+     * @brief 接口当前使用的协议版本,调用者需要持有_mutex
+     */
+    unsigned versionLocked(uint16_t ifIndex, uint64_t now) const;
+
+    /**
+     * @brief 构造并发送一个报告或离开报文,调用者需要持有_mutex
+     */
+    void sendReport(const Group &group, ReportKind kind, uint64_t now);
+
+    /**
+     * @brief 把物理端口和VLAN子接口上加入的组提交给McastFilter,调用者需要持有_mutex
+     */
+    void updateMacFilterLocked();
+
+    /**
+     * @brief 组地址对应的以太网组播地址:01:00:5e加上组地址的低23位
+     */
+    static void groupMac(uint32_t group, struct rte_ether_addr *mac);
+
+private:
+    std::atomic<uint64_t> _members[IGMP_MAX_GROUPS] = {}; ///< 成员关系,与_groups按下标对应,0表示空
+    Group _groups[IGMP_MAX_GROUPS];                       ///< 组的报告状态
+    uint64_t _olderQuerierUntilMs[LOCAL_ADDR_MAX_PORTS] = {}; ///< 每个接口保持IGMPv2兼容模式的截止时间(毫秒)
+    std::mutex _mutex;                                    ///< 保护_groups、_olderQuerierUntilMs和成员关系的修改
+    uint8_t _srcMac[RTE_ETHER_ADDR_LEN] = {0};            ///< 本机MAC地址
+    unsigned _version = 3;                                ///< 最高使用的IGMP版本
+    struct rte_timer _timer;                              ///< 发送报告的定时器
+    struct rte_mempool *_mbufPool = nullptr;              ///< 构造IGMP报文使用的内存池
+    struct rte_ring *_out = nullptr;                      ///< 输出环
+    uint16_t _ipId = 0;                                   ///< IP标识,只由定时器修改
+};
+
+#endif
@@ -0,0 +1,176 @@
+#ifndef IPV4_VALIDATE_HPP
+#define IPV4_VALIDATE_HPP
+#include <rte_mbuf.h>
+#include <rte_ether.h>
+#include <rte_ip.h>
+#include <rte_udp.h>
+#include <rte_tcp.h>
+#include <rte_branch_prediction.h>
+#include <cstdint>
+#include "Ring.hpp"
+
+/**
+ * @brief IPv4报文被丢弃的原因,按检查顺序排列,一个报文只计入最先失败的原因
+ */
+enum IPV4_DROP_REASON
+{
+    IPV4_DROP_TRUNCATED = 0, ///< 首个分段放不下IP头,或总长度超过报文长度
+    IPV4_DROP_VERSION,       ///< 版本号不是4
+    IPV4_DROP_IHL,           ///< 首部长度小于20字节、超出首个分段或大于总长度
+    IPV4_DROP_TTL,           ///< TTL为0
+    IPV4_DROP_ADDR,          ///< 源地址是组播或广播地址
+    IPV4_DROP_CKSUM,         ///< 首部校验和错误
+    IPV4_DROP_L4,            ///< 未分片报文的UDP/TCP头部长度字段与IP总长度不符
+    IPV4_DROP_MAX,
+};
+
+/**
+ * @brief IPv4入站报文的校验模块,单例模式
+ *
+ * 在报文交给协议处理模块之前对整批报文做一次校验,非法报文直接释放并按原因计数。
+ * 各项检查都计算成位掩码,不依赖前一项检查的结果跳转,只有报文非法时才进入分支。
+ * IP选项通过IHL正确跳过,合法报文末尾的以太网填充会被裁掉,之后的模块可以信任长度字段。
+ */
+class Ipv4Validator
+{
+public:
+    static Ipv4Validator &getInstance()
+    {
+        static Ipv4Validator instance;
+        return instance;
+    }
+
+    /**
+     * @brief 校验一批报文,合法报文按原顺序压缩到数组前部,非IPv4报文原样保留
+     * @tparam OFFLOAD 为true时使用网卡给出的IP校验和结果,网卡没有校验时仍用软件计算
+     * @param workerId 工作核编号,用于选择计数器
+     * @param mbufs 报文数组
+     * @param nbPkts 报文数量
+     * @return 合法报文数量
+     */
+    template <bool OFFLOAD>
+    unsigned validateBurst(unsigned workerId, struct rte_mbuf **mbufs, unsigned nbPkts)
+    {
+        uint64_t *drops = _workers[workerId].drops;
+        unsigned nbValid = 0;
+        for (unsigned i = 0; i < nbPkts; i++)
+        {
+            struct rte_mbuf *mbuf = mbufs[i];
+            uint32_t bad = check<OFFLOAD>(mbuf);
+            mbufs[nbValid] = mbuf;
+            nbValid += (bad == 0);
+            if (unlikely(bad != 0))
+            {
+                drops[__builtin_ctz(bad)]++;
+                rte_pktmbuf_free(mbuf);
+            }
+        }
+        return nbValid;
+    }
+
+    /**
+     * @brief 校验单个报文,用于解封装后的内层报文,非法报文被释放
+     * @return 合法或不是IPv4报文返回true
+     */
+    template <bool OFFLOAD>
+    bool validate(unsigned workerId, struct rte_mbuf *mbuf)
+    {
+        uint32_t bad = check<OFFLOAD>(mbuf);
+        if (likely(bad == 0))
+            return true;
+        _workers[workerId].drops[__builtin_ctz(bad)]++;
+        rte_pktmbuf_free(mbuf);
+        return false;
+    }
+
+    /**
+     * @brief 打印每个工作核的丢弃统计
+     */
+    void dumpStats();
+
+private:
+    Ipv4Validator() = default;
+    ~Ipv4Validator() = default;
+    Ipv4Validator(const Ipv4Validator &) = delete;
+    Ipv4Validator &operator=(const Ipv4Validator &) = delete;
+    Ipv4Validator(Ipv4Validator &&) = delete;
+    Ipv4Validator &operator=(Ipv4Validator &&) = delete;
+
+    /**
+     * @brief 检查单个报文
+     * @return 失败原因的位掩码,第n位对应IPV4_DROP_REASON中的第n个原因,0表示合法
+     */
+    template <bool OFFLOAD>
+    static uint32_t check(struct rte_mbuf *mbuf)
+    {
+        const struct rte_ether_hdr *ehdr = rte_pktmbuf_mtod(mbuf, const struct rte_ether_hdr *);
+        if (ehdr->ether_type != rte_cpu_to_be_16(RTE_ETHER_TYPE_IPV4))
+            return 0;
+
+        // 报文过短时读到的字段是mbuf数据区中的无效数据,但不会越界,结果由长度检查否决
+        const struct rte_ipv4_hdr *iphdr = (const struct rte_ipv4_hdr *)(ehdr + 1);
+        const int32_t segLen = (int32_t)rte_pktmbuf_data_len(mbuf) - (int32_t)sizeof(struct rte_ether_hdr);
+        const int32_t pktLen = (int32_t)rte_pktmbuf_pkt_len(mbuf) - (int32_t)sizeof(struct rte_ether_hdr);
+        const int32_t ihl = (iphdr->version_ihl & RTE_IPV4_HDR_IHL_MASK) * RTE_IPV4_IHL_MULTIPLIER;
+        const int32_t total = rte_be_to_cpu_16(iphdr->total_length);
+        const uint32_t src = rte_be_to_cpu_32(iphdr->src_addr);
+
+        uint32_t bad = 0;
+        bad |= (uint32_t)((segLen < (int32_t)sizeof(struct rte_ipv4_hdr)) | (total > pktLen)) << IPV4_DROP_TRUNCATED;
+        bad |= (uint32_t)((iphdr->version_ihl >> 4) != 4) << IPV4_DROP_VERSION;
+        bad |= (uint32_t)((ihl < (int32_t)sizeof(struct rte_ipv4_hdr)) | (ihl > segLen) | (total < ihl)) << IPV4_DROP_IHL;
+        bad |= (uint32_t)(iphdr->time_to_live == 0) << IPV4_DROP_TTL;
+        bad |= (uint32_t)(RTE_IS_IPV4_MCAST(src) | (src == 0xFFFFFFFF)) << IPV4_DROP_ADDR;
+        if (unlikely(bad != 0))
+            return bad;
+
+        if constexpr (OFFLOAD)
+        {
+            // 网卡识别出隧道时校验和标志描述的是内层头部,外层头部用软件校验
+            uint64_t flags = (mbuf->packet_type & RTE_PTYPE_TUNNEL_MASK) ? PKT_RX_IP_CKSUM_UNKNOWN
+                                                                           : mbuf->ol_flags & PKT_RX_IP_CKSUM_MASK;
+            if (flags == PKT_RX_IP_CKSUM_BAD)
+                bad |= 1u << IPV4_DROP_CKSUM;
+            else if (flags != PKT_RX_IP_CKSUM_GOOD)
+                bad |= (uint32_t)(rte_raw_cksum(iphdr, ihl) != 0xFFFF) << IPV4_DROP_CKSUM;
+        }
+        else
+        {
+            bad |= (uint32_t)(rte_raw_cksum(iphdr, ihl) != 0xFFFF) << IPV4_DROP_CKSUM;
+        }
+
+        // 只有未分片的报文能直接检查传输层头部,分片在重组之后由协议模块检查
+        if ((iphdr->fragment_offset & rte_cpu_to_be_16(RTE_IPV4_HDR_MF_FLAG | RTE_IPV4_HDR_OFFSET_MASK)) == 0)
+        {
+            const int32_t l4Len = total - ihl;
+            const uint8_t *l4 = (const uint8_t *)iphdr + ihl;
+            if (iphdr->next_proto_id == IPPROTO_UDP)
+            {
+                const int32_t udpLen = rte_be_to_cpu_16(((const struct rte_udp_hdr *)l4)->dgram_len);
+                bad |= (uint32_t)((ihl + (int32_t)sizeof(struct rte_udp_hdr) > segLen) |
+                                  (udpLen < (int32_t)sizeof(struct rte_udp_hdr)) | (udpLen > l4Len)) << IPV4_DROP_L4;
+            }
+            else if (iphdr->next_proto_id == IPPROTO_TCP)
+            {
+                const int32_t tcpHdrLen = (((const struct rte_tcp_hdr *)l4)->data_off >> 4) << 2;
+                bad |= (uint32_t)((ihl + (int32_t)sizeof(struct rte_tcp_hdr) > segLen) |
+                                  (tcpHdrLen < (int32_t)sizeof(struct rte_tcp_hdr)) | (tcpHdrLen > l4Len)) << IPV4_DROP_L4;
+            }
+        }
+
+        // 去掉以太网最小帧长带来的填充,之后按pkt_len计算的长度与IP总长度一致
+        if (bad == 0 && pktLen > total)
+            rte_pktmbuf_trim(mbuf, pktLen - total);
+        return bad;
+    }
+
+private:
+    struct alignas(RTE_CACHE_LINE_SIZE) WorkerStats
+    {
+        uint64_t drops[IPV4_DROP_MAX] = {0}; ///< 每种原因丢弃的报文数量
+    };
+
+    WorkerStats _workers[RING_MAX_WORKERS]; ///< 每个工作核的计数器,只由该工作核修改
+};
+
+#endif
@@ -0,0 +1,300 @@
+#ifndef IPV6_HPP
+#define IPV6_HPP
+#include <rte_mbuf.h>
+#include <rte_ether.h>
+#include <rte_ip.h>
+#include <cstdint>
+#include <cstring>
+#include <atomic>
+#include <mutex>
+#include <deque>
+#include <string>
+#include <vector>
+#include <unordered_map>
+#include "Ring.hpp"
+
+#define IPV6_ADDR_LEN 16               ///< IPv6地址长度
+#define IPV6_MAX_LOCAL_ADDRS 16        ///< 最多的本机IPv6地址数量,包括链路本地地址
+#define IPV6_DEFAULT_HOP_LIMIT 64      ///< 本机发出报文的跳数限制
+#define IPV6_MIN_MTU 1280              ///< IPv6要求链路支持的最小MTU(RFC 8200)
+#define TCP_IPV6_HDR_LEN 60            ///< 不带扩展头的IPv6头和不带选项的TCP头的总长度
+#define ND_HOP_LIMIT 255               ///< 邻居发现报文的跳数限制必须是255(RFC 4861)
+#define ND_RETRANS_MS 1000             ///< 同一个地址两次邻居请求的最小间隔(毫秒)
+#define ND_MAX_NEIGHBORS 1024          ///< 邻居表最多的条目数量,包括等待解析的地址
+#define ND_IDLE_MS 60000               ///< 邻居条目超过这个时间没有被使用或确认,表满时被回收(毫秒)
+
+#define ICMPV6_DEST_UNREACHABLE 1      ///< 目的不可达
+#define ICMPV6_ECHO_REQUEST 128        ///< 回显请求
+#define ICMPV6_ECHO_REPLY 129          ///< 回显应答
+#define ICMPV6_NEIGHBOR_SOLICIT 135    ///< 邻居请求
+#define ICMPV6_NEIGHBOR_ADVERT 136     ///< 邻居通告
+#define ND_OPT_SOURCE_LLADDR 1         ///< 源链路层地址选项
+#define ND_OPT_TARGET_LLADDR 2         ///< 目标链路层地址选项
+#define ND_NA_FLAG_SOLICITED 0x40000000 ///< 邻居通告是对请求的应答
+#define ND_NA_FLAG_OVERRIDE 0x20000000  ///< 邻居通告覆盖已有的缓存条目
+
+/**
+ * @brief ICMPv6头部,data按类型解释为标识/序号或邻居通告标志
+ */
+struct Icmp6Hdr
+{
+    uint8_t type;   ///< 类型
+    uint8_t code;   ///< 代码
+    uint16_t cksum; ///< 校验和,覆盖IPv6伪首部
+    uint32_t data;  ///< 类型相关的4个字节
+} __attribute__((__packed__));
+
+/**
+ * @brief 带有一个链路层地址选项的邻居请求/通告报文(RFC 4861 4.3, 4.4)
+ */
+struct NdMsg
+{
+    struct Icmp6Hdr hdr;                  ///< ICMPv6头部,邻居通告的标志在data中
+    uint8_t target[IPV6_ADDR_LEN];        ///< 目标地址
+    uint8_t optType;                      ///< 选项类型,ND_OPT_SOURCE_LLADDR或ND_OPT_TARGET_LLADDR
+    uint8_t optLen;                       ///< 选项长度,单位8字节
+    uint8_t lladdr[RTE_ETHER_ADDR_LEN];   ///< 链路层地址
+} __attribute__((__packed__));
+
+/**
+ * @brief 缓存在连接或socket中的IPv6下一跳MAC地址,用法与ArpCacheEntry相同
+ *
+ * 邻居表中已有条目的MAC地址变化时表的代数递增,所有缓存随之失效。
+ */
+struct Nd6CacheEntry
+{
+    uint8_t ip[IPV6_ADDR_LEN] = {0};       ///< 缓存对应的下一跳地址
+    uint32_t generation = 0;               ///< 缓存时邻居表的代数,0表示无效
+    uint8_t mac[RTE_ETHER_ADDR_LEN] = {0}; ///< 缓存的MAC地址
+};
+
+/**
+ * @brief 比较两个IPv6地址
+ */
+static inline bool ipv6Equal(const uint8_t *a, const uint8_t *b)
+{
+    uint64_t a0, a1, b0, b1;
+    memcpy(&a0, a, 8);
+    memcpy(&a1, a + 8, 8);
+    memcpy(&b0, b, 8);
+    memcpy(&b1, b + 8, 8);
+    return ((a0 ^ b0) | (a1 ^ b1)) == 0;
+}
+
+/**
+ * @brief 是否为未指定地址::
+ */
+static inline bool ipv6IsUnspecified(const uint8_t *a)
+{
+    static const uint8_t ZERO[IPV6_ADDR_LEN] = {0};
+    return ipv6Equal(a, ZERO);
+}
+
+/**
+ * @brief 把IPv6地址转换为字符串,用于日志
+ */
+std::string ipv6ToString(const uint8_t *addr);
+
+/**
+ * @brief IPv6协议处理模块,单例模式
+ *
+ * 负责IPv6报文的校验和分发、ICMPv6回显、邻居发现(代替ARP)以及IPv6邻居表。
+ * 不支持扩展头和分片,带扩展头的报文直接丢弃。本机IPv6地址数量很少,存放在定长数组中线性比较。
+ * 发送方向与IPv4一样在socket或连接上缓存下一跳的MAC地址,命中时只需要比较地址和代数。
+ */
+class Ipv6Processor
+{
+public:
+    static Ipv6Processor &getInstance()
+    {
+        static Ipv6Processor instance;
+        return instance;
+    }
+
+    /**
+     * @brief 初始化本机地址和网关
+     *
+     * 根据端口MAC地址按EUI-64生成链路本地地址fe80::/64,再加入配置的全局地址。
+     * @param portId 端口号
+     * @param mac 端口MAC地址
+     * @param addrs 配置的地址,格式为"2001:db8::10/64",没有前缀长度时按/128处理
+     * @param gateway 默认网关,为空表示只能访问直连网段
+     * @param linkMtu 链路MTU
+     * @param pendingDepth 每个未解析地址最多缓存的报文数量
+     * @return 成功返回0,失败返回-1
+     */
+    int init(uint16_t portId, const uint8_t *mac, const std::vector<std::string> &addrs, const std::string &gateway,
+             uint16_t linkMtu, unsigned pendingDepth);
+
+    bool isEnabled() const { return _enabled; }
+
+    /**
+     * @brief 添加本机地址
+     * @return 成功返回0,地址已满返回-1
+     */
+    int addAddr(const uint8_t *addr, uint8_t prefixLen);
+
+    /**
+     * @brief 地址是否属于本机
+     */
+    bool isLocal(const uint8_t *addr) const;
+
+    /**
+     * @brief 本机发起连接或绑定到任意地址的socket使用的源地址,有全局地址时使用第一个全局地址
+     */
+    const uint8_t *getPrimary() const;
+
+    uint16_t getMtu() const { return _linkMtu; }
+
+    /**
+     * @brief 处理收到的IPv6报文,函数内发送或释放报文
+     */
+    int handlePacket(struct rte_mempool *mbufPool, struct rte_mbuf *mbuf, struct inout_ring *ring);
+
+    /**
+     * @brief 计算目的地址的下一跳,直连网段内是目的地址本身,否则是默认网关
+     * @return 下一跳地址,没有网关时返回nullptr
+     */
+    const uint8_t *nextHop(const uint8_t *dst) const;
+
+    /**
+     * @brief 先检查缓存,缓存失效时查询邻居表并更新缓存
+     * @param nextHop 下一跳地址
+     * @param cache 连接或socket上的缓存
+     * @return 命中返回true,MAC地址在cache->mac中
+     */
+    bool lookupCached(const uint8_t *nextHop, Nd6CacheEntry *cache)
+    {
+        if (cache->generation == _generation.load(std::memory_order_acquire) && ipv6Equal(cache->ip, nextHop))
+            return true;
+        return lookupSlow(nextHop, cache);
+    }
+
+    /**
+     * @brief 下一跳MAC地址未知时的发送入口,报文缓存到解析完成,必要时发出邻居请求
+     * @param mbufPool 构造邻居请求使用的内存池
+     * @param out 输出环
+     * @param nextHop 下一跳地址
+     * @param mbuf 已构造好的报文,以太网目的地址在解析完成后填写
+     * @return 报文已缓存返回0,被丢弃返回-1
+     */
+    int queuePending(struct rte_mempool *mbufPool, struct rte_ring *out, const uint8_t *nextHop, struct rte_mbuf *mbuf);
+
+    /**
+     * @brief 把IPv6地址折叠为32位,用于按源地址限速等只需要区分地址的场合
+     */
+    static uint32_t foldAddr(const uint8_t *addr)
+    {
+        uint32_t w[4];
+        memcpy(w, addr, IPV6_ADDR_LEN);
+        return w[0] ^ w[1] ^ w[2] ^ w[3];
+    }
+
+private:
+    Ipv6Processor() = default;
+    ~Ipv6Processor() = default;
+    Ipv6Processor(const Ipv6Processor &) = delete;
+    Ipv6Processor &operator=(const Ipv6Processor &) = delete;
+    Ipv6Processor(Ipv6Processor &&) = delete;
+    Ipv6Processor &operator=(Ipv6Processor &&) = delete;
+
+    /**
+     * @brief 处理ICMPv6报文
+     */
+    void handleIcmp6(struct rte_mbuf *mbuf, struct rte_ipv6_hdr *ip6, struct inout_ring *ring);
+
+    /**
+     * @brief 把邻居请求原地改写成邻居通告
+     */
+    void reflectNeighborSolicit(struct rte_mbuf *mbuf, struct rte_ipv6_hdr *ip6, struct NdMsg *nd);
+
+    /**
+     * @brief 把回显请求原地改写成回显应答
+     */
+    void reflectEchoRequest(struct rte_mbuf *mbuf, struct rte_ipv6_hdr *ip6, struct Icmp6Hdr *icmp);
+
+    /**
+     * @brief 向请求节点组播地址发送邻居请求
+     */
+    void sendSolicit(struct rte_mempool *mbufPool, struct rte_ring *out, const uint8_t *target);
+
+    /**
+     * @brief 记录邻居的MAC地址并发出等待该邻居的报文
+     *
+     * RFC 4861 7.2.5: 邻居通告只更新已有的条目,已解析条目的MAC只有带覆盖标志时才替换;
+     * 带源链路层地址的邻居请求按7.2.3可以创建条目。
+     * @param create 条目不存在时是否创建
+     * @param override 是否替换已解析条目的MAC地址
+     */
+    void learn(const uint8_t *ip, const uint8_t *mac, struct rte_ring *out, bool create, bool override);
+
+    /**
+     * @brief 回收空闲超过ND_IDLE_MS的条目,调用者需要持有_mutex
+     */
+    void expireLocked(uint64_t now);
+
+    bool lookupSlow(const uint8_t *nextHop, Nd6CacheEntry *cache);
+
+    /**
+     * @brief 把所有节点组播地址和每个本机地址的请求节点组播地址对应的MAC提交给McastFilter,调用者需要持有_mutex
+     */
+    void updateMacFilterLocked();
+
+    /**
+     * @brief 是否为本机某个地址的请求节点组播地址ff02::1:ffXX:XXXX
+     */
+    bool isSolicitedNode(const uint8_t *addr) const;
+
+    static uint64_t nowMs();
+
+private:
+    struct LocalAddr6
+    {
+        uint8_t addr[IPV6_ADDR_LEN]; ///< 地址
+        uint8_t prefixLen;           ///< 所在网段的前缀长度
+    };
+
+    struct Ipv6Key
+    {
+        uint64_t hi; ///< 地址的前8个字节
+        uint64_t lo; ///< 地址的后8个字节
+        bool operator==(const Ipv6Key &other) const { return hi == other.hi && lo == other.lo; }
+    };
+
+    struct Ipv6KeyHash
+    {
+        size_t operator()(const Ipv6Key &key) const { return std::hash<uint64_t>()(key.hi ^ (key.lo * 0x9e3779b97f4a7c15ULL)); }
+    };
+
+    struct Neighbor
+    {
+        bool resolved = false;                    ///< 是否已知MAC地址
+        uint8_t mac[RTE_ETHER_ADDR_LEN] = {0};    ///< MAC地址
+        uint64_t lastSolicitMs = 0;               ///< 上一次发出邻居请求的时间
+        uint64_t lastUsedMs = 0;                  ///< 上一次被查询或确认的时间
+        std::deque<struct rte_mbuf *> pending;    ///< 等待解析的报文
+    };
+
+    static Ipv6Key toKey(const uint8_t *addr)
+    {
+        Ipv6Key key;
+        memcpy(&key.hi, addr, 8);
+        memcpy(&key.lo, addr + 8, 8);
+        return key;
+    }
+
+    bool _enabled = false;                             ///< 是否已初始化
+    uint16_t _portId = 0;                              ///< 端口号
+    uint8_t _mac[RTE_ETHER_ADDR_LEN] = {0};            ///< 端口MAC地址
+    uint16_t _linkMtu = 1500;                          ///< 链路MTU
+    unsigned _pendingDepth = 16;                       ///< 每个未解析地址最多缓存的报文数量
+    LocalAddr6 _addrs[IPV6_MAX_LOCAL_ADDRS];           ///< 本机地址,0号是链路本地地址
+    std::atomic<unsigned> _nbAddrs{0};                 ///< 本机地址数量,只增不减
+    uint8_t _gateway[IPV6_ADDR_LEN] = {0};             ///< 默认网关
+    bool _hasGateway = false;                          ///< 是否配置了默认网关
+    std::unordered_map<Ipv6Key, Neighbor, Ipv6KeyHash> _neighbors; ///< 邻居表
+    std::atomic<uint32_t> _generation{1};              ///< 邻居表代数,已有条目的MAC地址变化时递增
+    std::mutex _mutex;                                 ///< 保护_neighbors和_addrs的写入
+};
+
+#endif
@@ -0,0 +1,126 @@
+#ifndef LOCAL_ADDR_HPP
+#define LOCAL_ADDR_HPP
+#include <rte_jhash.h>
+#include <cstdint>
+#include <atomic>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#define LOCAL_ADDR_TABLE_BITS 10                          ///< 哈希表槽位数量的位数
+#define LOCAL_ADDR_TABLE_SIZE (1u << LOCAL_ADDR_TABLE_BITS) ///< 哈希表槽位数量
+#define LOCAL_ADDR_MAX (LOCAL_ADDR_TABLE_SIZE / 2)        ///< 最多的本机地址数量,保证开放寻址的探测长度
+#define LOCAL_ADDR_MAX_PORTS 64                           ///< 支持的最大端口号,包括VLAN子接口和隧道接口
+
+/**
+ * @brief 本机IPv4地址表,包括每个端口的主地址和虚拟IP(VIP),单例模式
+ *
+ * 开放寻址的哈希表,每个槽位是一个64位原子变量,低32位为地址,32~47位为端口号,48位以上为槽位状态,
+ * 查询只需要原子读,不加锁。删除的槽位标记为墓碑,保证探测链不断开,之后插入时复用。
+ * 修改在_mutex保护下进行,可以在运行时由任意线程调用。地址参数都是网络字节序。
+ */
+class LocalAddrTable
+{
+public:
+    static LocalAddrTable &getInstance()
+    {
+        static LocalAddrTable instance;
+        return instance;
+    }
+
+    /**
+     * @brief 添加本机地址,地址已存在时更新所属端口
+     * @param addr 地址
+     * @param portId 所属端口
+     * @return 成功返回0,地址非法或表已满返回-1
+     */
+    int add(uint32_t addr, uint16_t portId);
+
+    /**
+     * @brief 删除本机地址,端口的主地址被删除时由剩下的第一个地址接替
+     * @return 成功返回0,地址不存在返回-1
+     */
+    int remove(uint32_t addr);
+
+    /**
+     * @brief 添加配置文件中的地址,格式错误的条目跳过
+     * @param addrs 点分十进制地址列表
+     * @param portId 所属端口
+     * @return 成功添加的数量
+     */
+    unsigned addAddrs(const std::vector<std::string> &addrs, uint16_t portId);
+
+    /**
+     * @brief 查询地址是否属于本机
+     */
+    bool isLocal(uint32_t addr) const { return find(addr) != 0; }
+
+    /**
+     * @brief 查询本机地址所属的端口
+     * @return 端口号,不是本机地址返回-1
+     */
+    int getPort(uint32_t addr) const
+    {
+        uint64_t slot = find(addr);
+        return slot == 0 ? -1 : (int)((slot >> 32) & 0xFFFF);
+    }
+
+    /**
+     * @brief 端口的主地址,用作ARP请求等没有确定源地址的报文的源地址
+     * @return 主地址,端口没有地址时返回0
+     */
+    uint32_t getPrimary(uint16_t portId) const
+    {
+        return portId < LOCAL_ADDR_MAX_PORTS ? _primary[portId].load(std::memory_order_relaxed) : 0;
+    }
+
+    /**
+     * @brief 列出端口的所有地址
+     */
+    std::vector<uint32_t> list(uint16_t portId) const;
+
+private:
+    LocalAddrTable() = default;
+    ~LocalAddrTable() = default;
+    LocalAddrTable(const LocalAddrTable &) = delete;
+    LocalAddrTable &operator=(const LocalAddrTable &) = delete;
+    LocalAddrTable(LocalAddrTable &&) = delete;
+    LocalAddrTable &operator=(LocalAddrTable &&) = delete;
+
+    static constexpr uint64_t SLOT_USED = 1ULL << 48;      ///< 槽位存有地址
+    static constexpr uint64_t SLOT_TOMBSTONE = 2ULL << 48; ///< 槽位中的地址已删除
+
+    static uint32_t hash(uint32_t addr) { return rte_jhash_1word(addr, 0x9e3779b9) & (LOCAL_ADDR_TABLE_SIZE - 1); }
+
+    /**
+     * @brief 查找地址所在的槽位
+     * @return 槽位的值,不存在返回0
+     */
+    uint64_t find(uint32_t addr) const
+    {
+        uint32_t idx = hash(addr);
+        for (unsigned i = 0; i < LOCAL_ADDR_TABLE_SIZE; i++)
+        {
+            uint64_t slot = _slots[idx].load(std::memory_order_acquire);
+            if (slot == 0)
+                return 0;
+            if ((slot & SLOT_USED) && (uint32_t)slot == addr)
+                return slot;
+            idx = (idx + 1) & (LOCAL_ADDR_TABLE_SIZE - 1);
+        }
+        return 0;
+    }
+
+    /**
+     * @brief 找到端口剩下的第一个地址作为主地址,调用者需要持有_mutex
+     */
+    uint32_t firstAddrLocked(uint16_t portId) const;
+
+private:
+    std::atomic<uint64_t> _slots[LOCAL_ADDR_TABLE_SIZE] = {};   ///< 哈希表槽位,0表示空
+    std::atomic<uint32_t> _primary[LOCAL_ADDR_MAX_PORTS] = {};  ///< 每个端口的主地址
+    unsigned _count = 0;                                        ///< 地址数量
+    std::mutex _mutex;                                          ///< 串行化修改
+};
+
+#endif
@@ -0,0 +1,68 @@
+#ifndef MCAST_FILTER_HPP
+#define MCAST_FILTER_HPP
+#include <rte_ether.h>
+#include <cstdint>
+#include <mutex>
+#include <vector>
+
+/**
+ * @brief 需要网卡接收的组播MAC地址的来源
+ */
+enum MCAST_FILTER_SOURCE
+{
+    MCAST_SRC_IGMP = 0, ///< IPv4组播组,01:00:5e:xx:xx:xx
+    MCAST_SRC_NDP,      ///< IPv6所有节点和请求节点组播地址,33:33:xx:xx:xx:xx
+    MCAST_SRC_MAX,
+};
+
+/**
+ * @brief 网卡组播MAC过滤表的唯一拥有者,单例模式
+ *
+ * rte_eth_dev_set_mc_addr_list每次替换整张表,多个模块各自写入会互相覆盖。
+ * 各来源只提交自己的地址集合,这里合并去重后整体写入网卡;
+ * 网卡不支持过滤表时打开全部组播接收,之后不再写入。
+ */
+class McastFilter
+{
+public:
+    static McastFilter &getInstance()
+    {
+        static McastFilter instance;
+        return instance;
+    }
+
+    /**
+     * @brief 设置物理端口,必须在任何来源提交地址之前调用
+     */
+    void init(uint16_t portId);
+
+    /**
+     * @brief 替换一个来源的地址集合,合并所有来源后写入网卡,可以由任意线程调用
+     * @param source 地址来源
+     * @param addrs 该来源当前需要接收的组播MAC地址,可以有重复
+     * @param nbAddrs 地址数量
+     * @return 成功返回0,失败返回-1
+     */
+    int setAddrs(MCAST_FILTER_SOURCE source, const struct rte_ether_addr *addrs, unsigned nbAddrs);
+
+private:
+    McastFilter() = default;
+    ~McastFilter() = default;
+    McastFilter(const McastFilter &) = delete;
+    McastFilter &operator=(const McastFilter &) = delete;
+    McastFilter(McastFilter &&) = delete;
+    McastFilter &operator=(McastFilter &&) = delete;
+
+    /**
+     * @brief 合并所有来源的地址写入网卡,调用者需要持有_mutex
+     */
+    int applyLocked();
+
+private:
+    std::vector<struct rte_ether_addr> _addrs[MCAST_SRC_MAX]; ///< 每个来源提交的地址
+    std::mutex _mutex;                                        ///< 串行化对过滤表的修改
+    uint16_t _portId = 0;                                     ///< 物理端口
+    bool _allMulticast = false;                               ///< 网卡不支持过滤表,已打开全部组播接收
+};
+
+#endif
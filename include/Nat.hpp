@@ -0,0 +1,305 @@
+#ifndef NAT_HPP
+#define NAT_HPP
+#include <rte_mbuf.h>
+#include <rte_ether.h>
+#include <rte_ip.h>
+#include <rte_udp.h>
+#include <rte_byteorder.h>
+#include <cstdint>
+#include <string>
+#include <vector>
+#include "Ring.hpp"
+
+#define NAT_MAX_EXTERNAL_IPS 16  ///< 最多的外部地址数量
+#define NAT_MAX_INTERNAL_NETS 16 ///< 最多的内部网段数量
+#define NAT_NB_PROTOS 2          ///< 翻译的传输层协议数量:TCP和UDP,端口池按协议分开
+#define NAT_SWEEPS_PER_SEC 100   ///< 每秒扫描会话的次数,每次扫描1/NAT_SWEEPS_PER_SEC的会话,约1秒扫完一遍
+#define NAT_MAX_SESSIONS (1u << 20) ///< 每个工作核会话数量的上限,每个会话连同哈希槽位约80字节
+
+/**
+ * @brief 翻译的结果
+ */
+enum NAT_RESULT
+{
+    NAT_PASS = 0,   ///< 不需要翻译,报文原样继续处理
+    NAT_TRANSLATED, ///< 已改写地址和端口,报文需要转发
+    NAT_DROP,       ///< 报文已被释放
+};
+
+/**
+ * @brief NAT丢弃报文的原因
+ */
+enum NAT_DROP_REASON
+{
+    NAT_DROP_UNSUPPORTED = 0, ///< 内部地址发往外部的报文不是TCP/UDP或者是分片,不能翻译也不能泄露内部地址
+    NAT_DROP_NO_PORT,         ///< 外部地址在该工作核上的端口已用完
+    NAT_DROP_NO_SESSION,      ///< 会话表已满
+    NAT_DROP_MAX,
+};
+
+/**
+ * @brief NAT的配置参数
+ */
+struct NatParams
+{
+    std::vector<std::string> externalIps;  ///< 外部地址,点分十进制,应当同时配置为本机地址,ARP才会应答
+    std::vector<std::string> internalNets; ///< 内部网段,CIDR格式,源地址在其中的报文出去时做源地址转换
+    uint16_t portMin = 1024;               ///< 分配的外部端口下限
+    uint16_t portMax = 65535;              ///< 分配的外部端口上限
+    uint32_t maxSessions = 65536;          ///< 每个工作核最多的会话数量,不超过NAT_MAX_SESSIONS和该工作核拥有的外部端口总数
+    uint64_t udpTimeoutMs = 120000;        ///< UDP会话的空闲超时,RFC 4787 REQ-5要求不少于2分钟
+    uint64_t tcpEstTimeoutMs = 7440000;    ///< 已建立TCP会话的空闲超时,RFC 5382 REQ-5要求不少于2小时4分钟
+    uint64_t tcpTransTimeoutMs = 240000;   ///< 握手中或已关闭TCP会话的空闲超时,RFC 5382 REQ-5要求不少于4分钟
+};
+
+/**
+ * @brief 有状态的源地址转换(NAT44),单例模式
+ *
+ * 内部网段发往外部的TCP/UDP报文在转发前把源地址和源端口换成外部地址和分配的端口,
+ * 回程报文在交给协议处理之前按会话换回内部地址和端口,再交给转发路径。
+ * 地址和端口改变后IP首部校验和与TCP/UDP校验和都按RFC 1624增量更新。
+ *
+ * 会话按工作核分片,每个工作核只访问自己的会话表和端口池,快速路径不加锁:
+ * 外部端口按(端口 - 下限) % 工作核数量划分给各工作核,RPS按目的端口把回程报文交给建立会话的工作核,
+ * 出方向的报文按对称流哈希本来就落在同一个工作核上。
+ * 会话表是以五元组为键的开放寻址哈希表,每个会话以两个方向上收到的五元组各占一个槽位。
+ * 同一个内部地址总是使用同一个外部地址(RFC 4787的paired地址池),端口按先进先出回收,刚释放的端口最后才会复用。
+ * 会话的超时由工作核处理每批报文时分段扫描,不需要额外的定时器核。
+ */
+class Nat44
+{
+public:
+    static Nat44 &getInstance()
+    {
+        static Nat44 instance;
+        return instance;
+    }
+
+    /**
+     * @brief 创建每个工作核的会话表和端口池,必须在工作核启动前调用
+     * @param nbWorkers 工作核数量
+     * @param params 配置参数
+     * @return 成功返回0,失败返回-1
+     */
+    int init(unsigned nbWorkers, const NatParams &params);
+
+    bool isEnabled() const { return _enabled; }
+
+    /**
+     * @brief 地址是否是NAT的外部地址
+     * @param addr 网络字节序
+     */
+    bool isExternal(uint32_t addr) const
+    {
+        for (unsigned i = 0; i < _nbExternal; i++)
+        {
+            if (_externalIps[i] == addr)
+                return true;
+        }
+        return false;
+    }
+
+    /**
+     * @brief 回程报文应当交给的工作核,由RX核分发时调用
+     *
+     * IPv4分片只有第一片带端口,无法按端口定位工作核,这里返回-1交给普通的流哈希分发。
+     * 发往外部地址的分片不会被翻译,按发给本机的报文处理;出方向的分片由translateOutbound丢弃,
+     * 因此需要分片的内部流量应当由内部主机按PMTU避免分片。
+     * @return 发往外部地址NAT端口范围的未分片TCP/UDP报文返回分配该端口的工作核,其他报文返回-1
+     */
+    int steerWorker(const struct rte_mbuf *mbuf) const
+    {
+        const struct rte_ether_hdr *ehdr = rte_pktmbuf_mtod(mbuf, const struct rte_ether_hdr *);
+        if (ehdr->ether_type != rte_cpu_to_be_16(RTE_ETHER_TYPE_IPV4))
+            return -1;
+        const struct rte_ipv4_hdr *iphdr = (const struct rte_ipv4_hdr *)(ehdr + 1);
+        if ((iphdr->next_proto_id != IPPROTO_TCP && iphdr->next_proto_id != IPPROTO_UDP) ||
+            (iphdr->fragment_offset & rte_cpu_to_be_16(RTE_IPV4_HDR_MF_FLAG | RTE_IPV4_HDR_OFFSET_MASK)) != 0 ||
+            !isExternal(iphdr->dst_addr))
+            return -1;
+        const uint8_t ihl = (iphdr->version_ihl & RTE_IPV4_HDR_IHL_MASK) * RTE_IPV4_IHL_MULTIPLIER;
+        // TCP和UDP头部的前4个字节都是源端口和目的端口
+        const struct rte_udp_hdr *l4hdr = (const struct rte_udp_hdr *)((const uint8_t *)iphdr + ihl);
+        const uint16_t port = rte_be_to_cpu_16(l4hdr->dst_port);
+        if (port < _portMin || port > _portMax)
+            return -1;
+        return (port - _portMin) % _nbWorkers;
+    }
+
+    /**
+     * @brief 翻译发往外部地址的回程报文,命中会话时把目的地址和端口换成内部主机
+     * @return NAT_TRANSLATED或NAT_PASS,没有会话的报文按发给本机的报文处理
+     */
+    NAT_RESULT translateInbound(unsigned workerId, struct rte_mbuf *mbuf);
+
+    /**
+     * @brief 翻译内部网段发往外部的报文,会话不存在时创建,由转发路径在TTL减一之前调用
+     * @return 不是内部发往外部的报文返回NAT_PASS;返回NAT_DROP时调用者需要释放报文
+     */
+    NAT_RESULT translateOutbound(unsigned workerId, struct rte_mbuf *mbuf);
+
+    /**
+     * @brief 记录当前时间并扫描一段会话,释放超时的会话,工作核每批报文调用一次
+     * @param now 当前时间(TSC周期)
+     */
+    void maintain(unsigned workerId, uint64_t now);
+
+    /**
+     * @brief 打印每个工作核的会话和翻译统计
+     */
+    void dumpStats();
+
+private:
+    Nat44() = default;
+    ~Nat44() = default;
+    Nat44(const Nat44 &) = delete;
+    Nat44 &operator=(const Nat44 &) = delete;
+    Nat44(Nat44 &&) = delete;
+    Nat44 &operator=(Nat44 &&) = delete;
+
+    /**
+     * @brief 报文中的五元组,地址和端口都是网络字节序
+     */
+    struct NatTuple
+    {
+        uint32_t srcIp = 0;
+        uint32_t dstIp = 0;
+        uint16_t srcPort = 0;
+        uint16_t dstPort = 0;
+        uint8_t proto = 0;
+
+        bool operator==(const NatTuple &other) const
+        {
+            return srcIp == other.srcIp && dstIp == other.dstIp && srcPort == other.srcPort &&
+                   dstPort == other.dstPort && proto == other.proto;
+        }
+    };
+
+    enum SESSION_STATE : uint8_t
+    {
+        SESSION_FREE = 0,    ///< 空闲
+        SESSION_UDP,         ///< UDP会话
+        SESSION_TCP_SYN,     ///< TCP握手中,还没有收到对端带ACK的报文
+        SESSION_TCP_EST,     ///< TCP连接已建立
+        SESSION_TCP_CLOSING, ///< 任一方向见到FIN或RST,不再回到已建立状态
+        SESSION_STATE_MAX,
+    };
+
+    struct NatSession
+    {
+        NatTuple out;             ///< 出方向翻译前的五元组:内部地址:端口 -> 对端
+        NatTuple in;              ///< 入方向翻译前的五元组:对端 -> 外部地址:端口
+        uint64_t lastSeen = 0;    ///< 最近一次有报文的时间(TSC周期)
+        uint8_t extIdx = 0;       ///< 外部地址在_externalIps中的下标
+        SESSION_STATE state = SESSION_FREE; ///< 会话状态,决定超时时间
+    };
+
+    struct NatSlot
+    {
+        uint32_t hash; ///< 键的哈希值,搬移删除时用来计算起始槽位
+        uint32_t ref;  ///< 0表示空槽位,否则为(会话下标 << 1 | 方向) + 1,方向0为出方向
+    };
+
+    /**
+     * @brief 端口池,先进先出的环形队列
+     */
+    struct PortPool
+    {
+        uint16_t *ports = nullptr; ///< 空闲端口,主机字节序
+        uint32_t capacity = 0;     ///< 端口总数
+        uint32_t head = 0;         ///< 下一个分配的端口的位置
+        uint32_t count = 0;        ///< 空闲端口数量
+    };
+
+    struct alignas(RTE_CACHE_LINE_SIZE) Shard
+    {
+        NatSession *sessions = nullptr;     ///< 会话数组
+        uint32_t *freeSessions = nullptr;   ///< 空闲会话下标的栈
+        uint32_t nbFree = 0;                ///< 空闲会话数量
+        NatSlot *slots = nullptr;           ///< 哈希表
+        uint32_t slotMask = 0;              ///< 哈希表槽位数量减一
+        PortPool pools[NAT_MAX_EXTERNAL_IPS][NAT_NB_PROTOS]; ///< 每个外部地址每种协议的端口池
+        uint64_t now = 0;                   ///< 最近一次maintain记录的时间(TSC周期)
+        uint64_t nextSweep = 0;             ///< 下一次扫描的时间(TSC周期)
+        uint32_t sweepCursor = 0;           ///< 下一次扫描开始的会话下标
+        uint64_t created = 0;               ///< 创建的会话数量
+        uint64_t expired = 0;               ///< 超时释放的会话数量
+        uint64_t outbound = 0;              ///< 出方向翻译的报文数量
+        uint64_t inbound = 0;               ///< 入方向翻译的报文数量
+        uint64_t drops[NAT_DROP_MAX] = {0}; ///< 每种原因丢弃的报文数量
+    };
+
+    static int protoIndex(uint8_t proto) { return proto == IPPROTO_TCP ? 0 : 1; }
+
+    uint32_t hashTuple(const NatTuple &tuple) const;
+
+    /**
+     * @brief 按五元组查找会话
+     * @return 会话下标,找不到返回-1
+     */
+    int lookup(const Shard &shard, const NatTuple &tuple, uint32_t hash) const;
+
+    /**
+     * @brief 把会话一个方向的五元组插入哈希表,表的容量保证总有空槽位
+     */
+    void insertKey(Shard &shard, uint32_t hash, uint32_t ref);
+
+    /**
+     * @brief 删除会话一个方向的键,向后搬移,不留墓碑
+     */
+    void eraseKey(Shard &shard, uint32_t hash, uint32_t ref);
+
+    /**
+     * @brief 为出方向的新流创建会话并分配外部端口
+     * @return 会话下标,失败返回-1
+     */
+    int createSession(Shard &shard, const NatTuple &out, uint32_t hash);
+
+    /**
+     * @brief 释放会话,端口放回端口池的末尾
+     */
+    void releaseSession(Shard &shard, uint32_t idx);
+
+    /**
+     * @brief 根据TCP标志更新会话状态
+     * @param inbound 报文是否是回程方向
+     */
+    static void updateTcpState(NatSession &session, uint8_t tcpFlags, bool inbound);
+
+    /**
+     * @brief 改写一个地址和一个端口并增量更新IP和TCP/UDP校验和
+     * @param l4hdr TCP或UDP头部
+     * @param source true改写源地址和源端口,false改写目的地址和目的端口
+     */
+    static void rewrite(struct rte_ipv4_hdr *iphdr, uint8_t *l4hdr, bool source, uint32_t newAddr, uint16_t newPort);
+
+    bool isInternal(uint32_t addr) const
+    {
+        const uint32_t host = rte_be_to_cpu_32(addr);
+        for (unsigned i = 0; i < _nbInternal; i++)
+        {
+            if ((host & _internalMasks[i]) == _internalNets[i])
+                return true;
+        }
+        return false;
+    }
+
+private:
+    bool _enabled = false;                              ///< 是否开启NAT
+    unsigned _nbWorkers = 1;                            ///< 工作核数量,也是端口划分的份数
+    uint32_t _externalIps[NAT_MAX_EXTERNAL_IPS] = {0};  ///< 外部地址,网络字节序
+    unsigned _nbExternal = 0;                           ///< 外部地址数量
+    uint32_t _internalNets[NAT_MAX_INTERNAL_NETS] = {0};  ///< 内部网段,主机字节序
+    uint32_t _internalMasks[NAT_MAX_INTERNAL_NETS] = {0}; ///< 内部网段的掩码,主机字节序
+    unsigned _nbInternal = 0;                           ///< 内部网段数量
+    uint16_t _portMin = 1024;                           ///< 外部端口下限
+    uint16_t _portMax = 65535;                          ///< 外部端口上限
+    uint32_t _maxSessions = 0;                          ///< 每个工作核最多的会话数量
+    uint32_t _sweepChunk = 1;                           ///< 每次扫描的会话数量
+    uint64_t _sweepCycles = 0;                          ///< 两次扫描的间隔(TSC周期)
+    uint64_t _timeoutCycles[SESSION_STATE_MAX] = {0};   ///< 每种会话状态的空闲超时(TSC周期)
+    uint32_t _hashSeed = 0x2545f491;                    ///< 五元组哈希种子
+    Shard _shards[RING_MAX_WORKERS];                    ///< 每个工作核的会话表,只由该工作核访问
+};
+
+#endif
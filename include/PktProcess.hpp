@@ -2,11 +2,14 @@
 #define PKT_PROCESS_HPP
 #include <rte_mbuf.h>
 #include "Ring.hpp"
+#include <atomic>
 
 struct PktProcessParams
 {
     struct rte_mempool *mbufPool;
     struct inout_ring *ring;
+    unsigned workerId; ///< pkt_process工作核编号,0号工作核额外负责协议栈的发送和KNI请求
+    const std::atomic<bool> *quit; ///< 置位后工作核循环返回,由信号处理函数设置
 };
 
 int pkt_process(void *arg);
@@ -0,0 +1,130 @@
+#ifndef PMTU_HPP
+#define PMTU_HPP
+#include <cstdint>
+#include <atomic>
+#include <mutex>
+#include <unordered_map>
+
+#define PMTU_MIN 552               ///< 接受的最小PMTU,与Linux的min_pmtu一致,防止伪造的ICMP把报文压得过小
+#define PMTU_MAX_ENTRIES 4096      ///< 最多缓存的目的地址数量
+#define TCP_IPV4_HDR_LEN 40        ///< 不带选项的IPv4头和TCP头的总长度
+#define TCP_DEFAULT_MSS 536        ///< 对端没有通告MSS时使用的默认值(RFC 879)
+
+/**
+ * @brief 缓存在连接或socket中的PMTU,用法与RouteCacheEntry相同
+ *
+ * 缓存表的代数变化或学习到的PMTU过期时失效,命中时不需要加锁。
+ */
+struct PmtuCacheEntry
+{
+    uint32_t dst = 0;        ///< 缓存对应的目的地址
+    uint32_t generation = 0; ///< 缓存时PMTU缓存的代数,0表示无效
+    uint16_t mtu = 0;        ///< 缓存的PMTU
+    uint64_t expireMs = 0;   ///< 学习到的PMTU的过期时间(毫秒),0表示使用的是链路MTU,不会过期
+};
+
+/**
+ * @brief 路径MTU缓存(RFC 1191),单例模式
+ *
+ * 收到"需要分片"的ICMP差错后记录到目的地址的更小的PMTU,条目过期后恢复为链路MTU,
+ * 以便重新探测更大的PMTU。没有缓存的目的地址使用链路MTU。
+ */
+class PmtuCache
+{
+public:
+    static PmtuCache &getInstance()
+    {
+        static PmtuCache instance;
+        return instance;
+    }
+
+    /**
+     * @brief 设置链路MTU和学习到的PMTU的有效期
+     * @param linkMtu 网卡的MTU
+     * @param expireMs 学习到的PMTU的有效期(毫秒),RFC 1191建议10分钟
+     */
+    void init(uint16_t linkMtu, uint64_t expireMs);
+
+    uint16_t getLinkMtu() const { return _linkMtu; }
+
+    /**
+     * @brief 查询到目的地址的PMTU,没有缓存或已过期时返回链路MTU
+     * @param dst 目的IP地址,网络字节序
+     */
+    uint16_t get(uint32_t dst);
+
+    /**
+     * @brief 先检查缓存,缓存失效时加锁查询并更新缓存,用于每个报文都要查询的发送路径
+     * @param dst 目的IP地址,网络字节序
+     * @param cache 调用者持有的缓存
+     */
+    uint16_t getCached(uint32_t dst, PmtuCacheEntry *cache)
+    {
+        if (cache->dst == dst && cache->generation == _generation.load(std::memory_order_acquire) &&
+            (cache->expireMs == 0 || nowMs() < cache->expireMs))
+            return cache->mtu;
+        return lookup(dst, cache);
+    }
+
+    /**
+     * @brief 根据"需要分片"的ICMP差错更新PMTU,只会降低PMTU
+     * @param dst 原始报文的目的IP地址,网络字节序
+     * @param mtu ICMP中携带的下一跳MTU,为0时(不支持RFC 1191的旧路由器)根据原始报文长度选择更小的平台值
+     * @param origLength 原始报文的IP总长度
+     * @return PMTU被降低时返回0,否则返回-1
+     */
+    int update(uint32_t dst, uint16_t mtu, uint16_t origLength);
+
+    /**
+     * @brief 到目的地址的TCP报文段最多能携带的数据长度
+     */
+    uint16_t getMss(uint32_t dst) { return get(dst) - TCP_IPV4_HDR_LEN; }
+
+    /**
+     * @brief 删除所有条目
+     */
+    void clear();
+
+private:
+    PmtuCache() = default;
+    ~PmtuCache() = default;
+    PmtuCache(const PmtuCache &) = delete;
+    PmtuCache &operator=(const PmtuCache &) = delete;
+    PmtuCache(PmtuCache &&) = delete;
+    PmtuCache &operator=(PmtuCache &&) = delete;
+
+    uint64_t nowMs() const;
+
+    /**
+     * @brief 加锁查询PMTU并填写缓存
+     */
+    uint16_t lookup(uint32_t dst, PmtuCacheEntry *cache);
+
+    /**
+     * @brief 使所有PmtuCacheEntry失效,调用者需要持有_mutex
+     */
+    void bumpGenerationLocked()
+    {
+        _generation.store(_generation.load(std::memory_order_relaxed) + 1, std::memory_order_release);
+    }
+
+    /**
+     * @brief 删除所有过期条目,调用者需要持有_mutex
+     */
+    void expireLocked(uint64_t now);
+
+private:
+    struct PmtuEntry
+    {
+        uint16_t mtu;      ///< 学习到的PMTU
+        uint64_t expireMs; ///< 过期时间(毫秒)
+    };
+
+    uint16_t _linkMtu = 1500;                        ///< 链路MTU
+    uint64_t _expireMs = 600000;                     ///< 学习到的PMTU的有效期(毫秒)
+    std::unordered_map<uint32_t, PmtuEntry> _entries; ///< 目的地址到PMTU的映射
+    std::mutex _mutex;                               ///< 保护_entries
+    std::atomic<uint32_t> _generation{1};            ///< 缓存代数,从1开始,条目被降低或清空时递增
+};
+
+#endif
@@ -0,0 +1,111 @@
+#ifndef QOS_HPP
+#define QOS_HPP
+#include <rte_mbuf.h>
+#include <rte_ring.h>
+#include <rte_ether.h>
+#include <rte_ip.h>
+#include <cstdint>
+#include <vector>
+#include "Datapath.hpp"
+
+#define QOS_NB_CLASSES 4          ///< 流量类别数量,0号类别严格优先,其余类别按WRR调度
+#define QOS_STRICT_CLASS 0        ///< 严格优先的类别:网络控制和加速转发(EF)
+#define QOS_BEST_EFFORT_CLASS 3   ///< 尽力而为的类别,也是CS1(低于尽力而为)的类别
+#define QOS_DRAIN_BURSTS 4        ///< 主核每轮最多从输出环取出的burst数量
+#define QOS_DSCP_EF 46            ///< 加速转发(RFC 3246)
+#define QOS_DSCP_CS1 8            ///< 低于尽力而为的流量(RFC 8622)
+
+/**
+ * @brief 按DSCP调度的出口队列,单例模式
+ *
+ * 主核从输出环取出报文后按DSCP放入类别队列,再按"严格优先+WRR"的顺序取出发送:
+ * 0号类别(CS5~CS7、EF)有报文就先发,其余类别按配置的权重轮流发送。
+ * 网卡发送队列满时没发出去的报文留在调度器中,下一轮最先重试,不再丢弃;
+ * 大批量流量因此只会堆积在自己的类别队列里,高优先级报文不必排在它们后面。
+ * ARP报文和其他非IP报文属于0号类别。调度器只由主核访问,不加锁。
+ */
+class EgressScheduler
+{
+public:
+    static EgressScheduler &getInstance()
+    {
+        static EgressScheduler instance;
+        return instance;
+    }
+
+    /**
+     * @brief 创建类别队列并打开调度
+     * @param queueSize 每个类别队列的容量,向上取整为2的幂
+     * @param weights 1~3号类别的WRR权重,缺少的按1处理
+     * @return 成功返回0,失败返回-1
+     */
+    int init(unsigned queueSize, const std::vector<unsigned> &weights);
+
+    bool isEnabled() const { return _enabled; }
+
+    /**
+     * @brief 报文IP头部中的DSCP,非IP报文返回0
+     */
+    static uint8_t dscpOf(const struct rte_mbuf *mbuf)
+    {
+        const struct rte_ether_hdr *ehdr = rte_pktmbuf_mtod(mbuf, const struct rte_ether_hdr *);
+        if (ehdr->ether_type == rte_cpu_to_be_16(RTE_ETHER_TYPE_IPV4))
+            return ((const struct rte_ipv4_hdr *)(ehdr + 1))->type_of_service >> 2;
+        if (ehdr->ether_type == rte_cpu_to_be_16(RTE_ETHER_TYPE_IPV6))
+            return (rte_be_to_cpu_32(((const struct rte_ipv6_hdr *)(ehdr + 1))->vtc_flow) >> 22) & 0x3F;
+        return 0;
+    }
+
+    /**
+     * @brief 报文所属的类别
+     */
+    static unsigned classify(const struct rte_mbuf *mbuf);
+
+    /**
+     * @brief 报文按类别入队,队列已满的报文被释放
+     */
+    void enqueue(struct rte_mbuf **mbufs, unsigned nbPkts);
+
+    /**
+     * @brief 重试上一轮网卡没有接收的报文
+     * @return 全部发出返回true,此时才可以调用dequeue取出新的报文
+     */
+    bool flushHeld(uint16_t portId);
+
+    /**
+     * @brief 按严格优先和WRR取出下一批要发送的报文
+     * @return 取出的报文数量
+     */
+    unsigned dequeue(struct rte_mbuf **tx, unsigned maxPkts);
+
+    /**
+     * @brief 保存网卡没有接收的报文,下一轮由flushHeld最先发送
+     */
+    void hold(struct rte_mbuf **mbufs, unsigned nbPkts);
+
+    /**
+     * @brief 打印每个类别的发送和丢弃数量
+     */
+    void dumpStats() const;
+
+private:
+    EgressScheduler() = default;
+    ~EgressScheduler() = default;
+    EgressScheduler(const EgressScheduler &) = delete;
+    EgressScheduler &operator=(const EgressScheduler &) = delete;
+    EgressScheduler(EgressScheduler &&) = delete;
+    EgressScheduler &operator=(EgressScheduler &&) = delete;
+
+private:
+    bool _enabled = false;                              ///< 是否开启出口调度
+    struct rte_ring *_queues[QOS_NB_CLASSES] = {};      ///< 每个类别的队列
+    unsigned _weights[QOS_NB_CLASSES] = {0, 1, 1, 1};   ///< WRR权重,0号类别严格优先不使用
+    unsigned _wrrClass = 1;                             ///< WRR当前服务的类别
+    unsigned _wrrCredit = 0;                            ///< 当前类别在本轮还能发送的报文数量
+    struct rte_mbuf *_held[DATAPATH_MAX_BURST];         ///< 网卡没有接收、等待重试的报文
+    unsigned _nbHeld = 0;                               ///< 等待重试的报文数量
+    uint64_t _sent[QOS_NB_CLASSES] = {};                ///< 每个类别取出发送的报文数量
+    uint64_t _dropped[QOS_NB_CLASSES] = {};             ///< 每个类别因队列满丢弃的报文数量
+};
+
+#endif
@@ -0,0 +1,109 @@
+#ifndef REASSEMBLY_HPP
+#define REASSEMBLY_HPP
+#include <rte_mbuf.h>
+#include <rte_ip.h>
+#include <rte_ether.h>
+#include <rte_ip_frag.h>
+#include <cstdint>
+#include "Ring.hpp"
+#include "LocalAddr.hpp"
+
+#define REASSEMBLY_PREFETCH_OFFSET 3 ///< 释放death row时的预取距离
+
+/**
+ * @brief IPv4分片重组模块,单例模式
+ *
+ * 每个pkt_process工作核拥有独立的rte_ip_frag表和death row,无需加锁。
+ * RPS对分片只按地址哈希,同一个数据报的所有分片总是落到同一个工作核上。
+ * 未分片的报文只检查一次IP头的分片字段,不做任何分配。
+ */
+class IpReassembly
+{
+public:
+    static IpReassembly &getInstance()
+    {
+        static IpReassembly instance;
+        return instance;
+    }
+
+    /**
+     * @brief 为每个工作核创建分片表,必须在工作核启动之前调用
+     * @param nbWorkers 工作核数量
+     * @param maxEntries 每个工作核同时重组的最大数据报数量,决定了分片占用的mbuf上限
+     * @param bucketEntries 每个哈希桶的条目数量,必须是2的幂
+     * @param timeoutMs 分片的最长等待时间(毫秒),超时后整个数据报被丢弃
+     * @return 成功返回0,失败返回-1
+     */
+    int init(unsigned nbWorkers, uint32_t maxEntries, uint32_t bucketEntries, uint32_t timeoutMs);
+
+    /**
+     * @brief 重组入口,未分片的报文和要转发的分片原样返回
+     * @param workerId 工作核编号
+     * @param mbuf 入站报文
+     * @param now 当前时间(TSC周期)
+     * @return 可以继续处理的报文(可能是多段mbuf);分片尚未收齐或被丢弃时返回nullptr
+     */
+    struct rte_mbuf *reassemble(unsigned workerId, struct rte_mbuf *mbuf, uint64_t now)
+    {
+        struct rte_ether_hdr *ehdr = rte_pktmbuf_mtod(mbuf, struct rte_ether_hdr *);
+        if (ehdr->ether_type != rte_cpu_to_be_16(RTE_ETHER_TYPE_IPV4))
+            return mbuf;
+        struct rte_ipv4_hdr *iphdr = (struct rte_ipv4_hdr *)(ehdr + 1);
+        if (likely(!rte_ipv4_frag_pkt_is_fragmented(iphdr)))
+            return mbuf;
+        // 转发的分片原样转发,只重组发给本机的单播分片和组播分片
+        if (!RTE_IS_IPV4_MCAST(rte_be_to_cpu_32(iphdr->dst_addr)) && !LocalAddrTable::getInstance().isLocal(iphdr->dst_addr))
+            return mbuf;
+        return reassembleFragment(_lcores[workerId], mbuf, iphdr, now);
+    }
+
+    /**
+     * @brief 释放death row中的分片并清理超时的数据报,工作核每处理完一批报文调用一次
+     *
+     * 清理时已收到首片的超时数据报向源地址发送"分片重组超时"的ICMP差错(RFC 1122 3.3.2)。
+     * @param workerId 工作核编号
+     * @param now 当前时间(TSC周期)
+     * @param mbufPool 构造ICMP差错使用的内存池
+     * @param out 输出环
+     */
+    void maintain(unsigned workerId, uint64_t now, struct rte_mempool *mbufPool, struct rte_ring *out);
+
+    bool isEnabled() const { return _enabled; }
+
+    /**
+     * @brief 打印每个工作核的重组统计信息
+     */
+    void dumpStats();
+
+private:
+    IpReassembly() = default;
+    ~IpReassembly() = default;
+    IpReassembly(const IpReassembly &) = delete;
+    IpReassembly &operator=(const IpReassembly &) = delete;
+    IpReassembly(IpReassembly &&) = delete;
+    IpReassembly &operator=(IpReassembly &&) = delete;
+
+    struct alignas(RTE_CACHE_LINE_SIZE) LcoreState
+    {
+        struct rte_ip_frag_tbl *tbl = nullptr;  ///< 分片表
+        struct rte_ip_frag_death_row dr;        ///< 等待释放的分片
+        uint64_t lastSweep = 0;                 ///< 上次清理超时数据报的时间(TSC周期)
+        uint64_t fragments = 0;                 ///< 收到的分片数量
+        uint64_t reassembled = 0;               ///< 重组成功的数据报数量
+        uint64_t timeouts = 0;                  ///< 因超时被丢弃的分片数量
+        uint64_t invalid = 0;                   ///< 因重叠、非法或表满被丢弃的分片数量
+    };
+
+    /**
+     * @brief 慢路径:把一个分片交给rte_ip_frag,并根据death row的变化更新统计
+     */
+    struct rte_mbuf *reassembleFragment(LcoreState &state, struct rte_mbuf *mbuf, struct rte_ipv4_hdr *iphdr, uint64_t now);
+
+private:
+    bool _enabled = false;                    ///< 是否已初始化
+    unsigned _nbWorkers = 0;                  ///< 工作核数量
+    uint64_t _maxCycles = 0;                  ///< 分片的最长等待时间(TSC周期)
+    LcoreState _lcores[RING_MAX_WORKERS];     ///< 每个工作核的重组状态
+};
+
+#endif
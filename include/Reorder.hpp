@@ -0,0 +1,129 @@
+#ifndef REORDER_HPP
+#define REORDER_HPP
+#include <rte_mbuf.h>
+#include <rte_ring.h>
+#include <rte_per_lcore.h>
+#include <atomic>
+#include <deque>
+#include <cstdint>
+#include "Ring.hpp"
+
+#define REORDER_DRAIN_BURST 64 ///< 主核每次从输出环取出的最大报文数量
+
+RTE_DECLARE_PER_LCORE(uint64_t, egressSeqn); ///< 当前工作核正在处理的入站报文序号,0表示不参与排序
+
+/**
+ * @brief 多工作核下的出口保序模块,单例模式
+ *
+ * RX核给每个入站报文打上全局递增的序号,工作核在处理某个报文时产生的出站报文继承该序号。
+ * 主核发送前按序号缓存出站报文,只有当所有序号更小的入站报文都已处理完毕时才放行,
+ * 从而把报文喷洒(spray)到多个工作核之后,同一条流的出站报文依然保持入站顺序。
+ * 序号为0的报文(socket发送队列产生的报文)不参与排序,直接发送。
+ */
+class EgressReorder
+{
+public:
+    static EgressReorder &getInstance()
+    {
+        static EgressReorder instance;
+        return instance;
+    }
+
+    /**
+     * @brief 初始化保序模块,注册mbuf动态字段
+     * @param nbWorkers 工作核数量
+     * @param bufferSize 主核最多缓存的待排序报文数量
+     * @param maxHoldUs 报文最长缓存时间(微秒),超时后强制放行,避免某个工作核卡住时出口停顿
+     * @return 成功返回0,失败返回-1
+     */
+    int init(unsigned nbWorkers, unsigned bufferSize, unsigned maxHoldUs);
+
+    bool isEnabled() const { return _enabled; }
+
+    /**
+     * @brief RX核给报文打上入站序号
+     */
+    void stampRx(struct rte_mbuf *mbuf)
+    {
+        *seqnField(mbuf) = ++_nextSeqn;
+    }
+
+    /**
+     * @brief RX核记录某个工作核已经成功入队的最大序号
+     */
+    void noteDispatched(unsigned workerId, uint64_t seqn) { _dispatched[workerId] = seqn; }
+
+    /**
+     * @brief 读取报文上的序号
+     */
+    uint64_t getSeqn(struct rte_mbuf *mbuf) const { return *seqnField(mbuf); }
+
+    /**
+     * @brief 工作核处理完一批报文后发布已完成的最大序号,必须在这批报文产生的出站报文全部入队之后调用
+     */
+    void complete(unsigned workerId, uint64_t seqn) { _done[workerId].value.store(seqn, std::memory_order_release); }
+
+    /**
+     * @brief 给出站报文打上当前工作核的序号并放入输出环,入队失败的报文直接释放
+     * @param out 输出环
+     * @param mbufs 出站报文
+     * @param nbPkts 报文数量
+     * @return 成功入队的报文数量
+     */
+    unsigned enqueueOut(struct rte_ring *out, struct rte_mbuf **mbufs, unsigned nbPkts);
+
+    /**
+     * @brief 主核从输出环取出报文,按序号恢复顺序后返回可以发送的报文
+     * @param out 输出环
+     * @param tx 输出参数,可以发送的报文
+     * @param maxPkts tx的容量
+     * @return 可以发送的报文数量
+     */
+    unsigned drain(struct rte_ring *out, struct rte_mbuf **tx, unsigned maxPkts);
+
+    /**
+     * @brief 打印保序模块的统计信息
+     */
+    void dumpStats();
+
+private:
+    EgressReorder() = default;
+    ~EgressReorder() = default;
+    EgressReorder(const EgressReorder &) = delete;
+    EgressReorder &operator=(const EgressReorder &) = delete;
+    EgressReorder(EgressReorder &&) = delete;
+    EgressReorder &operator=(EgressReorder &&) = delete;
+
+    uint64_t *seqnField(struct rte_mbuf *mbuf) const
+    {
+        return RTE_MBUF_DYNFIELD(mbuf, _seqnOffset, uint64_t *);
+    }
+
+    /**
+     * @brief 计算当前可以安全放行的最大序号
+     */
+    uint64_t releaseBound() const;
+
+private:
+    struct alignas(RTE_CACHE_LINE_SIZE) DoneSeqn
+    {
+        std::atomic<uint64_t> value{0};
+    };
+
+    bool _enabled = false;                              ///< 是否开启出口保序
+    int _seqnOffset = -1;                               ///< 序号在mbuf动态字段中的偏移
+    unsigned _nbWorkers = 1;                            ///< 工作核数量
+    unsigned _bufferSize = 1024;                        ///< 最多缓存的待排序报文数量
+    uint64_t _maxHoldCycles = 0;                        ///< 报文最长缓存时间(时钟周期)
+    uint64_t _nextSeqn = 0;                             ///< 下一个入站序号,只由RX核修改
+    uint64_t _dispatched[RING_MAX_WORKERS] = {0};       ///< 每个工作核已入队的最大序号,只由RX核修改
+    DoneSeqn _done[RING_MAX_WORKERS];                   ///< 每个工作核已处理完成的最大序号
+    std::deque<struct rte_mbuf *> _pending;             ///< 等待放行的出站报文,只由主核访问
+    bool _pendingSorted = true;                         ///< _pending是否已按序号排序
+    uint64_t _stallSince = 0;                           ///< 放行边界停止前进的起始时间
+    uint64_t _lastBound = 0;                            ///< 上一次计算出的放行边界
+    uint64_t _reordered = 0;                            ///< 乱序到达并被重新排序的报文数
+    uint64_t _forced = 0;                               ///< 因缓存满或超时被强制放行的报文数
+};
+
+#endif
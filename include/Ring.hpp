@@ -1,8 +1,11 @@
 #ifndef RING__H__
 #define RING__H__
 #include <rte_malloc.h>
+#include <rte_ring.h>
 #include "Logger.hpp"
 
+#define RING_MAX_WORKERS 16 ///< 最多支持的pkt_process工作核数量
+
 struct inout_ring
 {
     struct rte_ring *in = nullptr;  ///< 输入环形缓冲区指针
@@ -30,30 +33,55 @@ public:
         return 0;
     }
 
-    struct inout_ring *getRing()
+    /**
+     * @brief 获取工作核对应的输入/输出环
+     * @param workerId pkt_process工作核编号,每个工作核拥有独立的输入环,输出环为所有工作核共享
+     * @return 环形缓冲区结构体指针,创建失败直接退出程序
+     */
+    struct inout_ring *getRing(unsigned workerId = 0)
     {
-        if (_ring == nullptr)
+        if (workerId >= RING_MAX_WORKERS)
+        {
+            SPDLOG_ERROR("Worker id {} exceeds max worker count {}", workerId, RING_MAX_WORKERS);
+            rte_exit(EXIT_FAILURE, "ring worker id out of range\n");
+        }
+        if (_out == nullptr)
         {
-            SPDLOG_INFO("Creating ring buffer with size: {}", _RING_SIZE);
-            _ring = static_cast<struct inout_ring *>(rte_malloc("in/out ring", sizeof(struct inout_ring), 0));
-            if (_ring == nullptr)
+            // 输出环由多个工作核并发写入,只有主核读取
+            _out = rte_ring_create("out ring", _RING_SIZE, rte_socket_id(), RING_F_SC_DEQ);
+            if (_out == nullptr)
+            {
+                SPDLOG_ERROR("Failed to allocate memory for ring out");
+                rte_exit(EXIT_FAILURE, "ring out create failed\n");
+            }
+        }
+        if (_ring[workerId] == nullptr)
+        {
+            SPDLOG_INFO("Creating ring buffer for worker {} with size: {}", workerId, _RING_SIZE);
+            struct inout_ring *ring = static_cast<struct inout_ring *>(rte_malloc("in/out ring", sizeof(struct inout_ring), 0));
+            if (ring == nullptr)
             {
                 SPDLOG_ERROR("Failed to allocate memory for ring buffer");
                 rte_exit(EXIT_FAILURE, "ring buffer init failed\n");
             }
-            memset(_ring, 0, sizeof(struct inout_ring));
-            _ring->in = rte_ring_create("in ring", _RING_SIZE, rte_socket_id(), RING_F_SP_ENQ | RING_F_SC_DEQ);
-            _ring->out = rte_ring_create("out ring", _RING_SIZE, rte_socket_id(), RING_F_SP_ENQ | RING_F_SC_DEQ);
+            memset(ring, 0, sizeof(struct inout_ring));
+            char name[RTE_RING_NAMESIZE] = {0};
+            if (workerId == 0)
+                snprintf(name, sizeof(name), "in ring");
+            else
+                snprintf(name, sizeof(name), "in ring %u", workerId);
+            ring->in = rte_ring_create(name, _RING_SIZE, rte_socket_id(), RING_F_SP_ENQ | RING_F_SC_DEQ);
+            ring->out = _out;
 
-            if (!_ring->in || !_ring->out)
+            if (!ring->in)
             {
-                rte_free(_ring);
-                _ring = nullptr;
-                SPDLOG_ERROR("Failed to allocate memory for ring in/out");
-                rte_exit(EXIT_FAILURE, "ring in/out create failed\n");
+                rte_free(ring);
+                SPDLOG_ERROR("Failed to allocate memory for ring in");
+                rte_exit(EXIT_FAILURE, "ring in create failed\n");
             }
+            _ring[workerId] = ring;
         }
-        return _ring;
+        return _ring[workerId];
     }
 
 private:
@@ -64,19 +92,27 @@ private:
     }
     int reSetRing()
     {
-        if (_ring)
+        for (unsigned i = 0; i < RING_MAX_WORKERS; i++)
+        {
+            if (_ring[i])
+            {
+                rte_ring_free(_ring[i]->in);
+                rte_free(_ring[i]);
+                _ring[i] = nullptr;
+            }
+        }
+        if (_out)
         {
-            rte_ring_free(_ring->in);
-            rte_ring_free(_ring->out);
-            rte_free(_ring);
-            _ring = nullptr;
+            rte_ring_free(_out);
+            _out = nullptr;
         }
         return 0; // 成功
     }
 
 private:
-    struct inout_ring *_ring = nullptr; ///< 内部使用的环形缓冲区结构体指针
-    size_t _RING_SIZE = 1024;           ///< 默认环形缓冲区大小
+    struct inout_ring *_ring[RING_MAX_WORKERS] = {nullptr}; ///< 每个工作核的环形缓冲区结构体指针
+    struct rte_ring *_out = nullptr;                        ///< 所有工作核共享的输出环
+    size_t _RING_SIZE = 1024;                               ///< 默认环形缓冲区大小
 };
 
 #endif
\ No newline at end of file
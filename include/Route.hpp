@@ -0,0 +1,155 @@
+#ifndef ROUTE_HPP
+#define ROUTE_HPP
+#include <cstdint>
+#include <atomic>
+#include <mutex>
+#include <string>
+#include <vector>
+#include <utility>
+
+#define ROUTE_MAX_NEXT_HOPS 256 ///< 最多同时存在的不同下一跳数量
+#define ROUTE_ON_LINK 0         ///< 网关为0表示直连路由,下一跳就是目的地址本身
+
+struct rte_lpm;
+
+/**
+ * @brief 缓存在连接或socket中的路由结果
+ *
+ * 路由表发生任何变化时表的代数(generation)递增,所有缓存随之失效。
+ * 路由很少变化,命中缓存时发送路径只需要比较两个整数。
+ */
+struct RouteCacheEntry
+{
+    uint32_t dst = 0;        ///< 缓存对应的目的地址
+    uint32_t generation = 0; ///< 缓存时路由表的代数,0表示无效
+    uint32_t nextHop = 0;    ///< 需要解析ARP的下一跳地址
+    uint16_t portId = 0;     ///< 出端口
+};
+
+/**
+ * @brief 基于rte_lpm的IPv4路由表,单例模式
+ *
+ * 按最长前缀匹配把目的地址解析为出端口和下一跳,ARP解析的对象是下一跳而不是目的地址。
+ * LPM的下一跳字段只有24位,因此表中保存的是_nextHops数组的下标。
+ * rte_lpm不接受长度为0的前缀,默认路由单独保存在_defaultHop中,LPM查不到时使用。
+ * 修改由任意线程在_mutex保护下进行,查询路径用序列锁检测并重试并发修改,不需要加锁。
+ * 所有地址参数都是网络字节序。
+ */
+class RouteTable
+{
+public:
+    static RouteTable &getInstance()
+    {
+        static RouteTable instance;
+        return instance;
+    }
+
+    /**
+     * @brief 创建LPM表
+     * @param maxRules 最多的路由条数
+     * @param numberTbl8 前缀长于24位的路由使用的tbl8组数量
+     * @param socketId 分配内存的NUMA节点
+     * @return 成功返回0,失败返回-1
+     */
+    int init(uint32_t maxRules, uint32_t numberTbl8, int socketId);
+
+    /**
+     * @brief 添加或替换一条路由
+     * @param prefix 目的网段
+     * @param depth 前缀长度,范围[0, 32],0为默认路由
+     * @param gateway 网关地址,ROUTE_ON_LINK表示直连
+     * @param portId 出端口
+     * @return 成功返回0,失败返回-1
+     */
+    int addRoute(uint32_t prefix, uint8_t depth, uint32_t gateway, uint16_t portId);
+
+    /**
+     * @brief 删除一条路由
+     * @return 成功返回0,路由不存在返回-1
+     */
+    int delRoute(uint32_t prefix, uint8_t depth);
+
+    /**
+     * @brief 添加配置文件中的静态路由,格式错误的条目跳过
+     * @param routes (目的网段, 网关)字符串,网段为CIDR格式如"10.0.0.0/8",网关为空或"0.0.0.0"表示直连
+     * @param portId 出端口
+     * @return 成功添加的条数
+     */
+    unsigned addRoutes(const std::vector<std::pair<std::string, std::string>> &routes, uint16_t portId);
+
+    /**
+     * @brief 查询目的地址的路由
+     * @param dst 目的地址
+     * @param cache 输出参数,查询结果
+     * @return 有路由返回true,否则返回false
+     */
+    bool lookup(uint32_t dst, RouteCacheEntry *cache);
+
+    /**
+     * @brief 先检查缓存,缓存失效时查询LPM表并更新缓存
+     */
+    bool lookupCached(uint32_t dst, RouteCacheEntry *cache)
+    {
+        if (cache->dst == dst && cache->generation == _generation.load(std::memory_order_acquire))
+            return true;
+        return lookup(dst, cache);
+    }
+
+    /**
+     * @brief 打印所有路由
+     */
+    void dump();
+
+private:
+    RouteTable() = default;
+    ~RouteTable() = default;
+    RouteTable(const RouteTable &) = delete;
+    RouteTable &operator=(const RouteTable &) = delete;
+    RouteTable(RouteTable &&) = delete;
+    RouteTable &operator=(RouteTable &&) = delete;
+
+    /**
+     * @brief 查找或分配一个下一跳,调用者需要持有_mutex
+     * @return 下一跳下标,没有空闲位置返回-1
+     */
+    int acquireNextHop(uint32_t gateway, uint16_t portId);
+
+    /**
+     * @brief 释放对下一跳的一次引用,调用者需要持有_mutex
+     */
+    void releaseNextHop(uint32_t index);
+
+    /**
+     * @brief 查询一条路由是否存在,默认路由不在LPM表中需要单独判断,调用者需要持有_mutex
+     * @param index 输出参数,路由使用的下一跳下标
+     * @return 存在返回true
+     */
+    bool findRule(uint32_t hostPrefix, uint8_t depth, uint32_t *index);
+
+    void writeBegin();
+    void writeEnd();
+
+private:
+    struct NextHop
+    {
+        uint32_t gateway = 0; ///< 网关地址,ROUTE_ON_LINK表示直连
+        uint16_t portId = 0;  ///< 出端口
+        uint32_t refcnt = 0;  ///< 引用该下一跳的路由条数,0表示空闲
+    };
+
+    struct RouteRule
+    {
+        uint32_t prefix; ///< 目的网段
+        uint8_t depth;   ///< 前缀长度
+    };
+
+    struct rte_lpm *_lpm = nullptr;              ///< LPM表
+    NextHop _nextHops[ROUTE_MAX_NEXT_HOPS];     ///< 下一跳表,下标保存在LPM中
+    std::atomic<int32_t> _defaultHop{-1};        ///< 默认路由的下一跳下标,-1表示没有默认路由
+    std::vector<RouteRule> _rules;               ///< 已添加的路由,只用于打印
+    std::atomic<uint32_t> _version{0};           ///< 序列锁版本号,奇数表示正在修改
+    std::atomic<uint32_t> _generation{1};        ///< 路由表代数,每次修改后递增
+    std::mutex _mutex;                           ///< 串行化修改
+};
+
+#endif
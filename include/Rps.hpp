@@ -0,0 +1,88 @@
+#ifndef RPS_HPP
+#define RPS_HPP
+#include <rte_mbuf.h>
+#include <rte_ring.h>
+#include <rte_ip.h>
+#include <cstdint>
+#include "Ring.hpp"
+
+#define RPS_DISPATCH_CHUNK 64 ///< 单次分发处理的最大报文数量
+
+/**
+ * @brief 软件RPS(Receive Packet Steering)分发器,单例模式
+ *
+ * 网卡只有一个接收队列(net_tap、无多队列的virtio等)时,由RX核对每个报文计算对称的四元组哈希,
+ * 按哈希值把报文分发到各个pkt_process工作核的输入环,保证同一条流(双向)总是落在同一个工作核上。
+ */
+class RpsDispatcher
+{
+public:
+    static RpsDispatcher &getInstance()
+    {
+        static RpsDispatcher instance;
+        return instance;
+    }
+
+    /**
+     * @brief 初始化分发器
+     * @param nbWorkers 工作核数量,范围[1, RING_MAX_WORKERS]
+     * @param spray 为true时无状态的报文按轮询喷洒到各工作核,需要配合出口保序使用
+     * @return 成功返回0,参数非法返回-1
+     */
+    int init(unsigned nbWorkers, bool spray = false);
+
+    /**
+     * @brief 把一批报文按流哈希分发到各工作核的输入环,入队失败的报文直接释放
+     * @param mbufs 报文数组
+     * @param nbPkts 报文数量
+     * @return 成功入队的报文数量
+     */
+    unsigned dispatch(struct rte_mbuf **mbufs, unsigned nbPkts);
+
+    /**
+     * @brief 计算报文的对称流哈希,交换源/目的地址和端口后结果不变
+     * @param mbuf 报文
+     * @param sprayable 输出参数,报文是否可以不按流喷洒。非IPv4、分片和发往本机的TCP报文依赖按流串行处理,不能喷洒
+     * @return 哈希值;IPv6报文按flowHash6计算,其他非IPv4报文返回0,固定分发到0号工作核
+     */
+    uint32_t flowHash(struct rte_mbuf *mbuf, bool *sprayable = nullptr) const;
+
+    /**
+     * @brief 根据流哈希选择工作核
+     */
+    unsigned selectWorker(uint32_t hash) const
+    {
+        return (unsigned)(((uint64_t)hash * _nbWorkers) >> 32);
+    }
+
+    unsigned getWorkerCount() const { return _nbWorkers; }
+
+    /**
+     * @brief 打印每个工作核的报文分布情况并清零统计
+     */
+    void dumpStats();
+
+private:
+    RpsDispatcher() = default;
+    ~RpsDispatcher() = default;
+    RpsDispatcher(const RpsDispatcher &) = delete;
+    RpsDispatcher &operator=(const RpsDispatcher &) = delete;
+    RpsDispatcher(RpsDispatcher &&) = delete;
+    RpsDispatcher &operator=(RpsDispatcher &&) = delete;
+
+    /**
+     * @brief IPv6报文的对称流哈希,报文不喷洒
+     */
+    uint32_t flowHash6(struct rte_ipv6_hdr *ip6) const;
+
+private:
+    unsigned _nbWorkers = 1;                                  ///< 工作核数量
+    bool _spray = false;                                      ///< 是否按轮询喷洒无状态报文
+    unsigned _sprayNext = 0;                                  ///< 下一个喷洒的工作核
+    struct rte_ring *_workerRings[RING_MAX_WORKERS] = {nullptr}; ///< 每个工作核的输入环
+    uint64_t _enqueued[RING_MAX_WORKERS] = {0};               ///< 每个工作核成功入队的报文数
+    uint64_t _dropped[RING_MAX_WORKERS] = {0};                ///< 每个工作核因输入环满被丢弃的报文数
+    uint32_t _hashSeed = 0x9e3779b9;                          ///< 流哈希种子
+};
+
+#endif
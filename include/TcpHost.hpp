@@ -7,6 +7,10 @@
 #include <list>
 #include "BaseNetwork.hpp"
 #include "Epoll.hpp"
+#include "Arp.hpp"
+#include "Route.hpp"
+#include "Pmtu.hpp"
+#include "Ipv6.hpp"
 
 #define TCP_OPTION_LENGTH 10
 
@@ -41,6 +45,15 @@ struct TcpStream
     TCP_STATUS status;
     pthread_cond_t cond;
     pthread_mutex_t mutex;
+    ArpCacheEntry arpCache; ///< 对端的MAC地址缓存,只由tcpOut访问
+    RouteCacheEntry routeCache; ///< 到对端的路由缓存,只由tcpOut访问
+    uint16_t peerMss;       ///< 对端在SYN中通告的MSS,没有通告时为TCP_DEFAULT_MSS
+    int family;             ///< 地址族,AF_INET6时srcIp/dstIp是地址的折叠值,只用于日志
+    uint8_t srcIp6[IPV6_ADDR_LEN]; ///< 对端IPv6地址
+    uint8_t dstIp6[IPV6_ADDR_LEN]; ///< 本端IPv6地址,监听socket全0表示任意地址
+    Nd6CacheEntry nd6Cache; ///< IPv6对端的下一跳MAC地址缓存,只由tcpOut访问
+    uint8_t tos;            ///< 发送报文的服务类型字节(DSCP),由IP_TOS/IPV6_TCLASS设置,新连接继承监听socket的值
+    PmtuCacheEntry pmtuCache; ///< 到对端的PMTU缓存,只由nsend访问
 };
 
 struct TcpFragment
@@ -70,8 +83,18 @@ public:
     }
     TcpStream *getTcpStreamByFd(int fd);
     int addTcpStream(TcpStream *ts);
-    TcpStream *getTcpStreamByPort(uint16_t port);
+    /**
+     * @brief 取出指定端口和地址族上等待accept的半连接
+     */
+    TcpStream *getTcpStreamByPort(uint16_t port, int family);
+    /**
+     * @brief 按IPv4四元组查找流,找不到时查找监听该端口的socket,绑定具体地址的优先于绑定INADDR_ANY的
+     */
     TcpStream *getTcpStream(uint32_t sip, uint32_t dip, uint16_t sport, uint16_t dport);
+    /**
+     * @brief 按IPv6四元组查找流,找不到时查找监听该端口的socket,规则与getTcpStream相同
+     */
+    TcpStream *getTcpStream6(const uint8_t *sip, const uint8_t *dip, uint16_t sport, uint16_t dport);
     struct event_poll *getEpoll() { return _ep; }
     int removeStream(TcpStream *ts);
     std::list<TcpStream *> getTcpStreamList() { return _tcpStreamList; }
@@ -111,6 +134,11 @@ public:
     ssize_t nrecv(int sockfd, void *buf, size_t len, __attribute__((unused)) int flags);
     ssize_t nsend(int sockfd, const void *buf, size_t len, __attribute__((unused)) int flags);
     int nclose(int fd);
+    /**
+     * @brief 设置socket选项,支持AF_INET的IP_TOS和AF_INET6的IPV6_TCLASS,optval为int,低两位ECN被忽略
+     * @return 成功返回0;失败返回-1并设置errno
+     */
+    int nsetsockopt(int sockfd, int level, int optname, const void *optval, socklen_t optlen);
     int tcpServer(__attribute__((unused)) void *arg);
 };
 
@@ -12,8 +12,34 @@ public:
         return instance;
     }
     int tcpProcess(struct rte_mbuf *tcpmbuf);
+    /**
+     * @brief 处理收到的IPv6 TCP报文,不释放报文
+     * @return 成功返回0;校验失败返回-1;找不到流和监听socket时返回-2
+     */
+    int tcp6Process(struct rte_mbuf *tcpmbuf);
+    /**
+     * @brief 按连接状态处理报文,与地址族无关。LISTEN状态需要对端地址,由调用者处理
+     * @param tcplen TCP头部和负载的总长度
+     */
+    int tcpHandleStream(struct TcpStream *ts, struct rte_tcp_hdr *tcphdr, int tcplen);
     int tcpHandleListen(struct TcpStream *listenStream, struct rte_tcp_hdr *tcphdr, struct rte_ipv4_hdr *iphdr);
+    int tcpHandleListen6(struct TcpStream *listenStream, struct rte_tcp_hdr *tcphdr, struct rte_ipv6_hdr *ip6);
+    /**
+     * @brief 记录对端MSS并把SYN+ACK放入新连接的发送队列,连接进入SYN_RCVD
+     * @param mss 本端通告的MSS
+     */
+    int tcpSendSynAck(struct TcpStream *ts, struct rte_tcp_hdr *tcphdr, uint16_t mss);
     struct TcpStream *tcpCreateStream(uint32_t srcIp, uint32_t dstIp, uint16_t srcPort, uint16_t dstPort);
+    /**
+     * @brief 解析SYN报文中的MSS选项
+     * @param family 地址族,决定接受的最小MSS
+     * @return 对端通告的MSS,不小于该地址族的最小MSS(IPv4为536,IPv6为1220);没有通告时返回TCP_DEFAULT_MSS
+     */
+    uint16_t tcpParseMss(struct rte_tcp_hdr *tcphdr, int family);
+    /**
+     * @brief 发送方向实际使用的MSS,取对端通告的MSS和PMTU允许的MSS中的较小值
+     */
+    uint16_t tcpEffectiveMss(struct TcpStream *stream);
     int tcpHandleSynRcvd(struct TcpStream *stream, struct rte_tcp_hdr *tcphdr);
     int tcpHandleEstablished(struct TcpStream *stream, struct rte_tcp_hdr *tcphdr, int tcplen);
     int tcpEnqueueRecvbuffer(struct TcpStream *stream, struct rte_tcp_hdr *tcphdr, int tcplen);
@@ -21,10 +47,23 @@ public:
     int tcpHandleCloseWait(struct TcpStream *stream, struct rte_tcp_hdr *tcphdr);
     int tcpHandleLastAck(struct TcpStream *ts, struct rte_tcp_hdr *tcphdr);
     int tcpOut(struct rte_mempool *mbufPool);
+    /**
+     * @brief 对找不到TCP流的报文回复RST,原地改写入站报文后放入输出环,受ICMP差错限速约束
+     * @param mbuf 入站报文,函数内发送或释放
+     * @param out 输出环
+     * @return 发送RST返回0,被过滤或限速返回-1
+     */
+    int tcpSendReset(struct rte_mbuf *mbuf, struct rte_ring *out);
+    /**
+     * @brief tcpSendReset的IPv6版本,按源地址的折叠值限速
+     */
+    int tcpSendReset6(struct rte_mbuf *mbuf, struct rte_ring *out);
     struct rte_mbuf *TcpPkt(struct rte_mempool *mbuf_pool, uint32_t sip, uint32_t dip,
-                            uint8_t *srcmac, uint8_t *dstmac, struct TcpFragment *fragment);
+                            uint8_t *srcmac, uint8_t *dstmac, struct TcpFragment *fragment, uint8_t tos);
     int encodeTcpApppkt(uint8_t *msg, uint32_t sip, uint32_t dip,
-                        uint8_t *srcmac, uint8_t *dstmac, struct TcpFragment *fragment);
+                        uint8_t *srcmac, uint8_t *dstmac, struct TcpFragment *fragment, uint8_t tos);
+    int encodeTcp6Apppkt(uint8_t *msg, const uint8_t *sip, const uint8_t *dip,
+                         uint8_t *srcmac, uint8_t *dstmac, struct TcpFragment *fragment, uint8_t tos);
     int setNextProcessor(std::shared_ptr<Processor> nextProcessor);
 
 private:
@@ -34,6 +73,11 @@ private:
     TcpProcessor &operator=(const TcpProcessor &) = delete;
     TcpProcessor(TcpProcessor &&) = delete;
     TcpProcessor &operator=(TcpProcessor &&) = delete;
+
+    /**
+     * @brief 发送一个IPv6报文段,下一跳MAC未知时交给邻居发现模块缓存
+     */
+    void tcp6Out(struct rte_mempool *mbufPool, struct rte_ring *out, struct TcpStream *stream, struct TcpFragment *fragment);
 };
 
 #endif
\ No newline at end of file
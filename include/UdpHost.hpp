@@ -3,9 +3,20 @@
 #include <cstdint>
 #include <rte_mbuf.h>
 #include <rte_ethdev.h>
-#include <list>
+#include <rte_malloc.h>
+#include <rte_rcu_qsbr.h>
+#include <rte_mbuf_dyn.h>
+#include <sys/uio.h>
+#include <atomic>
 #include <mutex>
 #include "BaseNetwork.hpp"
+#include "Arp.hpp"
+#include "Route.hpp"
+#include "Pmtu.hpp"
+#include "Ipv6.hpp"
+
+#define UDP_MAX_MEMBERSHIPS 20 ///< 单个socket最多加入的组播组数量,与Linux的IP_MAX_MEMBERSHIPS相同
+#define UDP_DEMUX_BUCKETS 4096 ///< 分用哈希表的桶数量,必须是2的幂
 
 struct UdpHost
 {
@@ -18,6 +29,19 @@ struct UdpHost
     struct rte_ring *rcvbuf;              ///< 接收缓冲区
     pthread_cond_t cond;                  ///< 条件变量，用于线程间同步
     pthread_mutex_t mutex;                ///< 互斥锁，用于保护条件变量
+    ArpCacheEntry arpCache;               ///< 最近一个对端的MAC地址缓存,只由udpOut访问
+    RouteCacheEntry routeCache;           ///< 最近一个对端的路由缓存,只由udpOut访问
+    int family;                           ///< 地址族,AF_INET或AF_INET6
+    uint8_t localIp6[IPV6_ADDR_LEN];      ///< 本地IPv6地址,全0表示任意地址
+    Nd6CacheEntry nd6Cache;               ///< 最近一个IPv6对端的下一跳MAC地址缓存,只由udpOut访问
+    PmtuCacheEntry pmtuCache;             ///< 最近一个对端的PMTU缓存,只由udpOut访问
+    uint32_t mcastGroups[UDP_MAX_MEMBERSHIPS]; ///< 加入的组播组,网络字节序
+    uint16_t mcastIfs[UDP_MAX_MEMBERSHIPS];    ///< 每个组播组加入的接口
+    unsigned nbMcast;                          ///< 加入的组播组数量
+    uint8_t tos;                               ///< 发送报文的服务类型字节(DSCP),由IP_TOS/IPV6_TCLASS设置
+    bool bound;                                ///< 是否已绑定并加入分用哈希表
+    std::atomic<UdpHost *> demuxNext;          ///< 分用哈希表同一个桶中的下一个socket
+    std::atomic<uint64_t> rcvDrops;            ///< 接收缓冲区满时丢弃的数据报数量,包括读了一部分后放不回去的
 };
 
 struct offload
@@ -29,8 +53,51 @@ struct offload
     int protocol;        ///< 协议类型(
     unsigned char *data; ///< 数据区
     uint16_t length;     ///< 数据包长度
+    int family;          ///< 地址族,AF_INET6时地址在sip6/dip6中
+    uint8_t sip6[IPV6_ADDR_LEN]; ///< IPv6源地址
+    uint8_t dip6[IPV6_ADDR_LEN]; ///< IPv6目的地址
+    uint8_t tos;         ///< 发送报文的服务类型字节
+    struct rte_mbuf *mbuf; ///< 接收的数据报:非空时data指向该mbuf中的负载,数据报读完后释放一个引用;为空时data由rte_malloc分配
+};
+
+/**
+ * @brief 零拷贝接收模式下数据报的元数据,保存在mbuf的动态字段中
+ *
+ * 放入接收队列的mbuf已经去掉了报文头部和填充,数据区就是UDP负载。
+ */
+struct UdpRxMeta
+{
+    union
+    {
+        uint32_t sip;                ///< IPv4源地址
+        uint8_t sip6[IPV6_ADDR_LEN]; ///< IPv6源地址
+    };
+    uint16_t sport;    ///< 源端口
+    uint16_t consumed; ///< 已被nrecvfrom读走的负载长度
+    uint8_t family;    ///< 地址族
 };
 
+/**
+ * @brief 释放接收队列中的数据报
+ */
+static inline void rxOffloadFree(struct offload *ol)
+{
+    if (ol->mbuf != nullptr)
+        rte_pktmbuf_free(ol->mbuf);
+    else
+        rte_free(ol->data);
+    rte_free(ol);
+}
+
+/**
+ * @brief UDP socket管理,单例模式
+ *
+ * 接收报文按(本地地址, 端口)在分用哈希表中查找socket,精确绑定的地址优先,其次是通配地址;
+ * 文件描述符直接索引socket数组。两者的查询都不加锁,修改在_mutex保护下进行,
+ * 链表指针用release写入,读者总能看到完整的socket。
+ * 工作核在每轮循环开始时报告一次静止状态(QSBR),关闭socket时先从两张表中摘除,
+ * 等所有工作核都经过静止状态后再释放,工作核持有的socket指针在处理完当前这批报文之前一直有效。
+ */
 class UdpServerManager : public BaseNetwork
 {
 public:
@@ -42,6 +109,64 @@ public:
         static UdpServerManager instance;
         return instance;
     }
+    /**
+     * @brief  创建工作核使用的QSBR变量,必须在工作核启动前调用
+     * @param  nbReaders 工作核数量,工作核编号作为读者编号
+     * @return 0 成功；-1 失败
+     */
+    int initRcu(unsigned nbReaders);
+    /**
+     * @brief  打开零拷贝接收：接收队列直接存放 mbuf，源地址写入 mbuf 的动态字段，必须在创建 socket 和工作核启动前调用
+     * @return 0 成功；-1 注册动态字段失败
+     * @note   排队的数据报占用接收 mbuf，读取慢的应用可能耗尽 mbuf 内存池
+     */
+    int enableRxZeroCopy();
+    bool isRxZeroCopy() const { return _rxZeroCopy; }
+    /**
+     * @brief  零拷贝接收模式下 mbuf 中的数据报元数据
+     */
+    UdpRxMeta *rxMeta(struct rte_mbuf *mbuf) const { return RTE_MBUF_DYNFIELD(mbuf, _rxMetaOffset, UdpRxMeta *); }
+    /**
+     * @brief  释放接收队列中的一项，零拷贝接收模式下为 mbuf，否则为 offload
+     */
+    void freeRxEntry(void *entry) const
+    {
+        if (_rxZeroCopy)
+            rte_pktmbuf_free((struct rte_mbuf *)entry);
+        else
+            rxOffloadFree((struct offload *)entry);
+    }
+    /**
+     * @brief  工作核启动时注册为读者
+     * @param  readerId 工作核编号
+     */
+    void registerReader(unsigned readerId)
+    {
+        if (_rcu == nullptr)
+            return;
+        rte_rcu_qsbr_thread_register(_rcu, readerId);
+        rte_rcu_qsbr_thread_online(_rcu, readerId);
+    }
+    /**
+     * @brief  工作核退出前注销读者
+     * @param  readerId 工作核编号
+     */
+    void unregisterReader(unsigned readerId)
+    {
+        if (_rcu == nullptr)
+            return;
+        rte_rcu_qsbr_thread_offline(_rcu, readerId);
+        rte_rcu_qsbr_thread_unregister(_rcu, readerId);
+    }
+    /**
+     * @brief  工作核报告静止状态,调用时不能持有任何socket指针
+     * @param  readerId 工作核编号
+     */
+    void quiescent(unsigned readerId)
+    {
+        if (_rcu != nullptr)
+            rte_rcu_qsbr_quiescent(_rcu, readerId);
+    }
     /**
      * @brief  根据本地 IP+端口+协议 查找 UdpHost
      * @param  dip   本地 IPv4（网络字节序）
@@ -50,9 +175,17 @@ public:
      * @return 指针；未找到返回 nullptr
      */
     struct UdpHost *getHostInfoFromIpAndPort(uint32_t dip, uint16_t port, uint8_t proto);
+    /**
+     * @brief  根据本地 IPv6+端口+协议 查找 UdpHost,规则与 getHostInfoFromIpAndPort 相同
+     * @param  dip   本地 IPv6 地址
+     * @param  port  本地端口（网络字节序）
+     * @param  proto 协议号，如 IPPROTO_UDP
+     * @return 指针；未找到返回 nullptr
+     */
+    struct UdpHost *getHostInfoFromIp6AndPort(const uint8_t *dip, uint16_t port, uint8_t proto);
     /**
      * @brief  创建 UDP socket
-     * @param  domain   协议族，仅支持 AF_INET
+     * @param  domain   协议族，AF_INET 或 AF_INET6
      * @param  type     套接字类型，仅支持 SOCK_DGRAM
      * @param  protocol 传输层协议号，当前忽略（固定为 IPPROTO_UDP）
      * @return 成功返回 fd（≥ 0）；失败返回 -1
@@ -63,7 +196,7 @@ public:
     /**
      * @brief  绑定本地地址
      * @param  sockfd 由 nsocket 返回的 fd
-     * @param  addr   本地 IPv4+端口（sockaddr_in）
+     * @param  addr   本地地址+端口（AF_INET6 socket 为 sockaddr_in6，否则为 sockaddr_in）
      * @param  addrlen 地址长度，当前忽略
      * @return 0 成功；-1 失败（fd 不存在或已绑定）
      */
@@ -75,30 +208,74 @@ public:
      * @param  buf      用户缓冲区
      * @param  len      缓冲区长度
      * @param  flags    标志位，当前忽略
-     * @param  src_addr 输出：对端地址（sockaddr_in）
+     * @param  src_addr 输出：对端地址（sockaddr_in 或 sockaddr_in6）
      * @param  addrlen  输入/输出：地址长度，当前忽略
      * @return 实际拷贝字节数；<0 表示错误
-     * @note   若用户缓冲区小于数据报，则剩余部分重新入队，下次返回
+     * @note   若用户缓冲区小于数据报，则剩余部分重新入队，下次返回；零拷贝接收模式下直接从 mbuf 拷贝，不分配内存
      */
     ssize_t nrecvfrom(int sockfd, void *buf, size_t len, __attribute__((unused)) int flags, struct sockaddr *src_addr, __attribute__((unused)) socklen_t *addrlen);
+    /**
+     * @brief  零拷贝接收数据报，负载留在接收 mbuf 中，需要开启 UDP_RX_ZERO_COPY
+     * @param  sockfd   本地 socket
+     * @param  iov      输出：负载所在的内存段，重组的数据报可能由多个分段组成
+     * @param  iovcnt   输入 iov 的容量，输出使用的段数
+     * @param  src_addr 输出：对端地址（sockaddr_in 或 sockaddr_in6）
+     * @param  addrlen  输入/输出：地址长度，当前忽略
+     * @param  handle   输出：数据报句柄，读完负载后交给 nrecvfree 释放
+     * @return 负载长度；<0 表示错误，iov 容量不足时设置 EMSGSIZE 并丢弃该数据报
+     * @note   之前被 nrecvfrom 读走一部分的数据报只返回剩余的负载
+     */
+    ssize_t nrecvfromzc(int sockfd, struct iovec *iov, int *iovcnt, struct sockaddr *src_addr, __attribute__((unused)) socklen_t *addrlen, void **handle);
+    /**
+     * @brief  释放 nrecvfromzc 返回的数据报，之后 iov 指向的内存不再有效
+     * @param  handle nrecvfromzc 输出的句柄
+     * @return 0 成功；-1 失败
+     */
+    int nrecvfree(void *handle);
     /**
      * @brief  发送数据报
      * @param  sockfd   本地 socket
      * @param  buf      待发送数据
      * @param  len      数据长度
      * @param  flags    标志位，当前忽略
-     * @param  dest_addr 对端地址（sockaddr_in）
+     * @param  dest_addr 对端地址（sockaddr_in 或 sockaddr_in6）
      * @param  addrlen   地址长度，当前忽略
      * @return 实际入队字节数；<0 表示错误
      * @note   仅将 offload 放入 sndbuf
      */
     ssize_t nsendto(int sockfd, const void *buf, size_t len, __attribute__((unused)) int flags, const struct sockaddr *dest_addr, __attribute__((unused)) socklen_t addrlen);
 
+    /**
+     * @brief  设置 socket 选项，支持 IPPROTO_IP 层的 IP_ADD_MEMBERSHIP、IP_DROP_MEMBERSHIP、IP_TOS
+     *         以及 IPPROTO_IPV6 层的 IPV6_TCLASS
+     * @param  sockfd  本地 socket，组播选项和 IP_TOS 要求 AF_INET，IPV6_TCLASS 要求 AF_INET6
+     * @param  level   选项所在的协议层
+     * @param  optname 选项名
+     * @param  optval  组播选项为 struct ip_mreq，imr_interface 为 INADDR_ANY 时使用物理端口，否则使用该本机地址所在的接口；
+     *                 IP_TOS/IPV6_TCLASS 为 int，低两位 ECN 被忽略
+     * @param  optlen  选项长度
+     * @return 0 成功；-1 失败并设置 errno
+     */
+    int nsetsockopt(int sockfd, int level, int optname, const void *optval, socklen_t optlen);
+
+    /**
+     * @brief  查找应当收到组播数据报的 socket：绑定到该端口、本地地址为 INADDR_ANY 或组地址，
+     *         并且在接收接口上加入了该组（与 Linux 的 IP_MULTICAST_ALL=0 相同）
+     * @param  group   组地址（网络字节序）
+     * @param  ifIndex 接收接口
+     * @param  port    目的端口（网络字节序）
+     * @param  hosts   输出：匹配的 socket
+     * @param  max     hosts 的容量
+     * @return 匹配的数量
+     */
+    unsigned getMcastHosts(uint32_t group, uint16_t ifIndex, uint16_t port, UdpHost **hosts, unsigned max);
+
     /**
      * @brief  关闭 socket 并释放资源
      * @param  fd 要关闭的 fd
      * @return 0 成功；-1 失败（fd 不存在）
-     * @note   会自动从 _udpHostList 移除、释放 rte_ring 与 UdpHost 内存
+     * @note   先从分用哈希表和 fd 表摘除并等待工作核的宽限期，再离开加入的组播组、释放未读的数据报、rte_ring 与 UdpHost 内存；
+     *         会阻塞，不能在工作核上调用
      */
     int nclose(int fd);
 
@@ -110,16 +287,18 @@ public:
      */
     int udpServer(__attribute__((unused)) void *arg);
     /**
-     * @brief  获取整个 UDP 主机列表（调试用）
-     * @return 引用，外部只读访问；写操作需自行加锁
-     */
-    std::list<UdpHost *> &getUdpHostList();
-    /**
-     * @brief  根据 fd 查找 UdpHost
+     * @brief  根据 fd 查找 UdpHost，不加锁
      * @param  fd socket 描述符
      * @return 指针；未找到返回 nullptr
      */
-    UdpHost *getHostInfoFromFd(int fd);
+    UdpHost *getHostInfoFromFd(int fd) const
+    {
+        return fd >= 0 && fd < MAX_FD_COUNT ? _fdHosts[fd].load(std::memory_order_acquire) : nullptr;
+    }
+    /**
+     * @brief  已分配过的最大 fd 加一，遍历所有 socket 时 fd 不需要超过该值
+     */
+    int getFdEnd() const { return _fdEnd.load(std::memory_order_acquire); }
     /**
      * @brief  从管理列表移除并释放指定 host
      * @param  host 必须是由本管理器创建的指针
@@ -135,9 +314,40 @@ private:
     UdpServerManager(UdpServerManager &&) = delete;
     UdpServerManager &operator=(UdpServerManager &&) = delete;
 
+    /**
+     * @brief  阻塞直到接收队列中有数据报，取出一项
+     */
+    void *waitRx(UdpHost *host);
+    /**
+     * @brief  把零拷贝接收的数据报的源地址写入 sockaddr_in 或 sockaddr_in6
+     */
+    static void writeSrcAddr(const UdpRxMeta *meta, struct sockaddr *src_addr);
+    /**
+     * @brief  地址和端口所在的分用哈希桶
+     * @param  addr AF_INET 时为 uint32_t 地址，AF_INET6 时为16字节地址
+     */
+    static uint32_t demuxBucket(int family, const void *addr, uint16_t port);
+    /**
+     * @brief  在一个哈希桶中查找绑定到该地址和端口的 socket，不加锁
+     */
+    UdpHost *demuxLookup(int family, const void *addr, uint16_t port, uint8_t proto) const;
+    /**
+     * @brief  把已绑定的 socket 加入分用哈希表的桶尾，调用者需要持有_mutex
+     */
+    void demuxInsertLocked(UdpHost *host);
+    /**
+     * @brief  把 socket 从分用哈希表中摘除，调用者需要持有_mutex
+     */
+    void demuxRemoveLocked(UdpHost *host);
+
 private:
-    std::list<UdpHost *> _udpHostList; ///< 所有存活 UdpHost
-    std::mutex _mutex;                 ///< 保护 _udpHostList
+    std::atomic<UdpHost *> _demux[UDP_DEMUX_BUCKETS] = {}; ///< 分用哈希表,每个桶是一个单向链表
+    std::atomic<UdpHost *> _fdHosts[MAX_FD_COUNT] = {};    ///< 按fd索引的socket
+    std::atomic<int> _fdEnd{0};                            ///< 已分配过的最大fd加一
+    struct rte_rcu_qsbr *_rcu = nullptr;                   ///< 工作核的QSBR变量,释放socket前等待宽限期
+    bool _rxZeroCopy = false;                              ///< 接收队列是否直接存放mbuf
+    int _rxMetaOffset = -1;                                ///< 数据报元数据动态字段的偏移
+    std::mutex _mutex;                                     ///< 串行化两张表的修改和组播成员关系的读写
 };
 
 #endif
\ No newline at end of file
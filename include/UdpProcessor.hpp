@@ -6,6 +6,10 @@
 #include "UdpHost.hpp"
 #include <mutex>
 
+#define UDP_MAX_PAYLOAD 65507 ///< 单个UDP数据报的最大负载(65535 - IP头 - UDP头)
+#define UDP_MAX_FRAGMENTS 160 ///< 单个数据报最多切分的分片数量,最小PMTU经VXLAN封装后最大数据报需要137片
+#define UDP_MCAST_MAX_FANOUT 64 ///< 一个组播数据报最多交给的socket数量
+
 class UdpProcessor : public Processor
 {
 public:
@@ -14,10 +18,50 @@ public:
         static UdpProcessor instance;
         return instance;
     }
+    /**
+     * @brief 处理收到的UDP报文
+     * @return 成功返回0;没有监听该端口时返回-3,此时报文不会被释放
+     */
     int udpProcess(struct rte_mbuf *udpMbuf);
+    /**
+     * @brief 处理发往已加入组播组的UDP报文,交给所有订阅了该组的socket,函数内总是释放报文
+     *
+     * 单段报文不拷贝负载:每个socket的offload指向mbuf中的负载并持有mbuf的一个引用。
+     * 零拷贝接收模式下其余socket各得到一个克隆的间接mbuf。
+     * @return 收到数据报的socket数量
+     */
+    int udpMcastProcess(struct rte_mbuf *udpMbuf);
+    /**
+     * @brief 处理收到的IPv6 UDP报文,函数内总是释放报文
+     * @return 成功返回0;校验失败返回-1;没有监听该端口时返回-3
+     */
+    int udp6Process(struct rte_mbuf *udpMbuf);
     int udpOut(struct rte_mempool *mbuf_pool);
-    struct rte_mbuf *udpPkt(struct rte_mempool *mbuf_pool, uint32_t srcIp, uint32_t dstIp, uint16_t srcPort, uint16_t dstPort, uint8_t *srcMac, uint8_t *dstMac, uint8_t *data, uint16_t length);
-    int encodeUdpApppkt(uint8_t *msg, uint32_t srcIp, uint32_t dstIp, uint16_t srcPort, uint16_t dstPort, uint8_t *srcMac, uint8_t *dstMac, unsigned char *data, uint16_t total_len);
+    struct rte_mbuf *udpPkt(struct rte_mempool *mbuf_pool, uint32_t srcIp, uint32_t dstIp, uint16_t srcPort, uint16_t dstPort, uint8_t *srcMac, uint8_t *dstMac, uint8_t *data, uint16_t length, uint8_t tos);
+    /**
+     * @brief 构造超过路径MTU的UDP数据报并切分成IPv4分片
+     *
+     * 数据报先写入一条不带以太网头的mbuf链,再由rte_ipv4_fragment_packet切分:
+     * 每个分片只分配一个存放头部的直接mbuf,负载通过间接mbuf引用原数据报,不再拷贝。
+     * @param mbuf_pool 直接mbuf使用的内存池
+     * @param ol 待发送的数据报
+     * @param srcMac 源MAC地址
+     * @param dstMac 目的MAC地址
+     * @param mtu 到目的地址的路径MTU
+     * @param frags 输出参数,分片数组,容量为UDP_MAX_FRAGMENTS
+     * @return 分片数量,失败返回0
+     */
+    unsigned udpFragmentPkt(struct rte_mempool *mbuf_pool, struct offload *ol, uint8_t *srcMac, uint8_t *dstMac,
+                            uint16_t mtu, struct rte_mbuf **frags);
+    /**
+     * @brief 设置分片使用的间接mbuf内存池,必须在工作核启动前调用
+     */
+    void setIndirectPool(struct rte_mempool *indirectPool) { _indirectPool = indirectPool; }
+    /**
+     * @brief 构造IPv6 UDP报文,长度已在nsendto中按链路MTU检查过
+     */
+    struct rte_mbuf *udp6Pkt(struct rte_mempool *mbuf_pool, struct offload *ol, uint8_t *srcMac, uint8_t *dstMac);
+    int encodeUdpApppkt(uint8_t *msg, uint32_t srcIp, uint32_t dstIp, uint16_t srcPort, uint16_t dstPort, uint8_t *srcMac, uint8_t *dstMac, unsigned char *data, uint16_t total_len, uint8_t tos);
     int setNextProcessor(std::shared_ptr<Processor> nextProcessor);
 
 private:
@@ -28,8 +72,35 @@ private:
     UdpProcessor(UdpProcessor &&) = delete;
     UdpProcessor &operator=(UdpProcessor &&) = delete;
 
+    /**
+     * @brief 发送一个IPv6数据报,下一跳MAC未知时交给邻居发现模块缓存
+     */
+    void udp6Out(struct rte_mempool *mbuf_pool, struct rte_ring *out, UdpHost *host, struct offload *ol);
+
+    /**
+     * @brief 把接收的IPv4数据报的负载拷贝到新分配的offload中,不释放报文
+     * @return 失败返回nullptr
+     */
+    struct offload *copyRxDatagram(struct rte_mbuf *udpMbuf, const struct rte_ipv4_hdr *iphdr, const struct rte_udp_hdr *udphdr);
+
+    /**
+     * @brief 零拷贝接收模式:源地址写入动态字段,去掉报文头部和以太网填充,使mbuf的数据区正好是负载
+     * @param payload 负载的起始地址,位于第一个分段
+     * @param payloadLen 负载长度
+     * @return 成功返回0;失败返回-1,不释放报文
+     */
+    int prepareRxMbuf(struct rte_mbuf *mbuf, int family, const void *sip, uint16_t sport, const uint8_t *payload, uint16_t payloadLen);
+
+    /**
+     * @brief 把数据报放入socket的接收队列并唤醒等待的nrecvfrom,队列已满时丢弃
+     * @param entry 零拷贝接收模式下为mbuf,否则为offload
+     */
+    void deliver(UdpHost *host, void *entry);
+
 private:
     std::shared_ptr<Processor> _nextProcessor; ///< 下一个处理器
+    struct rte_mempool *_indirectPool = nullptr; ///< 分片负载使用的间接mbuf内存池
+    uint16_t _ipId = 0;                        ///< 分片数据报的IP标识,只由0号工作核访问
 };
 
 #endif
\ No newline at end of file
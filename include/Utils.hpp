@@ -6,4 +6,19 @@
 string convert_uint32_to_ip(uint32_t ip);
 std::string sockaddr_in_to_string(const struct sockaddr_in &addr);
 std::string macAddressToString(const uint8_t *mac, size_t length);
+
+/**
+ * @brief 按RFC 1624增量更新校验和: HC' = ~(~HC + ~m + m')
+ * @param cksum 原校验和
+ * @param oldWord 被修改的16位字的旧值,与校验和使用相同的字节序
+ * @param newWord 被修改的16位字的新值
+ * @return 新的校验和
+ */
+static inline uint16_t checksumAdjust(uint16_t cksum, uint16_t oldWord, uint16_t newWord)
+{
+    uint32_t sum = (uint16_t)~cksum + (uint16_t)~oldWord + (uint32_t)newWord;
+    sum = (sum & 0xffff) + (sum >> 16);
+    sum = (sum & 0xffff) + (sum >> 16);
+    return (uint16_t)~sum;
+}
 #endif  
\ No newline at end of file
@@ -0,0 +1,155 @@
+#ifndef VLAN_HPP
+#define VLAN_HPP
+#include <rte_mbuf.h>
+#include <cstdint>
+#include <string>
+#include <vector>
+#include <utility>
+#include "LocalAddr.hpp"
+
+#define VLAN_ID_COUNT 4096                                 ///< 802.1Q VLAN ID的取值数量
+#define VLAN_ID_MASK 0x0FFF                                ///< TCI中VLAN ID所在的位
+#define VLAN_IF_BASE 16                                    ///< VLAN子接口编号的起始值,小于它的编号属于物理端口
+#define VLAN_MAX_IFS 16                                    ///< 最多的VLAN子接口数量
+#define VLAN_IF_NONE 0xFFFF                                ///< 没有配置的VLAN
+
+/**
+ * @brief 802.1Q VLAN子接口表,单例模式
+ *
+ * 每个VLAN子接口有自己的接口编号,本机地址表和路由表中的"端口"就是这个编号,
+ * 因此子接口拥有独立的地址、直连路由和ARP应答范围。
+ * 报文所属的接口记录在mbuf->port中,接收时是接收接口,发送时是出接口。
+ * 标签只保存在mbuf的vlan_tci和ol_flags中,协议模块看到的始终是不带标签的以太网头:
+ * 主核收包时网卡没有剥离的标签由软件剥离,发包时网卡不支持插入的标签由软件插入,
+ * 两者都只移动12字节的MAC地址,不移动负载。
+ * 子接口在启动时配置,之后表只读,查询不加锁。
+ */
+class VlanTable
+{
+public:
+    static VlanTable &getInstance()
+    {
+        static VlanTable instance;
+        return instance;
+    }
+
+    /**
+     * @brief 记录物理端口和网卡的VLAN卸载能力,必须在添加子接口之前调用
+     * @param portId 物理端口,必须小于VLAN_IF_BASE
+     * @param hwStrip 网卡是否剥离接收报文的标签
+     * @param hwInsert 网卡是否为发送报文插入标签
+     * @return 成功返回0,端口号冲突返回-1
+     */
+    int init(uint16_t portId, bool hwStrip, bool hwInsert);
+
+    /**
+     * @brief 添加VLAN子接口:分配接口编号,把地址加入本机地址表并添加直连路由
+     * @param vlanId VLAN ID,范围[1, 4094]
+     * @param cidr 子接口地址,格式为"地址/前缀长度"
+     * @return 接口编号,失败返回-1
+     */
+    int addVlan(uint16_t vlanId, const std::string &cidr);
+
+    /**
+     * @brief 添加配置文件中的子接口,非法的条目跳过
+     * @return 成功添加的数量
+     */
+    unsigned addVlans(const std::vector<std::pair<uint16_t, std::string>> &vlans);
+
+    /**
+     * @brief 是否配置了VLAN子接口
+     */
+    bool isEnabled() const { return _count > 0; }
+
+    /**
+     * @brief 列出物理端口和所有VLAN子接口的编号
+     */
+    std::vector<uint16_t> listIfs() const;
+
+    /**
+     * @brief 网卡是否支持插入标签,不支持时由主核在发送前插入
+     */
+    bool hasHwInsert() const { return _hwInsert; }
+
+    /**
+     * @brief 按标签计算报文的接收接口,不带标签的报文属于物理端口
+     * @return 接口编号,VLAN没有配置时返回VLAN_IF_NONE
+     */
+    uint16_t rxIf(const struct rte_mbuf *mbuf) const
+    {
+        if (!(mbuf->ol_flags & PKT_RX_VLAN_STRIPPED))
+            return _portId;
+        return _ifOfVlan[mbuf->vlan_tci & VLAN_ID_MASK];
+    }
+
+    /**
+     * @brief 记录报文的出接口并按出接口设置标签,物理端口发出的报文不带标签
+     */
+    void tagTx(struct rte_mbuf *mbuf, uint16_t ifIndex) const
+    {
+        mbuf->port = ifIndex;
+        uint16_t vlanId = ifIndex < LOCAL_ADDR_MAX_PORTS ? _vlanOfIf[ifIndex] : 0;
+        if (vlanId != 0)
+        {
+            mbuf->vlan_tci = vlanId;
+            mbuf->ol_flags |= PKT_TX_VLAN_PKT;
+        }
+    }
+
+    /**
+     * @brief 原地改写成应答的报文沿收到它的VLAN发回,同时清除接收时的其他卸载标志
+     */
+    static void reflect(struct rte_mbuf *mbuf)
+    {
+        mbuf->ol_flags = (mbuf->ol_flags & PKT_RX_VLAN_STRIPPED) ? PKT_TX_VLAN_PKT : 0;
+    }
+
+    /**
+     * @brief 新构造的应答报文从请求报文的接收接口发出,使用请求报文的标签
+     */
+    static void copyTag(struct rte_mbuf *out, const struct rte_mbuf *in)
+    {
+        out->port = in->port;
+        if (in->ol_flags & PKT_RX_VLAN_STRIPPED)
+        {
+            out->vlan_tci = in->vlan_tci;
+            out->ol_flags |= PKT_TX_VLAN_PKT;
+        }
+    }
+
+    /**
+     * @brief 主核收包后调用:剥离网卡没有剥离的标签,把接收接口写入mbuf->port,丢弃没有配置的VLAN的报文
+     * @return 剩下的报文数量,剩下的报文在数组前部
+     */
+    unsigned rxBurst(struct rte_mbuf **mbufs, unsigned nbPkts);
+
+    /**
+     * @brief 主核发包前调用:网卡不支持插入时为带标签的报文插入802.1Q头,失败的报文被释放
+     * @return 剩下的报文数量,剩下的报文在数组前部
+     */
+    unsigned txBurst(struct rte_mbuf **mbufs, unsigned nbPkts);
+
+    /**
+     * @brief 打印丢弃的报文数量
+     */
+    void dumpStats() const;
+
+private:
+    VlanTable();
+    ~VlanTable() = default;
+    VlanTable(const VlanTable &) = delete;
+    VlanTable &operator=(const VlanTable &) = delete;
+    VlanTable(VlanTable &&) = delete;
+    VlanTable &operator=(VlanTable &&) = delete;
+
+private:
+    uint16_t _portId = 0;                          ///< 物理端口
+    bool _hwInsert = false;                        ///< 网卡是否为发送报文插入标签
+    unsigned _count = 0;                           ///< 已配置的子接口数量
+    uint16_t _ifOfVlan[VLAN_ID_COUNT];             ///< VLAN ID到接口编号的映射,0号表示只带优先级的报文
+    uint16_t _vlanOfIf[LOCAL_ADDR_MAX_PORTS] = {}; ///< 接口编号到VLAN ID的映射,0表示不带标签
+    uint64_t _unknownDropped = 0;                  ///< 没有配置的VLAN的报文数量,只由主核修改
+    uint64_t _insertFailed = 0;                    ///< 软件插入标签失败的报文数量,只由主核修改
+};
+
+#endif
@@ -0,0 +1,179 @@
+#ifndef VXLAN_HPP
+#define VXLAN_HPP
+#include <rte_mbuf.h>
+#include <rte_ether.h>
+#include <rte_ip.h>
+#include <rte_udp.h>
+#include <cstdint>
+#include <string>
+#include <vector>
+#include <tuple>
+#include <atomic>
+#include "LocalAddr.hpp"
+#include "Route.hpp"
+#include "Arp.hpp"
+
+#define VXLAN_IF_BASE 32 ///< VXLAN隧道接口编号的起始值
+#define VXLAN_MAX_IFS 16 ///< 最多的隧道接口数量
+#define VXLAN_FLAG_VNI 0x08000000 ///< VXLAN头部的I标志,表示VNI有效(主机字节序)
+#define VXLAN_ENCAP_LEN (sizeof(struct rte_ether_hdr) + sizeof(struct rte_ipv4_hdr) + \
+                         sizeof(struct rte_udp_hdr) + sizeof(struct rte_vxlan_hdr)) ///< 外层封装的长度
+#define VXLAN_SRC_PORT_MIN 49152 ///< 外层UDP源端口的下限,RFC 7348建议使用动态端口范围
+
+static_assert(VXLAN_IF_BASE + VXLAN_MAX_IFS <= LOCAL_ADDR_MAX_PORTS, "VXLAN interfaces exceed LOCAL_ADDR_MAX_PORTS");
+
+/**
+ * @brief VXLAN隧道端点,单例模式
+ *
+ * 每个VNI对应一个隧道接口,接口编号从VXLAN_IF_BASE开始,与VLAN子接口一样拥有自己的地址、
+ * 直连路由和ARP应答范围。报文所属的接口记录在mbuf->port中。
+ * 解封装在工作核上进行:rte_pktmbuf_adj去掉外层头部后,内层帧交回协议分发,不拷贝负载。
+ * 封装在主核发送前进行:外层头部写入headroom,共享的mbuf则链接一个单独的头部mbuf。
+ * 外层按普通IPv4/UDP报文处理:IP校验和在网卡支持时由网卡计算,UDP校验和为0,内层校验和已由协议栈算好。
+ * 网卡识别出隧道时,接收报文的IP/L4校验和标志描述的是内层头部,内层报文可以继续使用这些标志。
+ * 隧道在启动时配置,之后表只读;每个隧道的路由和ARP缓存只由主核访问。
+ */
+class VxlanTunnel
+{
+public:
+    static VxlanTunnel &getInstance()
+    {
+        static VxlanTunnel instance;
+        return instance;
+    }
+
+    /**
+     * @brief 记录网卡是否能计算外层IPv4头部校验和,由端口初始化时调用
+     */
+    void setHwIpCksum(bool hwIpCksum) { _hwIpCksum = hwIpCksum; }
+
+    /**
+     * @brief 设置封装需要的参数,必须在添加隧道之前调用
+     * @param mbufPool 头部mbuf和ARP请求使用的内存池
+     * @param out 下一跳MAC未知时,解析完成后报文重新进入的输出环
+     * @param udpPort VXLAN使用的UDP端口
+     * @param linkMtu 物理链路的MTU
+     * @param srcMac 本机MAC地址
+     */
+    void init(struct rte_mempool *mbufPool, struct rte_ring *out, uint16_t udpPort, uint16_t linkMtu, const uint8_t *srcMac);
+
+    /**
+     * @brief 添加隧道:分配接口编号,把地址加入本机地址表并添加直连路由
+     * @param vni VXLAN网络标识,24位
+     * @param cidr 隧道接口地址,格式为"地址/前缀长度"
+     * @param remote 对端VTEP地址,点分十进制,只接受来自该地址的封装报文
+     * @return 接口编号,失败返回-1
+     */
+    int addTunnel(uint32_t vni, const std::string &cidr, const std::string &remote);
+
+    /**
+     * @brief 添加配置文件中的隧道,非法的条目跳过
+     * @param tunnels (VNI, 接口地址, 对端VTEP地址)
+     * @return 成功添加的数量
+     */
+    unsigned addTunnels(const std::vector<std::tuple<uint32_t, std::string, std::string>> &tunnels);
+
+    /**
+     * @brief 是否配置了隧道
+     */
+    bool isEnabled() const { return _count > 0; }
+
+    /**
+     * @brief VXLAN使用的UDP端口,网络字节序
+     */
+    uint16_t getUdpPort() const { return _udpPort; }
+
+    /**
+     * @brief 列出所有隧道接口的编号
+     */
+    std::vector<uint16_t> listIfs() const
+    {
+        std::vector<uint16_t> ifs;
+        for (unsigned i = 0; i < _count; i++)
+            ifs.push_back(VXLAN_IF_BASE + i);
+        return ifs;
+    }
+
+    /**
+     * @brief 接口是否是隧道接口
+     */
+    bool isTunnelIf(uint16_t ifIndex) const { return ifIndex >= VXLAN_IF_BASE && ifIndex < VXLAN_IF_BASE + _count; }
+
+    /**
+     * @brief 经过该接口发送时内层IP报文可用的MTU
+     * @param ifIndex 出接口
+     * @param mtu 不考虑隧道时的路径MTU
+     */
+    uint16_t ifMtu(uint16_t ifIndex, uint16_t mtu) const
+    {
+        return isTunnelIf(ifIndex) ? RTE_MIN(mtu, (uint16_t)(_linkMtu - VXLAN_ENCAP_LEN)) : mtu;
+    }
+
+    /**
+     * @brief 解封装发给本机VXLAN端口的报文,内层帧的接收接口为VNI对应的隧道接口
+     * @param mbuf 已经过IPv4校验的外层报文
+     * @return 成功返回0,mbuf指向内层帧;失败返回-1,报文已被释放
+     */
+    int decap(struct rte_mbuf *mbuf);
+
+    /**
+     * @brief 主核发包前调用:为出接口是隧道接口的报文加上外层封装
+     *
+     * 对端VTEP的MAC未知时报文交给ARP模块缓存,解析完成后以已封装的形式重新进入输出环。
+     * @return 可以立即发送的报文数量,这些报文在数组前部
+     */
+    unsigned encapBurst(struct rte_mbuf **mbufs, unsigned nbPkts);
+
+    /**
+     * @brief 打印隧道统计信息
+     */
+    void dumpStats() const;
+
+private:
+    VxlanTunnel() = default;
+    ~VxlanTunnel() = default;
+    VxlanTunnel(const VxlanTunnel &) = delete;
+    VxlanTunnel &operator=(const VxlanTunnel &) = delete;
+    VxlanTunnel(VxlanTunnel &&) = delete;
+    VxlanTunnel &operator=(VxlanTunnel &&) = delete;
+
+    struct Tunnel
+    {
+        uint32_t vni = 0;         ///< VXLAN网络标识,网络字节序并已左移8位,可以直接与vx_vni比较
+        uint32_t remote = 0;      ///< 对端VTEP地址
+        RouteCacheEntry route;    ///< 到对端VTEP的路由,只由主核访问
+        ArpCacheEntry arp;        ///< 外层下一跳的MAC,只由主核访问
+        uint64_t encapPkts = 0;   ///< 封装的报文数量,只由主核修改
+        std::atomic<uint64_t> decapPkts{0}; ///< 解封装的报文数量,由各工作核累加
+    };
+
+    /**
+     * @brief 按内层帧计算外层UDP源端口,同一条内层流使用相同的端口,对端可以据此做RSS
+     */
+    static uint16_t entropyPort(const struct rte_mbuf *mbuf);
+
+    /**
+     * @brief 写入外层头部
+     * @param hdr 外层头部的起始地址,长度为VXLAN_ENCAP_LEN
+     * @param innerLen 内层帧的长度
+     * @param tos 外层IP头部的服务类型字段
+     */
+    void writeOuter(uint8_t *hdr, const Tunnel &tunnel, uint32_t srcIp, uint16_t innerLen, uint16_t srcPort, uint8_t tos);
+
+private:
+    struct rte_mempool *_mbufPool = nullptr; ///< 头部mbuf使用的内存池
+    struct rte_ring *_out = nullptr;         ///< ARP解析完成后报文重新进入的输出环
+    uint16_t _udpPort = 0;                   ///< VXLAN的UDP端口,网络字节序
+    uint16_t _linkMtu = RTE_ETHER_MTU;       ///< 物理链路的MTU
+    uint8_t _srcMac[RTE_ETHER_ADDR_LEN] = {0}; ///< 本机MAC地址
+    bool _hwIpCksum = false;                 ///< 外层IPv4校验和是否由网卡计算
+    uint16_t _ipId = 0;                      ///< 外层IP标识,只由主核修改
+    unsigned _count = 0;                     ///< 已配置的隧道数量
+    Tunnel _tunnels[VXLAN_MAX_IFS];          ///< 按接口编号排列的隧道
+    std::atomic<uint64_t> _unknownVni{0};    ///< VNI或对端地址不匹配而丢弃的报文数量
+    uint64_t _oversize = 0;                  ///< 封装后超过链路MTU而丢弃的报文数量,只由主核修改
+    uint64_t _noRoute = 0;                   ///< 没有到对端VTEP的路由而丢弃的报文数量,只由主核修改
+    uint64_t _noMbuf = 0;                    ///< 分配头部mbuf失败而丢弃的报文数量,只由主核修改
+};
+
+#endif
@@ -1,8 +1,43 @@
 #include "Arp.hpp"
+#include <cstring>
+#include <vector>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 
-std::list<ArpHeader> ArpTable::_list;
+#define ARP_SNAPSHOT_MAGIC 0x53505241 ///< "ARPS"
+#define ARP_SNAPSHOT_VERSION 1
+
+/**
+ * @brief 快照文件头
+ */
+struct ArpSnapshotHeader
+{
+    uint32_t magic;
+    uint32_t version;
+    uint32_t count;
+    uint32_t reserved;
+};
+
+/**
+ * @brief 快照中的一个条目
+ */
+struct ArpSnapshotRecord
+{
+    uint32_t ip;
+    uint32_t reserved;
+    uint64_t hw;
+};
+
+ArpSlot ArpTable::_slots[ARP_TABLE_SIZE];
+atomic<uint32_t> ArpTable::_version{0};
+atomic<uint32_t> ArpTable::_generation{1};
+unsigned ArpTable::_count = 0;
+ArpTimers ArpTable::_timers;
+uint64_t ArpTable::_nowMs = 0;
 std::mutex ArpTable::_mutex;
-        
+
 bool ArpHeader::operator==(const ArpHeader &other) const
 {
     if (hardware_type != other.hardware_type)
@@ -22,45 +57,538 @@ ArpTable &ArpTable::getInstance()
     return _arpTable;
 }
 
+void ArpTable::setTimers(const ArpTimers &timers)
+{
+    lock_guard<mutex> lock(_mutex);
+    _timers = timers;
+}
+
+uint64_t ArpTable::packHw(const ArpHeader &arpHeader)
+{
+    uint64_t hw = 0;
+    memcpy(&hw, arpHeader.sender_hwaddr, RTE_ETHER_ADDR_LEN);
+    return hw | ((uint64_t)arpHeader.hardware_type << 48);
+}
+
+uint32_t ArpTable::readBegin()
+{
+    uint32_t version = _version.load(std::memory_order_acquire);
+    while (version & 1)
+    {
+        rte_pause();
+        version = _version.load(std::memory_order_acquire);
+    }
+    return version;
+}
+
+bool ArpTable::readRetry(uint32_t version)
+{
+    std::atomic_thread_fence(std::memory_order_acquire);
+    return _version.load(std::memory_order_relaxed) != version;
+}
+
+void ArpTable::writeBegin()
+{
+    _version.store(_version.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+}
+
+void ArpTable::writeEnd()
+{
+    _version.store(_version.load(std::memory_order_relaxed) + 1, std::memory_order_release);
+}
+
+int ArpTable::probe(uint32_t ip)
+{
+    const uint64_t key = makeKey(ip);
+    uint32_t idx = slotIndex(ip);
+    // 探测次数有上限,读者遇到并发修改时也不会死循环
+    for (unsigned i = 0; i < ARP_TABLE_SIZE; i++)
+    {
+        uint64_t k = _slots[idx].key.load(std::memory_order_relaxed);
+        if (k == 0)
+            return -1;
+        if (k == key)
+            return idx;
+        idx = (idx + 1) & (ARP_TABLE_SIZE - 1);
+    }
+    return -1;
+}
+
+int ArpTable::insertLocked(uint32_t ip, uint64_t hw, ARP_STATE state, uint64_t deadline)
+{
+    if (_count >= ARP_TABLE_MAX_ENTRIES)
+    {
+        SPDLOG_ERROR("ARP table is full, entries: {}", _count);
+        return -1;
+    }
+    uint32_t slot = slotIndex(ip);
+    while (_slots[slot].key.load(std::memory_order_relaxed) != 0)
+        slot = (slot + 1) & (ARP_TABLE_SIZE - 1);
+
+    writeBegin();
+    _slots[slot].hw.store(hw, std::memory_order_relaxed);
+    _slots[slot].used.store(0, std::memory_order_relaxed);
+    setState(_slots[slot], state, deadline);
+    _slots[slot].key.store(makeKey(ip), std::memory_order_relaxed);
+    writeEnd();
+    _count++;
+    return slot;
+}
+
+void ArpTable::eraseLocked(uint32_t idx)
+{
+    invalidateCaches();
+    // 向后搬移删除,不留墓碑,保证后续条目仍然能从各自的起始槽位探测到
+    uint32_t hole = idx;
+    uint32_t next = hole;
+    while (true)
+    {
+        next = (next + 1) & (ARP_TABLE_SIZE - 1);
+        uint64_t key = _slots[next].key.load(std::memory_order_relaxed);
+        if (key == 0)
+            break;
+        uint32_t home = slotIndex((uint32_t)key);
+        // home不在(hole, next]区间内时,该条目可以搬到hole
+        bool stay = hole <= next ? (hole < home && home <= next) : (hole < home || home <= next);
+        if (stay)
+            continue;
+        ArpSlot &dst = _slots[hole];
+        ArpSlot &src = _slots[next];
+        dst.hw.store(src.hw.load(std::memory_order_relaxed), std::memory_order_relaxed);
+        dst.state.store(src.state.load(std::memory_order_relaxed), std::memory_order_relaxed);
+        dst.used.store(src.used.load(std::memory_order_relaxed), std::memory_order_relaxed);
+        dst.probes = src.probes;
+        dst.deadline = src.deadline;
+        dst.key.store(key, std::memory_order_relaxed);
+        hole = next;
+    }
+    _slots[hole].key.store(0, std::memory_order_relaxed);
+    _count--;
+}
+
 int ArpTable::pushBack(ArpHeader arpHeader)
 {
     lock_guard<mutex> lock(_mutex);
-    _list.push_back(arpHeader);
+    const uint64_t hw = packHw(arpHeader);
+    const uint64_t deadline = _nowMs + _timers.reachableMs;
+
+    int idx = probe(arpHeader.sender_protoaddr);
+    if (idx < 0)
+        return insertLocked(arpHeader.sender_protoaddr, hw, ARP_STATE::ARP_STATE_REACHABLE, deadline) < 0 ? -1 : 0;
+
+    if (_slots[idx].state.load(std::memory_order_relaxed) == (uint8_t)ARP_STATE::ARP_STATE_PERMANENT)
+        return 0;
+
+    writeBegin();
+    if (_slots[idx].hw.load(std::memory_order_relaxed) != hw)
+        invalidateCaches();
+    _slots[idx].hw.store(hw, std::memory_order_relaxed);
+    setState(_slots[idx], ARP_STATE::ARP_STATE_REACHABLE, deadline);
+    writeEnd();
+    return 0;
+}
+
+int ArpTable::addStatic(ArpHeader arpHeader)
+{
+    lock_guard<mutex> lock(_mutex);
+    const uint64_t hw = packHw(arpHeader);
+
+    int idx = probe(arpHeader.sender_protoaddr);
+    if (idx < 0)
+        return insertLocked(arpHeader.sender_protoaddr, hw, ARP_STATE::ARP_STATE_PERMANENT, 0) < 0 ? -1 : 0;
+
+    writeBegin();
+    if (_slots[idx].hw.load(std::memory_order_relaxed) != hw)
+        invalidateCaches();
+    _slots[idx].hw.store(hw, std::memory_order_relaxed);
+    setState(_slots[idx], ARP_STATE::ARP_STATE_PERMANENT, 0);
+    writeEnd();
+    return 0;
+}
+
+int ArpTable::update(ArpHeader arpHeader)
+{
+    lock_guard<mutex> lock(_mutex);
+    const uint64_t hw = packHw(arpHeader);
+    const uint64_t deadline = _nowMs + _timers.staleGcMs;
+
+    int idx = probe(arpHeader.sender_protoaddr);
+    if (idx < 0)
+        return insertLocked(arpHeader.sender_protoaddr, hw, ARP_STATE::ARP_STATE_STALE, deadline) < 0 ? -1 : 0;
+
+    ArpSlot &slot = _slots[idx];
+    uint8_t state = slot.state.load(std::memory_order_relaxed);
+    if (state == (uint8_t)ARP_STATE::ARP_STATE_PERMANENT)
+        return 0;
+    if (state != (uint8_t)ARP_STATE::ARP_STATE_INCOMPLETE && slot.hw.load(std::memory_order_relaxed) == hw)
+        return 0;
+
+    writeBegin();
+    if (slot.hw.load(std::memory_order_relaxed) != hw)
+        invalidateCaches();
+    slot.hw.store(hw, std::memory_order_relaxed);
+    slot.used.store(0, std::memory_order_relaxed);
+    setState(slot, ARP_STATE::ARP_STATE_STALE, deadline);
+    writeEnd();
+    return 0;
+}
+
+int ArpTable::resolve(uint32_t dip)
+{
+    lock_guard<mutex> lock(_mutex);
+    if (probe(dip) >= 0)
+        return 1;
+    int idx = insertLocked(dip, 0, ARP_STATE::ARP_STATE_INCOMPLETE, _nowMs + _timers.retransMs);
+    if (idx < 0)
+        return -1;
+    _slots[idx].probes = 1;
     return 0;
 }
 
 int ArpTable::remove(const ArpHeader &arpHeader)
 {
     lock_guard<mutex> lock(_mutex);
+    int found = probe(arpHeader.sender_protoaddr);
+    if (found < 0 || _slots[found].hw.load(std::memory_order_relaxed) != packHw(arpHeader))
+        return -1;
+
+    writeBegin();
+    eraseLocked(found);
+    writeEnd();
+    return 0;
+}
+
+int ArpTable::clear()
+{
+    lock_guard<mutex> lock(_mutex);
+    writeBegin();
+    invalidateCaches();
+    for (auto &slot : _slots)
+    {
+        slot.key.store(0, std::memory_order_relaxed);
+        slot.hw.store(0, std::memory_order_relaxed);
+    }
+    writeEnd();
+    _count = 0;
+    return 0;
+}
+
+unsigned ArpTable::size()
+{
+    lock_guard<mutex> lock(_mutex);
+    return _count;
+}
+
+int ArpTable::getState(uint32_t dip)
+{
+    lock_guard<mutex> lock(_mutex);
+    int idx = probe(dip);
+    return idx < 0 ? -1 : _slots[idx].state.load(std::memory_order_relaxed);
+}
 
-    for (auto it = _list.begin(); it != _list.end();)
+int ArpTable::saveSnapshot(const std::string &path)
+{
+    std::vector<ArpSnapshotRecord> records;
     {
-        if (*it == arpHeader)
+        lock_guard<mutex> lock(_mutex);
+        for (auto &slot : _slots)
         {
-            it = _list.erase(it);
-            return 0;
+            uint64_t key = slot.key.load(std::memory_order_relaxed);
+            uint8_t state = slot.state.load(std::memory_order_relaxed);
+            if (key == 0 || state == (uint8_t)ARP_STATE::ARP_STATE_INCOMPLETE || state == (uint8_t)ARP_STATE::ARP_STATE_PERMANENT)
+                continue;
+            records.push_back({(uint32_t)key, 0, slot.hw.load(std::memory_order_relaxed)});
         }
-        ++it;
     }
-    return -1;
+
+    size_t size = sizeof(ArpSnapshotHeader) + records.size() * sizeof(ArpSnapshotRecord);
+    int fd = open(path.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0)
+    {
+        SPDLOG_ERROR("Failed to open ARP snapshot {}", path);
+        return -1;
+    }
+    if (ftruncate(fd, size) < 0)
+    {
+        SPDLOG_ERROR("Failed to resize ARP snapshot {}", path);
+        close(fd);
+        return -1;
+    }
+    void *addr = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (addr == MAP_FAILED)
+    {
+        SPDLOG_ERROR("Failed to mmap ARP snapshot {}", path);
+        return -1;
+    }
+
+    ArpSnapshotHeader *header = (ArpSnapshotHeader *)addr;
+    header->magic = ARP_SNAPSHOT_MAGIC;
+    header->version = ARP_SNAPSHOT_VERSION;
+    header->count = records.size();
+    header->reserved = 0;
+    if (!records.empty())
+        memcpy(header + 1, records.data(), records.size() * sizeof(ArpSnapshotRecord));
+    msync(addr, size, MS_SYNC);
+    munmap(addr, size);
+    SPDLOG_INFO("Saved {} ARP entries to {}", records.size(), path);
+    return records.size();
 }
 
-int ArpTable::clear()
+int ArpTable::loadSnapshot(const std::string &path)
 {
-    lock_guard<mutex> lock(_mutex);
-    _list.clear();
-    return 0;
+    int fd = open(path.c_str(), O_RDONLY);
+    if (fd < 0)
+        return -1;
+    struct stat st;
+    if (fstat(fd, &st) < 0 || (size_t)st.st_size < sizeof(ArpSnapshotHeader))
+    {
+        close(fd);
+        return -1;
+    }
+    void *addr = mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (addr == MAP_FAILED)
+        return -1;
+
+    const ArpSnapshotHeader *header = (const ArpSnapshotHeader *)addr;
+    if (header->magic != ARP_SNAPSHOT_MAGIC || header->version != ARP_SNAPSHOT_VERSION ||
+        sizeof(ArpSnapshotHeader) + (size_t)header->count * sizeof(ArpSnapshotRecord) > (size_t)st.st_size)
+    {
+        SPDLOG_ERROR("Invalid ARP snapshot {}", path);
+        munmap(addr, st.st_size);
+        return -1;
+    }
+
+    // 快照中的地址可能已经过期,按STALE加载,首次使用时走DELAY/PROBE单播确认
+    const ArpSnapshotRecord *records = (const ArpSnapshotRecord *)(header + 1);
+    int loaded = 0;
+    {
+        lock_guard<mutex> lock(_mutex);
+        for (uint32_t i = 0; i < header->count; i++)
+        {
+            if (probe(records[i].ip) >= 0)
+                continue;
+            if (insertLocked(records[i].ip, records[i].hw, ARP_STATE::ARP_STATE_STALE, _nowMs + _timers.staleGcMs) < 0)
+                break;
+            loaded++;
+        }
+    }
+    munmap(addr, st.st_size);
+    SPDLOG_INFO("Loaded {} ARP entries from {}", loaded, path);
+    return loaded;
 }
 
-uint8_t *ArpTable::search(const uint32_t &dip)
+unsigned ArpTable::tick(uint64_t nowMs, ArpProbe *probes, unsigned maxProbes)
 {
     lock_guard<mutex> lock(_mutex);
-    for (auto &it : _list)
+    _nowMs = nowMs;
+    unsigned nbProbes = 0;
+    std::vector<uint32_t> expired;
+
+    auto emit = [&](uint32_t ip, uint64_t hw, bool unicast)
+    {
+        probes[nbProbes].ip = ip;
+        memcpy(probes[nbProbes].mac, &hw, RTE_ETHER_ADDR_LEN);
+        probes[nbProbes].unicast = unicast;
+        nbProbes++;
+    };
+
+    // 状态迁移不改变条目的位置和MAC地址,读者不需要重试,只有删除条目时才进入写临界区
+    for (uint32_t idx = 0; idx < ARP_TABLE_SIZE; idx++)
     {
-        if (it.sender_protoaddr == dip)
+        ArpSlot &slot = _slots[idx];
+        uint64_t key = slot.key.load(std::memory_order_relaxed);
+        if (key == 0)
+            continue;
+        uint32_t ip = (uint32_t)key;
+        uint64_t hw = slot.hw.load(std::memory_order_relaxed);
+
+        switch ((ARP_STATE)slot.state.load(std::memory_order_relaxed))
+        {
+        case ARP_STATE::ARP_STATE_REACHABLE:
+            if (nowMs >= slot.deadline)
+            {
+                slot.used.store(0, std::memory_order_relaxed);
+                setState(slot, ARP_STATE::ARP_STATE_STALE, nowMs + _timers.staleGcMs);
+            }
+            break;
+        case ARP_STATE::ARP_STATE_STALE:
+            if (slot.used.load(std::memory_order_relaxed))
+            {
+                slot.used.store(0, std::memory_order_relaxed);
+                setState(slot, ARP_STATE::ARP_STATE_DELAY, nowMs + _timers.delayMs);
+            }
+            else if (nowMs >= slot.deadline)
+            {
+                expired.push_back(ip);
+            }
+            break;
+        case ARP_STATE::ARP_STATE_DELAY:
+            if (nowMs >= slot.deadline && nbProbes < maxProbes)
+            {
+                setState(slot, ARP_STATE::ARP_STATE_PROBE, nowMs + _timers.retransMs);
+                slot.probes = 1;
+                emit(ip, hw, true);
+            }
+            break;
+        case ARP_STATE::ARP_STATE_PERMANENT:
+            break;
+        case ARP_STATE::ARP_STATE_PROBE:
+        case ARP_STATE::ARP_STATE_INCOMPLETE:
         {
-            return it.sender_hwaddr;
+            if (nowMs < slot.deadline)
+                break;
+            bool unicast = slot.state.load(std::memory_order_relaxed) == (uint8_t)ARP_STATE::ARP_STATE_PROBE;
+            uint32_t maxRetries = unicast ? _timers.ucastProbes : _timers.mcastProbes;
+            if (slot.probes >= maxRetries)
+            {
+                expired.push_back(ip);
+            }
+            else if (nbProbes < maxProbes)
+            {
+                // 单播确认按固定间隔重传,广播解析按指数退避,避免对不存在的地址持续广播
+                uint64_t interval = _timers.retransMs;
+                if (!unicast)
+                    interval = std::min(_timers.retransMs << slot.probes, _timers.retransMaxMs);
+                slot.probes++;
+                slot.deadline = nowMs + interval;
+                emit(ip, hw, unicast);
+            }
+            break;
         }
+        }
+    }
+
+    if (!expired.empty())
+    {
+        writeBegin();
+        for (uint32_t ip : expired)
+        {
+            int idx = probe(ip);
+            if (idx >= 0)
+                eraseLocked(idx);
+        }
+        writeEnd();
+    }
+    return nbProbes;
+}
+
+bool ArpTable::lookup(uint32_t dip, uint8_t *mac)
+{
+    uint64_t hw = 0;
+    bool found = false;
+    uint32_t version;
+    do
+    {
+        version = readBegin();
+        int idx = probe(dip);
+        found = idx >= 0 && _slots[idx].state.load(std::memory_order_relaxed) != (uint8_t)ARP_STATE::ARP_STATE_INCOMPLETE;
+        if (found)
+        {
+            hw = _slots[idx].hw.load(std::memory_order_relaxed);
+            // 只在未置位时写入,避免每次查找都弄脏缓存行
+            if (!_slots[idx].used.load(std::memory_order_relaxed))
+                _slots[idx].used.store(1, std::memory_order_relaxed);
+        }
+    } while (readRetry(version));
+
+    if (!found)
+        return false;
+    memcpy(mac, &hw, RTE_ETHER_ADDR_LEN);
+    return true;
+}
+
+uint64_t ArpTable::lookupBulk(const uint32_t *dips, unsigned nb, uint8_t (*macs)[RTE_ETHER_ADDR_LEN])
+{
+    nb = std::min(nb, (unsigned)ARP_BULK_MAX);
+    uint64_t hws[ARP_BULK_MAX];
+    uint64_t hitMask = 0;
+    uint32_t version;
+    do
+    {
+        version = readBegin();
+        hitMask = 0;
+        for (unsigned i = 0; i < nb; i++)
+        {
+            int idx = probe(dips[i]);
+            if (idx < 0 || _slots[idx].state.load(std::memory_order_relaxed) == (uint8_t)ARP_STATE::ARP_STATE_INCOMPLETE)
+                continue;
+            hws[i] = _slots[idx].hw.load(std::memory_order_relaxed);
+            if (!_slots[idx].used.load(std::memory_order_relaxed))
+                _slots[idx].used.store(1, std::memory_order_relaxed);
+            hitMask |= 1ULL << i;
+        }
+    } while (readRetry(version));
+
+    for (unsigned i = 0; i < nb; i++)
+    {
+        if (hitMask & (1ULL << i))
+            memcpy(macs[i], &hws[i], RTE_ETHER_ADDR_LEN);
+    }
+    return hitMask;
+}
+
+uint64_t ArpTable::lookupBulkCached(const uint32_t *dips, unsigned nb, ArpCacheEntry **caches, uint8_t (*macs)[RTE_ETHER_ADDR_LEN])
+{
+    nb = std::min(nb, (unsigned)ARP_BULK_MAX);
+    uint64_t hitMask = 0;
+    uint64_t missMask = 0;
+    uint32_t generation = _generation.load(std::memory_order_acquire);
+    for (unsigned i = 0; i < nb; i++)
+    {
+        if (caches[i]->ip == dips[i] && caches[i]->generation == generation)
+        {
+            ArpSlot &slot = _slots[caches[i]->slot];
+            if (!slot.used.load(std::memory_order_relaxed))
+                slot.used.store(1, std::memory_order_relaxed);
+            if (&macs[i][0] != &caches[i]->mac[0])
+                memcpy(macs[i], caches[i]->mac, RTE_ETHER_ADDR_LEN);
+            hitMask |= 1ULL << i;
+        }
+        else
+        {
+            missMask |= 1ULL << i;
+        }
+    }
+    if (missMask == 0)
+        return hitMask;
+
+    uint64_t hws[ARP_BULK_MAX];
+    uint32_t slots[ARP_BULK_MAX];
+    uint64_t found = 0;
+    uint32_t version;
+    do
+    {
+        version = readBegin();
+        found = 0;
+        generation = _generation.load(std::memory_order_relaxed);
+        for (unsigned i = 0; i < nb; i++)
+        {
+            if (!(missMask & (1ULL << i)))
+                continue;
+            int idx = probe(dips[i]);
+            if (idx < 0 || _slots[idx].state.load(std::memory_order_relaxed) == (uint8_t)ARP_STATE::ARP_STATE_INCOMPLETE)
+                continue;
+            hws[i] = _slots[idx].hw.load(std::memory_order_relaxed);
+            slots[i] = idx;
+            if (!_slots[idx].used.load(std::memory_order_relaxed))
+                _slots[idx].used.store(1, std::memory_order_relaxed);
+            found |= 1ULL << i;
+        }
+    } while (readRetry(version));
+
+    for (unsigned i = 0; i < nb; i++)
+    {
+        if (!(found & (1ULL << i)))
+            continue;
+        memcpy(caches[i]->mac, &hws[i], RTE_ETHER_ADDR_LEN);
+        caches[i]->ip = dips[i];
+        caches[i]->slot = slots[i];
+        caches[i]->generation = generation;
+        if (&macs[i][0] != &caches[i]->mac[0])
+            memcpy(macs[i], caches[i]->mac, RTE_ETHER_ADDR_LEN);
     }
-    return nullptr;
+    return hitMask | found;
 }
@@ -2,7 +2,15 @@
 #include "ConfigManager.hpp"
 #include "Arp.hpp"
 #include "Utils.hpp"
+#include "Reorder.hpp"
+#include "LocalAddr.hpp"
+#include "Route.hpp"
+#include "Vlan.hpp"
+#include "Vxlan.hpp"
 #include <cstring>
+#include <cstdio>
+#include <vector>
+#include <rte_cycles.h>
 
 ArpProcessor::ArpProcessor()
 {
@@ -76,6 +84,211 @@ int ArpProcessor::encodeArpPacket(uint8_t *msg, uint16_t opcode, uint8_t *srcMac
     return 0;
 }
 
+int ArpProcessor::startTimer(struct rte_mempool *mbufPool, struct rte_ring *out, uint64_t periodMs)
+{
+    _timerPool = mbufPool;
+    _timerOut = out;
+    rte_timer_init(&_arpTimer);
+    uint64_t ticks = rte_get_timer_hz() / 1000 * periodMs;
+    if (rte_timer_reset(&_arpTimer, ticks, PERIODICAL, rte_lcore_id(), arpTimerCallback, this) < 0)
+    {
+        SPDLOG_ERROR("Failed to start ARP timer");
+        return -1;
+    }
+    SPDLOG_INFO("ARP timer started on lcore {}, period {} ms", rte_lcore_id(), periodMs);
+    return 0;
+}
+
+void ArpProcessor::arpTimerCallback(struct rte_timer *timer, void *arg)
+{
+    ArpProcessor *self = (ArpProcessor *)arg;
+    uint64_t nowMs = rte_get_timer_cycles() / (rte_get_timer_hz() / 1000);
+    ArpProbe probes[ARP_TIMER_MAX_PROBES];
+    unsigned nbProbes = ArpTable::tick(nowMs, probes, ARP_TIMER_MAX_PROBES);
+
+    for (unsigned i = 0; i < nbProbes; i++)
+    {
+        uint8_t dstMac[RTE_ETHER_ADDR_LEN];
+        if (probes[i].unicast)
+            rte_memcpy(dstMac, probes[i].mac, RTE_ETHER_ADDR_LEN);
+        else
+            self->getDefaultArpMac(dstMac);
+        SPDLOG_INFO("ARP {} probe for IP: {}", probes[i].unicast ? "unicast" : "broadcast", convert_uint32_to_ip(probes[i].ip));
+        self->sendRequest(self->_timerPool, self->_timerOut, dstMac, probes[i].ip);
+    }
+    self->expirePending();
+
+    if (self->_garpRemaining > 0 && nowMs >= self->_garpNextMs)
+    {
+        self->sendGratuitous();
+        self->_garpRemaining--;
+        self->_garpNextMs = nowMs + self->_garpIntervalMs;
+    }
+}
+
+int ArpProcessor::addStaticEntries(const std::vector<std::pair<std::string, std::string>> &entries)
+{
+    int added = 0;
+    for (auto &entry : entries)
+    {
+        struct in_addr addr;
+        ArpHeader arpHeader = {.hardware_type = 0};
+        uint8_t *mac = arpHeader.sender_hwaddr;
+        if (inet_pton(AF_INET, entry.first.c_str(), &addr) != 1 ||
+            sscanf(entry.second.c_str(), "%hhx:%hhx:%hhx:%hhx:%hhx:%hhx",
+                   &mac[0], &mac[1], &mac[2], &mac[3], &mac[4], &mac[5]) != RTE_ETHER_ADDR_LEN)
+        {
+            SPDLOG_ERROR("Invalid static ARP entry: IP: {}, MAC: {}", entry.first, entry.second);
+            continue;
+        }
+        arpHeader.sender_protoaddr = addr.s_addr;
+        if (ArpTable::addStatic(arpHeader) < 0)
+        {
+            SPDLOG_ERROR("ARP table is full, static entry {} ignored", entry.first);
+            continue;
+        }
+        SPDLOG_INFO("Static ARP entry: IP: {}, MAC: {}", entry.first, entry.second);
+        added++;
+    }
+    return added;
+}
+
+void ArpProcessor::announce(unsigned count, uint64_t intervalMs)
+{
+    if (count == 0)
+        return;
+    sendGratuitous();
+    _garpRemaining = count - 1;
+    _garpIntervalMs = intervalMs;
+    _garpNextMs = rte_get_timer_cycles() / (rte_get_timer_hz() / 1000) + intervalMs;
+}
+
+void ArpProcessor::sendGratuitous()
+{
+    // 每个本机地址(包括VIP)都要通告,对端才会把这些地址都指向本机的MAC
+    // VLAN子接口和隧道接口的地址只在自己的接口上通告
+    VlanTable &vlan = VlanTable::getInstance();
+    std::vector<uint16_t> ifs = vlan.listIfs();
+    for (uint16_t ifIndex : VxlanTunnel::getInstance().listIfs())
+        ifs.push_back(ifIndex);
+    for (uint16_t ifIndex : ifs)
+    {
+        for (uint32_t localIp : LocalAddrTable::getInstance().list(ifIndex))
+        {
+            uint8_t targetMac[RTE_ETHER_ADDR_LEN] = {0x0};
+            struct rte_mbuf *arpbuf = sendArpPacket(_timerPool, RTE_ARP_OP_REQUEST, ConfigManager::getInstance().getSrcMac(),
+                                                    localIp, targetMac, localIp);
+            // 目标硬件地址为全0,以太网目的地址必须是广播
+            struct rte_ether_hdr *ehdr = rte_pktmbuf_mtod(arpbuf, struct rte_ether_hdr *);
+            rte_memcpy(ehdr->d_addr.addr_bytes, defaultArpMac, RTE_ETHER_ADDR_LEN);
+            vlan.tagTx(arpbuf, ifIndex);
+            SPDLOG_INFO("Send gratuitous ARP for IP: {}", convert_uint32_to_ip(localIp));
+            EgressReorder::getInstance().enqueueOut(_timerOut, &arpbuf, 1);
+        }
+    }
+}
+
+void ArpProcessor::sendRequest(struct rte_mempool *mbufPool, struct rte_ring *out, uint8_t *dstMac, uint32_t targetIp)
+{
+    // 解析的对象都是直连的下一跳,直连路由给出它所在的接口
+    RouteCacheEntry route;
+    uint16_t ifIndex = ConfigManager::getInstance().getDpdkPortId();
+    if (RouteTable::getInstance().lookup(targetIp, &route))
+        ifIndex = route.portId;
+    struct rte_mbuf *arpbuf = sendArpPacket(mbufPool, RTE_ARP_OP_REQUEST, ConfigManager::getInstance().getSrcMac(),
+                                            LocalAddrTable::getInstance().getPrimary(ifIndex), dstMac, targetIp);
+    VlanTable::getInstance().tagTx(arpbuf, ifIndex);
+    EgressReorder::getInstance().enqueueOut(out, &arpbuf, 1);
+}
+
+int ArpProcessor::queuePending(struct rte_mempool *mbufPool, struct rte_ring *out, uint32_t nextHop, struct rte_mbuf *mbuf)
+{
+    int ret = ArpTable::resolve(nextHop);
+    if (ret < 0)
+    {
+        rte_pktmbuf_free(mbuf);
+        return -1;
+    }
+    // 新开始解析时发出第一个广播请求,之后的重传由ARP定时器负责
+    if (ret == 0)
+    {
+        uint8_t dstMac[RTE_ETHER_ADDR_LEN];
+        getDefaultArpMac(dstMac);
+        sendRequest(mbufPool, out, dstMac, nextHop);
+    }
+
+    struct rte_mbuf *dropped = nullptr;
+    {
+        lock_guard<mutex> lock(_pendingMutex);
+        auto &queue = _pending[nextHop];
+        if (queue.size() >= _pendingDepth)
+        {
+            dropped = queue.front();
+            queue.pop_front();
+            _pendingDropped++;
+        }
+        queue.push_back(mbuf);
+    }
+    if (dropped != nullptr)
+        rte_pktmbuf_free(dropped);
+    return 0;
+}
+
+unsigned ArpProcessor::flushPending(uint32_t ip, const uint8_t *mac, struct rte_ring *out)
+{
+    std::deque<struct rte_mbuf *> queue;
+    {
+        lock_guard<mutex> lock(_pendingMutex);
+        auto it = _pending.find(ip);
+        if (it == _pending.end())
+            return 0;
+        queue.swap(it->second);
+        _pending.erase(it);
+    }
+
+    std::vector<struct rte_mbuf *> burst(queue.begin(), queue.end());
+    for (struct rte_mbuf *mbuf : burst)
+    {
+        struct rte_ether_hdr *ehdr = rte_pktmbuf_mtod(mbuf, struct rte_ether_hdr *);
+        rte_memcpy(ehdr->d_addr.addr_bytes, mac, RTE_ETHER_ADDR_LEN);
+    }
+    SPDLOG_INFO("Flush {} pending packets to IP: {}", burst.size(), convert_uint32_to_ip(ip));
+    return EgressReorder::getInstance().enqueueOut(out, burst.data(), burst.size());
+}
+
+void ArpProcessor::expirePending()
+{
+    std::vector<struct rte_mbuf *> dropped;
+    std::vector<uint32_t> resolved;
+    {
+        lock_guard<mutex> lock(_pendingMutex);
+        for (auto it = _pending.begin(); it != _pending.end();)
+        {
+            int state = ArpTable::getState(it->first);
+            if (state >= 0)
+            {
+                // 没有经过handlePacket完成的解析(如静态条目)也在这里发出
+                if (state != (int)ARP_STATE::ARP_STATE_INCOMPLETE)
+                    resolved.push_back(it->first);
+                ++it;
+                continue;
+            }
+            SPDLOG_INFO("ARP resolution failed for IP: {}, drop {} pending packets", convert_uint32_to_ip(it->first), it->second.size());
+            dropped.insert(dropped.end(), it->second.begin(), it->second.end());
+            _pendingDropped += it->second.size();
+            it = _pending.erase(it);
+        }
+    }
+    for (struct rte_mbuf *mbuf : dropped)
+        rte_pktmbuf_free(mbuf);
+    for (uint32_t ip : resolved)
+    {
+        uint8_t mac[RTE_ETHER_ADDR_LEN];
+        if (ArpTable::lookup(ip, mac))
+            flushPending(ip, mac, _timerOut);
+    }
+}
+
 int ArpProcessor::setNextProcessor(std::shared_ptr<Processor> nextProcessor)
 {
     _nextProcessor = nextProcessor;
@@ -89,9 +302,7 @@ int ArpProcessor::handlePacket(struct rte_mempool *mbufPool, struct rte_mbuf *mb
         return -1; // Error: mbuf is null
     }
 
-    static uint32_t LOCAL_IP = ConfigManager::getInstance().getLocalAddr();
     auto SRC_MAC = ConfigManager::getInstance().getSrcMac();
-    SPDLOG_INFO("LOCAL_IP: {}", convert_uint32_to_ip(LOCAL_IP));
 
     struct rte_ether_hdr *ehdr = rte_pktmbuf_mtod(mbuf, struct rte_ether_hdr *);
     struct rte_arp_hdr *ahdr = rte_pktmbuf_mtod_offset(mbuf, struct rte_arp_hdr *, sizeof(struct rte_ether_hdr));
@@ -99,46 +310,86 @@ int ArpProcessor::handlePacket(struct rte_mempool *mbufPool, struct rte_mbuf *mb
     SPDLOG_INFO("Received ARP request from packet target IP: {}", convert_uint32_to_ip(ahdr->arp_data.arp_sip));
     if (ehdr->ether_type == rte_cpu_to_be_16(RTE_ETHER_TYPE_ARP))
     {
-        if (ahdr->arp_data.arp_tip == LOCAL_IP)
+        // 只处理目标是接收接口上的本机地址(包括VIP)的报文;
+        // 发送方按路由属于其他接口时既不应答也不学习,其他VLAN上的主机不能改写本接口的ARP条目
+        const uint16_t rxIf = mbuf->port;
+        RouteCacheEntry route;
+        if (LocalAddrTable::getInstance().getPort(ahdr->arp_data.arp_tip) == (int)rxIf &&
+            !(RouteTable::getInstance().lookup(ahdr->arp_data.arp_sip, &route) && route.portId != rxIf))
         {
             if (ahdr->arp_opcode == rte_cpu_to_be_16(RTE_ARP_OP_REQUEST))
             {
+                // 对方发来的请求说明它的MAC地址可用,但没有经过确认,按STALE处理
+                ArpHeader arpHeader = {
+                    .hardware_type = 0,
+                    .sender_protoaddr = ahdr->arp_data.arp_sip,
+                };
+                rte_memcpy(arpHeader.sender_hwaddr, ahdr->arp_data.arp_sha.addr_bytes, RTE_ETHER_ADDR_LEN);
+
+                // 独占的单段报文直接原地改写成应答,不需要分配新的mbuf
+                if (rte_mbuf_refcnt_read(mbuf) == 1 && RTE_MBUF_DIRECT(mbuf) && mbuf->nb_segs == 1)
+                {
+                    reflectRequest(mbuf, SRC_MAC);
+                    EgressReorder::getInstance().enqueueOut(ring->out, &mbuf, 1);
+                }
+                else
+                {
+                    struct rte_mbuf *arpbuf = sendArpPacket(mbufPool, RTE_ARP_OP_REPLY,
+                                                            SRC_MAC, ahdr->arp_data.arp_tip,
+                                                            ahdr->arp_data.arp_sha.addr_bytes, ahdr->arp_data.arp_sip);
+                    VlanTable::copyTag(arpbuf, mbuf);
+                    EgressReorder::getInstance().enqueueOut(ring->out, &arpbuf, 1);
+                    rte_pktmbuf_free(mbuf);
+                }
 
-                struct rte_mbuf *arpbuf = sendArpPacket(mbufPool, RTE_ARP_OP_REPLY,
-                                                        SRC_MAC, ahdr->arp_data.arp_tip,
-                                                        ahdr->arp_data.arp_sha.addr_bytes, ahdr->arp_data.arp_sip);
-                rte_ring_mp_enqueue_burst(ring->out, (void **)&arpbuf, 1, nullptr);
+                ArpTable::update(arpHeader);
+                flushPending(arpHeader.sender_protoaddr, arpHeader.sender_hwaddr, ring->out);
+                return 0;
             }
             else if (ahdr->arp_opcode == rte_cpu_to_be_16(RTE_ARP_OP_REPLY))
             {
                 SPDLOG_INFO("Received ARP Replay from IP: {}", convert_uint32_to_ip(ahdr->arp_data.arp_sip));
-                uint8_t *hwaddr = ArpTable::search(ahdr->arp_data.arp_sip);
-                if (hwaddr == nullptr)
-                {
-                    ArpHeader arpHeader = {
-                        .hardware_type = 0,
-                        .sender_protoaddr = ahdr->arp_data.arp_sip,
-                    };
-                    rte_memcpy(arpHeader.sender_hwaddr, ahdr->arp_data.arp_sha.addr_bytes, RTE_ETHER_ADDR_LEN);
-                    SPDLOG_INFO("Adding new ARP entry: IP: {}, MAC: {:02x}:{:02x}:{:02x}:{:02x}:{:02x}:{:02x}",
-                                convert_uint32_to_ip(arpHeader.sender_protoaddr),
-                                arpHeader.sender_hwaddr[0], arpHeader.sender_hwaddr[1],
-                                arpHeader.sender_hwaddr[2], arpHeader.sender_hwaddr[3],
-                                arpHeader.sender_hwaddr[4], arpHeader.sender_hwaddr[5]);
-                    ArpTable::getInstance().pushBack(arpHeader);
-                }
+                // 应答确认了对方的可达性,条目进入REACHABLE状态
+                ArpHeader arpHeader = {
+                    .hardware_type = 0,
+                    .sender_protoaddr = ahdr->arp_data.arp_sip,
+                };
+                rte_memcpy(arpHeader.sender_hwaddr, ahdr->arp_data.arp_sha.addr_bytes, RTE_ETHER_ADDR_LEN);
+                SPDLOG_INFO("Confirm ARP entry: IP: {}, MAC: {:02x}:{:02x}:{:02x}:{:02x}:{:02x}:{:02x}",
+                            convert_uint32_to_ip(arpHeader.sender_protoaddr),
+                            arpHeader.sender_hwaddr[0], arpHeader.sender_hwaddr[1],
+                            arpHeader.sender_hwaddr[2], arpHeader.sender_hwaddr[3],
+                            arpHeader.sender_hwaddr[4], arpHeader.sender_hwaddr[5]);
+                ArpTable::getInstance().pushBack(arpHeader);
+                flushPending(arpHeader.sender_protoaddr, arpHeader.sender_hwaddr, ring->out);
                 rte_pktmbuf_free(mbuf);
-            }
-            else
-            {
-                // 传递给后续的handler处理
+                return 0;
             }
         }
     }
 
+    rte_pktmbuf_free(mbuf);
     return 0;
 }
 
+void ArpProcessor::reflectRequest(struct rte_mbuf *mbuf, const uint8_t *srcMac)
+{
+    struct rte_ether_hdr *ehdr = rte_pktmbuf_mtod(mbuf, struct rte_ether_hdr *);
+    struct rte_arp_hdr *ahdr = (struct rte_arp_hdr *)(ehdr + 1);
+
+    // ARP头部是packed结构,按字节拷贝MAC地址
+    rte_memcpy(ehdr->d_addr.addr_bytes, ahdr->arp_data.arp_sha.addr_bytes, RTE_ETHER_ADDR_LEN);
+    rte_memcpy(ehdr->s_addr.addr_bytes, srcMac, RTE_ETHER_ADDR_LEN);
+
+    ahdr->arp_opcode = rte_cpu_to_be_16(RTE_ARP_OP_REPLY);
+    rte_memcpy(ahdr->arp_data.arp_tha.addr_bytes, ahdr->arp_data.arp_sha.addr_bytes, RTE_ETHER_ADDR_LEN);
+    rte_memcpy(ahdr->arp_data.arp_sha.addr_bytes, srcMac, RTE_ETHER_ADDR_LEN);
+    uint32_t sip = ahdr->arp_data.arp_sip;
+    ahdr->arp_data.arp_sip = ahdr->arp_data.arp_tip;
+    ahdr->arp_data.arp_tip = sip;
+    VlanTable::reflect(mbuf);
+}
+
 void ArpProcessor::getDefaultArpMac(uint8_t *copy)
 {
     std::memmove(copy, defaultArpMac, RTE_ETHER_ADDR_LEN);
@@ -1,10 +1,11 @@
 #include "BaseNetwork.hpp"
 #include <arpa/inet.h>
+#include <netinet/in.h>
+#include <cerrno>
 #include <rte_malloc.h>
 #include "ConfigManager.hpp"
 
 #define DEFAULT_FD_NUM 3
-#define MAX_FD_COUNT 1024
 unsigned char BaseNetwork::_fdTable[1024] = {0};
 std::mutex BaseNetwork::fdTableMutex;
 
@@ -40,3 +41,28 @@ int BaseNetwork::freeFdFromBitMap(int fd)
     _fdTable[int(fd / 8)] &= ~(0x1 << fd % 8);
     return 0;
 }
+
+int BaseNetwork::parseTosOption(int family, int level, int optname, const void *optval, socklen_t optlen, uint8_t *tos)
+{
+    const bool isTos = family == AF_INET6 ? level == IPPROTO_IPV6 && optname == IPV6_TCLASS
+                                          : level == IPPROTO_IP && optname == IP_TOS;
+    if (!isTos)
+        return 1;
+    if (optval == nullptr || optlen < sizeof(int))
+    {
+        errno = EINVAL;
+        return -1;
+    }
+    int value = *(const int *)optval;
+    // 与Linux相同,IPV6_TCLASS为-1时恢复默认值
+    if (family == AF_INET6 && value == -1)
+        value = 0;
+    if (value < 0 || value > 0xFF)
+    {
+        errno = EINVAL;
+        return -1;
+    }
+    // ECN位由传输层管理,socket只能设置DSCP
+    *tos = value & 0xFC;
+    return 0;
+}
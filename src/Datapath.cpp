@@ -0,0 +1,412 @@
+#include "Datapath.hpp"
+#include <rte_ethdev.h>
+#include <rte_ether.h>
+#include <rte_ip.h>
+#include <rte_cycles.h>
+#include <rte_timer.h>
+#include "PktProcess.hpp"
+#include "ArpProcessor.hpp"
+#include "IcmpProcessor.hpp"
+#include "UdpProcessor.hpp"
+#include "TcpProcessor.hpp"
+#include "KniProcessor.hpp"
+#include "DDosDetect.hpp"
+#include "Rps.hpp"
+#include "Reorder.hpp"
+#include "Reassembly.hpp"
+#include "Ipv4Validate.hpp"
+#include "LocalAddr.hpp"
+#include "Ipv6.hpp"
+#include "Vlan.hpp"
+#include "Vxlan.hpp"
+#include "IgmpProcessor.hpp"
+#include "Qos.hpp"
+#include "Forward.hpp"
+#include "Nat.hpp"
+#include "Logger.hpp"
+
+/**
+ * @brief 按协议把单个报文交给对应的处理模块
+ * @tparam OFFLOAD 为true时网卡已经校验过L4校验和,校验失败的报文直接丢弃。IP头部已由Ipv4Validator校验
+ * @param workerId 工作核编号,解封装后的内层报文按该编号计入校验统计
+ */
+template <bool OFFLOAD>
+static void handlePacket(struct rte_mempool *mbufPool, struct rte_mbuf *mbuf, struct inout_ring *ring, unsigned workerId)
+{
+    if constexpr (OFFLOAD)
+    {
+        if ((mbuf->ol_flags & PKT_RX_L4_CKSUM_MASK) == PKT_RX_L4_CKSUM_BAD)
+        {
+            SPDLOG_INFO("Drop packet with bad checksum, ol_flags={}", mbuf->ol_flags);
+            rte_pktmbuf_free(mbuf);
+            return;
+        }
+    }
+
+    struct rte_ether_hdr *ehdr = rte_pktmbuf_mtod(mbuf, struct rte_ether_hdr *);
+    if (ehdr->ether_type == rte_cpu_to_be_16(RTE_ETHER_TYPE_ARP))
+    {
+        SPDLOG_INFO("Received ARP packet ether_type={}", ehdr->ether_type);
+        ArpProcessor::getInstance().handlePacket(mbufPool, mbuf, ring);
+        return;
+    }
+
+    if (ehdr->ether_type == rte_cpu_to_be_16(RTE_ETHER_TYPE_IPV6))
+    {
+        // IPv6只运行在物理端口上,VLAN子接口没有IPv6地址
+        Ipv6Processor &ipv6 = Ipv6Processor::getInstance();
+        if (ipv6.isEnabled() && mbuf->port < VLAN_IF_BASE)
+            ipv6.handlePacket(mbufPool, mbuf, ring);
+        else
+            rte_pktmbuf_free(mbuf);
+        return;
+    }
+
+    // 不是IPV4协议的包，丢弃
+    if (ehdr->ether_type != rte_cpu_to_be_16(RTE_ETHER_TYPE_IPV4))
+    {
+        rte_pktmbuf_free(mbuf);
+        return;
+    }
+
+    // 处理IPV4包,目的地址不属于接收接口的报文不交给任何协议模块
+    struct rte_ipv4_hdr *iphdr = rte_pktmbuf_mtod_offset(mbuf, struct rte_ipv4_hdr *, sizeof(struct rte_ether_hdr));
+    // 组播报文按接收接口上的组成员关系接收,不回复ICMP差错
+    if (RTE_IS_IPV4_MCAST(rte_be_to_cpu_32(iphdr->dst_addr)))
+    {
+        IgmpProcessor &igmp = IgmpProcessor::getInstance();
+        if (iphdr->next_proto_id == IPPROTO_IGMP)
+            igmp.handlePacket(mbuf);
+        else if (iphdr->next_proto_id == IPPROTO_UDP && igmp.isMember(iphdr->dst_addr, mbuf->port))
+            UdpProcessor::getInstance().udpMcastProcess(mbuf);
+        else
+            rte_pktmbuf_free(mbuf);
+        return;
+    }
+    // 发往NAT外部地址的回程报文换回内部地址后转发,没有会话的报文仍按发给本机处理
+    Nat44 &nat = Nat44::getInstance();
+    if (nat.isEnabled() && nat.isExternal(iphdr->dst_addr) && nat.translateInbound(workerId, mbuf) == NAT_TRANSLATED)
+    {
+        Ipv4Forwarder::getInstance().stage(workerId, mbufPool, ring->out, mbuf);
+        return;
+    }
+    const int localPort = LocalAddrTable::getInstance().getPort(iphdr->dst_addr);
+    if (localPort != (int)mbuf->port)
+    {
+        // 不属于本机任何接口的报文在开启转发时暂存,这批报文处理完后统一转发
+        Ipv4Forwarder &forwarder = Ipv4Forwarder::getInstance();
+        if (localPort < 0 && forwarder.isEnabled())
+            forwarder.stage(workerId, mbufPool, ring->out, mbuf);
+        else
+            rte_pktmbuf_free(mbuf);
+        return;
+    }
+    if (iphdr->next_proto_id == IPPROTO_UDP)
+    {
+        SPDLOG_INFO("Received UDP packet. next_proto_id={}", iphdr->next_proto_id);
+        // VXLAN报文去掉外层头部后,内层帧按隧道接口收到的报文重新分发
+        VxlanTunnel &vxlan = VxlanTunnel::getInstance();
+        const uint8_t ihl = (iphdr->version_ihl & RTE_IPV4_HDR_IHL_MASK) * RTE_IPV4_IHL_MULTIPLIER;
+        const struct rte_udp_hdr *udphdr = (const struct rte_udp_hdr *)((const uint8_t *)iphdr + ihl);
+        if (vxlan.isEnabled() && udphdr->dst_port == vxlan.getUdpPort() &&
+            (iphdr->fragment_offset & rte_cpu_to_be_16(RTE_IPV4_HDR_MF_FLAG | RTE_IPV4_HDR_OFFSET_MASK)) == 0)
+        {
+            if (vxlan.decap(mbuf) == 0 && Ipv4Validator::getInstance().validate<OFFLOAD>(workerId, mbuf))
+                handlePacket<OFFLOAD>(mbufPool, mbuf, ring, workerId);
+            return;
+        }
+        if (UdpProcessor::getInstance().udpProcess(mbuf) == -3)
+        {
+            IcmpProcessor::getInstance().sendError(mbufPool, ring->out, mbuf, ICMP_TYPE_DEST_UNREACHABLE, ICMP_CODE_PORT_UNREACHABLE);
+            rte_pktmbuf_free(mbuf);
+        }
+    }
+    else if (iphdr->next_proto_id == IPPROTO_TCP)
+    {
+        SPDLOG_INFO("Received TCP packet. next_proto_id={}", iphdr->next_proto_id);
+        // TCP模块已把负载拷贝到接收队列,报文在这里释放
+        if (TcpProcessor::getInstance().tcpProcess(mbuf) == -2)
+            TcpProcessor::getInstance().tcpSendReset(mbuf, ring->out);
+        else
+            rte_pktmbuf_free(mbuf);
+    }
+    else if (iphdr->next_proto_id == IPPROTO_ICMP)
+    {
+        SPDLOG_INFO("Received ICMP packet. next_proto_id={}", iphdr->next_proto_id);
+        IcmpProcessor::getInstance().handlePacket(mbufPool, mbuf, ring);
+    }
+    else if (iphdr->next_proto_id == IPPROTO_IGMP)
+    {
+        // IGMPv3查询也可以单播给本机
+        IgmpProcessor::getInstance().handlePacket(mbuf);
+    }
+    else
+    {
+        IcmpProcessor::getInstance().sendError(mbufPool, ring->out, mbuf, ICMP_TYPE_DEST_UNREACHABLE, ICMP_CODE_PROTO_UNREACHABLE);
+        rte_pktmbuf_free(mbuf);
+    }
+}
+
+/**
+ * @brief pkt_process工作核的特化实现
+ * @tparam BURST 每次从输入环取出的最大报文数量
+ * @tparam KNI 为true时所有报文交给KNI,协议栈不处理
+ * @tparam OFFLOAD 是否信任网卡给出的校验和结果
+ */
+template <unsigned BURST, bool KNI, bool OFFLOAD>
+static int pktProcessLoop(void *arg)
+{
+    struct PktProcessParams *pktParams = (struct PktProcessParams *)arg;
+    rte_mempool *mbufPool = pktParams->mbufPool;
+    struct inout_ring *ring = pktParams->ring;
+    const bool IS_MAIN_WORKER = pktParams->workerId == 0;
+    EgressReorder &reorder = EgressReorder::getInstance();
+    const bool ENABLE_REORDER = reorder.isEnabled();
+    IpReassembly &reassembly = IpReassembly::getInstance();
+    const bool ENABLE_REASSEMBLY = reassembly.isEnabled();
+    Ipv4Validator &validator = Ipv4Validator::getInstance();
+    Ipv4Forwarder &forwarder = Ipv4Forwarder::getInstance();
+    const bool ENABLE_FORWARD = forwarder.isEnabled();
+    Nat44 &nat = Nat44::getInstance();
+    const bool ENABLE_NAT = nat.isEnabled();
+    const unsigned WORKER_ID = pktParams->workerId;
+    UdpServerManager &udpManager = UdpServerManager::getInstance();
+    udpManager.registerReader(WORKER_ID);
+    SPDLOG_INFO("Packet processing worker {} running on lcore {}, burst {}, kni {}, offload {}",
+                pktParams->workerId, rte_lcore_id(), BURST, KNI, OFFLOAD);
+
+    while (!pktParams->quit->load(std::memory_order_relaxed))
+    {
+        // 上一轮查到的socket都已用完,关闭的socket可以在所有工作核经过这里后释放
+        udpManager.quiescent(WORKER_ID);
+        struct rte_mbuf *mbufs[BURST];
+        unsigned num_recvd = rte_ring_mc_dequeue_burst(ring->in, (void **)mbufs, BURST, nullptr);
+        // 报文处理后可能已被释放,先记下这批报文的最大序号
+        uint64_t lastSeqn = (ENABLE_REORDER && num_recvd > 0) ? reorder.getSeqn(mbufs[num_recvd - 1]) : 0;
+
+        if constexpr (KNI)
+        {
+            if (num_recvd > 0)
+            {
+                SPDLOG_INFO("Received {} packets, kni prosses them.", num_recvd);
+                KniProcessor::getInstance().burstTx(mbufs, num_recvd);
+            }
+        }
+        else
+        {
+            // 非法IPv4报文在这里被释放,之后的模块可以信任IP头部的长度字段
+            // 整批都非法时仍要在下面报告这批序号已处理完,不能覆盖num_recvd
+            unsigned num_valid = validator.validateBurst<OFFLOAD>(WORKER_ID, mbufs, num_recvd);
+            uint64_t now = (ENABLE_REASSEMBLY || ENABLE_NAT) ? rte_rdtsc() : 0;
+            // 这批报文创建和使用的NAT会话都记为这个时间
+            if (ENABLE_NAT)
+                nat.maintain(WORKER_ID, now);
+            for (unsigned i = 0; i < num_valid; i++)
+            {
+                // 处理该报文时产生的出站报文继承它的入站序号
+                if (ENABLE_REORDER)
+                    RTE_PER_LCORE(egressSeqn) = reorder.getSeqn(mbufs[i]);
+                struct rte_mbuf *pkt = mbufs[i];
+                // 分片在收齐之前由重组模块持有
+                if (ENABLE_REASSEMBLY && (pkt = reassembly.reassemble(WORKER_ID, pkt, now)) == nullptr)
+                    continue;
+                handlePacket<OFFLOAD>(mbufPool, pkt, ring, WORKER_ID);
+            }
+            // 转发的报文继承这批报文最后一个的入站序号
+            if (ENABLE_FORWARD)
+                forwarder.flush(WORKER_ID, mbufPool, ring->out);
+            if (ENABLE_REASSEMBLY)
+                reassembly.maintain(WORKER_ID, now, mbufPool, ring->out);
+        }
+
+        if (ENABLE_REORDER && num_recvd > 0)
+        {
+            reorder.complete(WORKER_ID, lastSeqn);
+            RTE_PER_LCORE(egressSeqn) = 0;
+        }
+
+        // socket发送队列只由0号工作核消费,保证同一个socket发出的报文保持顺序
+        if (!IS_MAIN_WORKER)
+            continue;
+        if constexpr (KNI)
+            KniProcessor::getInstance().kniHandleRequests();
+        TcpProcessor::getInstance().tcpOut(mbufPool);
+        UdpProcessor::getInstance().udpOut(mbufPool);
+    }
+    // 退出后不再报告静止状态,之后关闭socket不需要等待这个工作核
+    udpManager.unregisterReader(WORKER_ID);
+    SPDLOG_INFO("Packet processing worker {} stopped", pktParams->workerId);
+    return 0;
+}
+
+/**
+ * @brief 主核收发循环的特化实现
+ * @tparam BURST 每次收发的最大报文数量
+ * @tparam DDOS 是否对收到的报文做DDoS检测
+ * @tparam VLAN 是否配置了VLAN子接口,为true时收包后统一剥离标签,网卡不支持时发包前由软件插入标签
+ */
+template <unsigned BURST, bool DDOS, bool VLAN>
+static int mainLoop(struct MainLoopParams *params)
+{
+    const uint16_t portId = params->portId;
+    struct inout_ring *ring = params->ring;
+    RpsDispatcher &rps = RpsDispatcher::getInstance();
+    EgressReorder &reorder = EgressReorder::getInstance();
+    VlanTable &vlan = VlanTable::getInstance();
+    const bool SW_VLAN_INSERT = VLAN && !vlan.hasHwInsert();
+    VxlanTunnel &vxlan = VxlanTunnel::getInstance();
+    const bool ENABLE_VXLAN = vxlan.isEnabled();
+    EgressScheduler &qos = EgressScheduler::getInstance();
+    const bool ENABLE_QOS = qos.isEnabled();
+    uint64_t lastStats = rte_get_timer_cycles();
+    uint64_t lastTimer = lastStats;
+    DDosDetect ddosDetect;
+    SPDLOG_INFO("Main loop running on lcore {}, burst {}, ddos detect {}, vlan {}", rte_lcore_id(), BURST, DDOS, VLAN);
+
+    while (!params->quit->load(std::memory_order_relaxed))
+    {
+        // 接收数据包
+        struct rte_mbuf *rx[BURST];
+        unsigned num_recvd = rte_eth_rx_burst(portId, 0, rx, BURST);
+        // 之后的模块都按固定偏移读取以太网类型
+        if (VLAN && num_recvd > 0)
+            num_recvd = vlan.rxBurst(rx, num_recvd);
+        if (num_recvd > 0)
+        {
+            if constexpr (DDOS)
+            {
+                for (unsigned i = 0; i < num_recvd; i++)
+                    ddosDetect.ddosDetect(rx[i]);
+            }
+            rps.dispatch(rx, num_recvd);
+            SPDLOG_INFO("Received {} packets from port {}", num_recvd, portId);
+        }
+
+        // ARP等控制面定时器都运行在主核上
+        uint64_t now = rte_get_timer_cycles();
+        if (now - lastTimer > params->timerCycles)
+        {
+            rte_timer_manage();
+            lastTimer = now;
+        }
+
+        if (params->statsCycles > 0 && rte_get_timer_cycles() - lastStats > params->statsCycles)
+        {
+            rps.dumpStats();
+            reorder.dumpStats();
+            IpReassembly::getInstance().dumpStats();
+            Ipv4Validator::getInstance().dumpStats();
+            vlan.dumpStats();
+            vxlan.dumpStats();
+            qos.dumpStats();
+            Ipv4Forwarder::getInstance().dumpStats();
+            Nat44::getInstance().dumpStats();
+            lastStats = rte_get_timer_cycles();
+        }
+
+        // 发送数据包
+        struct rte_mbuf *tx[BURST];
+        unsigned nb_tx = 0;
+        if (ENABLE_QOS)
+        {
+            // 输出环中的报文先按DSCP进入类别队列,网卡忙时积压留在各自的类别里
+            for (unsigned round = 0; round < QOS_DRAIN_BURSTS; round++)
+            {
+                unsigned nb = reorder.drain(ring->out, tx, BURST);
+                if (nb == 0)
+                    break;
+                if (ENABLE_VXLAN)
+                    nb = vxlan.encapBurst(tx, nb);
+                qos.enqueue(tx, nb);
+            }
+            // 上一轮网卡没有接收的报文发完之前不取新的报文
+            if (qos.flushHeld(portId))
+                nb_tx = qos.dequeue(tx, BURST);
+        }
+        else
+        {
+            nb_tx = reorder.drain(ring->out, tx, BURST);
+            // 先封装隧道报文,外层头部需要的VLAN标签再由后面的软件插入完成
+            if (ENABLE_VXLAN && nb_tx > 0)
+                nb_tx = vxlan.encapBurst(tx, nb_tx);
+        }
+        if (SW_VLAN_INSERT && nb_tx > 0)
+            nb_tx = vlan.txBurst(tx, nb_tx);
+        if (nb_tx > 0)
+        {
+            SPDLOG_INFO("Send packets with port {} ", portId);
+            unsigned nb_sent = rte_eth_tx_burst(portId, 0, tx, nb_tx);
+            // 发送成功的报文由网卡驱动释放;没有发出去的报文在开启调度时留到下一轮,否则释放
+            if (ENABLE_QOS)
+                qos.hold(tx + nb_sent, nb_tx - nb_sent);
+            else
+            {
+                for (unsigned i = nb_sent; i < nb_tx; i++)
+                {
+                    rte_pktmbuf_free(tx[i]);
+                }
+            }
+        }
+    }
+    return 0;
+}
+
+template <unsigned BURST>
+static PktProcessFn pickPktProcess(bool enableKni, bool enableOffload)
+{
+    if (enableKni)
+        return enableOffload ? pktProcessLoop<BURST, true, true> : pktProcessLoop<BURST, true, false>;
+    return enableOffload ? pktProcessLoop<BURST, false, true> : pktProcessLoop<BURST, false, false>;
+}
+
+template <unsigned BURST>
+static MainLoopFn pickMainLoop(bool enableDdos, bool enableVlan)
+{
+    if (enableDdos)
+        return enableVlan ? mainLoop<BURST, true, true> : mainLoop<BURST, true, false>;
+    return enableVlan ? mainLoop<BURST, false, true> : mainLoop<BURST, false, false>;
+}
+
+unsigned datapathBurstSize(unsigned burstSize)
+{
+    unsigned size = 8;
+    while (size < burstSize && size < DATAPATH_MAX_BURST)
+        size <<= 1;
+    return size;
+}
+
+PktProcessFn selectPktProcess(unsigned burstSize, bool enableKni, bool enableOffload)
+{
+    switch (burstSize)
+    {
+    case 8:
+        return pickPktProcess<8>(enableKni, enableOffload);
+    case 16:
+        return pickPktProcess<16>(enableKni, enableOffload);
+    case 32:
+        return pickPktProcess<32>(enableKni, enableOffload);
+    case 64:
+        return pickPktProcess<64>(enableKni, enableOffload);
+    default:
+        SPDLOG_ERROR("Unsupported datapath burst size {}", burstSize);
+        return nullptr;
+    }
+}
+
+MainLoopFn selectMainLoop(unsigned burstSize, bool enableDdos, bool enableVlan)
+{
+    switch (burstSize)
+    {
+    case 8:
+        return pickMainLoop<8>(enableDdos, enableVlan);
+    case 16:
+        return pickMainLoop<16>(enableDdos, enableVlan);
+    case 32:
+        return pickMainLoop<32>(enableDdos, enableVlan);
+    case 64:
+        return pickMainLoop<64>(enableDdos, enableVlan);
+    default:
+        SPDLOG_ERROR("Unsupported datapath burst size {}", burstSize);
+        return nullptr;
+    }
+}
@@ -1,5 +1,7 @@
 #include "DpdkManager.hpp"
 #include "ConfigManager.hpp"
+#include "Vlan.hpp"
+#include "Vxlan.hpp"
 #include <rte_errno.h>
 
 DPDKManager::DPDKManager(const string &name, unsigned NUM_MBUFS, int socket_id) : _name(name), _NUM_MBUFS(NUM_MBUFS), _socket_id(socket_id)
@@ -50,6 +52,34 @@ int DPDKManager::initPort(int portID, rte_eth_conf port_conf_default)
     const int num_tx_queues = 1;
     // 端口配置信息
     struct rte_eth_conf port_conf = port_conf_default;
+    if (ConfigManager::getInstance().isRxCksumOffloadEnabled())
+    {
+        port_conf.rxmode.offloads |= dev_info.rx_offload_capa & DEV_RX_OFFLOAD_CHECKSUM;
+        if ((dev_info.rx_offload_capa & DEV_RX_OFFLOAD_CHECKSUM) != DEV_RX_OFFLOAD_CHECKSUM)
+        {
+            SPDLOG_WARN("Port {} only supports part of RX checksum offload, capa=0x{:x}", portID, dev_info.rx_offload_capa);
+        }
+    }
+    // 端口是trunk时尽量由网卡剥离和插入VLAN标签,网卡不支持的部分由VlanTable在主核上用软件完成
+    const bool ENABLE_VLAN = !ConfigManager::getInstance().getVlans().empty();
+    const bool hwStrip = ENABLE_VLAN && (dev_info.rx_offload_capa & DEV_RX_OFFLOAD_VLAN_STRIP);
+    const bool hwInsert = ENABLE_VLAN && (dev_info.tx_offload_capa & DEV_TX_OFFLOAD_VLAN_INSERT);
+    if (hwStrip)
+        port_conf.rxmode.offloads |= DEV_RX_OFFLOAD_VLAN_STRIP;
+    if (hwInsert)
+        port_conf.txmode.offloads |= DEV_TX_OFFLOAD_VLAN_INSERT;
+    if (VlanTable::getInstance().init(portID, hwStrip, hwInsert) < 0 && ENABLE_VLAN)
+    {
+        SPDLOG_ERROR("Could not enable VLAN on port {}", portID);
+        rte_exit(EXIT_FAILURE, "Could not enable VLAN\n");
+    }
+    // VXLAN外层IPv4头部的校验和交给网卡计算
+    const bool ENABLE_VXLAN = !ConfigManager::getInstance().getVxlans().empty();
+    if (ENABLE_VXLAN && (dev_info.tx_offload_capa & DEV_TX_OFFLOAD_IPV4_CKSUM))
+    {
+        port_conf.txmode.offloads |= DEV_TX_OFFLOAD_IPV4_CKSUM;
+        VxlanTunnel::getInstance().setHwIpCksum(true);
+    }
     rte_eth_dev_configure(portID, num_rx_queues, num_tx_queues, &port_conf);
     //设置接收队列
     if (rte_eth_rx_queue_setup(portID, 0, 1024,
@@ -60,7 +90,7 @@ int DPDKManager::initPort(int portID, rte_eth_conf port_conf_default)
     }
     // 设置发送队列
     struct rte_eth_txconf txq_conf = dev_info.default_txconf;
-    txq_conf.offloads = port_conf.rxmode.offloads;
+    txq_conf.offloads = port_conf.txmode.offloads;
     if (rte_eth_tx_queue_setup(portID, 0, 1024,
                                rte_eth_dev_socket_id(portID), &txq_conf) < 0)
     {
@@ -74,6 +104,18 @@ int DPDKManager::initPort(int portID, rte_eth_conf port_conf_default)
         rte_exit(EXIT_FAILURE, "Could not start\n");
     }
 
+    // 告诉网卡VXLAN使用的端口,网卡识别出隧道后给出的校验和结果针对内层头部,内层报文不用再由软件校验
+    if (ENABLE_VXLAN && ConfigManager::getInstance().isRxCksumOffloadEnabled())
+    {
+        struct rte_eth_udp_tunnel tunnel = {
+            .udp_port = ConfigManager::getInstance().getVxlanUdpPort(),
+            .prot_type = RTE_TUNNEL_TYPE_VXLAN};
+        if (rte_eth_dev_udp_tunnel_port_add(portID, &tunnel) != 0)
+        {
+            SPDLOG_WARN("Port {} cannot parse VXLAN on UDP port {}, inner checksums are verified in software", portID, tunnel.udp_port);
+        }
+    }
+
     if(ConfigManager::getInstance().isKniEnabled())
     {
         rte_eth_promiscuous_enable(portID);
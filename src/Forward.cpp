@@ -0,0 +1,144 @@
+#include "Forward.hpp"
+#include <rte_cycles.h>
+#include <rte_memcpy.h>
+#include <cstring>
+#include "Arp.hpp"
+#include "ArpProcessor.hpp"
+#include "IcmpProcessor.hpp"
+#include "Pmtu.hpp"
+#include "Vlan.hpp"
+#include "Vxlan.hpp"
+#include "Nat.hpp"
+#include "Reorder.hpp"
+#include "Rps.hpp"
+#include "Logger.hpp"
+
+static const char *FWD_DROP_NAMES[FWD_DROP_MAX] = {"addr", "ttl", "no route", "too big", "neigh"};
+
+void Ipv4Forwarder::init(const uint8_t *srcMac)
+{
+    rte_memcpy(_srcMac.addr_bytes, srcMac, RTE_ETHER_ADDR_LEN);
+    _lastStatsCycles = rte_get_timer_cycles();
+    _enabled = true;
+    SPDLOG_INFO("IPv4 forwarding enabled");
+}
+
+void Ipv4Forwarder::flush(unsigned workerId, struct rte_mempool *mbufPool, struct rte_ring *out)
+{
+    WorkerState &state = _workers[workerId];
+    const unsigned nbPending = state.nbPending;
+    if (nbPending == 0)
+        return;
+    state.nbPending = 0;
+
+    RouteTable &routeTable = RouteTable::getInstance();
+    IcmpProcessor &icmp = IcmpProcessor::getInstance();
+    Nat44 &nat = Nat44::getInstance();
+    const bool ENABLE_NAT = nat.isEnabled();
+    const uint16_t linkMtu = PmtuCache::getInstance().getLinkMtu();
+    struct rte_mbuf *pkts[DATAPATH_MAX_BURST];
+    uint32_t nextHops[DATAPATH_MAX_BURST];
+    uint16_t ports[DATAPATH_MAX_BURST];
+    unsigned nb = 0;
+    for (unsigned i = 0; i < nbPending; i++)
+    {
+        struct rte_mbuf *mbuf = state.pending[i];
+        struct rte_ether_hdr *ehdr = rte_pktmbuf_mtod(mbuf, struct rte_ether_hdr *);
+        struct rte_ipv4_hdr *iphdr = (struct rte_ipv4_hdr *)(ehdr + 1);
+        // 网卡为KNI开启了混杂模式,只转发发给本机MAC的帧,其他主机之间的单播帧不能被路由
+        if (unlikely(!rte_is_same_ether_addr(&ehdr->d_addr, &_srcMac) || !isForwardable(iphdr->dst_addr)))
+        {
+            state.drops[FWD_DROP_ADDR]++;
+            rte_pktmbuf_free(mbuf);
+            continue;
+        }
+        // 差错报文引用的是收到时的IP头部,必须在改写之前生成
+        if (unlikely(iphdr->time_to_live <= 1))
+        {
+            state.drops[FWD_DROP_TTL]++;
+            icmp.sendError(mbufPool, out, mbuf, ICMP_TYPE_TIME_EXCEEDED, ICMP_CODE_TTL_EXCEEDED);
+            rte_pktmbuf_free(mbuf);
+            continue;
+        }
+        if (unlikely(!routeTable.lookupCached(iphdr->dst_addr, &state.route)))
+        {
+            state.drops[FWD_DROP_NO_ROUTE]++;
+            icmp.sendError(mbufPool, out, mbuf, ICMP_TYPE_DEST_UNREACHABLE, ICMP_CODE_NET_UNREACHABLE);
+            rte_pktmbuf_free(mbuf);
+            continue;
+        }
+        const uint16_t mtu = VxlanTunnel::getInstance().ifMtu(state.route.portId, linkMtu);
+        if (unlikely(rte_be_to_cpu_16(iphdr->total_length) > mtu))
+        {
+            state.drops[FWD_DROP_TOO_BIG]++;
+            if (iphdr->fragment_offset & rte_cpu_to_be_16(RTE_IPV4_HDR_DF_FLAG))
+                icmp.sendError(mbufPool, out, mbuf, ICMP_TYPE_DEST_UNREACHABLE, ICMP_CODE_FRAG_NEEDED, rte_cpu_to_be_32(mtu));
+            rte_pktmbuf_free(mbuf);
+            continue;
+        }
+        // 源地址转换放在各项检查之后,差错报文仍然发给内部主机
+        if (ENABLE_NAT && nat.translateOutbound(workerId, mbuf) == NAT_DROP)
+        {
+            rte_pktmbuf_free(mbuf);
+            continue;
+        }
+        decrementTtl(iphdr);
+        pkts[nb] = mbuf;
+        nextHops[nb] = state.route.nextHop;
+        ports[nb] = state.route.portId;
+        nb++;
+    }
+    if (nb == 0)
+        return;
+
+    uint8_t dstMacs[DATAPATH_MAX_BURST][RTE_ETHER_ADDR_LEN];
+    const uint64_t hitMask = ArpTable::lookupBulk(nextHops, nb, dstMacs);
+    VlanTable &vlan = VlanTable::getInstance();
+    unsigned nbTx = 0;
+    for (unsigned i = 0; i < nb; i++)
+    {
+        struct rte_mbuf *mbuf = pkts[i];
+        struct rte_ether_hdr *ehdr = rte_pktmbuf_mtod(mbuf, struct rte_ether_hdr *);
+        const bool hit = hitMask & (1ULL << i);
+        rte_ether_addr_copy(&_srcMac, &ehdr->s_addr);
+        // 目的MAC未知时在解析完成后由ARP模块填写
+        if (hit)
+            rte_memcpy(ehdr->d_addr.addr_bytes, dstMacs[i], RTE_ETHER_ADDR_LEN);
+        else
+            memset(ehdr->d_addr.addr_bytes, 0, RTE_ETHER_ADDR_LEN);
+        // 接收时的卸载标志和VLAN标签不能带到出接口上
+        mbuf->ol_flags = 0;
+        mbuf->vlan_tci = 0;
+        vlan.tagTx(mbuf, ports[i]);
+        if (hit)
+            pkts[nbTx++] = mbuf;
+        else if (ArpProcessor::getInstance().queuePending(mbufPool, out, nextHops[i], mbuf) < 0)
+            state.drops[FWD_DROP_NEIGH]++;
+        else
+            state.forwarded++;
+    }
+    state.forwarded += nbTx;
+    EgressReorder::getInstance().enqueueOut(out, pkts, nbTx);
+}
+
+void Ipv4Forwarder::dumpStats()
+{
+    if (!_enabled)
+        return;
+    uint64_t total = 0;
+    for (unsigned w = 0; w < RpsDispatcher::getInstance().getWorkerCount(); w++)
+    {
+        const WorkerState &state = _workers[w];
+        total += state.forwarded;
+        SPDLOG_INFO("IPv4 forwarding worker {}: forwarded {}, {} {}, {} {}, {} {}, {} {}, {} {}", w, state.forwarded,
+                    FWD_DROP_NAMES[0], state.drops[0], FWD_DROP_NAMES[1], state.drops[1], FWD_DROP_NAMES[2], state.drops[2],
+                    FWD_DROP_NAMES[3], state.drops[3], FWD_DROP_NAMES[4], state.drops[4]);
+    }
+    // 两次打印之间的平均转发速率
+    const uint64_t now = rte_get_timer_cycles();
+    const double seconds = (double)(now - _lastStatsCycles) / rte_get_timer_hz();
+    if (seconds > 0)
+        SPDLOG_INFO("IPv4 forwarding rate {:.3f} Mpps", (total - _lastForwarded) / seconds / 1e6);
+    _lastForwarded = total;
+    _lastStatsCycles = now;
+}
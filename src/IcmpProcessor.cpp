@@ -7,6 +7,14 @@
 #include "Ring.hpp"
 #include "ConfigManager.hpp"
 #include "Utils.hpp"
+#include "Reorder.hpp"
+#include "Pmtu.hpp"
+#include "LocalAddr.hpp"
+#include "Vlan.hpp"
+#include <rte_cycles.h>
+#include <rte_jhash.h>
+#include <algorithm>
+#include <cstring>
 int IcmpProcessor::handlePacket(struct rte_mempool *mbufPool, struct rte_mbuf *mbuf, struct inout_ring *ring)
 {
     struct rte_ether_hdr *ehdr = rte_pktmbuf_mtod(mbuf, struct rte_ether_hdr *);
@@ -15,11 +23,27 @@ int IcmpProcessor::handlePacket(struct rte_mempool *mbufPool, struct rte_mbuf *m
 
     if (iphdr->next_proto_id == IPPROTO_ICMP)
     {
-        struct rte_icmp_hdr *icmphdr = (struct rte_icmp_hdr *)(iphdr + 1);
+        uint8_t ihl = (iphdr->version_ihl & RTE_IPV4_HDR_IHL_MASK) * RTE_IPV4_IHL_MULTIPLIER;
+        struct rte_icmp_hdr *icmphdr = (struct rte_icmp_hdr *)((uint8_t *)iphdr + ihl);
 
         if (icmphdr->icmp_type == RTE_IP_ICMP_ECHO_REQUEST)
         {
-            uint16_t icmp_len = ntohs(iphdr->total_length) - sizeof(struct rte_ipv4_hdr);
+            // 独占的单段报文直接原地改写成应答,不分配新的mbuf也不拷贝负载
+            if (rte_mbuf_refcnt_read(mbuf) == 1 && RTE_MBUF_DIRECT(mbuf) && mbuf->nb_segs == 1)
+            {
+                reflectEchoRequest(mbuf);
+                EgressReorder::getInstance().enqueueOut(ring->out, &mbuf, 1);
+                return 0;
+            }
+
+            // 重组出的大报文需要分片才能发回,不回复
+            if (mbuf->nb_segs > 1)
+            {
+                SPDLOG_INFO("Drop multi-segment echo request, length {}", rte_pktmbuf_pkt_len(mbuf));
+                rte_pktmbuf_free(mbuf);
+                return 0;
+            }
+            uint16_t icmp_len = ntohs(iphdr->total_length) - ihl;
             uint8_t *icmp_data = (uint8_t *)icmphdr;
 
             // 构造回复包
@@ -31,14 +55,65 @@ int IcmpProcessor::handlePacket(struct rte_mempool *mbufPool, struct rte_mbuf *m
                                                     icmphdr->icmp_seq_nb,
                                                     icmp_data,
                                                     icmp_len);
-
-            rte_ring_mp_enqueue_burst(ring->out, (void **)&txbuf, 1, nullptr);
-            rte_pktmbuf_free(mbuf);
+            if (txbuf != nullptr)
+            {
+                VlanTable::copyTag(txbuf, mbuf);
+                EgressReorder::getInstance().enqueueOut(ring->out, &txbuf, 1);
+            }
+        }
+        else if (icmphdr->icmp_type == ICMP_TYPE_DEST_UNREACHABLE && icmphdr->icmp_code == ICMP_CODE_FRAG_NEEDED)
+        {
+            handleFragNeeded(mbuf, icmphdr);
         }
     }
+    rte_pktmbuf_free(mbuf);
     return 0;
 }
 
+void IcmpProcessor::handleFragNeeded(struct rte_mbuf *mbuf, struct rte_icmp_hdr *icmphdr)
+{
+    // 差错报文至少要引用原始IP头和8字节数据
+    uint8_t *end = rte_pktmbuf_mtod(mbuf, uint8_t *) + rte_pktmbuf_data_len(mbuf);
+    struct rte_ipv4_hdr *orig = (struct rte_ipv4_hdr *)(icmphdr + 1);
+    if ((uint8_t *)(orig + 1) + 8 > end)
+        return;
+
+    // 只接受针对本机发出的报文的差错,防止伪造的ICMP降低到任意地址的PMTU
+    if (!LocalAddrTable::getInstance().isLocal(orig->src_addr))
+        return;
+
+    // RFC 1191: 下一跳MTU在ICMP头部的后16位
+    uint16_t mtu = ntohs(icmphdr->icmp_seq_nb);
+    PmtuCache::getInstance().update(orig->dst_addr, mtu, ntohs(orig->total_length));
+}
+
+void IcmpProcessor::reflectEchoRequest(struct rte_mbuf *mbuf)
+{
+    struct rte_ether_hdr *ehdr = rte_pktmbuf_mtod(mbuf, struct rte_ether_hdr *);
+    struct rte_ipv4_hdr *iphdr = (struct rte_ipv4_hdr *)(ehdr + 1);
+    uint8_t ihl = (iphdr->version_ihl & RTE_IPV4_HDR_IHL_MASK) * RTE_IPV4_IHL_MULTIPLIER;
+    struct rte_icmp_hdr *icmphdr = (struct rte_icmp_hdr *)((uint8_t *)iphdr + ihl);
+
+    rte_ether_addr_copy(&ehdr->s_addr, &ehdr->d_addr);
+    rte_memcpy(ehdr->s_addr.addr_bytes, ConfigManager::getInstance().getSrcMac(), RTE_ETHER_ADDR_LEN);
+
+    // 交换源/目的地址不改变IP头校验和,只有TTL的变化需要增量更新
+    uint32_t addr = iphdr->src_addr;
+    iphdr->src_addr = iphdr->dst_addr;
+    iphdr->dst_addr = addr;
+    uint16_t oldTtl = *(uint16_t *)&iphdr->time_to_live;
+    iphdr->time_to_live = 64;
+    iphdr->hdr_checksum = checksumAdjust(iphdr->hdr_checksum, oldTtl, *(uint16_t *)&iphdr->time_to_live);
+
+    // 类型和代码在同一个16位字中,Echo Request变为Echo Reply只改变这一个字
+    uint16_t oldType = *(uint16_t *)&icmphdr->icmp_type;
+    icmphdr->icmp_type = RTE_IP_ICMP_ECHO_REPLY;
+    icmphdr->icmp_cksum = checksumAdjust(icmphdr->icmp_cksum, oldType, *(uint16_t *)&icmphdr->icmp_type);
+
+    // 接收时的校验和卸载标志对发送没有意义,只保留VLAN标签
+    VlanTable::reflect(mbuf);
+}
+
 struct rte_mbuf *IcmpProcessor::sendIcmpPacket(struct rte_mempool *mbufPool, uint8_t *dstMac,
                                                uint32_t sip, uint32_t dip,
                                                uint16_t id, uint16_t seqNb,
@@ -112,6 +187,128 @@ uint16_t IcmpProcessor::ng_checksum(uint16_t *addr, int count)
     return ~sum;
 }
 
+void IcmpProcessor::initErrorGenerator(uint32_t rate, uint32_t burst, uint32_t srcRate, uint32_t srcBurst)
+{
+    _hz = rte_get_timer_hz();
+    _rate = rate;
+    _burst = burst;
+    _srcRate = srcRate;
+    _srcBurst = srcBurst;
+    _globalBucket = {(uint64_t)burst * _hz, rte_get_timer_cycles()};
+    std::fill(_srcBuckets, _srcBuckets + ICMP_SRC_BUCKETS, _globalBucket);
+    for (auto &bucket : _srcBuckets)
+        bucket.tokens = (uint64_t)srcBurst * _hz;
+
+    // 每个差错报文只需要修改地址、类型和长度,其余字段在这里一次性填好
+    memset(_errorTemplate, 0, sizeof(_errorTemplate));
+    struct rte_ether_hdr *eth = (struct rte_ether_hdr *)_errorTemplate;
+    rte_memcpy(eth->s_addr.addr_bytes, ConfigManager::getInstance().getSrcMac(), RTE_ETHER_ADDR_LEN);
+    eth->ether_type = htons(RTE_ETHER_TYPE_IPV4);
+    struct rte_ipv4_hdr *ip = (struct rte_ipv4_hdr *)(eth + 1);
+    ip->version_ihl = 0x45;
+    ip->type_of_service = 0xc0; // 网络控制报文,与Linux一致
+    ip->time_to_live = 64;
+    ip->next_proto_id = IPPROTO_ICMP;
+    SPDLOG_INFO("ICMP error generator: rate {}/s burst {}, per source rate {}/s burst {}", rate, burst, srcRate, srcBurst);
+}
+
+bool IcmpProcessor::consume(TokenBucket &bucket, uint64_t now, uint32_t rate, uint32_t burst)
+{
+    const uint64_t cap = (uint64_t)burst * _hz;
+    // 空闲时间超过补满所需的时间时直接补满,同时避免乘法溢出
+    uint64_t elapsed = now - bucket.last;
+    if (rate == 0 || elapsed >= cap / rate)
+        bucket.tokens = cap;
+    else
+        bucket.tokens = std::min(cap, bucket.tokens + elapsed * rate);
+    bucket.last = now;
+    if (bucket.tokens < _hz)
+        return false;
+    bucket.tokens -= _hz;
+    return true;
+}
+
+bool IcmpProcessor::allowError(uint32_t srcIp)
+{
+    uint64_t now = rte_get_timer_cycles();
+    TokenBucket &srcBucket = _srcBuckets[rte_jhash_1word(srcIp, 0) & (ICMP_SRC_BUCKETS - 1)];
+    bool allowed;
+    rte_spinlock_lock(&_limitLock);
+    // 先检查源地址的桶,单个源超速时不消耗全局令牌
+    allowed = consume(srcBucket, now, _srcRate, _srcBurst) && consume(_globalBucket, now, _rate, _burst);
+    if (!allowed)
+        _limited++;
+    rte_spinlock_unlock(&_limitLock);
+    return allowed;
+}
+
+int IcmpProcessor::sendError(struct rte_mempool *mbufPool, struct rte_ring *out, struct rte_mbuf *mbuf,
+                             uint8_t type, uint8_t code, uint32_t info)
+{
+    struct rte_ether_hdr *ehdr = rte_pktmbuf_mtod(mbuf, struct rte_ether_hdr *);
+    struct rte_ipv4_hdr *iphdr = (struct rte_ipv4_hdr *)(ehdr + 1);
+    uint8_t ihl = (iphdr->version_ihl & RTE_IPV4_HDR_IHL_MASK) * RTE_IPV4_IHL_MULTIPLIER;
+
+    // RFC 1122 3.2.2: 不对广播/组播、非首片分片和ICMP差错报文生成差错
+    if (!rte_is_unicast_ether_addr(&ehdr->d_addr) || !rte_is_unicast_ether_addr(&ehdr->s_addr))
+        return -1;
+    if (iphdr->src_addr == 0 || iphdr->src_addr == 0xFFFFFFFF || iphdr->dst_addr == 0xFFFFFFFF ||
+        RTE_IS_IPV4_MCAST(ntohl(iphdr->src_addr)) || RTE_IS_IPV4_MCAST(ntohl(iphdr->dst_addr)))
+        return -1;
+    if ((iphdr->fragment_offset & rte_cpu_to_be_16(RTE_IPV4_HDR_OFFSET_MASK)) != 0)
+        return -1;
+    if (iphdr->next_proto_id == IPPROTO_ICMP)
+    {
+        struct rte_icmp_hdr *icmphdr = (struct rte_icmp_hdr *)((uint8_t *)iphdr + ihl);
+        if (icmphdr->icmp_type != RTE_IP_ICMP_ECHO_REQUEST && icmphdr->icmp_type != RTE_IP_ICMP_ECHO_REPLY)
+            return -1;
+    }
+    // 转发的报文目的地址不是本机,差错报文使用接收接口的主地址作为源地址
+    LocalAddrTable &localAddrs = LocalAddrTable::getInstance();
+    const uint32_t srcIp = localAddrs.isLocal(iphdr->dst_addr) ? iphdr->dst_addr : localAddrs.getPrimary(mbuf->port);
+    if (srcIp == 0)
+        return -1;
+    if (!allowError(iphdr->src_addr))
+        return -1;
+
+    // 引用原始IP头和尽可能多的数据,只拷贝第一个分段中的内容
+    uint16_t quoteLen = std::min<uint32_t>({ntohs(iphdr->total_length), ICMP_ERROR_QUOTE_MAX,
+                                            (uint32_t)(rte_pktmbuf_data_len(mbuf) - sizeof(struct rte_ether_hdr))});
+    struct rte_mbuf *txbuf = rte_pktmbuf_alloc(mbufPool);
+    if (txbuf == nullptr)
+    {
+        SPDLOG_ERROR("IcmpProcessor::sendError: Failed to allocate mbuf");
+        return -1;
+    }
+    const uint16_t icmpLen = sizeof(struct rte_icmp_hdr) + quoteLen;
+    const uint16_t totalLength = sizeof(_errorTemplate) + quoteLen;
+    txbuf->pkt_len = totalLength;
+    txbuf->data_len = totalLength;
+    uint8_t *msg = rte_pktmbuf_mtod(txbuf, uint8_t *);
+    rte_memcpy(msg, _errorTemplate, sizeof(_errorTemplate));
+    rte_memcpy(msg + sizeof(_errorTemplate), iphdr, quoteLen);
+
+    struct rte_ether_hdr *eth = (struct rte_ether_hdr *)msg;
+    rte_ether_addr_copy(&ehdr->s_addr, &eth->d_addr);
+    struct rte_ipv4_hdr *ip = (struct rte_ipv4_hdr *)(eth + 1);
+    ip->total_length = htons(sizeof(struct rte_ipv4_hdr) + icmpLen);
+    ip->src_addr = srcIp;
+    ip->dst_addr = iphdr->src_addr;
+    ip->hdr_checksum = rte_ipv4_cksum(ip);
+
+    struct rte_icmp_hdr *icmp = (struct rte_icmp_hdr *)(ip + 1);
+    icmp->icmp_type = type;
+    icmp->icmp_code = code;
+    // 差错报文头部的后4个字节没有标识符和序号,保存类型相关的信息
+    memcpy(&icmp->icmp_ident, &info, sizeof(info));
+    icmp->icmp_cksum = ng_checksum((uint16_t *)icmp, icmpLen);
+
+    VlanTable::copyTag(txbuf, mbuf);
+    SPDLOG_INFO("Send ICMP error type {} code {} to {}", type, code, convert_uint32_to_ip(ip->dst_addr));
+    EgressReorder::getInstance().enqueueOut(out, &txbuf, 1);
+    return 0;
+}
+
 int IcmpProcessor::setNextProcessor(std::shared_ptr<Processor> nextProcessor)
 {
     return 0;
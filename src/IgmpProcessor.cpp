@@ -0,0 +1,356 @@
+#include "IgmpProcessor.hpp"
+#include <rte_random.h>
+#include <arpa/inet.h>
+#include <cstring>
+#include "Reorder.hpp"
+#include "McastFilter.hpp"
+#include "Vlan.hpp"
+#include "Vxlan.hpp"
+#include "Logger.hpp"
+#include "Utils.hpp"
+
+/**
+ * @brief IGMPv1/v2报文和IGMPv3查询的公共部分
+ */
+struct IgmpHdr
+{
+    uint8_t type;    ///< 报文类型
+    uint8_t maxResp; ///< 最大响应时间,只在查询中有意义
+    uint16_t cksum;  ///< 校验和
+    uint32_t group;  ///< 组地址,通用查询为0
+} __attribute__((__packed__));
+
+/**
+ * @brief IGMPv3成员关系报告,后跟若干组记录
+ */
+struct IgmpV3ReportHdr
+{
+    uint8_t type;        ///< IGMP_TYPE_V3_REPORT
+    uint8_t reserved;    ///< 保留
+    uint16_t cksum;      ///< 校验和
+    uint16_t reserved2;  ///< 保留
+    uint16_t nbRecords;  ///< 组记录数量
+} __attribute__((__packed__));
+
+/**
+ * @brief IGMPv3组记录,只加入或离开整个组,源列表总是为空
+ */
+struct IgmpV3Record
+{
+    uint8_t type;        ///< 记录类型
+    uint8_t auxLen;      ///< 辅助数据长度
+    uint16_t nbSources;  ///< 源地址数量
+    uint32_t group;      ///< 组地址
+} __attribute__((__packed__));
+
+void IgmpProcessor::init(const uint8_t *srcMac, unsigned version)
+{
+    rte_memcpy(_srcMac, srcMac, RTE_ETHER_ADDR_LEN);
+    if (version != 2 && version != 3)
+    {
+        SPDLOG_WARN("Unsupported IGMP version {}, use IGMPv3", version);
+        version = 3;
+    }
+    _version = version;
+}
+
+int IgmpProcessor::startTimer(struct rte_mempool *mbufPool, struct rte_ring *out, uint64_t periodMs)
+{
+    _mbufPool = mbufPool;
+    _out = out;
+    rte_timer_init(&_timer);
+    uint64_t ticks = rte_get_timer_hz() / 1000 * periodMs;
+    if (rte_timer_reset(&_timer, ticks, PERIODICAL, rte_lcore_id(), igmpTimerCallback, this) < 0)
+    {
+        SPDLOG_ERROR("Failed to start IGMP timer");
+        return -1;
+    }
+    SPDLOG_INFO("IGMPv{} timer started on lcore {}, period {} ms", _version, rte_lcore_id(), periodMs);
+    return 0;
+}
+
+int IgmpProcessor::join(uint32_t group, uint16_t ifIndex)
+{
+    if (!RTE_IS_IPV4_MCAST(ntohl(group)) || ifIndex >= LOCAL_ADDR_MAX_PORTS)
+        return -1;
+    std::lock_guard<std::mutex> lock(_mutex);
+    int slot = -1;
+    int freeSlot = -1;
+    for (unsigned i = 0; i < IGMP_MAX_GROUPS; i++)
+    {
+        Group &g = _groups[i];
+        if (g.users == 0 && g.pending == REPORT_NONE)
+        {
+            if (freeSlot < 0)
+                freeSlot = i;
+            continue;
+        }
+        if (g.group == group && g.ifIndex == ifIndex)
+        {
+            slot = i;
+            break;
+        }
+    }
+    if (slot >= 0 && _groups[slot].users > 0)
+    {
+        _groups[slot].users++;
+        return 0;
+    }
+    // 还在发送离开报文的组直接复用原来的槽位
+    if (slot < 0)
+        slot = freeSlot;
+    if (slot < 0)
+    {
+        SPDLOG_ERROR("Too many multicast groups, join {} on interface {} failed", convert_uint32_to_ip(group), ifIndex);
+        return -1;
+    }
+
+    Group &g = _groups[slot];
+    g.group = group;
+    g.ifIndex = ifIndex;
+    g.users = 1;
+    // 所有主机组不发送报告(RFC 3376 5),其他组在下一次定时器触发时发出第一个主动报告
+    g.pending = ntohl(group) == IGMP_ALL_HOSTS ? REPORT_NONE : REPORT_JOIN;
+    g.retransLeft = IGMP_ROBUSTNESS - 1;
+    g.dueMs = 0;
+    _members[slot].store(memberKey(group, ifIndex), std::memory_order_release);
+    updateMacFilterLocked();
+    SPDLOG_INFO("Join multicast group {} on interface {}", convert_uint32_to_ip(group), ifIndex);
+    return 0;
+}
+
+int IgmpProcessor::leave(uint32_t group, uint16_t ifIndex)
+{
+    std::lock_guard<std::mutex> lock(_mutex);
+    for (unsigned i = 0; i < IGMP_MAX_GROUPS; i++)
+    {
+        Group &g = _groups[i];
+        if (g.users == 0 || g.group != group || g.ifIndex != ifIndex)
+            continue;
+        if (--g.users > 0)
+            return 0;
+        _members[i].store(0, std::memory_order_release);
+        g.pending = ntohl(group) == IGMP_ALL_HOSTS ? REPORT_NONE : REPORT_LEAVE;
+        g.retransLeft = IGMP_ROBUSTNESS - 1;
+        g.dueMs = 0;
+        updateMacFilterLocked();
+        SPDLOG_INFO("Leave multicast group {} on interface {}", convert_uint32_to_ip(group), ifIndex);
+        return 0;
+    }
+    return -1;
+}
+
+void IgmpProcessor::handlePacket(struct rte_mbuf *mbuf)
+{
+    const struct rte_ipv4_hdr *iphdr = rte_pktmbuf_mtod_offset(mbuf, struct rte_ipv4_hdr *, sizeof(struct rte_ether_hdr));
+    const uint16_t ihl = rte_ipv4_hdr_len(iphdr);
+    const uint16_t igmpLen = rte_be_to_cpu_16(iphdr->total_length) - ihl;
+    const uint16_t ifIndex = mbuf->port;
+    const struct IgmpHdr *igmp = (const struct IgmpHdr *)((const uint8_t *)iphdr + ihl);
+    // IGMP报文很短,不会分片;重组后的多段报文同样不处理
+    if (mbuf->nb_segs != 1 || igmpLen < sizeof(struct IgmpHdr) || ifIndex >= LOCAL_ADDR_MAX_PORTS ||
+        (iphdr->fragment_offset & rte_cpu_to_be_16(RTE_IPV4_HDR_MF_FLAG | RTE_IPV4_HDR_OFFSET_MASK)) != 0 ||
+        rte_raw_cksum(igmp, igmpLen) != 0xffff)
+    {
+        rte_pktmbuf_free(mbuf);
+        return;
+    }
+
+    const uint64_t now = nowMs();
+    std::lock_guard<std::mutex> lock(_mutex);
+    if (igmp->type == IGMP_TYPE_QUERY)
+    {
+        uint64_t maxRespMs;
+        if (igmpLen == sizeof(struct IgmpHdr))
+        {
+            // 8字节的查询来自IGMPv1/v2路由器,之后一段时间内只发送IGMPv2报文
+            maxRespMs = igmp->maxResp == 0 ? IGMP_V2_MAX_RESP_MS : igmp->maxResp * 100;
+            _olderQuerierUntilMs[ifIndex] = now + IGMP_OLDER_QUERIER_MS;
+        }
+        else if (igmpLen >= 12)
+        {
+            // IGMPv3最大响应码不小于128时是浮点格式:尾数4位,指数3位(RFC 3376 4.1.1)
+            const uint8_t code = igmp->maxResp;
+            const uint32_t tenths = code < 128 ? code : ((code & 0x0F) | 0x10) << (((code >> 4) & 0x07) + 3);
+            maxRespMs = (uint64_t)tenths * 100;
+        }
+        else
+        {
+            // 9~11字节的查询按RFC 3376 7.1忽略
+            rte_pktmbuf_free(mbuf);
+            return;
+        }
+        if (maxRespMs == 0)
+            maxRespMs = 1;
+
+        for (unsigned i = 0; i < IGMP_MAX_GROUPS; i++)
+        {
+            Group &g = _groups[i];
+            if (g.users == 0 || g.ifIndex != ifIndex || ntohl(g.group) == IGMP_ALL_HOSTS ||
+                (igmp->group != 0 && igmp->group != g.group))
+                continue;
+            // 在最大响应时间内随机延迟,已经安排的更早的报告不推迟
+            const uint64_t due = now + rte_rand() % maxRespMs;
+            if (g.pending == REPORT_NONE)
+            {
+                g.pending = REPORT_CURRENT;
+                g.retransLeft = 0;
+                g.dueMs = due;
+            }
+            else if (due < g.dueMs)
+            {
+                g.dueMs = due;
+            }
+        }
+    }
+    else if ((igmp->type == IGMP_TYPE_V1_REPORT || igmp->type == IGMP_TYPE_V2_REPORT) && versionLocked(ifIndex, now) == 2)
+    {
+        // 同一网段上已经有主机报告了该组,本机不再应答这次查询(RFC 2236 3)
+        for (unsigned i = 0; i < IGMP_MAX_GROUPS; i++)
+        {
+            Group &g = _groups[i];
+            if (g.users > 0 && g.ifIndex == ifIndex && g.group == igmp->group && g.pending == REPORT_CURRENT)
+                g.pending = REPORT_NONE;
+        }
+    }
+    rte_pktmbuf_free(mbuf);
+}
+
+void IgmpProcessor::igmpTimerCallback(__attribute__((unused)) struct rte_timer *timer, void *arg)
+{
+    IgmpProcessor *self = (IgmpProcessor *)arg;
+    const uint64_t now = nowMs();
+    std::lock_guard<std::mutex> lock(self->_mutex);
+    for (unsigned i = 0; i < IGMP_MAX_GROUPS; i++)
+    {
+        Group &g = self->_groups[i];
+        if (g.pending == REPORT_NONE || now < g.dueMs)
+            continue;
+        self->sendReport(g, g.pending, now);
+        if (g.retransLeft > 0)
+        {
+            g.retransLeft--;
+            g.dueMs = now + IGMP_UNSOLICITED_MS;
+            continue;
+        }
+        // 离开报文发完后槽位才空闲
+        g.pending = REPORT_NONE;
+    }
+}
+
+unsigned IgmpProcessor::versionLocked(uint16_t ifIndex, uint64_t now) const
+{
+    return (_version == 2 || now < _olderQuerierUntilMs[ifIndex]) ? 2 : 3;
+}
+
+void IgmpProcessor::sendReport(const Group &group, ReportKind kind, uint64_t now)
+{
+    const unsigned version = versionLocked(group.ifIndex, now);
+    uint32_t dstIp;
+    uint16_t igmpLen;
+    if (version == 3)
+    {
+        dstIp = rte_cpu_to_be_32(IGMP_V3_ROUTERS);
+        igmpLen = sizeof(struct IgmpV3ReportHdr) + sizeof(struct IgmpV3Record);
+    }
+    else
+    {
+        dstIp = kind == REPORT_LEAVE ? rte_cpu_to_be_32(IGMP_ALL_ROUTERS) : group.group;
+        igmpLen = sizeof(struct IgmpHdr);
+    }
+    const uint16_t totalLen = sizeof(struct rte_ether_hdr) + IGMP_IP_HDR_LEN + igmpLen;
+    struct rte_mbuf *mbuf = rte_pktmbuf_alloc(_mbufPool);
+    if (mbuf == nullptr)
+    {
+        SPDLOG_ERROR("Failed to allocate mbuf for IGMP report");
+        return;
+    }
+    mbuf->pkt_len = totalLen;
+    mbuf->data_len = totalLen;
+
+    struct rte_ether_hdr *eth = rte_pktmbuf_mtod(mbuf, struct rte_ether_hdr *);
+    rte_memcpy(eth->s_addr.addr_bytes, _srcMac, RTE_ETHER_ADDR_LEN);
+    groupMac(dstIp, &eth->d_addr);
+    eth->ether_type = rte_cpu_to_be_16(RTE_ETHER_TYPE_IPV4);
+
+    // 报告只在本网段内有效:TTL为1,带路由器告警选项(RFC 2113),服务类型为网间控制
+    struct rte_ipv4_hdr *ip = (struct rte_ipv4_hdr *)(eth + 1);
+    ip->version_ihl = 0x40 | (IGMP_IP_HDR_LEN / RTE_IPV4_IHL_MULTIPLIER);
+    ip->type_of_service = 0xc0;
+    ip->total_length = rte_cpu_to_be_16(IGMP_IP_HDR_LEN + igmpLen);
+    ip->packet_id = rte_cpu_to_be_16(_ipId++);
+    ip->fragment_offset = 0;
+    ip->time_to_live = 1;
+    ip->next_proto_id = IPPROTO_IGMP;
+    ip->src_addr = LocalAddrTable::getInstance().getPrimary(group.ifIndex);
+    ip->dst_addr = dstIp;
+    uint8_t *option = (uint8_t *)(ip + 1);
+    option[0] = 0x94;
+    option[1] = 4;
+    option[2] = 0;
+    option[3] = 0;
+    // rte_ipv4_cksum只覆盖20字节的固定头部,选项需要一起计算
+    ip->hdr_checksum = 0;
+    uint16_t cksum = rte_raw_cksum(ip, IGMP_IP_HDR_LEN);
+    ip->hdr_checksum = cksum == 0xffff ? cksum : (uint16_t)~cksum;
+
+    uint8_t *msg = (uint8_t *)ip + IGMP_IP_HDR_LEN;
+    if (version == 3)
+    {
+        struct IgmpV3ReportHdr *report = (struct IgmpV3ReportHdr *)msg;
+        report->type = IGMP_TYPE_V3_REPORT;
+        report->reserved = 0;
+        report->cksum = 0;
+        report->reserved2 = 0;
+        report->nbRecords = rte_cpu_to_be_16(1);
+        struct IgmpV3Record *record = (struct IgmpV3Record *)(report + 1);
+        record->type = kind == REPORT_JOIN    ? IGMP_V3_CHANGE_TO_EXCLUDE
+                       : kind == REPORT_LEAVE ? IGMP_V3_CHANGE_TO_INCLUDE
+                                              : IGMP_V3_MODE_IS_EXCLUDE;
+        record->auxLen = 0;
+        record->nbSources = 0;
+        record->group = group.group;
+        report->cksum = ~rte_raw_cksum(msg, igmpLen);
+    }
+    else
+    {
+        struct IgmpHdr *igmp = (struct IgmpHdr *)msg;
+        igmp->type = kind == REPORT_LEAVE ? IGMP_TYPE_V2_LEAVE : IGMP_TYPE_V2_REPORT;
+        igmp->maxResp = 0;
+        igmp->cksum = 0;
+        igmp->group = group.group;
+        igmp->cksum = ~rte_raw_cksum(msg, igmpLen);
+    }
+
+    VlanTable::getInstance().tagTx(mbuf, group.ifIndex);
+    SPDLOG_INFO("Send IGMPv{} {} for group {} on interface {}", version, kind == REPORT_LEAVE ? "leave" : "report",
+                convert_uint32_to_ip(group.group), group.ifIndex);
+    EgressReorder::getInstance().enqueueOut(_out, &mbuf, 1);
+}
+
+void IgmpProcessor::updateMacFilterLocked()
+{
+    // 隧道接口的内层帧不经过网卡的过滤表
+    struct rte_ether_addr addrs[IGMP_MAX_GROUPS];
+    unsigned nbAddrs = 0;
+    for (unsigned i = 0; i < IGMP_MAX_GROUPS; i++)
+    {
+        const Group &g = _groups[i];
+        if (g.users == 0 || g.ifIndex >= VXLAN_IF_BASE)
+            continue;
+        groupMac(g.group, &addrs[nbAddrs++]);
+    }
+    // 过滤表还包含IPv6邻居发现的地址,由McastFilter合并后整体写入
+    McastFilter::getInstance().setAddrs(MCAST_SRC_IGMP, addrs, nbAddrs);
+}
+
+void IgmpProcessor::groupMac(uint32_t group, struct rte_ether_addr *mac)
+{
+    const uint32_t addr = rte_be_to_cpu_32(group);
+    mac->addr_bytes[0] = 0x01;
+    mac->addr_bytes[1] = 0x00;
+    mac->addr_bytes[2] = 0x5e;
+    mac->addr_bytes[3] = (addr >> 16) & 0x7f;
+    mac->addr_bytes[4] = (addr >> 8) & 0xff;
+    mac->addr_bytes[5] = addr & 0xff;
+}
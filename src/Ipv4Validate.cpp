@@ -0,0 +1,22 @@
+#include "Ipv4Validate.hpp"
+#include "Rps.hpp"
+#include "Logger.hpp"
+
+static const char *DROP_REASON_NAMES[IPV4_DROP_MAX] = {"truncated", "version", "ihl", "ttl", "addr", "cksum", "l4"};
+
+void Ipv4Validator::dumpStats()
+{
+    for (unsigned w = 0; w < RpsDispatcher::getInstance().getWorkerCount(); w++)
+    {
+        const uint64_t *drops = _workers[w].drops;
+        uint64_t sum = 0;
+        for (unsigned r = 0; r < IPV4_DROP_MAX; r++)
+            sum += drops[r];
+        if (sum == 0)
+            continue;
+        SPDLOG_INFO("IPv4 validation worker {}: {} {}, {} {}, {} {}, {} {}, {} {}, {} {}, {} {}", w,
+                    DROP_REASON_NAMES[0], drops[0], DROP_REASON_NAMES[1], drops[1], DROP_REASON_NAMES[2], drops[2],
+                    DROP_REASON_NAMES[3], drops[3], DROP_REASON_NAMES[4], drops[4], DROP_REASON_NAMES[5], drops[5],
+                    DROP_REASON_NAMES[6], drops[6]);
+    }
+}
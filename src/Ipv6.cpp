@@ -0,0 +1,496 @@
+#include "Ipv6.hpp"
+#include <rte_cycles.h>
+#include <arpa/inet.h>
+#include <cstdlib>
+#include "Logger.hpp"
+#include "Utils.hpp"
+#include "Reorder.hpp"
+#include "UdpProcessor.hpp"
+#include "TcpProcessor.hpp"
+#include "McastFilter.hpp"
+
+using std::lock_guard;
+using std::mutex;
+
+/// 所有节点组播地址ff02::1
+static const uint8_t ALL_NODES[IPV6_ADDR_LEN] = {0xff, 0x02, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0x01};
+
+std::string ipv6ToString(const uint8_t *addr)
+{
+    char buf[INET6_ADDRSTRLEN] = {0};
+    inet_ntop(AF_INET6, addr, buf, sizeof(buf));
+    return std::string(buf);
+}
+
+/**
+ * @brief 两个地址的前prefixLen位是否相同
+ */
+static bool ipv6SamePrefix(const uint8_t *a, const uint8_t *b, uint8_t prefixLen)
+{
+    unsigned bytes = prefixLen / 8;
+    if (memcmp(a, b, bytes) != 0)
+        return false;
+    unsigned bits = prefixLen % 8;
+    if (bits == 0)
+        return true;
+    uint8_t mask = (uint8_t)(0xff << (8 - bits));
+    return (a[bytes] & mask) == (b[bytes] & mask);
+}
+
+/**
+ * @brief 地址对应的以太网组播地址33:33:xx:xx:xx:xx(RFC 2464)
+ */
+static void ipv6MulticastMac(const uint8_t *addr, uint8_t *mac)
+{
+    mac[0] = 0x33;
+    mac[1] = 0x33;
+    memcpy(mac + 2, addr + 12, 4);
+}
+
+uint64_t Ipv6Processor::nowMs()
+{
+    return rte_get_timer_cycles() / (rte_get_timer_hz() / 1000);
+}
+
+int Ipv6Processor::init(uint16_t portId, const uint8_t *mac, const std::vector<std::string> &addrs, const std::string &gateway,
+                        uint16_t linkMtu, unsigned pendingDepth)
+{
+    if (linkMtu < IPV6_MIN_MTU)
+    {
+        SPDLOG_ERROR("Link MTU {} is below the IPv6 minimum {}", linkMtu, IPV6_MIN_MTU);
+        return -1;
+    }
+    _portId = portId;
+    memcpy(_mac, mac, RTE_ETHER_ADDR_LEN);
+    _linkMtu = linkMtu;
+    _pendingDepth = pendingDepth;
+
+    // 链路本地地址fe80::/64,接口标识按EUI-64由MAC地址生成
+    uint8_t linkLocal[IPV6_ADDR_LEN] = {0xfe, 0x80};
+    linkLocal[8] = mac[0] ^ 0x02;
+    linkLocal[9] = mac[1];
+    linkLocal[10] = mac[2];
+    linkLocal[11] = 0xff;
+    linkLocal[12] = 0xfe;
+    linkLocal[13] = mac[3];
+    linkLocal[14] = mac[4];
+    linkLocal[15] = mac[5];
+    addAddr(linkLocal, 64);
+
+    for (const std::string &str : addrs)
+    {
+        size_t slash = str.find('/');
+        std::string addrStr = str.substr(0, slash);
+        int prefixLen = slash == std::string::npos ? 128 : atoi(str.c_str() + slash + 1);
+        uint8_t addr[IPV6_ADDR_LEN];
+        if (inet_pton(AF_INET6, addrStr.c_str(), addr) != 1 || prefixLen < 0 || prefixLen > 128)
+        {
+            SPDLOG_WARN("Invalid local IPv6 address {}, skipped", str);
+            continue;
+        }
+        addAddr(addr, (uint8_t)prefixLen);
+    }
+
+    if (!gateway.empty())
+    {
+        if (inet_pton(AF_INET6, gateway.c_str(), _gateway) == 1)
+            _hasGateway = true;
+        else
+            SPDLOG_WARN("Invalid IPv6 gateway {}, ignored", gateway);
+    }
+    _enabled = true;
+    return 0;
+}
+
+int Ipv6Processor::addAddr(const uint8_t *addr, uint8_t prefixLen)
+{
+    lock_guard<mutex> lock(_mutex);
+    unsigned nb = _nbAddrs.load(std::memory_order_relaxed);
+    if (nb >= IPV6_MAX_LOCAL_ADDRS)
+    {
+        SPDLOG_ERROR("Too many local IPv6 addresses, {} ignored", ipv6ToString(addr));
+        return -1;
+    }
+    memcpy(_addrs[nb].addr, addr, IPV6_ADDR_LEN);
+    _addrs[nb].prefixLen = prefixLen;
+    // 先写地址再发布数量,读者不加锁
+    _nbAddrs.store(nb + 1, std::memory_order_release);
+    SPDLOG_INFO("Local IPv6 address {}/{}", ipv6ToString(addr), prefixLen);
+    updateMacFilterLocked();
+    return 0;
+}
+
+void Ipv6Processor::updateMacFilterLocked()
+{
+    // 邻居请求发往请求节点组播地址,重复地址检测的应答发往所有节点,网卡不接收这些帧时邻居发现无法工作
+    struct rte_ether_addr addrs[IPV6_MAX_LOCAL_ADDRS + 1];
+    unsigned nbAddrs = 0;
+    ipv6MulticastMac(ALL_NODES, addrs[nbAddrs++].addr_bytes);
+    const unsigned nb = _nbAddrs.load(std::memory_order_relaxed);
+    for (unsigned i = 0; i < nb; i++)
+    {
+        uint8_t solicited[IPV6_ADDR_LEN] = {0xff, 0x02, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0x01, 0xff};
+        memcpy(solicited + 13, _addrs[i].addr + 13, 3);
+        ipv6MulticastMac(solicited, addrs[nbAddrs++].addr_bytes);
+    }
+    McastFilter::getInstance().setAddrs(MCAST_SRC_NDP, addrs, nbAddrs);
+}
+
+bool Ipv6Processor::isLocal(const uint8_t *addr) const
+{
+    unsigned nb = _nbAddrs.load(std::memory_order_acquire);
+    for (unsigned i = 0; i < nb; i++)
+    {
+        if (ipv6Equal(_addrs[i].addr, addr))
+            return true;
+    }
+    return false;
+}
+
+bool Ipv6Processor::isSolicitedNode(const uint8_t *addr) const
+{
+    static const uint8_t PREFIX[13] = {0xff, 0x02, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0x01, 0xff};
+    if (memcmp(addr, PREFIX, sizeof(PREFIX)) != 0)
+        return false;
+    unsigned nb = _nbAddrs.load(std::memory_order_acquire);
+    for (unsigned i = 0; i < nb; i++)
+    {
+        if (memcmp(_addrs[i].addr + 13, addr + 13, 3) == 0)
+            return true;
+    }
+    return false;
+}
+
+const uint8_t *Ipv6Processor::getPrimary() const
+{
+    unsigned nb = _nbAddrs.load(std::memory_order_acquire);
+    return nb > 1 ? _addrs[1].addr : _addrs[0].addr;
+}
+
+const uint8_t *Ipv6Processor::nextHop(const uint8_t *dst) const
+{
+    // 链路本地地址和组播地址总是直连
+    if (dst[0] == 0xff || (dst[0] == 0xfe && (dst[1] & 0xc0) == 0x80))
+        return dst;
+    unsigned nb = _nbAddrs.load(std::memory_order_acquire);
+    for (unsigned i = 1; i < nb; i++)
+    {
+        if (ipv6SamePrefix(_addrs[i].addr, dst, _addrs[i].prefixLen))
+            return dst;
+    }
+    return _hasGateway ? _gateway : nullptr;
+}
+
+int Ipv6Processor::handlePacket(struct rte_mempool *mbufPool, struct rte_mbuf *mbuf, struct inout_ring *ring)
+{
+    const int32_t l3Len = (int32_t)rte_pktmbuf_pkt_len(mbuf) - (int32_t)sizeof(struct rte_ether_hdr);
+    struct rte_ipv6_hdr *ip6 = rte_pktmbuf_mtod_offset(mbuf, struct rte_ipv6_hdr *, sizeof(struct rte_ether_hdr));
+    // 与IPv4相同的基本校验:头部完整、版本号、长度不超过报文、跳数限制不为0
+    if (rte_pktmbuf_data_len(mbuf) < sizeof(struct rte_ether_hdr) + sizeof(struct rte_ipv6_hdr) ||
+        (rte_be_to_cpu_32(ip6->vtc_flow) >> 28) != 6 || ip6->hop_limits == 0 ||
+        (int32_t)(sizeof(struct rte_ipv6_hdr) + rte_be_to_cpu_16(ip6->payload_len)) > l3Len)
+    {
+        rte_pktmbuf_free(mbuf);
+        return -1;
+    }
+    const int32_t ip6Len = sizeof(struct rte_ipv6_hdr) + rte_be_to_cpu_16(ip6->payload_len);
+    if (l3Len > ip6Len)
+        rte_pktmbuf_trim(mbuf, l3Len - ip6Len);
+
+    if (!isLocal(ip6->dst_addr) && !isSolicitedNode(ip6->dst_addr) && !ipv6Equal(ip6->dst_addr, ALL_NODES))
+    {
+        rte_pktmbuf_free(mbuf);
+        return -1;
+    }
+
+    switch (ip6->proto)
+    {
+    case IPPROTO_ICMPV6:
+        handleIcmp6(mbuf, ip6, ring);
+        return 0;
+    case IPPROTO_UDP:
+        UdpProcessor::getInstance().udp6Process(mbuf);
+        return 0;
+    case IPPROTO_TCP:
+        // TCP模块已把负载拷贝到接收队列,报文在这里释放
+        if (TcpProcessor::getInstance().tcp6Process(mbuf) == -2)
+            TcpProcessor::getInstance().tcpSendReset6(mbuf, ring->out);
+        else
+            rte_pktmbuf_free(mbuf);
+        return 0;
+    default:
+        // 扩展头和其他上层协议不支持
+        SPDLOG_INFO("Drop IPv6 packet with next header {}", ip6->proto);
+        rte_pktmbuf_free(mbuf);
+        return -1;
+    }
+}
+
+void Ipv6Processor::handleIcmp6(struct rte_mbuf *mbuf, struct rte_ipv6_hdr *ip6, struct inout_ring *ring)
+{
+    const uint16_t icmpLen = rte_be_to_cpu_16(ip6->payload_len);
+    struct Icmp6Hdr *icmp = (struct Icmp6Hdr *)(ip6 + 1);
+    const bool exclusive = rte_mbuf_refcnt_read(mbuf) == 1 && RTE_MBUF_DIRECT(mbuf) && mbuf->nb_segs == 1;
+    if (icmpLen < sizeof(struct Icmp6Hdr) || mbuf->nb_segs != 1 ||
+        ((mbuf->ol_flags & PKT_RX_L4_CKSUM_MASK) != PKT_RX_L4_CKSUM_GOOD && rte_ipv6_udptcp_cksum(ip6, icmp) != 0xffff))
+    {
+        rte_pktmbuf_free(mbuf);
+        return;
+    }
+
+    if (icmp->type == ICMPV6_ECHO_REQUEST && isLocal(ip6->dst_addr) && exclusive)
+    {
+        reflectEchoRequest(mbuf, ip6, icmp);
+        EgressReorder::getInstance().enqueueOut(ring->out, &mbuf, 1);
+        return;
+    }
+
+    // RFC 4861 7.1: 邻居发现报文的跳数限制必须是255,代码必须是0
+    if ((icmp->type == ICMPV6_NEIGHBOR_SOLICIT || icmp->type == ICMPV6_NEIGHBOR_ADVERT) &&
+        ip6->hop_limits == ND_HOP_LIMIT && icmp->code == 0 && icmpLen >= sizeof(struct Icmp6Hdr) + IPV6_ADDR_LEN)
+    {
+        struct NdMsg *nd = (struct NdMsg *)icmp;
+        const bool hasLladdr = icmpLen >= sizeof(struct NdMsg) && nd->optLen == 1;
+        if (icmp->type == ICMPV6_NEIGHBOR_SOLICIT && isLocal(nd->target))
+        {
+            if (hasLladdr && nd->optType == ND_OPT_SOURCE_LLADDR && !ipv6IsUnspecified(ip6->src_addr))
+                learn(ip6->src_addr, nd->lladdr, ring->out, true, true);
+            // 共享的报文不能原地改写,对方会重传请求
+            if (exclusive)
+            {
+                reflectNeighborSolicit(mbuf, ip6, nd);
+                EgressReorder::getInstance().enqueueOut(ring->out, &mbuf, 1);
+                return;
+            }
+        }
+        else if (icmp->type == ICMPV6_NEIGHBOR_ADVERT && hasLladdr && nd->optType == ND_OPT_TARGET_LLADDR)
+        {
+            learn(nd->target, nd->lladdr, ring->out, false,
+                  (rte_be_to_cpu_32(nd->hdr.data) & ND_NA_FLAG_OVERRIDE) != 0);
+        }
+    }
+    rte_pktmbuf_free(mbuf);
+}
+
+void Ipv6Processor::reflectEchoRequest(struct rte_mbuf *mbuf, struct rte_ipv6_hdr *ip6, struct Icmp6Hdr *icmp)
+{
+    struct rte_ether_hdr *ehdr = rte_pktmbuf_mtod(mbuf, struct rte_ether_hdr *);
+    rte_ether_addr_copy(&ehdr->s_addr, &ehdr->d_addr);
+    memcpy(ehdr->s_addr.addr_bytes, _mac, RTE_ETHER_ADDR_LEN);
+
+    // 交换源/目的地址不改变伪首部的校验和,只有类型字段需要增量更新
+    uint8_t addr[IPV6_ADDR_LEN];
+    memcpy(addr, ip6->src_addr, IPV6_ADDR_LEN);
+    memcpy(ip6->src_addr, ip6->dst_addr, IPV6_ADDR_LEN);
+    memcpy(ip6->dst_addr, addr, IPV6_ADDR_LEN);
+    ip6->hop_limits = IPV6_DEFAULT_HOP_LIMIT;
+
+    uint16_t oldType = *(uint16_t *)&icmp->type;
+    icmp->type = ICMPV6_ECHO_REPLY;
+    icmp->cksum = checksumAdjust(icmp->cksum, oldType, *(uint16_t *)&icmp->type);
+    mbuf->ol_flags = 0;
+}
+
+void Ipv6Processor::reflectNeighborSolicit(struct rte_mbuf *mbuf, struct rte_ipv6_hdr *ip6, struct NdMsg *nd)
+{
+    struct rte_ether_hdr *ehdr = rte_pktmbuf_mtod(mbuf, struct rte_ether_hdr *);
+    // 来自未指定地址的请求(重复地址检测)只能组播应答
+    const bool fromUnspecified = ipv6IsUnspecified(ip6->src_addr);
+    if (fromUnspecified)
+    {
+        memcpy(ip6->dst_addr, ALL_NODES, IPV6_ADDR_LEN);
+        ipv6MulticastMac(ALL_NODES, ehdr->d_addr.addr_bytes);
+    }
+    else
+    {
+        memcpy(ip6->dst_addr, ip6->src_addr, IPV6_ADDR_LEN);
+        rte_ether_addr_copy(&ehdr->s_addr, &ehdr->d_addr);
+    }
+    memcpy(ehdr->s_addr.addr_bytes, _mac, RTE_ETHER_ADDR_LEN);
+    memcpy(ip6->src_addr, nd->target, IPV6_ADDR_LEN);
+    ip6->hop_limits = ND_HOP_LIMIT;
+
+    // 请求可能不带源链路层地址选项,应答固定为带目标链路层地址选项的32字节
+    const uint32_t ndLen = sizeof(struct NdMsg);
+    const uint32_t curLen = rte_be_to_cpu_16(ip6->payload_len);
+    if (curLen < ndLen)
+        rte_pktmbuf_append(mbuf, ndLen - curLen);
+    else if (curLen > ndLen)
+        rte_pktmbuf_trim(mbuf, curLen - ndLen);
+    ip6->payload_len = rte_cpu_to_be_16(ndLen);
+
+    nd->hdr.type = ICMPV6_NEIGHBOR_ADVERT;
+    nd->hdr.code = 0;
+    nd->hdr.data = rte_cpu_to_be_32(ND_NA_FLAG_OVERRIDE | (fromUnspecified ? 0 : ND_NA_FLAG_SOLICITED));
+    nd->optType = ND_OPT_TARGET_LLADDR;
+    nd->optLen = 1;
+    memcpy(nd->lladdr, _mac, RTE_ETHER_ADDR_LEN);
+    nd->hdr.cksum = 0;
+    nd->hdr.cksum = rte_ipv6_udptcp_cksum(ip6, nd);
+    mbuf->ol_flags = 0;
+}
+
+void Ipv6Processor::sendSolicit(struct rte_mempool *mbufPool, struct rte_ring *out, const uint8_t *target)
+{
+    const uint16_t length = sizeof(struct rte_ether_hdr) + sizeof(struct rte_ipv6_hdr) + sizeof(struct NdMsg);
+    struct rte_mbuf *mbuf = rte_pktmbuf_alloc(mbufPool);
+    if (mbuf == nullptr)
+        return;
+    mbuf->data_len = length;
+    mbuf->pkt_len = length;
+
+    // 请求节点组播地址ff02::1:ff00:0/104加目标地址的后24位
+    uint8_t solicited[IPV6_ADDR_LEN] = {0xff, 0x02, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0x01, 0xff};
+    memcpy(solicited + 13, target + 13, 3);
+
+    struct rte_ether_hdr *eth = rte_pktmbuf_mtod(mbuf, struct rte_ether_hdr *);
+    memcpy(eth->s_addr.addr_bytes, _mac, RTE_ETHER_ADDR_LEN);
+    ipv6MulticastMac(solicited, eth->d_addr.addr_bytes);
+    eth->ether_type = rte_cpu_to_be_16(RTE_ETHER_TYPE_IPV6);
+
+    struct rte_ipv6_hdr *ip6 = (struct rte_ipv6_hdr *)(eth + 1);
+    ip6->vtc_flow = rte_cpu_to_be_32(6u << 28);
+    ip6->payload_len = rte_cpu_to_be_16(sizeof(struct NdMsg));
+    ip6->proto = IPPROTO_ICMPV6;
+    ip6->hop_limits = ND_HOP_LIMIT;
+    memcpy(ip6->src_addr, _addrs[0].addr, IPV6_ADDR_LEN);
+    memcpy(ip6->dst_addr, solicited, IPV6_ADDR_LEN);
+
+    struct NdMsg *nd = (struct NdMsg *)(ip6 + 1);
+    nd->hdr.type = ICMPV6_NEIGHBOR_SOLICIT;
+    nd->hdr.code = 0;
+    nd->hdr.data = 0;
+    memcpy(nd->target, target, IPV6_ADDR_LEN);
+    nd->optType = ND_OPT_SOURCE_LLADDR;
+    nd->optLen = 1;
+    memcpy(nd->lladdr, _mac, RTE_ETHER_ADDR_LEN);
+    nd->hdr.cksum = 0;
+    nd->hdr.cksum = rte_ipv6_udptcp_cksum(ip6, nd);
+
+    SPDLOG_INFO("Send neighbor solicitation for {}", ipv6ToString(target));
+    EgressReorder::getInstance().enqueueOut(out, &mbuf, 1);
+}
+
+void Ipv6Processor::learn(const uint8_t *ip, const uint8_t *mac, struct rte_ring *out, bool create, bool override)
+{
+    std::deque<struct rte_mbuf *> pending;
+    {
+        lock_guard<mutex> lock(_mutex);
+        const uint64_t now = nowMs();
+        auto it = _neighbors.find(toKey(ip));
+        if (it == _neighbors.end())
+        {
+            // 未经请求的通告不创建条目,防止任意主机填满邻居表
+            if (!create)
+                return;
+            if (_neighbors.size() >= ND_MAX_NEIGHBORS)
+            {
+                expireLocked(now);
+                if (_neighbors.size() >= ND_MAX_NEIGHBORS)
+                    return;
+            }
+            it = _neighbors.emplace(toKey(ip), Neighbor()).first;
+        }
+        Neighbor &neighbor = it->second;
+        if (neighbor.resolved && memcmp(neighbor.mac, mac, RTE_ETHER_ADDR_LEN) != 0)
+        {
+            if (!override)
+                return;
+            _generation.store(_generation.load(std::memory_order_relaxed) + 1, std::memory_order_release);
+        }
+        memcpy(neighbor.mac, mac, RTE_ETHER_ADDR_LEN);
+        neighbor.resolved = true;
+        neighbor.lastUsedMs = now;
+        pending.swap(neighbor.pending);
+    }
+    if (pending.empty())
+        return;
+
+    std::vector<struct rte_mbuf *> burst(pending.begin(), pending.end());
+    for (struct rte_mbuf *mbuf : burst)
+    {
+        struct rte_ether_hdr *ehdr = rte_pktmbuf_mtod(mbuf, struct rte_ether_hdr *);
+        memcpy(ehdr->d_addr.addr_bytes, mac, RTE_ETHER_ADDR_LEN);
+    }
+    SPDLOG_INFO("Flush {} pending packets to {}", burst.size(), ipv6ToString(ip));
+    EgressReorder::getInstance().enqueueOut(out, burst.data(), burst.size());
+}
+
+bool Ipv6Processor::lookupSlow(const uint8_t *nextHop, Nd6CacheEntry *cache)
+{
+    lock_guard<mutex> lock(_mutex);
+    auto it = _neighbors.find(toKey(nextHop));
+    if (it == _neighbors.end() || !it->second.resolved)
+        return false;
+    it->second.lastUsedMs = nowMs();
+    memcpy(cache->ip, nextHop, IPV6_ADDR_LEN);
+    memcpy(cache->mac, it->second.mac, RTE_ETHER_ADDR_LEN);
+    cache->generation = _generation.load(std::memory_order_relaxed);
+    return true;
+}
+
+int Ipv6Processor::queuePending(struct rte_mempool *mbufPool, struct rte_ring *out, const uint8_t *nextHop, struct rte_mbuf *mbuf)
+{
+    struct rte_mbuf *dropped = nullptr;
+    bool solicit = false;
+    {
+        lock_guard<mutex> lock(_mutex);
+        const uint64_t now = nowMs();
+        auto it = _neighbors.find(toKey(nextHop));
+        if (it == _neighbors.end())
+        {
+            if (_neighbors.size() >= ND_MAX_NEIGHBORS)
+                expireLocked(now);
+            if (_neighbors.size() >= ND_MAX_NEIGHBORS)
+            {
+                dropped = mbuf;
+                mbuf = nullptr;
+            }
+            else
+                it = _neighbors.emplace(toKey(nextHop), Neighbor()).first;
+        }
+        if (mbuf != nullptr)
+        {
+            Neighbor &neighbor = it->second;
+            neighbor.lastUsedMs = now;
+            if (neighbor.pending.size() >= _pendingDepth)
+            {
+                dropped = neighbor.pending.front();
+                neighbor.pending.pop_front();
+            }
+            neighbor.pending.push_back(mbuf);
+            // 没有单独的重传定时器,有报文等待时最多每ND_RETRANS_MS发出一次请求
+            if (now - neighbor.lastSolicitMs >= ND_RETRANS_MS)
+            {
+                neighbor.lastSolicitMs = now;
+                solicit = true;
+            }
+        }
+    }
+    if (dropped != nullptr)
+        rte_pktmbuf_free(dropped);
+    if (solicit)
+        sendSolicit(mbufPool, out, nextHop);
+    return mbuf != nullptr ? 0 : -1;
+}
+
+void Ipv6Processor::expireLocked(uint64_t now)
+{
+    bool removedResolved = false;
+    for (auto it = _neighbors.begin(); it != _neighbors.end();)
+    {
+        if (now - it->second.lastUsedMs >= ND_IDLE_MS)
+        {
+            // 一直没有应答的地址,等待的报文随条目一起丢弃
+            for (struct rte_mbuf *mbuf : it->second.pending)
+                rte_pktmbuf_free(mbuf);
+            removedResolved |= it->second.resolved;
+            it = _neighbors.erase(it);
+        }
+        else
+            ++it;
+    }
+    // 缓存了被回收条目的连接需要重新查询,否则对端MAC变化后再也无法更新
+    if (removedResolved)
+        _generation.store(_generation.load(std::memory_order_relaxed) + 1, std::memory_order_release);
+}
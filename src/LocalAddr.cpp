@@ -0,0 +1,106 @@
+#include "LocalAddr.hpp"
+#include <arpa/inet.h>
+#include "Logger.hpp"
+#include "Utils.hpp"
+
+using std::lock_guard;
+using std::mutex;
+
+int LocalAddrTable::add(uint32_t addr, uint16_t portId)
+{
+    if (addr == 0 || addr == 0xFFFFFFFF || portId >= LOCAL_ADDR_MAX_PORTS)
+        return -1;
+    lock_guard<mutex> lock(_mutex);
+    const uint64_t value = SLOT_USED | ((uint64_t)portId << 32) | addr;
+    int freeIdx = -1;
+    uint32_t idx = hash(addr);
+    for (unsigned i = 0; i < LOCAL_ADDR_TABLE_SIZE; i++, idx = (idx + 1) & (LOCAL_ADDR_TABLE_SIZE - 1))
+    {
+        uint64_t slot = _slots[idx].load(std::memory_order_relaxed);
+        if ((slot & SLOT_USED) && (uint32_t)slot == addr)
+        {
+            // 已存在的地址只更新所属端口
+            _slots[idx].store(value, std::memory_order_release);
+            if (_primary[portId].load(std::memory_order_relaxed) == 0)
+                _primary[portId].store(addr, std::memory_order_relaxed);
+            return 0;
+        }
+        if (freeIdx < 0 && (slot == 0 || (slot & SLOT_TOMBSTONE)))
+            freeIdx = idx;
+        if (slot == 0)
+            break;
+    }
+    if (freeIdx < 0 || _count >= LOCAL_ADDR_MAX)
+    {
+        SPDLOG_ERROR("Local address table is full, {} ignored", convert_uint32_to_ip(addr));
+        return -1;
+    }
+    _slots[freeIdx].store(value, std::memory_order_release);
+    _count++;
+    if (_primary[portId].load(std::memory_order_relaxed) == 0)
+        _primary[portId].store(addr, std::memory_order_relaxed);
+    SPDLOG_INFO("Local address {} on port {}", convert_uint32_to_ip(addr), portId);
+    return 0;
+}
+
+int LocalAddrTable::remove(uint32_t addr)
+{
+    lock_guard<mutex> lock(_mutex);
+    uint32_t idx = hash(addr);
+    for (unsigned i = 0; i < LOCAL_ADDR_TABLE_SIZE; i++, idx = (idx + 1) & (LOCAL_ADDR_TABLE_SIZE - 1))
+    {
+        uint64_t slot = _slots[idx].load(std::memory_order_relaxed);
+        if (slot == 0)
+            break;
+        if (!(slot & SLOT_USED) || (uint32_t)slot != addr)
+            continue;
+        uint16_t portId = (slot >> 32) & 0xFFFF;
+        _slots[idx].store(SLOT_TOMBSTONE, std::memory_order_release);
+        _count--;
+        if (_primary[portId].load(std::memory_order_relaxed) == addr)
+            _primary[portId].store(firstAddrLocked(portId), std::memory_order_relaxed);
+        SPDLOG_INFO("Local address {} removed from port {}", convert_uint32_to_ip(addr), portId);
+        return 0;
+    }
+    return -1;
+}
+
+unsigned LocalAddrTable::addAddrs(const std::vector<std::string> &addrs, uint16_t portId)
+{
+    unsigned added = 0;
+    for (const std::string &str : addrs)
+    {
+        struct in_addr addr;
+        if (inet_pton(AF_INET, str.c_str(), &addr) != 1)
+        {
+            SPDLOG_WARN("Invalid local address {}, skipped", str);
+            continue;
+        }
+        if (add(addr.s_addr, portId) == 0)
+            added++;
+    }
+    return added;
+}
+
+std::vector<uint32_t> LocalAddrTable::list(uint16_t portId) const
+{
+    std::vector<uint32_t> addrs;
+    for (unsigned i = 0; i < LOCAL_ADDR_TABLE_SIZE; i++)
+    {
+        uint64_t slot = _slots[i].load(std::memory_order_acquire);
+        if ((slot & SLOT_USED) && ((slot >> 32) & 0xFFFF) == portId)
+            addrs.push_back((uint32_t)slot);
+    }
+    return addrs;
+}
+
+uint32_t LocalAddrTable::firstAddrLocked(uint16_t portId) const
+{
+    for (unsigned i = 0; i < LOCAL_ADDR_TABLE_SIZE; i++)
+    {
+        uint64_t slot = _slots[i].load(std::memory_order_relaxed);
+        if ((slot & SLOT_USED) && ((slot >> 32) & 0xFFFF) == portId)
+            return (uint32_t)slot;
+    }
+    return 0;
+}
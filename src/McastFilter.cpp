@@ -0,0 +1,57 @@
+#include "McastFilter.hpp"
+#include <rte_ethdev.h>
+#include "Logger.hpp"
+
+using std::lock_guard;
+using std::mutex;
+
+void McastFilter::init(uint16_t portId)
+{
+    lock_guard<mutex> lock(_mutex);
+    _portId = portId;
+}
+
+int McastFilter::setAddrs(MCAST_FILTER_SOURCE source, const struct rte_ether_addr *addrs, unsigned nbAddrs)
+{
+    if (source >= MCAST_SRC_MAX)
+        return -1;
+    lock_guard<mutex> lock(_mutex);
+    _addrs[source].assign(addrs, addrs + nbAddrs);
+    return applyLocked();
+}
+
+int McastFilter::applyLocked()
+{
+    if (_allMulticast)
+        return 0;
+    std::vector<struct rte_ether_addr> merged;
+    for (const auto &addrs : _addrs)
+    {
+        for (const struct rte_ether_addr &mac : addrs)
+        {
+            bool dup = false;
+            for (size_t j = 0; j < merged.size() && !dup; j++)
+                dup = rte_is_same_ether_addr(&merged[j], &mac);
+            if (!dup)
+                merged.push_back(mac);
+        }
+    }
+    int ret = rte_eth_dev_set_mc_addr_list(_portId, merged.empty() ? nullptr : merged.data(), (uint32_t)merged.size());
+    if (ret == -ENOTSUP || ret == -ENOSPC)
+    {
+        SPDLOG_WARN("Port {} cannot filter {} multicast addresses, enable all-multicast", _portId, merged.size());
+        if (rte_eth_allmulticast_enable(_portId) < 0)
+        {
+            SPDLOG_ERROR("Failed to enable all-multicast on port {}", _portId);
+            return -1;
+        }
+        _allMulticast = true;
+        return 0;
+    }
+    if (ret < 0)
+    {
+        SPDLOG_ERROR("Failed to set multicast address filter on port {}, error {}", _portId, ret);
+        return -1;
+    }
+    return 0;
+}
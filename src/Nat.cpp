@@ -0,0 +1,381 @@
+#include "Nat.hpp"
+#include <rte_malloc.h>
+#include <rte_jhash.h>
+#include <rte_tcp.h>
+#include <rte_cycles.h>
+#include <rte_lcore.h>
+#include <arpa/inet.h>
+#include <algorithm>
+#include "LocalAddr.hpp"
+#include "Utils.hpp"
+#include "Logger.hpp"
+
+static const char *NAT_DROP_NAMES[NAT_DROP_MAX] = {"unsupported", "no port", "no session"};
+
+int Nat44::init(unsigned nbWorkers, const NatParams &params)
+{
+    if (nbWorkers == 0 || nbWorkers > RING_MAX_WORKERS)
+    {
+        SPDLOG_ERROR("Invalid NAT worker count {}", nbWorkers);
+        return -1;
+    }
+    if (params.externalIps.empty() || params.externalIps.size() > NAT_MAX_EXTERNAL_IPS ||
+        params.internalNets.empty() || params.internalNets.size() > NAT_MAX_INTERNAL_NETS)
+    {
+        SPDLOG_ERROR("NAT needs 1~{} external addresses and 1~{} internal networks", NAT_MAX_EXTERNAL_IPS, NAT_MAX_INTERNAL_NETS);
+        return -1;
+    }
+    // 每个工作核至少要分到一个端口
+    if (params.portMin == 0 || params.portMin > params.portMax || (unsigned)(params.portMax - params.portMin + 1) < nbWorkers)
+    {
+        SPDLOG_ERROR("Invalid NAT port range {}-{}", params.portMin, params.portMax);
+        return -1;
+    }
+    if (params.maxSessions == 0 || params.maxSessions > NAT_MAX_SESSIONS)
+    {
+        SPDLOG_ERROR("Invalid NAT session count {}, must be 1~{}", params.maxSessions, NAT_MAX_SESSIONS);
+        return -1;
+    }
+
+    _nbExternal = 0;
+    for (const auto &str : params.externalIps)
+    {
+        struct in_addr addr;
+        if (inet_pton(AF_INET, str.c_str(), &addr) != 1)
+        {
+            SPDLOG_ERROR("Invalid NAT external address {}", str);
+            return -1;
+        }
+        if (!LocalAddrTable::getInstance().isLocal(addr.s_addr))
+            SPDLOG_WARN("NAT external address {} is not a local address, ARP will not answer for it", str);
+        _externalIps[_nbExternal++] = addr.s_addr;
+    }
+    _nbInternal = 0;
+    for (const auto &cidr : params.internalNets)
+    {
+        size_t slash = cidr.find('/');
+        std::string addrStr = cidr.substr(0, slash);
+        int depth = slash == std::string::npos ? 32 : atoi(cidr.c_str() + slash + 1);
+        struct in_addr addr;
+        if (inet_pton(AF_INET, addrStr.c_str(), &addr) != 1 || depth <= 0 || depth > 32)
+        {
+            SPDLOG_ERROR("Invalid NAT internal network {}", cidr);
+            return -1;
+        }
+        _internalMasks[_nbInternal] = depth == 32 ? 0xFFFFFFFF : ~(0xFFFFFFFFu >> depth);
+        _internalNets[_nbInternal] = ntohl(addr.s_addr) & _internalMasks[_nbInternal];
+        _nbInternal++;
+    }
+
+    _nbWorkers = nbWorkers;
+    _portMin = params.portMin;
+    _portMax = params.portMax;
+    // 每个会话占用一个外部端口,超过端口总数的会话永远用不上,不必分配
+    const uint32_t nbPorts = _portMax - _portMin + 1;
+    const uint32_t portsPerWorker = (nbPorts + nbWorkers - 1) / nbWorkers * _nbExternal * NAT_NB_PROTOS;
+    _maxSessions = std::min(params.maxSessions, portsPerWorker);
+    if (_maxSessions < params.maxSessions)
+        SPDLOG_WARN("NAT sessions per worker limited to {} by the external ports", _maxSessions);
+    const uint64_t hz = rte_get_tsc_hz();
+    _timeoutCycles[SESSION_UDP] = params.udpTimeoutMs * hz / 1000;
+    _timeoutCycles[SESSION_TCP_SYN] = params.tcpTransTimeoutMs * hz / 1000;
+    _timeoutCycles[SESSION_TCP_EST] = params.tcpEstTimeoutMs * hz / 1000;
+    _timeoutCycles[SESSION_TCP_CLOSING] = params.tcpTransTimeoutMs * hz / 1000;
+    _sweepCycles = hz / NAT_SWEEPS_PER_SEC;
+    _sweepChunk = (_maxSessions + NAT_SWEEPS_PER_SEC - 1) / NAT_SWEEPS_PER_SEC;
+
+    // 每个会话占两个槽位,装载率不超过一半,查找总能遇到空槽位
+    const uint32_t nbSlots = rte_align32pow2(_maxSessions * 4);
+    const int socketId = rte_socket_id();
+    for (unsigned w = 0; w < nbWorkers; w++)
+    {
+        Shard &shard = _shards[w];
+        shard.sessions = (NatSession *)rte_zmalloc_socket("nat sessions", sizeof(NatSession) * _maxSessions, RTE_CACHE_LINE_SIZE, socketId);
+        shard.freeSessions = (uint32_t *)rte_malloc_socket("nat free sessions", sizeof(uint32_t) * _maxSessions, 0, socketId);
+        shard.slots = (NatSlot *)rte_zmalloc_socket("nat slots", sizeof(NatSlot) * nbSlots, RTE_CACHE_LINE_SIZE, socketId);
+        if (shard.sessions == nullptr || shard.freeSessions == nullptr || shard.slots == nullptr)
+        {
+            SPDLOG_ERROR("Failed to allocate NAT session table for worker {}", w);
+            return -1;
+        }
+        shard.slotMask = nbSlots - 1;
+        // 倒序入栈,先分配下标小的会话
+        for (uint32_t i = 0; i < _maxSessions; i++)
+            shard.freeSessions[i] = _maxSessions - 1 - i;
+        shard.nbFree = _maxSessions;
+
+        // 工作核w拥有(端口 - 下限) % 工作核数量 == w的端口
+        const uint32_t owned = (nbPorts - w + nbWorkers - 1) / nbWorkers;
+        for (unsigned e = 0; e < _nbExternal; e++)
+        {
+            for (unsigned p = 0; p < NAT_NB_PROTOS; p++)
+            {
+                PortPool &pool = shard.pools[e][p];
+                pool.ports = (uint16_t *)rte_malloc_socket("nat ports", sizeof(uint16_t) * owned, 0, socketId);
+                if (pool.ports == nullptr)
+                {
+                    SPDLOG_ERROR("Failed to allocate NAT port pool for worker {}", w);
+                    return -1;
+                }
+                for (uint32_t i = 0; i < owned; i++)
+                    pool.ports[i] = _portMin + w + i * nbWorkers;
+                pool.capacity = owned;
+                pool.head = 0;
+                pool.count = owned;
+            }
+        }
+    }
+    _enabled = true;
+    SPDLOG_INFO("NAT44 enabled: {} external addresses, {} internal networks, ports {}-{}, {} sessions per worker",
+                _nbExternal, _nbInternal, _portMin, _portMax, _maxSessions);
+    return 0;
+}
+
+uint32_t Nat44::hashTuple(const NatTuple &tuple) const
+{
+    return rte_jhash_3words(tuple.srcIp, tuple.dstIp, ((uint32_t)tuple.srcPort << 16) | tuple.dstPort, _hashSeed + tuple.proto);
+}
+
+int Nat44::lookup(const Shard &shard, const NatTuple &tuple, uint32_t hash) const
+{
+    uint32_t idx = hash & shard.slotMask;
+    while (true)
+    {
+        const NatSlot &slot = shard.slots[idx];
+        if (slot.ref == 0)
+            return -1;
+        if (slot.hash == hash)
+        {
+            const uint32_t sessionIdx = (slot.ref - 1) >> 1;
+            const NatSession &session = shard.sessions[sessionIdx];
+            if ((((slot.ref - 1) & 1) ? session.in : session.out) == tuple)
+                return sessionIdx;
+        }
+        idx = (idx + 1) & shard.slotMask;
+    }
+}
+
+void Nat44::insertKey(Shard &shard, uint32_t hash, uint32_t ref)
+{
+    uint32_t idx = hash & shard.slotMask;
+    while (shard.slots[idx].ref != 0)
+        idx = (idx + 1) & shard.slotMask;
+    shard.slots[idx].hash = hash;
+    shard.slots[idx].ref = ref;
+}
+
+void Nat44::eraseKey(Shard &shard, uint32_t hash, uint32_t ref)
+{
+    uint32_t hole = hash & shard.slotMask;
+    while (shard.slots[hole].ref != ref)
+        hole = (hole + 1) & shard.slotMask;
+    // 与ARP表相同的向后搬移删除,保证后续的键仍然能从各自的起始槽位探测到
+    uint32_t next = hole;
+    while (true)
+    {
+        next = (next + 1) & shard.slotMask;
+        const NatSlot &slot = shard.slots[next];
+        if (slot.ref == 0)
+            break;
+        const uint32_t home = slot.hash & shard.slotMask;
+        bool stay = hole <= next ? (hole < home && home <= next) : (hole < home || home <= next);
+        if (stay)
+            continue;
+        shard.slots[hole] = slot;
+        hole = next;
+    }
+    shard.slots[hole].ref = 0;
+}
+
+int Nat44::createSession(Shard &shard, const NatTuple &out, uint32_t hash)
+{
+    if (shard.nbFree == 0)
+    {
+        shard.drops[NAT_DROP_NO_SESSION]++;
+        return -1;
+    }
+    const uint8_t extIdx = rte_jhash_1word(out.srcIp, _hashSeed) % _nbExternal;
+    PortPool &pool = shard.pools[extIdx][protoIndex(out.proto)];
+    if (pool.count == 0)
+    {
+        shard.drops[NAT_DROP_NO_PORT]++;
+        return -1;
+    }
+    const uint16_t port = pool.ports[pool.head];
+    pool.head = pool.head + 1 == pool.capacity ? 0 : pool.head + 1;
+    pool.count--;
+
+    const uint32_t idx = shard.freeSessions[--shard.nbFree];
+    NatSession &session = shard.sessions[idx];
+    session.out = out;
+    session.in.srcIp = out.dstIp;
+    session.in.dstIp = _externalIps[extIdx];
+    session.in.srcPort = out.dstPort;
+    session.in.dstPort = rte_cpu_to_be_16(port);
+    session.in.proto = out.proto;
+    session.extIdx = extIdx;
+    session.lastSeen = shard.now;
+    session.state = out.proto == IPPROTO_TCP ? SESSION_TCP_SYN : SESSION_UDP;
+    insertKey(shard, hash, (idx << 1) + 1);
+    insertKey(shard, hashTuple(session.in), ((idx << 1) | 1) + 1);
+    shard.created++;
+    return idx;
+}
+
+void Nat44::releaseSession(Shard &shard, uint32_t idx)
+{
+    NatSession &session = shard.sessions[idx];
+    eraseKey(shard, hashTuple(session.out), (idx << 1) + 1);
+    eraseKey(shard, hashTuple(session.in), ((idx << 1) | 1) + 1);
+    PortPool &pool = shard.pools[session.extIdx][protoIndex(session.out.proto)];
+    pool.ports[(pool.head + pool.count) % pool.capacity] = rte_be_to_cpu_16(session.in.dstPort);
+    pool.count++;
+    session.state = SESSION_FREE;
+    shard.freeSessions[shard.nbFree++] = idx;
+}
+
+void Nat44::updateTcpState(NatSession &session, uint8_t tcpFlags, bool inbound)
+{
+    if (tcpFlags & (RTE_TCP_FIN_FLAG | RTE_TCP_RST_FLAG))
+        session.state = SESSION_TCP_CLOSING;
+    else if (session.state == SESSION_TCP_SYN && inbound && (tcpFlags & RTE_TCP_ACK_FLAG))
+        session.state = SESSION_TCP_EST;
+}
+
+void Nat44::rewrite(struct rte_ipv4_hdr *iphdr, uint8_t *l4hdr, bool source, uint32_t newAddr, uint16_t newPort)
+{
+    struct rte_udp_hdr *udphdr = (struct rte_udp_hdr *)l4hdr;
+    const uint32_t oldAddr = source ? iphdr->src_addr : iphdr->dst_addr;
+    const uint16_t oldPort = source ? udphdr->src_port : udphdr->dst_port;
+    const uint16_t *oldWords = (const uint16_t *)&oldAddr;
+    const uint16_t *newWords = (const uint16_t *)&newAddr;
+    iphdr->hdr_checksum = checksumAdjust(checksumAdjust(iphdr->hdr_checksum, oldWords[0], newWords[0]), oldWords[1], newWords[1]);
+
+    // TCP/UDP校验和的伪首部包含地址,地址和端口的变化都要计入
+    auto adjustL4 = [&](uint16_t cksum) {
+        cksum = checksumAdjust(cksum, oldWords[0], newWords[0]);
+        cksum = checksumAdjust(cksum, oldWords[1], newWords[1]);
+        return checksumAdjust(cksum, oldPort, newPort);
+    };
+    if (iphdr->next_proto_id == IPPROTO_TCP)
+    {
+        struct rte_tcp_hdr *tcphdr = (struct rte_tcp_hdr *)l4hdr;
+        tcphdr->cksum = adjustL4(tcphdr->cksum);
+    }
+    else if (udphdr->dgram_cksum != 0)
+    {
+        // UDP校验和为0表示发送方没有计算,计算结果为0时按RFC 768发送全1
+        const uint16_t cksum = adjustL4(udphdr->dgram_cksum);
+        udphdr->dgram_cksum = cksum == 0 ? 0xFFFF : cksum;
+    }
+
+    if (source)
+    {
+        iphdr->src_addr = newAddr;
+        udphdr->src_port = newPort;
+    }
+    else
+    {
+        iphdr->dst_addr = newAddr;
+        udphdr->dst_port = newPort;
+    }
+}
+
+NAT_RESULT Nat44::translateOutbound(unsigned workerId, struct rte_mbuf *mbuf)
+{
+    struct rte_ipv4_hdr *iphdr = rte_pktmbuf_mtod_offset(mbuf, struct rte_ipv4_hdr *, sizeof(struct rte_ether_hdr));
+    if (!isInternal(iphdr->src_addr) || isInternal(iphdr->dst_addr))
+        return NAT_PASS;
+    Shard &shard = _shards[workerId];
+    if ((iphdr->next_proto_id != IPPROTO_TCP && iphdr->next_proto_id != IPPROTO_UDP) ||
+        (iphdr->fragment_offset & rte_cpu_to_be_16(RTE_IPV4_HDR_MF_FLAG | RTE_IPV4_HDR_OFFSET_MASK)) != 0)
+    {
+        shard.drops[NAT_DROP_UNSUPPORTED]++;
+        return NAT_DROP;
+    }
+
+    const uint8_t ihl = (iphdr->version_ihl & RTE_IPV4_HDR_IHL_MASK) * RTE_IPV4_IHL_MULTIPLIER;
+    uint8_t *l4hdr = (uint8_t *)iphdr + ihl;
+    const struct rte_udp_hdr *ports = (const struct rte_udp_hdr *)l4hdr;
+    NatTuple out;
+    out.srcIp = iphdr->src_addr;
+    out.dstIp = iphdr->dst_addr;
+    out.srcPort = ports->src_port;
+    out.dstPort = ports->dst_port;
+    out.proto = iphdr->next_proto_id;
+    const uint32_t hash = hashTuple(out);
+    int idx = lookup(shard, out, hash);
+    if (idx < 0 && (idx = createSession(shard, out, hash)) < 0)
+        return NAT_DROP;
+
+    NatSession &session = shard.sessions[idx];
+    session.lastSeen = shard.now;
+    if (out.proto == IPPROTO_TCP)
+        updateTcpState(session, ((const struct rte_tcp_hdr *)l4hdr)->tcp_flags, false);
+    rewrite(iphdr, l4hdr, true, session.in.dstIp, session.in.dstPort);
+    shard.outbound++;
+    return NAT_TRANSLATED;
+}
+
+NAT_RESULT Nat44::translateInbound(unsigned workerId, struct rte_mbuf *mbuf)
+{
+    struct rte_ipv4_hdr *iphdr = rte_pktmbuf_mtod_offset(mbuf, struct rte_ipv4_hdr *, sizeof(struct rte_ether_hdr));
+    if ((iphdr->next_proto_id != IPPROTO_TCP && iphdr->next_proto_id != IPPROTO_UDP) ||
+        (iphdr->fragment_offset & rte_cpu_to_be_16(RTE_IPV4_HDR_MF_FLAG | RTE_IPV4_HDR_OFFSET_MASK)) != 0)
+        return NAT_PASS;
+
+    Shard &shard = _shards[workerId];
+    const uint8_t ihl = (iphdr->version_ihl & RTE_IPV4_HDR_IHL_MASK) * RTE_IPV4_IHL_MULTIPLIER;
+    uint8_t *l4hdr = (uint8_t *)iphdr + ihl;
+    const struct rte_udp_hdr *ports = (const struct rte_udp_hdr *)l4hdr;
+    NatTuple in;
+    in.srcIp = iphdr->src_addr;
+    in.dstIp = iphdr->dst_addr;
+    in.srcPort = ports->src_port;
+    in.dstPort = ports->dst_port;
+    in.proto = iphdr->next_proto_id;
+    const int idx = lookup(shard, in, hashTuple(in));
+    if (idx < 0)
+        return NAT_PASS;
+
+    NatSession &session = shard.sessions[idx];
+    session.lastSeen = shard.now;
+    if (in.proto == IPPROTO_TCP)
+        updateTcpState(session, ((const struct rte_tcp_hdr *)l4hdr)->tcp_flags, true);
+    rewrite(iphdr, l4hdr, false, session.out.srcIp, session.out.srcPort);
+    shard.inbound++;
+    return NAT_TRANSLATED;
+}
+
+void Nat44::maintain(unsigned workerId, uint64_t now)
+{
+    Shard &shard = _shards[workerId];
+    shard.now = now;
+    if (now < shard.nextSweep)
+        return;
+    shard.nextSweep = now + _sweepCycles;
+    for (uint32_t n = 0; n < _sweepChunk; n++)
+    {
+        const uint32_t idx = shard.sweepCursor;
+        shard.sweepCursor = idx + 1 == _maxSessions ? 0 : idx + 1;
+        const NatSession &session = shard.sessions[idx];
+        if (session.state != SESSION_FREE && now - session.lastSeen > _timeoutCycles[session.state])
+        {
+            releaseSession(shard, idx);
+            shard.expired++;
+        }
+    }
+}
+
+void Nat44::dumpStats()
+{
+    if (!_enabled)
+        return;
+    for (unsigned w = 0; w < _nbWorkers; w++)
+    {
+        const Shard &shard = _shards[w];
+        SPDLOG_INFO("NAT44 worker {}: sessions {}, created {}, expired {}, outbound {}, inbound {}, {} {}, {} {}, {} {}", w,
+                    _maxSessions - shard.nbFree, shard.created, shard.expired, shard.outbound, shard.inbound,
+                    NAT_DROP_NAMES[0], shard.drops[0], NAT_DROP_NAMES[1], shard.drops[1], NAT_DROP_NAMES[2], shard.drops[2]);
+    }
+}
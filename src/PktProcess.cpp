@@ -1,13 +1,9 @@
 #include "PktProcess.hpp"
-#include "ArpProcessor.hpp"
-#include "IcmpProcessor.hpp"
-#include "UdpProcessor.hpp"
 #include "UdpHost.hpp"
 #include "Logger.hpp"
 #include "ConfigManager.hpp"
 #include "TcpHost.hpp"
-#include "TcpProcessor.hpp"
-#include "KniProcessor.hpp"
+#include "Datapath.hpp"
 
 int pkt_process(void *arg)
 {
@@ -25,64 +21,15 @@ int pkt_process(void *arg)
         SPDLOG_ERROR("Mbuf pool or ring is null");
         return -1;
     }
-    const int BURST_SIZE = ConfigManager::getInstance().getBurstSize();
-    const bool ENABLE_KNI = ConfigManager::getInstance().isKniEnabled();
-
-    while (1)
+    ConfigManager &configManager = ConfigManager::getInstance();
+    unsigned burstSize = datapathBurstSize(configManager.getBurstSize());
+    PktProcessFn loop = selectPktProcess(burstSize, configManager.isKniEnabled(), configManager.isRxCksumOffloadEnabled());
+    if (loop == nullptr)
     {
-        struct rte_mbuf *mbufs[BURST_SIZE];
-        unsigned num_recvd = rte_ring_mc_dequeue_burst(ring->in, (void **)mbufs, BURST_SIZE, nullptr);
-        unsigned i = 0;
-        for (i = 0; i < num_recvd; i++)
-        {
-            SPDLOG_INFO("Received packet number: {}, current {}", num_recvd, i);
-            struct rte_ether_hdr *ehdr = rte_pktmbuf_mtod(mbufs[i], struct rte_ether_hdr *);
-
-            if (ENABLE_KNI)
-            {
-                SPDLOG_INFO("Received other IP packet, kni prosses it.");
-                KniProcessor::getInstance().burstTx(mbufs, num_recvd);
-                continue;
-            }
-
-            if (ehdr->ether_type == rte_cpu_to_be_16(RTE_ETHER_TYPE_ARP))
-            {
-                SPDLOG_INFO("Received ARP packet ether_type={}", ehdr->ether_type);
-                ArpProcessor::getInstance().handlePacket(mbufPool, mbufs[i], ring);
-                continue;
-            }
-
-            // 不是IPV4协议的包，跳过
-            if (ehdr->ether_type != rte_cpu_to_be_16(RTE_ETHER_TYPE_IPV4))
-            {
-                continue;
-            }
-
-            // 处理IPV4包
-            struct rte_ipv4_hdr *iphdr = rte_pktmbuf_mtod_offset(mbufs[i], struct rte_ipv4_hdr *,
-                                                                 sizeof(struct rte_ether_hdr));
-
-            if (iphdr->next_proto_id == IPPROTO_UDP)
-            {
-                SPDLOG_INFO("Received UDP packet. next_proto_id={}", iphdr->next_proto_id);
-                UdpProcessor::getInstance().udpProcess(mbufs[i]);
-            }
-            else if (iphdr->next_proto_id == IPPROTO_TCP)
-            {
-                SPDLOG_INFO("Received TCP packet. next_proto_id={}", iphdr->next_proto_id);
-                TcpProcessor::getInstance().tcpProcess(mbufs[i]);
-            }
-            else if (iphdr->next_proto_id == IPPROTO_ICMP)
-            {
-                SPDLOG_INFO("Received ICMP packet. next_proto_id={}", iphdr->next_proto_id);
-                IcmpProcessor::getInstance().handlePacket(mbufPool, mbufs[i], ring);
-            }
-        }
-
-        KniProcessor::getInstance().kniHandleRequests();
-        TcpProcessor::getInstance().tcpOut(mbufPool);
-        UdpProcessor::getInstance().udpOut(mbufPool);
+        SPDLOG_ERROR("No datapath for burst size {}", burstSize);
+        return -1;
     }
+    return loop(arg);
 }
 
 int udp_server(void *arg)
@@ -0,0 +1,116 @@
+#include "Pmtu.hpp"
+#include <rte_cycles.h>
+#include <algorithm>
+#include "Logger.hpp"
+#include "Utils.hpp"
+
+using std::lock_guard;
+using std::mutex;
+
+/// RFC 1191 第7节的MTU平台值,从大到小排列
+static const uint16_t MTU_PLATEAUS[] = {32000, 17914, 8166, 4352, 2002, 1492, 1006, 508, 296, 68};
+
+void PmtuCache::init(uint16_t linkMtu, uint64_t expireMs)
+{
+    lock_guard<mutex> lock(_mutex);
+    _linkMtu = linkMtu;
+    _expireMs = expireMs;
+    _entries.clear();
+    bumpGenerationLocked();
+    SPDLOG_INFO("PMTU cache: link MTU {}, expire {} ms", linkMtu, expireMs);
+}
+
+uint64_t PmtuCache::nowMs() const
+{
+    return rte_get_timer_cycles() / (rte_get_timer_hz() / 1000);
+}
+
+uint16_t PmtuCache::get(uint32_t dst)
+{
+    lock_guard<mutex> lock(_mutex);
+    auto it = _entries.find(dst);
+    if (it == _entries.end())
+        return _linkMtu;
+    if (nowMs() >= it->second.expireMs)
+    {
+        // 过期后恢复链路MTU,重新探测更大的PMTU
+        _entries.erase(it);
+        return _linkMtu;
+    }
+    return it->second.mtu;
+}
+
+uint16_t PmtuCache::lookup(uint32_t dst, PmtuCacheEntry *cache)
+{
+    lock_guard<mutex> lock(_mutex);
+    cache->dst = dst;
+    cache->generation = _generation.load(std::memory_order_relaxed);
+    cache->mtu = _linkMtu;
+    cache->expireMs = 0;
+    auto it = _entries.find(dst);
+    if (it == _entries.end())
+        return _linkMtu;
+    // 过期的条目留给get和expireLocked删除,删除不影响其他缓存,不需要递增代数
+    if (nowMs() < it->second.expireMs)
+    {
+        cache->mtu = it->second.mtu;
+        cache->expireMs = it->second.expireMs;
+    }
+    return cache->mtu;
+}
+
+int PmtuCache::update(uint32_t dst, uint16_t mtu, uint16_t origLength)
+{
+    if (mtu == 0)
+    {
+        mtu = MTU_PLATEAUS[sizeof(MTU_PLATEAUS) / sizeof(MTU_PLATEAUS[0]) - 1];
+        for (uint16_t plateau : MTU_PLATEAUS)
+        {
+            if (plateau < origLength)
+            {
+                mtu = plateau;
+                break;
+            }
+        }
+    }
+    mtu = std::max<uint16_t>(mtu, PMTU_MIN);
+
+    lock_guard<mutex> lock(_mutex);
+    uint64_t now = nowMs();
+    auto it = _entries.find(dst);
+    uint16_t current = (it == _entries.end() || now >= it->second.expireMs) ? _linkMtu : it->second.mtu;
+    if (mtu >= current)
+        return -1;
+
+    if (it == _entries.end() && _entries.size() >= PMTU_MAX_ENTRIES)
+    {
+        expireLocked(now);
+        if (_entries.size() >= PMTU_MAX_ENTRIES)
+        {
+            SPDLOG_WARN("PMTU cache is full, ignore PMTU {} for {}", mtu, convert_uint32_to_ip(dst));
+            return -1;
+        }
+    }
+    _entries[dst] = {mtu, now + _expireMs};
+    bumpGenerationLocked();
+    SPDLOG_INFO("PMTU to {} lowered from {} to {}", convert_uint32_to_ip(dst), current, mtu);
+    return 0;
+}
+
+void PmtuCache::expireLocked(uint64_t now)
+{
+    for (auto it = _entries.begin(); it != _entries.end();)
+    {
+        if (now >= it->second.expireMs)
+            it = _entries.erase(it);
+        else
+            ++it;
+    }
+}
+
+void PmtuCache::clear()
+{
+    lock_guard<mutex> lock(_mutex);
+    _entries.clear();
+    bumpGenerationLocked();
+}
@@ -0,0 +1,117 @@
+#include "Qos.hpp"
+#include <rte_ethdev.h>
+#include <rte_errno.h>
+#include <algorithm>
+#include <cstring>
+#include "Logger.hpp"
+
+int EgressScheduler::init(unsigned queueSize, const std::vector<unsigned> &weights)
+{
+    const unsigned size = rte_align32pow2(std::max(queueSize, 2u));
+    for (unsigned c = 0; c < QOS_NB_CLASSES; c++)
+    {
+        char name[RTE_RING_NAMESIZE];
+        snprintf(name, sizeof(name), "qos class %u", c);
+        // 入队和出队都在主核上
+        _queues[c] = rte_ring_create(name, size, rte_socket_id(), RING_F_SP_ENQ | RING_F_SC_DEQ);
+        if (_queues[c] == nullptr)
+        {
+            SPDLOG_ERROR("Failed to create QoS queue {}. {}", c, rte_strerror(rte_errno));
+            return -1;
+        }
+        if (c != QOS_STRICT_CLASS)
+            _weights[c] = c - 1 < weights.size() ? std::max(weights[c - 1], 1u) : 1;
+    }
+    _enabled = true;
+    SPDLOG_INFO("Egress QoS enabled, queue size {}, WRR weights {}/{}/{}", size, _weights[1], _weights[2], _weights[3]);
+    return 0;
+}
+
+unsigned EgressScheduler::classify(const struct rte_mbuf *mbuf)
+{
+    const struct rte_ether_hdr *ehdr = rte_pktmbuf_mtod(mbuf, const struct rte_ether_hdr *);
+    if (ehdr->ether_type != rte_cpu_to_be_16(RTE_ETHER_TYPE_IPV4) && ehdr->ether_type != rte_cpu_to_be_16(RTE_ETHER_TYPE_IPV6))
+        return QOS_STRICT_CLASS;
+    // 按DSCP的类选择位(RFC 2474)划分:CS5~CS7和EF严格优先,AF3x/AF4x、AF1x/AF2x、尽力而为依次降低
+    const uint8_t dscp = dscpOf(mbuf);
+    if (dscp == QOS_DSCP_EF || (dscp >> 3) >= 5)
+        return QOS_STRICT_CLASS;
+    if ((dscp >> 3) >= 3)
+        return 1;
+    if ((dscp >> 3) >= 1 && dscp != QOS_DSCP_CS1)
+        return 2;
+    return QOS_BEST_EFFORT_CLASS;
+}
+
+void EgressScheduler::enqueue(struct rte_mbuf **mbufs, unsigned nbPkts)
+{
+    for (unsigned i = 0; i < nbPkts; i++)
+    {
+        const unsigned c = classify(mbufs[i]);
+        if (rte_ring_sp_enqueue(_queues[c], mbufs[i]) < 0)
+        {
+            _dropped[c]++;
+            rte_pktmbuf_free(mbufs[i]);
+        }
+    }
+}
+
+bool EgressScheduler::flushHeld(uint16_t portId)
+{
+    if (_nbHeld == 0)
+        return true;
+    const unsigned nbSent = rte_eth_tx_burst(portId, 0, _held, _nbHeld);
+    if (nbSent < _nbHeld)
+        memmove(_held, _held + nbSent, (_nbHeld - nbSent) * sizeof(struct rte_mbuf *));
+    _nbHeld -= nbSent;
+    return _nbHeld == 0;
+}
+
+unsigned EgressScheduler::dequeue(struct rte_mbuf **tx, unsigned maxPkts)
+{
+    unsigned nbTx = rte_ring_sc_dequeue_burst(_queues[QOS_STRICT_CLASS], (void **)tx, maxPkts, nullptr);
+    _sent[QOS_STRICT_CLASS] += nbTx;
+
+    // 每个类别一次最多发送权重个报文,队列空或额度用完后轮到下一个类别;连续一圈都没有报文时结束
+    unsigned idle = 0;
+    while (nbTx < maxPkts && idle < QOS_NB_CLASSES - 1)
+    {
+        const unsigned c = _wrrClass;
+        if (_wrrCredit == 0)
+            _wrrCredit = _weights[c];
+        const unsigned got = rte_ring_sc_dequeue_burst(_queues[c], (void **)(tx + nbTx),
+                                                       std::min(maxPkts - nbTx, _wrrCredit), nullptr);
+        nbTx += got;
+        _sent[c] += got;
+        _wrrCredit -= got;
+        idle = got == 0 ? idle + 1 : 0;
+        if (got == 0 || _wrrCredit == 0)
+        {
+            _wrrClass = _wrrClass == QOS_NB_CLASSES - 1 ? 1 : _wrrClass + 1;
+            _wrrCredit = 0;
+        }
+    }
+    return nbTx;
+}
+
+void EgressScheduler::hold(struct rte_mbuf **mbufs, unsigned nbPkts)
+{
+    // 只有_held清空后才会取出新的一批,最多保存一个burst
+    for (unsigned i = 0; i < nbPkts; i++)
+    {
+        if (_nbHeld < DATAPATH_MAX_BURST)
+            _held[_nbHeld++] = mbufs[i];
+        else
+            rte_pktmbuf_free(mbufs[i]);
+    }
+}
+
+void EgressScheduler::dumpStats() const
+{
+    if (!_enabled)
+        return;
+    for (unsigned c = 0; c < QOS_NB_CLASSES; c++)
+    {
+        SPDLOG_INFO("QoS class {}: queued {}, sent {}, dropped {}", c, rte_ring_count(_queues[c]), _sent[c], _dropped[c]);
+    }
+}
@@ -0,0 +1,90 @@
+#include "Reassembly.hpp"
+#include <rte_cycles.h>
+#include <rte_lcore.h>
+#include "Logger.hpp"
+#include "IcmpProcessor.hpp"
+
+int IpReassembly::init(unsigned nbWorkers, uint32_t maxEntries, uint32_t bucketEntries, uint32_t timeoutMs)
+{
+    if (nbWorkers == 0 || nbWorkers > RING_MAX_WORKERS)
+    {
+        SPDLOG_ERROR("Invalid reassembly worker count: {}", nbWorkers);
+        return -1;
+    }
+    _nbWorkers = nbWorkers;
+    _maxCycles = (rte_get_tsc_hz() + 999) / 1000 * timeoutMs;
+    for (unsigned i = 0; i < nbWorkers; i++)
+    {
+        // 桶数量和最大条目数相同,与DPDK ip_reassembly示例一致,哈希冲突时桶内还有空位
+        _lcores[i].tbl = rte_ip_frag_table_create(maxEntries, bucketEntries, maxEntries, _maxCycles, rte_socket_id());
+        if (_lcores[i].tbl == nullptr)
+        {
+            SPDLOG_ERROR("Failed to create fragment table for worker {}", i);
+            return -1;
+        }
+        _lcores[i].dr.cnt = 0;
+    }
+    _enabled = true;
+    SPDLOG_INFO("IPv4 reassembly: {} workers, {} entries per worker, timeout {} ms", nbWorkers, maxEntries, timeoutMs);
+    return 0;
+}
+
+struct rte_mbuf *IpReassembly::reassembleFragment(LcoreState &state, struct rte_mbuf *mbuf, struct rte_ipv4_hdr *iphdr, uint64_t now)
+{
+    // 单次重组最多向death row放入一个数据报的全部分片,放不下时先释放
+    if (state.dr.cnt + RTE_LIBRTE_IP_FRAG_MAX_FRAG + 1 > RTE_DIM(state.dr.row))
+        rte_ip_frag_free_death_row(&state.dr, REASSEMBLY_PREFETCH_OFFSET);
+
+    state.fragments++;
+    mbuf->l2_len = sizeof(struct rte_ether_hdr);
+    mbuf->l3_len = (iphdr->version_ihl & RTE_IPV4_HDR_IHL_MASK) * RTE_IPV4_IHL_MULTIPLIER;
+    uint32_t before = state.dr.cnt;
+    struct rte_mbuf *out = rte_ipv4_frag_reassemble_packet(state.tbl, &state.dr, mbuf, now, iphdr);
+    if (out != nullptr)
+    {
+        state.reassembled++;
+        return out;
+    }
+
+    // 当前分片也进了death row说明它被判定为重叠/非法或表已满;只有旧分片进入说明旧的数据报超时被回收
+    uint32_t added = state.dr.cnt - before;
+    if (added > 0 && state.dr.row[state.dr.cnt - 1] == mbuf)
+        state.invalid += added;
+    else
+        state.timeouts += added;
+    return nullptr;
+}
+
+void IpReassembly::maintain(unsigned workerId, uint64_t now, struct rte_mempool *mbufPool, struct rte_ring *out)
+{
+    LcoreState &state = _lcores[workerId];
+    // 没有后续分片到达的数据报不会被LRU回收,按超时时间周期性清理
+    if (now - state.lastSweep > _maxCycles)
+    {
+        uint32_t before = state.dr.cnt;
+        rte_frag_table_del_expired_entries(state.tbl, &state.dr, now);
+        state.timeouts += state.dr.cnt - before;
+        state.lastSweep = now;
+        // 没有收到首片时不发送差错,差错报文引用首片的IP头部和传输层端口
+        for (uint32_t i = before; i < state.dr.cnt; i++)
+        {
+            struct rte_mbuf *frag = state.dr.row[i];
+            struct rte_ipv4_hdr *iphdr = rte_pktmbuf_mtod_offset(frag, struct rte_ipv4_hdr *, sizeof(struct rte_ether_hdr));
+            if ((iphdr->fragment_offset & rte_cpu_to_be_16(RTE_IPV4_HDR_OFFSET_MASK)) == 0)
+                IcmpProcessor::getInstance().sendError(mbufPool, out, frag, ICMP_TYPE_TIME_EXCEEDED,
+                                                       ICMP_CODE_REASSEMBLY_EXCEEDED);
+        }
+    }
+    if (state.dr.cnt > 0)
+        rte_ip_frag_free_death_row(&state.dr, REASSEMBLY_PREFETCH_OFFSET);
+}
+
+void IpReassembly::dumpStats()
+{
+    for (unsigned w = 0; w < _nbWorkers; w++)
+    {
+        LcoreState &state = _lcores[w];
+        SPDLOG_INFO("Reassembly worker {}: fragments {}, reassembled {}, timeouts {}, invalid {}",
+                    w, state.fragments, state.reassembled, state.timeouts, state.invalid);
+    }
+}
@@ -0,0 +1,122 @@
+#include "Reorder.hpp"
+#include <rte_mbuf_dyn.h>
+#include <rte_cycles.h>
+#include <rte_errno.h>
+#include <algorithm>
+#include "Logger.hpp"
+
+RTE_DEFINE_PER_LCORE(uint64_t, egressSeqn) = 0;
+
+int EgressReorder::init(unsigned nbWorkers, unsigned bufferSize, unsigned maxHoldUs)
+{
+    static const struct rte_mbuf_dynfield seqnDesc = {
+        .name = "protocol_stack_egress_seqn",
+        .size = sizeof(uint64_t),
+        .align = __alignof__(uint64_t),
+    };
+    _seqnOffset = rte_mbuf_dynfield_register(&seqnDesc);
+    if (_seqnOffset < 0)
+    {
+        SPDLOG_ERROR("Failed to register egress seqn dynfield. {}", rte_strerror(rte_errno));
+        return -1;
+    }
+    _nbWorkers = nbWorkers;
+    _bufferSize = bufferSize;
+    _maxHoldCycles = rte_get_timer_hz() / 1000000 * maxHoldUs;
+    _enabled = true;
+    SPDLOG_INFO("Egress reorder enabled, workers {}, buffer size {}, max hold {} us", nbWorkers, bufferSize, maxHoldUs);
+    return 0;
+}
+
+unsigned EgressReorder::enqueueOut(struct rte_ring *out, struct rte_mbuf **mbufs, unsigned nbPkts)
+{
+    if (_enabled)
+    {
+        uint64_t seqn = RTE_PER_LCORE(egressSeqn);
+        for (unsigned i = 0; i < nbPkts; i++)
+            *seqnField(mbufs[i]) = seqn;
+    }
+    unsigned nbEnq = rte_ring_mp_enqueue_burst(out, (void **)mbufs, nbPkts, nullptr);
+    for (unsigned i = nbEnq; i < nbPkts; i++)
+        rte_pktmbuf_free(mbufs[i]);
+    return nbEnq;
+}
+
+uint64_t EgressReorder::releaseBound() const
+{
+    // 已经处理完所有已分发报文的工作核不构成限制,其后收到的报文序号一定更大
+    uint64_t bound = _nextSeqn;
+    for (unsigned w = 0; w < _nbWorkers; w++)
+    {
+        uint64_t done = _done[w].value.load(std::memory_order_acquire);
+        if (done < _dispatched[w])
+            bound = std::min(bound, done);
+    }
+    return bound;
+}
+
+unsigned EgressReorder::drain(struct rte_ring *out, struct rte_mbuf **tx, unsigned maxPkts)
+{
+    if (!_enabled)
+        return rte_ring_sc_dequeue_burst(out, (void **)tx, maxPkts, nullptr);
+
+    // 必须先读取放行边界再出队,保证序号不大于边界的报文都已经在输出环中
+    uint64_t bound = releaseBound();
+    unsigned nbTx = 0;
+
+    struct rte_mbuf *burst[REORDER_DRAIN_BURST];
+    unsigned room = _bufferSize > _pending.size() ? _bufferSize - _pending.size() : 0;
+    unsigned nbDeq = rte_ring_sc_dequeue_burst(out, (void **)burst, std::min(room, (unsigned)REORDER_DRAIN_BURST), nullptr);
+    for (unsigned i = 0; i < nbDeq; i++)
+    {
+        uint64_t seqn = *seqnField(burst[i]);
+        if (seqn == 0 && nbTx < maxPkts)
+        {
+            tx[nbTx++] = burst[i];
+            continue;
+        }
+        if (!_pending.empty() && seqn < *seqnField(_pending.back()))
+        {
+            _pendingSorted = false;
+            _reordered++;
+        }
+        _pending.push_back(burst[i]);
+    }
+
+    if (!_pendingSorted)
+    {
+        std::stable_sort(_pending.begin(), _pending.end(), [this](struct rte_mbuf *a, struct rte_mbuf *b)
+                         { return *seqnField(a) < *seqnField(b); });
+        _pendingSorted = true;
+    }
+
+    // 缓存已满或者放行边界长时间不前进时强制放行,防止某个工作核卡住导致出口停顿
+    uint64_t now = rte_get_timer_cycles();
+    if (bound != _lastBound || _pending.empty())
+    {
+        _lastBound = bound;
+        _stallSince = now;
+    }
+    bool force = _pending.size() >= _bufferSize || now - _stallSince > _maxHoldCycles;
+
+    while (!_pending.empty() && nbTx < maxPkts)
+    {
+        struct rte_mbuf *mbuf = _pending.front();
+        if (*seqnField(mbuf) > bound)
+        {
+            if (!force)
+                break;
+            _forced++;
+        }
+        tx[nbTx++] = mbuf;
+        _pending.pop_front();
+    }
+    return nbTx;
+}
+
+void EgressReorder::dumpStats()
+{
+    if (!_enabled)
+        return;
+    SPDLOG_INFO("Egress reorder: pending {}, reordered {}, forced {}", _pending.size(), _reordered, _forced);
+}
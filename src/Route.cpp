@@ -0,0 +1,222 @@
+#include "Route.hpp"
+#include <rte_lpm.h>
+#include <rte_pause.h>
+#include <rte_byteorder.h>
+#include <arpa/inet.h>
+#include <algorithm>
+#include "Logger.hpp"
+#include "Utils.hpp"
+
+using std::lock_guard;
+using std::mutex;
+
+int RouteTable::init(uint32_t maxRules, uint32_t numberTbl8, int socketId)
+{
+    lock_guard<mutex> lock(_mutex);
+    if (_lpm != nullptr)
+        return 0;
+    struct rte_lpm_config config = {};
+    config.max_rules = maxRules;
+    config.number_tbl8s = numberTbl8;
+    config.flags = 0;
+    _lpm = rte_lpm_create("route table", socketId, &config);
+    if (_lpm == nullptr)
+    {
+        SPDLOG_ERROR("Failed to create LPM route table, max rules {}, tbl8 {}", maxRules, numberTbl8);
+        return -1;
+    }
+    SPDLOG_INFO("Route table created, max rules {}, tbl8 {}", maxRules, numberTbl8);
+    return 0;
+}
+
+void RouteTable::writeBegin()
+{
+    _version.store(_version.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+}
+
+void RouteTable::writeEnd()
+{
+    // 代数在同一个写临界区内递增,读者拿到的代数和查询结果总是一致的
+    _generation.store(_generation.load(std::memory_order_relaxed) + 1, std::memory_order_release);
+    _version.store(_version.load(std::memory_order_relaxed) + 1, std::memory_order_release);
+}
+
+int RouteTable::acquireNextHop(uint32_t gateway, uint16_t portId)
+{
+    int freeIdx = -1;
+    for (int i = 0; i < ROUTE_MAX_NEXT_HOPS; i++)
+    {
+        NextHop &hop = _nextHops[i];
+        if (hop.refcnt > 0 && hop.gateway == gateway && hop.portId == portId)
+        {
+            hop.refcnt++;
+            return i;
+        }
+        if (hop.refcnt == 0 && freeIdx < 0)
+            freeIdx = i;
+    }
+    if (freeIdx >= 0)
+    {
+        _nextHops[freeIdx].gateway = gateway;
+        _nextHops[freeIdx].portId = portId;
+        _nextHops[freeIdx].refcnt = 1;
+    }
+    return freeIdx;
+}
+
+void RouteTable::releaseNextHop(uint32_t index)
+{
+    if (index < ROUTE_MAX_NEXT_HOPS && _nextHops[index].refcnt > 0)
+        _nextHops[index].refcnt--;
+}
+
+bool RouteTable::findRule(uint32_t hostPrefix, uint8_t depth, uint32_t *index)
+{
+    if (depth == 0)
+    {
+        int32_t hop = _defaultHop.load(std::memory_order_relaxed);
+        *index = (uint32_t)hop;
+        return hop >= 0;
+    }
+    return rte_lpm_is_rule_present(_lpm, hostPrefix, depth, index) == 1;
+}
+
+int RouteTable::addRoute(uint32_t prefix, uint8_t depth, uint32_t gateway, uint16_t portId)
+{
+    lock_guard<mutex> lock(_mutex);
+    if (_lpm == nullptr || depth > 32)
+        return -1;
+    // rte_lpm使用主机字节序
+    const uint32_t hostPrefix = depth == 0 ? 0 : rte_be_to_cpu_32(prefix) & (~0u << (32 - depth));
+    int index = acquireNextHop(gateway, portId);
+    if (index < 0)
+    {
+        SPDLOG_ERROR("Too many next hops, cannot add route via {}", convert_uint32_to_ip(gateway));
+        return -1;
+    }
+
+    uint32_t oldIndex = 0;
+    const bool replace = findRule(hostPrefix, depth, &oldIndex);
+    int ret = 0;
+    writeBegin();
+    if (depth == 0)
+        _defaultHop.store(index, std::memory_order_relaxed);
+    else
+        ret = rte_lpm_add(_lpm, hostPrefix, depth, (uint32_t)index);
+    writeEnd();
+    if (ret < 0)
+    {
+        releaseNextHop(index);
+        SPDLOG_ERROR("Failed to add route {}/{}: {}", convert_uint32_to_ip(rte_cpu_to_be_32(hostPrefix)), depth, ret);
+        return -1;
+    }
+    if (replace)
+        releaseNextHop(oldIndex);
+    else
+        _rules.push_back({hostPrefix, depth});
+    SPDLOG_INFO("Route {}/{} via {} port {}", convert_uint32_to_ip(rte_cpu_to_be_32(hostPrefix)), depth,
+                gateway == ROUTE_ON_LINK ? std::string("on-link") : convert_uint32_to_ip(gateway), portId);
+    return 0;
+}
+
+int RouteTable::delRoute(uint32_t prefix, uint8_t depth)
+{
+    lock_guard<mutex> lock(_mutex);
+    if (_lpm == nullptr || depth > 32)
+        return -1;
+    const uint32_t hostPrefix = depth == 0 ? 0 : rte_be_to_cpu_32(prefix) & (~0u << (32 - depth));
+    uint32_t index = 0;
+    if (!findRule(hostPrefix, depth, &index))
+        return -1;
+    int ret = 0;
+    writeBegin();
+    if (depth == 0)
+        _defaultHop.store(-1, std::memory_order_relaxed);
+    else
+        ret = rte_lpm_delete(_lpm, hostPrefix, depth);
+    writeEnd();
+    if (ret < 0)
+        return -1;
+    releaseNextHop(index);
+    _rules.erase(std::remove_if(_rules.begin(), _rules.end(),
+                                [&](const RouteRule &r) { return r.prefix == hostPrefix && r.depth == depth; }),
+                 _rules.end());
+    SPDLOG_INFO("Route {}/{} deleted", convert_uint32_to_ip(rte_cpu_to_be_32(hostPrefix)), depth);
+    return 0;
+}
+
+unsigned RouteTable::addRoutes(const std::vector<std::pair<std::string, std::string>> &routes, uint16_t portId)
+{
+    unsigned added = 0;
+    for (const auto &[cidr, via] : routes)
+    {
+        size_t slash = cidr.find('/');
+        std::string addr = cidr.substr(0, slash);
+        int depth = slash == std::string::npos ? 32 : atoi(cidr.c_str() + slash + 1);
+        struct in_addr prefix, gateway;
+        gateway.s_addr = ROUTE_ON_LINK;
+        if (inet_pton(AF_INET, addr.c_str(), &prefix) != 1 || depth < 0 || depth > 32 ||
+            (!via.empty() && inet_pton(AF_INET, via.c_str(), &gateway) != 1))
+        {
+            SPDLOG_WARN("Invalid route {} via {}, skipped", cidr, via);
+            continue;
+        }
+        if (addRoute(prefix.s_addr, (uint8_t)depth, gateway.s_addr, portId) == 0)
+            added++;
+    }
+    return added;
+}
+
+bool RouteTable::lookup(uint32_t dst, RouteCacheEntry *cache)
+{
+    if (_lpm == nullptr)
+        return false;
+    const uint32_t hostDst = rte_be_to_cpu_32(dst);
+    uint32_t version, generation, index = 0;
+    int ret;
+    NextHop hop;
+    do
+    {
+        version = _version.load(std::memory_order_acquire);
+        while (version & 1)
+        {
+            rte_pause();
+            version = _version.load(std::memory_order_acquire);
+        }
+        ret = rte_lpm_lookup(_lpm, hostDst, &index);
+        if (ret != 0)
+        {
+            // 没有更具体的路由时走默认路由
+            int32_t defaultHop = _defaultHop.load(std::memory_order_relaxed);
+            ret = defaultHop >= 0 ? 0 : ret;
+            index = (uint32_t)defaultHop;
+        }
+        if (ret == 0 && index < ROUTE_MAX_NEXT_HOPS)
+            hop = _nextHops[index];
+        generation = _generation.load(std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_acquire);
+    } while (_version.load(std::memory_order_relaxed) != version);
+
+    if (ret != 0 || index >= ROUTE_MAX_NEXT_HOPS)
+        return false;
+    cache->dst = dst;
+    cache->nextHop = hop.gateway == ROUTE_ON_LINK ? dst : hop.gateway;
+    cache->portId = hop.portId;
+    cache->generation = generation;
+    return true;
+}
+
+void RouteTable::dump()
+{
+    lock_guard<mutex> lock(_mutex);
+    for (const RouteRule &rule : _rules)
+    {
+        uint32_t index = 0;
+        if (!findRule(rule.prefix, rule.depth, &index) || index >= ROUTE_MAX_NEXT_HOPS)
+            continue;
+        const NextHop &hop = _nextHops[index];
+        SPDLOG_INFO("Route {}/{} via {} port {}", convert_uint32_to_ip(rte_cpu_to_be_32(rule.prefix)), rule.depth,
+                    hop.gateway == ROUTE_ON_LINK ? std::string("on-link") : convert_uint32_to_ip(hop.gateway), hop.portId);
+    }
+}
@@ -0,0 +1,152 @@
+#include "Rps.hpp"
+#include <rte_ether.h>
+#include <rte_ip.h>
+#include <rte_udp.h>
+#include <rte_jhash.h>
+#include <algorithm>
+#include "Logger.hpp"
+#include "Reorder.hpp"
+#include "LocalAddr.hpp"
+#include "Nat.hpp"
+
+int RpsDispatcher::init(unsigned nbWorkers, bool spray)
+{
+    if (nbWorkers == 0 || nbWorkers > RING_MAX_WORKERS)
+    {
+        SPDLOG_ERROR("Invalid RPS worker count: {}, must be in [1, {}]", nbWorkers, RING_MAX_WORKERS);
+        return -1;
+    }
+    _nbWorkers = nbWorkers;
+    _spray = spray && nbWorkers > 1;
+    for (unsigned i = 0; i < _nbWorkers; i++)
+    {
+        _workerRings[i] = Ring::getSingleton().getRing(i)->in;
+        _enqueued[i] = 0;
+        _dropped[i] = 0;
+    }
+    SPDLOG_INFO("RPS dispatcher initialized with {} workers, mode {}", _nbWorkers, _spray ? "spray" : "hash");
+    return 0;
+}
+
+uint32_t RpsDispatcher::flowHash(struct rte_mbuf *mbuf, bool *sprayable) const
+{
+    if (sprayable)
+        *sprayable = false;
+
+    struct rte_ether_hdr *ehdr = rte_pktmbuf_mtod(mbuf, struct rte_ether_hdr *);
+    if (ehdr->ether_type == rte_cpu_to_be_16(RTE_ETHER_TYPE_IPV6))
+        return flowHash6((struct rte_ipv6_hdr *)(ehdr + 1));
+    if (ehdr->ether_type != rte_cpu_to_be_16(RTE_ETHER_TYPE_IPV4))
+        return 0;
+
+    struct rte_ipv4_hdr *iphdr = (struct rte_ipv4_hdr *)(ehdr + 1);
+    uint32_t ipLo = std::min(iphdr->src_addr, iphdr->dst_addr);
+    uint32_t ipHi = std::max(iphdr->src_addr, iphdr->dst_addr);
+    uint32_t ports = 0;
+
+    // 分片报文只有首片带有端口,所有分片只按地址哈希,保证同一个数据报的分片落到同一个工作核
+    bool fragmented = (iphdr->fragment_offset & rte_cpu_to_be_16(RTE_IPV4_HDR_MF_FLAG | RTE_IPV4_HDR_OFFSET_MASK)) != 0;
+    if (!fragmented && (iphdr->next_proto_id == IPPROTO_TCP || iphdr->next_proto_id == IPPROTO_UDP))
+    {
+        uint8_t ihl = (iphdr->version_ihl & RTE_IPV4_HDR_IHL_MASK) * RTE_IPV4_IHL_MULTIPLIER;
+        // TCP和UDP头部的前4个字节都是源端口和目的端口
+        struct rte_udp_hdr *l4hdr = (struct rte_udp_hdr *)((uint8_t *)iphdr + ihl);
+        uint16_t portLo = std::min(l4hdr->src_port, l4hdr->dst_port);
+        uint16_t portHi = std::max(l4hdr->src_port, l4hdr->dst_port);
+        ports = ((uint32_t)portLo << 16) | portHi;
+    }
+    if (sprayable)
+        *sprayable = !fragmented && !(iphdr->next_proto_id == IPPROTO_TCP && LocalAddrTable::getInstance().isLocal(iphdr->dst_addr));
+
+    return rte_jhash_3words(ipLo, ipHi, ports ^ iphdr->next_proto_id, _hashSeed);
+}
+
+uint32_t RpsDispatcher::flowHash6(struct rte_ipv6_hdr *ip6) const
+{
+    // 先把每个128位地址哈希成32位,再按IPv4的方式取较小/较大值,保证双向对称
+    uint32_t srcHash = rte_jhash(ip6->src_addr, sizeof(ip6->src_addr), _hashSeed);
+    uint32_t dstHash = rte_jhash(ip6->dst_addr, sizeof(ip6->dst_addr), _hashSeed);
+    uint32_t ports = 0;
+    // 不解析扩展头,只有上层协议紧跟固定头部时才带上端口
+    if (ip6->proto == IPPROTO_TCP || ip6->proto == IPPROTO_UDP)
+    {
+        struct rte_udp_hdr *l4hdr = (struct rte_udp_hdr *)(ip6 + 1);
+        uint16_t portLo = std::min(l4hdr->src_port, l4hdr->dst_port);
+        uint16_t portHi = std::max(l4hdr->src_port, l4hdr->dst_port);
+        ports = ((uint32_t)portLo << 16) | portHi;
+    }
+    return rte_jhash_3words(std::min(srcHash, dstHash), std::max(srcHash, dstHash), ports ^ ip6->proto, _hashSeed);
+}
+
+unsigned RpsDispatcher::dispatch(struct rte_mbuf **mbufs, unsigned nbPkts)
+{
+    EgressReorder &reorder = EgressReorder::getInstance();
+    if (_nbWorkers == 1)
+    {
+        unsigned nbEnq = rte_ring_sp_enqueue_burst(_workerRings[0], (void **)mbufs, nbPkts, nullptr);
+        _enqueued[0] += nbEnq;
+        _dropped[0] += nbPkts - nbEnq;
+        for (unsigned i = nbEnq; i < nbPkts; i++)
+            rte_pktmbuf_free(mbufs[i]);
+        return nbEnq;
+    }
+
+    const Nat44 &nat = Nat44::getInstance();
+    const bool ENABLE_NAT = nat.isEnabled();
+    struct rte_mbuf *batch[RING_MAX_WORKERS][RPS_DISPATCH_CHUNK];
+    unsigned batchLen[RING_MAX_WORKERS];
+    unsigned total = 0;
+
+    for (unsigned base = 0; base < nbPkts; base += RPS_DISPATCH_CHUNK)
+    {
+        unsigned chunk = std::min(nbPkts - base, (unsigned)RPS_DISPATCH_CHUNK);
+        std::fill(batchLen, batchLen + _nbWorkers, 0);
+
+        for (unsigned i = 0; i < chunk; i++)
+        {
+            struct rte_mbuf *mbuf = mbufs[base + i];
+            bool sprayable = false;
+            // NAT会话只在分配外部端口的工作核上,回程报文按目的端口分发
+            const int natWorker = ENABLE_NAT ? nat.steerWorker(mbuf) : -1;
+            unsigned worker = natWorker >= 0 ? (unsigned)natWorker : selectWorker(flowHash(mbuf, _spray ? &sprayable : nullptr));
+            if (sprayable)
+            {
+                worker = _sprayNext;
+                _sprayNext = (_sprayNext + 1 == _nbWorkers) ? 0 : _sprayNext + 1;
+            }
+            if (reorder.isEnabled())
+                reorder.stampRx(mbuf);
+            batch[worker][batchLen[worker]++] = mbuf;
+        }
+
+        for (unsigned w = 0; w < _nbWorkers; w++)
+        {
+            if (batchLen[w] == 0)
+                continue;
+            unsigned nbEnq = rte_ring_sp_enqueue_burst(_workerRings[w], (void **)batch[w], batchLen[w], nullptr);
+            if (nbEnq > 0 && reorder.isEnabled())
+                reorder.noteDispatched(w, reorder.getSeqn(batch[w][nbEnq - 1]));
+            _enqueued[w] += nbEnq;
+            _dropped[w] += batchLen[w] - nbEnq;
+            for (unsigned i = nbEnq; i < batchLen[w]; i++)
+                rte_pktmbuf_free(batch[w][i]);
+            total += nbEnq;
+        }
+    }
+    return total;
+}
+
+void RpsDispatcher::dumpStats()
+{
+    uint64_t sum = 0;
+    for (unsigned w = 0; w < _nbWorkers; w++)
+        sum += _enqueued[w];
+
+    for (unsigned w = 0; w < _nbWorkers; w++)
+    {
+        double share = sum ? (100.0 * _enqueued[w] / sum) : 0.0;
+        SPDLOG_INFO("RPS worker {}: enqueued {}, dropped {}, share {:.1f}%", w, _enqueued[w], _dropped[w], share);
+        _enqueued[w] = 0;
+        _dropped[w] = 0;
+    }
+}
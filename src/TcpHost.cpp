@@ -3,9 +3,13 @@
 #include "Logger.hpp"
 #include "Utils.hpp"
 #include "Epoll.hpp"
+#include "TcpProcessor.hpp"
 #include <rte_malloc.h>
 #include <arpa/inet.h>
 #include <vector>
+#include <algorithm>
+#include <cerrno>
+#include <new>
 
 #define TCP_OPTION_LENGTH 10
 #define TCP_MAX_SEQ 4294967295
@@ -122,9 +126,11 @@ int TcpServerManager::nsocket(__attribute__((unused)) int domain, int type, __at
         {
             return -1;
         }
-        memset(ts, 0, sizeof(struct TcpStream));
+        // TcpStream的缓存成员带默认初始化,值初始化会先把所有字段清零
+        new (ts) TcpStream();
         ts->fd = fd;
         ts->protocol = IPPROTO_TCP;
+        ts->family = domain == AF_INET6 ? AF_INET6 : AF_INET;
         ts->rcvbuf = rte_ring_create("tcp recv buffer", RING_SIZE, rte_socket_id(), RING_F_SP_ENQ | RING_F_SC_DEQ);
         if (ts->rcvbuf == nullptr)
         {
@@ -169,16 +175,26 @@ int TcpServerManager::nlisten(int sockfd, __attribute__((unused)) int backlog)
 
 int TcpServerManager::nbind(int sockfd, const struct sockaddr *addr, __attribute__((unused)) socklen_t addrlen)
 {
-    SPDLOG_INFO("Bind socket fd: {}, addr: {}", sockfd, sockaddr_in_to_string(*(const struct sockaddr_in *)addr));
     TcpStream *ts = TcpTable::getInstance().getTcpStreamByFd(sockfd);
     if (ts == nullptr)
     {
         SPDLOG_ERROR("Couldn't found TCP Stream. sockfd:{}", sockfd);
         return -1;
     }
-    const struct sockaddr_in *laddr = (const struct sockaddr_in *)addr;
-    ts->dstPort = laddr->sin_port;
-    rte_memcpy(&ts->dstIp, &laddr->sin_addr.s_addr, sizeof(uint32_t));
+    if (ts->family == AF_INET6)
+    {
+        const struct sockaddr_in6 *laddr6 = (const struct sockaddr_in6 *)addr;
+        SPDLOG_INFO("Bind socket fd: {}, addr: [{}]:{}", sockfd, ipv6ToString(laddr6->sin6_addr.s6_addr), ntohs(laddr6->sin6_port));
+        ts->dstPort = laddr6->sin6_port;
+        rte_memcpy(ts->dstIp6, laddr6->sin6_addr.s6_addr, IPV6_ADDR_LEN);
+    }
+    else
+    {
+        const struct sockaddr_in *laddr = (const struct sockaddr_in *)addr;
+        SPDLOG_INFO("Bind socket fd: {}, addr: {}", sockfd, sockaddr_in_to_string(*laddr));
+        ts->dstPort = laddr->sin_port;
+        rte_memcpy(&ts->dstIp, &laddr->sin_addr.s_addr, sizeof(uint32_t));
+    }
     rte_memcpy(ts->localMac, ConfigManager::getInstance().getSrcMac(), RTE_ETHER_ADDR_LEN);
     ts->status = TCP_STATUS::TCP_STATUS_CLOSED;
     return 0;
@@ -250,7 +266,7 @@ int TcpServerManager::naccept(int sockfd, struct sockaddr *addr, __attribute__((
         TcpStream *tmp = nullptr;
         pthread_mutex_lock(&ts->mutex);
         SPDLOG_INFO("Waiting for TCP connection on port: {}", ntohs(ts->dstPort));
-        while ((tmp = TcpTable::getInstance().getTcpStreamByPort(ts->dstPort)) == nullptr)
+        while ((tmp = TcpTable::getInstance().getTcpStreamByPort(ts->dstPort, ts->family)) == nullptr)
         {
             pthread_cond_wait(&ts->cond, &ts->mutex);
         }
@@ -261,9 +277,19 @@ int TcpServerManager::naccept(int sockfd, struct sockaddr *addr, __attribute__((
         }
         tmp->fd = allocFdFromBitMap();
         SPDLOG_INFO("alloc fd {}", tmp->fd);
-        struct sockaddr_in *saddr = (struct sockaddr_in *)addr;
-        saddr->sin_port = tmp->srcPort;
-        rte_memcpy(&saddr->sin_addr.s_addr, &tmp->srcIp, sizeof(uint32_t));
+        if (tmp->family == AF_INET6)
+        {
+            struct sockaddr_in6 *saddr6 = (struct sockaddr_in6 *)addr;
+            saddr6->sin6_family = AF_INET6;
+            saddr6->sin6_port = tmp->srcPort;
+            rte_memcpy(saddr6->sin6_addr.s6_addr, tmp->srcIp6, IPV6_ADDR_LEN);
+        }
+        else
+        {
+            struct sockaddr_in *saddr = (struct sockaddr_in *)addr;
+            saddr->sin_port = tmp->srcPort;
+            rte_memcpy(&saddr->sin_addr.s_addr, &tmp->srcIp, sizeof(uint32_t));
+        }
         TcpTable::getInstance().debug();
         return tmp->fd;
     }
@@ -284,40 +310,72 @@ ssize_t TcpServerManager::nsend(int sockfd, const void *buf, size_t len, __attri
         return -1;
     }
 
-    struct TcpFragment *fragment = (struct TcpFragment *)rte_malloc("TcpFragment", sizeof(struct TcpFragment), 0);
-    if (fragment == nullptr)
+    // 按有效MSS切分,每个报文段都不超过路径MTU
+    const uint16_t mss = TcpProcessor::getInstance().tcpEffectiveMss(ts);
+    const uint8_t *data = (const uint8_t *)buf;
+    while ((size_t)length < len)
     {
-        SPDLOG_ERROR("Failed to allocate memory for TCP fragment");
-        return -2;
-    }
+        uint32_t segLen = std::min<size_t>(len - length, mss);
+        struct TcpFragment *fragment = (struct TcpFragment *)rte_malloc("TcpFragment", sizeof(struct TcpFragment), 0);
+        if (fragment == nullptr)
+        {
+            SPDLOG_ERROR("Failed to allocate memory for TCP fragment");
+            return length > 0 ? length : -2;
+        }
 
-    memset(fragment, 0, sizeof(struct TcpFragment));
+        memset(fragment, 0, sizeof(struct TcpFragment));
 
-    fragment->dstPort = ts->srcPort;
-    fragment->srcPort = ts->dstPort;
+        fragment->dstPort = ts->srcPort;
+        fragment->srcPort = ts->dstPort;
 
-    fragment->acknum = ts->rcvNxt;
-    fragment->seqnum = ts->sndNxt;
-    SPDLOG_INFO("debug");
-    SPDLOG_INFO("fragment->acknum: {}, fragment->seqnum: {}", fragment->acknum, fragment->seqnum);
+        fragment->acknum = ts->rcvNxt;
+        fragment->seqnum = ts->sndNxt + length;
+        SPDLOG_INFO("debug");
+        SPDLOG_INFO("fragment->acknum: {}, fragment->seqnum: {}", fragment->acknum, fragment->seqnum);
+
+        fragment->tcp_flags = RTE_TCP_ACK_FLAG;
+        // 只在最后一个报文段上设置PSH
+        if ((size_t)length + segLen == len)
+            fragment->tcp_flags |= RTE_TCP_PSH_FLAG;
+        fragment->windows = TCP_INITIAL_WINDOW;
+        fragment->hdrlen_off = 0x50;
 
-    fragment->tcp_flags = RTE_TCP_ACK_FLAG | RTE_TCP_PSH_FLAG;
-    fragment->windows = TCP_INITIAL_WINDOW;
-    fragment->hdrlen_off = 0x50;
+        fragment->data = (unsigned char *)rte_malloc("unsigned char *", segLen + 1, 0);
+        if (fragment->data == nullptr)
+        {
+            SPDLOG_ERROR("Failed to allocate memory for TCP fragment data");
+            rte_free(fragment);
+            return length > 0 ? length : -1;
+        }
+        memset(fragment->data, 0, segLen + 1);
+        rte_memcpy(fragment->data, data + length, segLen);
+        fragment->length = segLen;
+        if (rte_ring_mp_enqueue(ts->sndbuf, fragment) < 0)
+        {
+            rte_free(fragment->data);
+            rte_free(fragment);
+            break;
+        }
+        length += segLen;
+    }
+    return length;
+}
 
-    fragment->data = (unsigned char *)rte_malloc("unsigned char *", len + 1, 0);
-    if (fragment->data == nullptr)
+int TcpServerManager::nsetsockopt(int sockfd, int level, int optname, const void *optval, socklen_t optlen)
+{
+    TcpStream *ts = TcpTable::getInstance().getTcpStreamByFd(sockfd);
+    if (ts == nullptr)
     {
-        SPDLOG_ERROR("Failed to allocate memory for TCP fragment data");
-        rte_free(fragment);
+        errno = EBADF;
         return -1;
     }
-    memset(fragment->data, 0, len + 1);
-    rte_memcpy(fragment->data, buf, len);
-    fragment->length = len;
-    length = fragment->length;
-    rte_ring_mp_enqueue(ts->sndbuf, fragment);
-    return length;
+    const int ret = parseTosOption(ts->family, level, optname, optval, optlen, &ts->tos);
+    if (ret > 0)
+    {
+        errno = ENOPROTOOPT;
+        return -1;
+    }
+    return ret;
 }
 
 int TcpServerManager::nclose(int fd)
@@ -371,13 +429,13 @@ int TcpTable::addTcpStream(TcpStream *ts)
     return 0;
 }
 
-TcpStream *TcpTable::getTcpStreamByPort(uint16_t port)
+TcpStream *TcpTable::getTcpStreamByPort(uint16_t port, int family)
 {
     struct TcpStream *ts = nullptr;
     for (auto &it : _tcpStreamList)
     {
         // 只取出半连接的队列
-        if (it->dstPort == port && it->fd == -1)
+        if (it->dstPort == port && it->family == family && it->fd == -1)
         {
             ts = it;
             return ts;
@@ -392,7 +450,7 @@ TcpStream *TcpTable::getTcpStream(uint32_t sip, uint32_t dip, uint16_t sport, ui
     std::lock_guard<std::mutex> lock(_mutex);
     for (auto &it : _tcpStreamList)
     {
-        if (it->srcIp == sip && it->dstIp == dip && it->srcPort == sport && it->dstPort == dport)
+        if (it->family == AF_INET && it->srcIp == sip && it->dstIp == dip && it->srcPort == sport && it->dstPort == dport)
         {
             SPDLOG_INFO("Found established TCP stream: fd: {}, srcIp: {}, dstIp: {}, srcPort: {}, dstPort: {}, status: {}",
                         it->fd, convert_uint32_to_ip(it->srcIp), convert_uint32_to_ip(it->dstIp),
@@ -401,18 +459,46 @@ TcpStream *TcpTable::getTcpStream(uint32_t sip, uint32_t dip, uint16_t sport, ui
             return ts;
         }
     }
+    // 绑定具体地址的监听socket优先于绑定INADDR_ANY的,与UDP的分发规则一致
     for (auto &it : _tcpStreamList)
     {
-        if (it->dstPort == dport && it->status == TCP_STATUS::TCP_STATUS_LISTEN)
+        if (it->family != AF_INET || it->dstPort != dport || it->status != TCP_STATUS::TCP_STATUS_LISTEN)
+            continue;
+        if (it->dstIp == dip)
         {
-            SPDLOG_INFO("Found listening TCP stream: fd: {}, srcIp: {}, dstIp: {}, srcPort: {}, dstPort: {}, status: {}",
-                        it->fd, convert_uint32_to_ip(it->srcIp), convert_uint32_to_ip(it->dstIp),
-                        ntohs(it->srcPort), ntohs(it->dstPort), (int)it->status);
             ts = it;
-            return ts;
+            break;
         }
+        if (ts == nullptr && it->dstIp == INADDR_ANY)
+            ts = it;
     }
-    return nullptr;
+    if (ts != nullptr)
+        SPDLOG_INFO("Found listening TCP stream: fd: {}, srcIp: {}, dstIp: {}, srcPort: {}, dstPort: {}, status: {}",
+                    ts->fd, convert_uint32_to_ip(ts->srcIp), convert_uint32_to_ip(ts->dstIp),
+                    ntohs(ts->srcPort), ntohs(ts->dstPort), (int)ts->status);
+    return ts;
+}
+
+TcpStream *TcpTable::getTcpStream6(const uint8_t *sip, const uint8_t *dip, uint16_t sport, uint16_t dport)
+{
+    std::lock_guard<std::mutex> lock(_mutex);
+    for (auto &it : _tcpStreamList)
+    {
+        if (it->family == AF_INET6 && it->srcPort == sport && it->dstPort == dport &&
+            ipv6Equal(it->srcIp6, sip) && ipv6Equal(it->dstIp6, dip))
+            return it;
+    }
+    TcpStream *wildcard = nullptr;
+    for (auto &it : _tcpStreamList)
+    {
+        if (it->family != AF_INET6 || it->dstPort != dport || it->status != TCP_STATUS::TCP_STATUS_LISTEN)
+            continue;
+        if (ipv6Equal(it->dstIp6, dip))
+            return it;
+        if (wildcard == nullptr && ipv6IsUnspecified(it->dstIp6))
+            wildcard = it;
+    }
+    return wildcard;
 }
 
 TcpStream *TcpTable::getTcpStreamByFd(int fd)
@@ -6,30 +6,51 @@
 #include "Arp.hpp"
 #include "ArpProcessor.hpp"
 #include "Epoll.hpp"
+#include "Reorder.hpp"
+#include "IcmpProcessor.hpp"
+#include "Pmtu.hpp"
+#include "Ipv6.hpp"
+#include "Vlan.hpp"
+#include "Vxlan.hpp"
 #include <rte_malloc.h>
 #include <rte_errno.h>
 #include <cstdio>
+#include <algorithm>
 
 #define TCP_INITIAL_WINDOW 14600
 #define TCP_MAX_SEQ 4294967295
+#define TCP_OPT_END 0
+#define TCP_OPT_NOP 1
+#define TCP_OPT_MSS 2
+#define TCP_OPT_MSS_LEN 4
 
 int TcpProcessor::tcpProcess(struct rte_mbuf *tcpmbuf)
 {
     SPDLOG_INFO("TCP Process ...");
+    // 重组后的报文段是多段mbuf,之后的校验和与头部解析都假设数据连续,直接丢弃
+    if (tcpmbuf->nb_segs != 1)
+    {
+        SPDLOG_INFO("Drop multi-segment TCP segment, nb_segs {}", tcpmbuf->nb_segs);
+        return -1;
+    }
     struct rte_ipv4_hdr *iphdr = rte_pktmbuf_mtod_offset(tcpmbuf, struct rte_ipv4_hdr *, sizeof(struct rte_ether_hdr));
-    struct rte_tcp_hdr *tcphdr = (struct rte_tcp_hdr *)(iphdr + 1);
+    // 报文可能带有IP选项,按IHL定位TCP头部
+    struct rte_tcp_hdr *tcphdr = (struct rte_tcp_hdr *)((uint8_t *)iphdr + rte_ipv4_hdr_len(iphdr));
     SPDLOG_INFO("debug");
     SPDLOG_INFO("seqnumber: {}, acknumber: {}, srcPort: {}, dstPort: {}",
                 ntohl(tcphdr->sent_seq), ntohl(tcphdr->recv_ack), ntohs(tcphdr->src_port), ntohs(tcphdr->dst_port));
-    // tcphdr, rte_ipv4_udptcp_cksum
-    uint16_t tcpcksum = tcphdr->cksum;
-    tcphdr->cksum = 0;
-    uint16_t cksum = rte_ipv4_udptcp_cksum(iphdr, tcphdr);
-
-    if (cksum != tcpcksum)
+    // 网卡已经校验过的报文不再用软件计算校验和
+    if ((tcpmbuf->ol_flags & PKT_RX_L4_CKSUM_MASK) != PKT_RX_L4_CKSUM_GOOD)
     {
-        SPDLOG_ERROR("cksum:{}, tcp cksum: {}", cksum, tcpcksum);
-        return -1;
+        uint16_t tcpcksum = tcphdr->cksum;
+        tcphdr->cksum = 0;
+        uint16_t cksum = rte_ipv4_udptcp_cksum(iphdr, tcphdr);
+
+        if (cksum != tcpcksum)
+        {
+            SPDLOG_ERROR("cksum:{}, tcp cksum: {}", cksum, tcpcksum);
+            return -1;
+        }
     }
 
     struct TcpStream *ts = TcpTable::getInstance().getTcpStream(iphdr->src_addr, iphdr->dst_addr, tcphdr->src_port, tcphdr->dst_port);
@@ -43,20 +64,51 @@ int TcpProcessor::tcpProcess(struct rte_mbuf *tcpmbuf)
                 ts->fd, convert_uint32_to_ip(ts->srcIp), convert_uint32_to_ip(ts->dstIp),
                 ntohs(tcphdr->src_port), ntohs(tcphdr->dst_port), (int)ts->status);
 
-    switch (ts->status)
-    {
-    case TCP_STATUS::TCP_STATUS_CLOSED: // client
-        break;
-
-    case TCP_STATUS::TCP_STATUS_LISTEN: // server
+    if (ts->status == TCP_STATUS::TCP_STATUS_LISTEN) // server
     {
         int code = tcpHandleListen(ts, tcphdr, iphdr);
         if (code != 0)
         {
             SPDLOG_ERROR("TCP Listen failed. code={}", code);
         }
-        break;
+        return 0;
+    }
+    return tcpHandleStream(ts, tcphdr, ntohs(iphdr->total_length) - rte_ipv4_hdr_len(iphdr));
+}
+
+int TcpProcessor::tcp6Process(struct rte_mbuf *tcpmbuf)
+{
+    struct rte_ipv6_hdr *ip6 = rte_pktmbuf_mtod_offset(tcpmbuf, struct rte_ipv6_hdr *, sizeof(struct rte_ether_hdr));
+    struct rte_tcp_hdr *tcphdr = (struct rte_tcp_hdr *)(ip6 + 1);
+    const int tcplen = rte_be_to_cpu_16(ip6->payload_len);
+    if (tcpmbuf->nb_segs != 1 || tcplen < (int)sizeof(struct rte_tcp_hdr) || ((tcphdr->data_off >> 4) << 2) > tcplen ||
+        ((tcpmbuf->ol_flags & PKT_RX_L4_CKSUM_MASK) != PKT_RX_L4_CKSUM_GOOD && rte_ipv6_udptcp_cksum(ip6, tcphdr) != 0xffff))
+    {
+        SPDLOG_INFO("Drop invalid TCP segment from {}", ipv6ToString(ip6->src_addr));
+        return -1;
+    }
+
+    struct TcpStream *ts = TcpTable::getInstance().getTcpStream6(ip6->src_addr, ip6->dst_addr, tcphdr->src_port, tcphdr->dst_port);
+    if (ts == nullptr)
+    {
+        SPDLOG_INFO("TcpStream not found for [{}]:{}", ipv6ToString(ip6->dst_addr), ntohs(tcphdr->dst_port));
+        return -2;
     }
+    if (ts->status == TCP_STATUS::TCP_STATUS_LISTEN)
+        return tcpHandleListen6(ts, tcphdr, ip6);
+    return tcpHandleStream(ts, tcphdr, tcplen);
+}
+
+int TcpProcessor::tcpHandleStream(struct TcpStream *ts, struct rte_tcp_hdr *tcphdr, int tcplen)
+{
+    switch (ts->status)
+    {
+    case TCP_STATUS::TCP_STATUS_CLOSED: // client
+        break;
+
+    case TCP_STATUS::TCP_STATUS_LISTEN: // server,由调用者按地址族处理
+        break;
+
     case TCP_STATUS::TCP_STATUS_SYN_RCVD: // server
         tcpHandleSynRcvd(ts, tcphdr);
         break;
@@ -64,12 +116,10 @@ int TcpProcessor::tcpProcess(struct rte_mbuf *tcpmbuf)
     case TCP_STATUS::TCP_STATUS_SYN_SENT: // client
         break;
 
-    case TCP_STATUS::TCP_STATUS_ESTABLISHED:
-    { // server | client
-        int tcplen = ntohs(iphdr->total_length) - sizeof(struct rte_ipv4_hdr);
+    case TCP_STATUS::TCP_STATUS_ESTABLISHED: // server | client
         tcpHandleEstablished(ts, tcphdr, tcplen);
         break;
-    }
+
     case TCP_STATUS::TCP_STATUS_FIN_WAIT_1: //  ~client
         break;
 
@@ -107,41 +157,115 @@ int TcpProcessor::tcpHandleListen(struct TcpStream *listenStream, struct rte_tcp
                 SPDLOG_ERROR("Create TcpStream failed");
                 return -1;
             }
+            ts->tos = listenStream->tos;
             TcpTable::getInstance().addTcpStream(ts);
-
-            struct TcpFragment *tf = static_cast<struct TcpFragment *>(rte_malloc("TcpFragment", sizeof(struct TcpFragment), 0));
-            if (tf == nullptr)
-            {
-                SPDLOG_ERROR("Create TcpFragment failed");
-                return -1;
-            }
-            memset(tf, 0, sizeof(struct TcpFragment));
-
-            tf->srcPort = tcphdr->dst_port;
-            tf->dstPort = tcphdr->src_port;
-
             SPDLOG_INFO("TCP listening src: {}:{} dst: {}:{}", convert_uint32_to_ip(ts->srcIp), ntohs(tcphdr->src_port),
                         convert_uint32_to_ip(ts->dstIp), ntohs(tcphdr->dst_port));
-            tf->seqnum = ts->sndNxt;
-            tf->acknum = ntohl(tcphdr->sent_seq) + 1;
-            ts->rcvNxt = tf->acknum;
-
-            SPDLOG_INFO("debug");
-            SPDLOG_INFO("tf->acknum: {}, tf->seqnum: {}", tf->acknum, tf->seqnum);
-
-            tf->tcp_flags = (RTE_TCP_SYN_FLAG | RTE_TCP_ACK_FLAG);
-            tf->windows = TCP_INITIAL_WINDOW;
-            tf->hdrlen_off = 0x50;
-            tf->data = nullptr;
-            tf->length = 0;
-            rte_ring_mp_enqueue(ts->sndbuf, tf);
-            ts->status = TCP_STATUS::TCP_STATUS_SYN_RCVD;
+            // 按本端链路MTU通告MSS
+            return tcpSendSynAck(ts, tcphdr, PmtuCache::getInstance().getLinkMtu() - TCP_IPV4_HDR_LEN);
         }
     }
 
     return 0;
 }
 
+int TcpProcessor::tcpHandleListen6(struct TcpStream *listenStream, struct rte_tcp_hdr *tcphdr, struct rte_ipv6_hdr *ip6)
+{
+    if (!(tcphdr->tcp_flags & RTE_TCP_SYN_FLAG) || listenStream->status != TCP_STATUS::TCP_STATUS_LISTEN)
+        return 0;
+    // 流的两个地址都以IPv6形式保存,srcIp/dstIp只用于日志和环的命名
+    struct TcpStream *ts = tcpCreateStream(Ipv6Processor::foldAddr(ip6->src_addr), Ipv6Processor::foldAddr(ip6->dst_addr),
+                                           tcphdr->src_port, tcphdr->dst_port);
+    if (ts == nullptr)
+    {
+        SPDLOG_ERROR("Create TcpStream failed");
+        return -1;
+    }
+    ts->family = AF_INET6;
+    ts->tos = listenStream->tos;
+    rte_memcpy(ts->srcIp6, ip6->src_addr, IPV6_ADDR_LEN);
+    rte_memcpy(ts->dstIp6, ip6->dst_addr, IPV6_ADDR_LEN);
+    TcpTable::getInstance().addTcpStream(ts);
+    SPDLOG_INFO("TCP listening src: [{}]:{} dst: [{}]:{}", ipv6ToString(ts->srcIp6), ntohs(tcphdr->src_port),
+                ipv6ToString(ts->dstIp6), ntohs(tcphdr->dst_port));
+    return tcpSendSynAck(ts, tcphdr, Ipv6Processor::getInstance().getMtu() - TCP_IPV6_HDR_LEN);
+}
+
+int TcpProcessor::tcpSendSynAck(struct TcpStream *ts, struct rte_tcp_hdr *tcphdr, uint16_t mss)
+{
+    ts->peerMss = tcpParseMss(tcphdr, ts->family);
+
+    struct TcpFragment *tf = static_cast<struct TcpFragment *>(rte_malloc("TcpFragment", sizeof(struct TcpFragment), 0));
+    if (tf == nullptr)
+    {
+        SPDLOG_ERROR("Create TcpFragment failed");
+        return -1;
+    }
+    memset(tf, 0, sizeof(struct TcpFragment));
+
+    tf->srcPort = tcphdr->dst_port;
+    tf->dstPort = tcphdr->src_port;
+    tf->seqnum = ts->sndNxt;
+    tf->acknum = ntohl(tcphdr->sent_seq) + 1;
+    ts->rcvNxt = tf->acknum;
+
+    SPDLOG_INFO("debug");
+    SPDLOG_INFO("tf->acknum: {}, tf->seqnum: {}", tf->acknum, tf->seqnum);
+
+    tf->tcp_flags = (RTE_TCP_SYN_FLAG | RTE_TCP_ACK_FLAG);
+    tf->windows = TCP_INITIAL_WINDOW;
+    tf->option[0] = htonl((TCP_OPT_MSS << 24) | (TCP_OPT_MSS_LEN << 16) | mss);
+    tf->optlen = 1;
+    tf->hdrlen_off = (sizeof(struct rte_tcp_hdr) / sizeof(uint32_t) + tf->optlen) << 4;
+    tf->data = nullptr;
+    tf->length = 0;
+    rte_ring_mp_enqueue(ts->sndbuf, tf);
+    ts->status = TCP_STATUS::TCP_STATUS_SYN_RCVD;
+    return 0;
+}
+
+uint16_t TcpProcessor::tcpParseMss(struct rte_tcp_hdr *tcphdr, int family)
+{
+    // 过小的MSS会迫使本机发送大量极小的报文段,按最小MTU能容纳的MSS下限处理
+    const uint16_t minMss = family == AF_INET6 ? IPV6_MIN_MTU - TCP_IPV6_HDR_LEN : TCP_DEFAULT_MSS;
+    uint8_t *opt = (uint8_t *)(tcphdr + 1);
+    uint8_t *end = (uint8_t *)tcphdr + ((tcphdr->data_off >> 4) << 2);
+    while (opt < end)
+    {
+        if (*opt == TCP_OPT_END)
+            break;
+        if (*opt == TCP_OPT_NOP)
+        {
+            opt++;
+            continue;
+        }
+        if (opt + 1 >= end || opt[1] < 2 || opt + opt[1] > end)
+            break;
+        if (opt[0] == TCP_OPT_MSS && opt[1] == TCP_OPT_MSS_LEN)
+        {
+            uint16_t mss = (opt[2] << 8) | opt[3];
+            return std::max(mss, minMss);
+        }
+        opt += opt[1];
+    }
+    return TCP_DEFAULT_MSS;
+}
+
+uint16_t TcpProcessor::tcpEffectiveMss(struct TcpStream *stream)
+{
+    // 没有经过三次握手创建的流(如监听socket)没有记录对端的MSS
+    uint16_t peerMss = stream->peerMss > 0 ? stream->peerMss : TCP_DEFAULT_MSS;
+    // IPv6没有路径MTU缓存,按链路MTU计算
+    if (stream->family == AF_INET6)
+        return std::min<uint16_t>(peerMss, Ipv6Processor::getInstance().getMtu() - TCP_IPV6_HDR_LEN);
+    // 经过隧道接口发送的流还要留出外层封装的长度;握手时流上还没有路由缓存,这里单独查询
+    uint16_t mtu = PmtuCache::getInstance().getCached(stream->srcIp, &stream->pmtuCache);
+    RouteCacheEntry route;
+    if (RouteTable::getInstance().lookup(stream->srcIp, &route))
+        mtu = VxlanTunnel::getInstance().ifMtu(route.portId, mtu);
+    return std::min<uint16_t>(peerMss, mtu - TCP_IPV4_HDR_LEN);
+}
+
 struct TcpStream *TcpProcessor::tcpCreateStream(uint32_t srcIp, uint32_t dstIp, uint16_t srcPort, uint16_t dstPort)
 {
     SPDLOG_INFO("Create TCP Stream ....");
@@ -156,6 +280,13 @@ struct TcpStream *TcpProcessor::tcpCreateStream(uint32_t srcIp, uint32_t dstIp,
     ts->protocol = IPPROTO_TCP;
     ts->fd = -1;
     ts->status = TCP_STATUS::TCP_STATUS_LISTEN;
+    ts->arpCache = ArpCacheEntry();
+    ts->routeCache = RouteCacheEntry();
+    ts->peerMss = TCP_DEFAULT_MSS;
+    ts->family = AF_INET;
+    ts->nd6Cache = Nd6CacheEntry();
+    ts->pmtuCache = PmtuCacheEntry();
+    ts->tos = 0;
 
     SPDLOG_INFO("TcpStream create srcIp={}, dstIp={}, srcPort={}, dstPort={}", convert_uint32_to_ip(srcIp), convert_uint32_to_ip(dstIp), ntohs(srcPort), ntohs(dstPort));
 
@@ -209,7 +340,10 @@ int TcpProcessor::tcpHandleSynRcvd(struct TcpStream *stream, struct rte_tcp_hdr
             }
             stream->status = TCP_STATUS::TCP_STATUS_ESTABLISHED;
             // accept
-            struct TcpStream *listenStream = TcpTable::getInstance().getTcpStream(0, 0, 0, stream->dstPort);
+            static const uint8_t ANY6[IPV6_ADDR_LEN] = {0};
+            struct TcpStream *listenStream = stream->family == AF_INET6
+                                                 ? TcpTable::getInstance().getTcpStream6(ANY6, stream->dstIp6, 0, stream->dstPort)
+                                                 : TcpTable::getInstance().getTcpStream(0, stream->dstIp, 0, stream->dstPort);
             TcpTable::getInstance().debug();
             if (listenStream == nullptr)
             {
@@ -338,6 +472,145 @@ int TcpProcessor::tcpSendAckpkt(struct TcpStream *stream, struct rte_tcp_hdr *tc
     return 0;
 }
 
+int TcpProcessor::tcpSendReset(struct rte_mbuf *mbuf, struct rte_ring *out)
+{
+    struct rte_ether_hdr *ehdr = rte_pktmbuf_mtod(mbuf, struct rte_ether_hdr *);
+    struct rte_ipv4_hdr *iphdr = (struct rte_ipv4_hdr *)(ehdr + 1);
+    uint8_t ihl = (iphdr->version_ihl & RTE_IPV4_HDR_IHL_MASK) * RTE_IPV4_IHL_MULTIPLIER;
+    struct rte_tcp_hdr *tcphdr = (struct rte_tcp_hdr *)((uint8_t *)iphdr + ihl);
+
+    // 不对RST回复RST;共享的报文不能原地改写,直接丢弃
+    if ((tcphdr->tcp_flags & RTE_TCP_RST_FLAG) || !rte_is_unicast_ether_addr(&ehdr->d_addr) ||
+        rte_mbuf_refcnt_read(mbuf) != 1 || !RTE_MBUF_DIRECT(mbuf) ||
+        !IcmpProcessor::getInstance().allowError(iphdr->src_addr))
+    {
+        rte_pktmbuf_free(mbuf);
+        return -1;
+    }
+
+    // RFC 793: 带ACK的报文用对方的确认号作为序号,否则确认对方的整个报文段
+    uint32_t segLen = ntohs(iphdr->total_length) - ihl - ((tcphdr->data_off >> 4) << 2);
+    if (tcphdr->tcp_flags & RTE_TCP_SYN_FLAG)
+        segLen++;
+    if (tcphdr->tcp_flags & RTE_TCP_FIN_FLAG)
+        segLen++;
+    if (tcphdr->tcp_flags & RTE_TCP_ACK_FLAG)
+    {
+        tcphdr->sent_seq = tcphdr->recv_ack;
+        tcphdr->recv_ack = 0;
+        tcphdr->tcp_flags = RTE_TCP_RST_FLAG;
+    }
+    else
+    {
+        tcphdr->recv_ack = htonl(ntohl(tcphdr->sent_seq) + segLen);
+        tcphdr->sent_seq = 0;
+        tcphdr->tcp_flags = RTE_TCP_RST_FLAG | RTE_TCP_ACK_FLAG;
+    }
+    uint16_t port = tcphdr->src_port;
+    tcphdr->src_port = tcphdr->dst_port;
+    tcphdr->dst_port = port;
+    tcphdr->data_off = 0x50;
+    tcphdr->rx_win = 0;
+    tcphdr->tcp_urp = 0;
+
+    // 去掉IP选项、TCP选项和负载,只保留40字节的头部
+    if (ihl != sizeof(struct rte_ipv4_hdr))
+    {
+        memmove((uint8_t *)iphdr + sizeof(struct rte_ipv4_hdr), tcphdr, sizeof(struct rte_tcp_hdr));
+        iphdr->version_ihl = 0x45;
+        tcphdr = (struct rte_tcp_hdr *)(iphdr + 1);
+    }
+    uint32_t addr = iphdr->src_addr;
+    iphdr->src_addr = iphdr->dst_addr;
+    iphdr->dst_addr = addr;
+    iphdr->total_length = htons(sizeof(struct rte_ipv4_hdr) + sizeof(struct rte_tcp_hdr));
+    iphdr->time_to_live = 64;
+    iphdr->fragment_offset = 0;
+    iphdr->hdr_checksum = 0;
+    iphdr->hdr_checksum = rte_ipv4_cksum(iphdr);
+    tcphdr->cksum = 0;
+    tcphdr->cksum = rte_ipv4_udptcp_cksum(iphdr, tcphdr);
+
+    rte_ether_addr_copy(&ehdr->s_addr, &ehdr->d_addr);
+    rte_memcpy(ehdr->s_addr.addr_bytes, ConfigManager::getInstance().getSrcMac(), RTE_ETHER_ADDR_LEN);
+    const uint16_t length = sizeof(struct rte_ether_hdr) + sizeof(struct rte_ipv4_hdr) + sizeof(struct rte_tcp_hdr);
+    if (mbuf->nb_segs > 1)
+    {
+        rte_pktmbuf_free(mbuf->next);
+        mbuf->next = nullptr;
+        mbuf->nb_segs = 1;
+    }
+    mbuf->data_len = length;
+    mbuf->pkt_len = length;
+    VlanTable::reflect(mbuf);
+
+    SPDLOG_INFO("Send RST to {}:{}", convert_uint32_to_ip(iphdr->dst_addr), ntohs(tcphdr->dst_port));
+    EgressReorder::getInstance().enqueueOut(out, &mbuf, 1);
+    return 0;
+}
+
+int TcpProcessor::tcpSendReset6(struct rte_mbuf *mbuf, struct rte_ring *out)
+{
+    struct rte_ether_hdr *ehdr = rte_pktmbuf_mtod(mbuf, struct rte_ether_hdr *);
+    struct rte_ipv6_hdr *ip6 = (struct rte_ipv6_hdr *)(ehdr + 1);
+    struct rte_tcp_hdr *tcphdr = (struct rte_tcp_hdr *)(ip6 + 1);
+    const uint16_t tcplen = rte_be_to_cpu_16(ip6->payload_len);
+
+    // 与IPv4相同:不对RST和组播报文回复,共享的报文不能原地改写,按源地址限速
+    if (tcplen < sizeof(struct rte_tcp_hdr) || (tcphdr->tcp_flags & RTE_TCP_RST_FLAG) ||
+        !rte_is_unicast_ether_addr(&ehdr->d_addr) || ip6->dst_addr[0] == 0xff ||
+        rte_mbuf_refcnt_read(mbuf) != 1 || !RTE_MBUF_DIRECT(mbuf) || mbuf->nb_segs != 1 ||
+        !IcmpProcessor::getInstance().allowError(Ipv6Processor::foldAddr(ip6->src_addr)))
+    {
+        rte_pktmbuf_free(mbuf);
+        return -1;
+    }
+
+    uint32_t segLen = tcplen - ((tcphdr->data_off >> 4) << 2);
+    if (tcphdr->tcp_flags & RTE_TCP_SYN_FLAG)
+        segLen++;
+    if (tcphdr->tcp_flags & RTE_TCP_FIN_FLAG)
+        segLen++;
+    if (tcphdr->tcp_flags & RTE_TCP_ACK_FLAG)
+    {
+        tcphdr->sent_seq = tcphdr->recv_ack;
+        tcphdr->recv_ack = 0;
+        tcphdr->tcp_flags = RTE_TCP_RST_FLAG;
+    }
+    else
+    {
+        tcphdr->recv_ack = htonl(ntohl(tcphdr->sent_seq) + segLen);
+        tcphdr->sent_seq = 0;
+        tcphdr->tcp_flags = RTE_TCP_RST_FLAG | RTE_TCP_ACK_FLAG;
+    }
+    uint16_t port = tcphdr->src_port;
+    tcphdr->src_port = tcphdr->dst_port;
+    tcphdr->dst_port = port;
+    tcphdr->data_off = 0x50;
+    tcphdr->rx_win = 0;
+    tcphdr->tcp_urp = 0;
+
+    uint8_t addr[IPV6_ADDR_LEN];
+    rte_memcpy(addr, ip6->src_addr, IPV6_ADDR_LEN);
+    rte_memcpy(ip6->src_addr, ip6->dst_addr, IPV6_ADDR_LEN);
+    rte_memcpy(ip6->dst_addr, addr, IPV6_ADDR_LEN);
+    ip6->payload_len = htons(sizeof(struct rte_tcp_hdr));
+    ip6->hop_limits = IPV6_DEFAULT_HOP_LIMIT;
+    tcphdr->cksum = 0;
+    tcphdr->cksum = rte_ipv6_udptcp_cksum(ip6, tcphdr);
+
+    rte_ether_addr_copy(&ehdr->s_addr, &ehdr->d_addr);
+    rte_memcpy(ehdr->s_addr.addr_bytes, ConfigManager::getInstance().getSrcMac(), RTE_ETHER_ADDR_LEN);
+    const uint16_t length = sizeof(struct rte_ether_hdr) + sizeof(struct rte_ipv6_hdr) + sizeof(struct rte_tcp_hdr);
+    mbuf->data_len = length;
+    mbuf->pkt_len = length;
+    mbuf->ol_flags = 0;
+
+    SPDLOG_INFO("Send RST to [{}]:{}", ipv6ToString(ip6->dst_addr), ntohs(tcphdr->dst_port));
+    EgressReorder::getInstance().enqueueOut(out, &mbuf, 1);
+    return 0;
+}
+
 int TcpProcessor::tcpHandleCloseWait(struct TcpStream *stream, struct rte_tcp_hdr *tcphdr)
 {
 
@@ -373,39 +646,78 @@ int TcpProcessor::tcpOut(struct rte_mempool *mbufPool)
     std::list<TcpStream *> tmplist = TcpTable::getInstance().getTcpStreamList();
     struct inout_ring *ring = Ring::getSingleton().getRing();
 
-    for (auto &stream : tmplist)
+    auto it = tmplist.begin();
+    while (it != tmplist.end())
     {
-        if (stream->sndbuf == nullptr)
-            continue;
-
-        struct TcpFragment *fragment = nullptr;
-        int nb_snd = rte_ring_mc_dequeue(stream->sndbuf, (void **)&fragment);
-        if (nb_snd < 0)
-            continue;
-
-        uint8_t *dstMac = ArpTable::getInstance().search(stream->srcIp);
-        if (dstMac == nullptr)
+        // 每条流最多取出一个待发送的分段,凑成一批后统一解析目的MAC
+        TcpStream *streams[ARP_BULK_MAX];
+        struct TcpFragment *fragments[ARP_BULK_MAX];
+        uint32_t dips[ARP_BULK_MAX];
+        ArpCacheEntry *caches[ARP_BULK_MAX];
+        unsigned nb = 0;
+        for (; it != tmplist.end() && nb < ARP_BULK_MAX; ++it)
         {
-            SPDLOG_INFO("MAC not found for IP: {}, Port: {}", convert_uint32_to_ip(stream->srcIp), ntohs(stream->srcPort));
-            uint8_t *dstMac = new uint8_t[RTE_ETHER_ADDR_LEN];
-            struct rte_mbuf *arpbuf = ArpProcessor::getInstance().sendArpPacket(mbufPool, RTE_ARP_OP_REQUEST, ConfigManager::getInstance().getSrcMac(), stream->dstIp, dstMac, stream->srcIp);
-            rte_ring_mp_enqueue_burst(ring->out, (void **)&arpbuf, 1, nullptr);
-            rte_ring_mp_enqueue(stream->sndbuf, fragment);
-            delete [] dstMac;
+            TcpStream *stream = *it;
+            if (stream->sndbuf == nullptr)
+                continue;
+            struct TcpFragment *fragment = nullptr;
+            if (rte_ring_mc_dequeue(stream->sndbuf, (void **)&fragment) < 0)
+                continue;
+            // IPv6报文段不参与ARP批量查询,直接发送
+            if (stream->family == AF_INET6)
+            {
+                tcp6Out(mbufPool, ring->out, stream, fragment);
+                if (fragment->data != nullptr)
+                    rte_free(fragment->data);
+                rte_free(fragment);
+                continue;
+            }
+            // ARP解析的是路由给出的下一跳,路由结果缓存在流上
+            if (!RouteTable::getInstance().lookupCached(stream->srcIp, &stream->routeCache))
+            {
+                SPDLOG_WARN("No route to {}, drop tcp segment", convert_uint32_to_ip(stream->srcIp));
+                if (fragment->data != nullptr)
+                    rte_free(fragment->data);
+                rte_free(fragment);
+                continue;
+            }
+            streams[nb] = stream;
+            fragments[nb] = fragment;
+            dips[nb] = stream->routeCache.nextHop;
+            caches[nb] = &stream->arpCache;
+            nb++;
         }
-        else
+        if (nb == 0)
+            break;
+
+        uint8_t dstMacs[ARP_BULK_MAX][RTE_ETHER_ADDR_LEN];
+        uint64_t hitMask = ArpTable::lookupBulkCached(dips, nb, caches, dstMacs);
+        for (unsigned i = 0; i < nb; i++)
         {
+            TcpStream *stream = streams[i];
+            struct TcpFragment *fragment = fragments[i];
+            bool hit = hitMask & (1ULL << i);
+            uint8_t *dstMac = dstMacs[i];
+            if (!hit)
+            {
+                // 目的MAC在解析完成后由ARP模块填写
+                SPDLOG_INFO("MAC not found for IP: {}, Port: {}", convert_uint32_to_ip(stream->srcIp), ntohs(stream->srcPort));
+                memset(dstMac, 0, RTE_ETHER_ADDR_LEN);
+            }
             SPDLOG_INFO("Start to send tcp packet...");
-            SPDLOG_INFO("nb_send={}", nb_snd);
             TcpTable::getInstance().debug();
             if (fragment->data != nullptr)
             {
                 std::string str(reinterpret_cast<char *>(fragment->data), sizeof(fragment->data));
                 SPDLOG_INFO("Data: {}", str);
             }
-            struct rte_mbuf *tcpbuf = TcpPkt(mbufPool, stream->dstIp, stream->srcIp, stream->localMac, dstMac, fragment);
+            struct rte_mbuf *tcpbuf = TcpPkt(mbufPool, stream->dstIp, stream->srcIp, stream->localMac, dstMac, fragment, stream->tos);
+            VlanTable::getInstance().tagTx(tcpbuf, stream->routeCache.portId);
             SPDLOG_INFO("tcpmbuf->pkt_len: {}, tcpmbuf->data_len: {}", tcpbuf->pkt_len, tcpbuf->data_len);
-            rte_ring_mp_enqueue_burst(ring->out, (void **)&tcpbuf, 1, nullptr);
+            if (hit)
+                EgressReorder::getInstance().enqueueOut(ring->out, &tcpbuf, 1);
+            else
+                ArpProcessor::getInstance().queuePending(mbufPool, ring->out, dips[i], tcpbuf);
 
             if (fragment->data != nullptr)
                 rte_free(fragment->data);
@@ -416,7 +728,37 @@ int TcpProcessor::tcpOut(struct rte_mempool *mbufPool)
     return 0;
 }
 
-struct rte_mbuf *TcpProcessor::TcpPkt(struct rte_mempool *mbuf_pool, uint32_t sip, uint32_t dip, uint8_t *srcmac, uint8_t *dstmac, struct TcpFragment *fragment)
+void TcpProcessor::tcp6Out(struct rte_mempool *mbufPool, struct rte_ring *out, struct TcpStream *stream, struct TcpFragment *fragment)
+{
+    Ipv6Processor &ipv6 = Ipv6Processor::getInstance();
+    const uint8_t *nextHop = ipv6.nextHop(stream->srcIp6);
+    if (nextHop == nullptr)
+    {
+        SPDLOG_WARN("No route to {}, drop tcp segment", ipv6ToString(stream->srcIp6));
+        return;
+    }
+    bool hit = ipv6.lookupCached(nextHop, &stream->nd6Cache);
+    const unsigned totalLen = fragment->length + sizeof(struct rte_ether_hdr) + sizeof(struct rte_ipv6_hdr) +
+                              sizeof(struct rte_tcp_hdr) + fragment->optlen * sizeof(uint32_t);
+    struct rte_mbuf *mbuf = rte_pktmbuf_alloc(mbufPool);
+    if (mbuf == nullptr)
+    {
+        SPDLOG_ERROR("Failed to allocate mbuf for TCP segment");
+        return;
+    }
+    mbuf->pkt_len = totalLen;
+    mbuf->data_len = totalLen;
+    // 目的MAC在邻居解析完成后由IPv6模块填写
+    uint8_t zeroMac[RTE_ETHER_ADDR_LEN] = {0};
+    encodeTcp6Apppkt(rte_pktmbuf_mtod(mbuf, uint8_t *), stream->dstIp6, stream->srcIp6, stream->localMac,
+                     hit ? stream->nd6Cache.mac : zeroMac, fragment, stream->tos);
+    if (hit)
+        EgressReorder::getInstance().enqueueOut(out, &mbuf, 1);
+    else
+        ipv6.queuePending(mbufPool, out, nextHop, mbuf);
+}
+
+struct rte_mbuf *TcpProcessor::TcpPkt(struct rte_mempool *mbuf_pool, uint32_t sip, uint32_t dip, uint8_t *srcmac, uint8_t *dstmac, struct TcpFragment *fragment, uint8_t tos)
 {
 
     const unsigned total_len = fragment->length + sizeof(struct rte_ether_hdr) +
@@ -432,12 +774,12 @@ struct rte_mbuf *TcpProcessor::TcpPkt(struct rte_mempool *mbuf_pool, uint32_t si
 
     uint8_t *pktdata = rte_pktmbuf_mtod(mbuf, uint8_t *);
 
-    encodeTcpApppkt(pktdata, sip, dip, srcmac, dstmac, fragment);
+    encodeTcpApppkt(pktdata, sip, dip, srcmac, dstmac, fragment, tos);
 
     return mbuf;
 }
 
-int TcpProcessor::encodeTcpApppkt(uint8_t *msg, uint32_t sip, uint32_t dip, uint8_t *srcmac, uint8_t *dstmac, struct TcpFragment *fragment)
+int TcpProcessor::encodeTcpApppkt(uint8_t *msg, uint32_t sip, uint32_t dip, uint8_t *srcmac, uint8_t *dstmac, struct TcpFragment *fragment, uint8_t tos)
 {
     const unsigned total_len = fragment->length + sizeof(struct rte_ether_hdr) +
                                sizeof(struct rte_ipv4_hdr) + sizeof(struct rte_tcp_hdr) +
@@ -452,10 +794,11 @@ int TcpProcessor::encodeTcpApppkt(uint8_t *msg, uint32_t sip, uint32_t dip, uint
     // ip
     struct rte_ipv4_hdr *ip = (struct rte_ipv4_hdr *)(msg + sizeof(struct rte_ether_hdr));
     ip->version_ihl = 0x45;
-    ip->type_of_service = 0;
+    ip->type_of_service = tos;
     ip->total_length = htons(total_len - sizeof(struct rte_ether_hdr));
     ip->packet_id = 0;
-    ip->fragment_offset = 0;
+    // 报文段按PMTU切分,设置DF让路径上的路由器返回"需要分片"差错
+    ip->fragment_offset = htons(RTE_IPV4_HDR_DF_FLAG);
     ip->time_to_live = 64; // ttl = 64
     ip->next_proto_id = IPPROTO_TCP;
     ip->src_addr = sip;
@@ -475,6 +818,8 @@ int TcpProcessor::encodeTcpApppkt(uint8_t *msg, uint32_t sip, uint32_t dip, uint
     tcp->rx_win = fragment->windows;
     tcp->tcp_urp = fragment->tcp_urp;
     tcp->tcp_flags = fragment->tcp_flags;
+    if (fragment->optlen > 0)
+        rte_memcpy(tcp + 1, fragment->option, fragment->optlen * sizeof(uint32_t));
 
     if (fragment->data != nullptr)
     {
@@ -497,6 +842,43 @@ int TcpProcessor::encodeTcpApppkt(uint8_t *msg, uint32_t sip, uint32_t dip, uint
     return 0;
 }
 
+int TcpProcessor::encodeTcp6Apppkt(uint8_t *msg, const uint8_t *sip, const uint8_t *dip,
+                                   uint8_t *srcmac, uint8_t *dstmac, struct TcpFragment *fragment, uint8_t tos)
+{
+    const uint16_t tcpLen = sizeof(struct rte_tcp_hdr) + fragment->optlen * sizeof(uint32_t) + fragment->length;
+
+    struct rte_ether_hdr *eth = (struct rte_ether_hdr *)msg;
+    rte_memcpy(eth->s_addr.addr_bytes, srcmac, RTE_ETHER_ADDR_LEN);
+    rte_memcpy(eth->d_addr.addr_bytes, dstmac, RTE_ETHER_ADDR_LEN);
+    eth->ether_type = htons(RTE_ETHER_TYPE_IPV6);
+
+    struct rte_ipv6_hdr *ip6 = (struct rte_ipv6_hdr *)(eth + 1);
+    ip6->vtc_flow = htonl(6u << 28 | (uint32_t)tos << 20);
+    ip6->payload_len = htons(tcpLen);
+    ip6->proto = IPPROTO_TCP;
+    ip6->hop_limits = IPV6_DEFAULT_HOP_LIMIT;
+    rte_memcpy(ip6->src_addr, sip, IPV6_ADDR_LEN);
+    rte_memcpy(ip6->dst_addr, dip, IPV6_ADDR_LEN);
+
+    struct rte_tcp_hdr *tcp = (struct rte_tcp_hdr *)(ip6 + 1);
+    tcp->src_port = fragment->srcPort;
+    tcp->dst_port = fragment->dstPort;
+    tcp->sent_seq = htonl(fragment->seqnum);
+    tcp->recv_ack = htonl(fragment->acknum);
+    tcp->data_off = fragment->hdrlen_off;
+    tcp->rx_win = fragment->windows;
+    tcp->tcp_urp = fragment->tcp_urp;
+    tcp->tcp_flags = fragment->tcp_flags;
+    if (fragment->optlen > 0)
+        rte_memcpy(tcp + 1, fragment->option, fragment->optlen * sizeof(uint32_t));
+    if (fragment->data != nullptr)
+        rte_memcpy((uint8_t *)(tcp + 1) + fragment->optlen * sizeof(uint32_t), fragment->data, fragment->length);
+
+    tcp->cksum = 0;
+    tcp->cksum = rte_ipv6_udptcp_cksum(ip6, tcp);
+    return 0;
+}
+
 int TcpProcessor::setNextProcessor(std::shared_ptr<Processor> nextProcessor)
 {
 }
\ No newline at end of file
@@ -1,29 +1,151 @@
 #include "UdpHost.hpp"
 #include <rte_malloc.h>
+#include <rte_jhash.h>
 #include "ConfigManager.hpp"
 #include "Logger.hpp"
 #include "Utils.hpp"
 #include <rte_errno.h>
+#include <cerrno>
+#include <new>
+#include "UdpProcessor.hpp"
+#include "LocalAddr.hpp"
+#include "IgmpProcessor.hpp"
 
 #define UDP_APP_RECV_BUFFER_SIZE 128
 
+int UdpServerManager::initRcu(unsigned nbReaders)
+{
+    const size_t size = rte_rcu_qsbr_get_memsize(nbReaders);
+    _rcu = (struct rte_rcu_qsbr *)rte_zmalloc("udp demux rcu", size, RTE_CACHE_LINE_SIZE);
+    if (_rcu == nullptr || rte_rcu_qsbr_init(_rcu, nbReaders) != 0)
+    {
+        SPDLOG_ERROR("Failed to create UDP demux QSBR variable for {} readers", nbReaders);
+        rte_free(_rcu);
+        _rcu = nullptr;
+        return -1;
+    }
+    return 0;
+}
+
+int UdpServerManager::enableRxZeroCopy()
+{
+    static const struct rte_mbuf_dynfield rxMetaDesc = {
+        .name = "protocol_stack_udp_rx_meta",
+        .size = sizeof(UdpRxMeta),
+        .align = __alignof__(UdpRxMeta),
+    };
+    _rxMetaOffset = rte_mbuf_dynfield_register(&rxMetaDesc);
+    if (_rxMetaOffset < 0)
+    {
+        SPDLOG_ERROR("Failed to register UDP rx meta dynfield. {}", rte_strerror(rte_errno));
+        return -1;
+    }
+    _rxZeroCopy = true;
+    SPDLOG_INFO("UDP zero-copy receive enabled");
+    return 0;
+}
+
+uint32_t UdpServerManager::demuxBucket(int family, const void *addr, uint16_t port)
+{
+    const uint32_t hash = family == AF_INET6 ? rte_jhash(addr, IPV6_ADDR_LEN, port)
+                                             : rte_jhash_2words(*(const uint32_t *)addr, port, 0);
+    return hash & (UDP_DEMUX_BUCKETS - 1);
+}
+
+UdpHost *UdpServerManager::demuxLookup(int family, const void *addr, uint16_t port, uint8_t proto) const
+{
+    UdpHost *host = _demux[demuxBucket(family, addr, port)].load(std::memory_order_acquire);
+    for (; host != nullptr; host = host->demuxNext.load(std::memory_order_acquire))
+    {
+        if (host->family != family || host->localport != port || host->protocal != proto)
+            continue;
+        if (family == AF_INET6 ? ipv6Equal(host->localIp6, (const uint8_t *)addr) : host->localIp == *(const uint32_t *)addr)
+            return host;
+    }
+    return nullptr;
+}
+
+void UdpServerManager::demuxInsertLocked(UdpHost *host)
+{
+    const void *addr = host->family == AF_INET6 ? (const void *)host->localIp6 : (const void *)&host->localIp;
+    std::atomic<UdpHost *> *link = &_demux[demuxBucket(host->family, addr, host->localport)];
+    UdpHost *cur;
+    // 插入桶尾,同一地址和端口上先绑定的socket先被找到
+    while ((cur = link->load(std::memory_order_relaxed)) != nullptr)
+        link = &cur->demuxNext;
+    host->demuxNext.store(nullptr, std::memory_order_relaxed);
+    link->store(host, std::memory_order_release);
+    host->bound = true;
+}
+
+void UdpServerManager::demuxRemoveLocked(UdpHost *host)
+{
+    const void *addr = host->family == AF_INET6 ? (const void *)host->localIp6 : (const void *)&host->localIp;
+    std::atomic<UdpHost *> *link = &_demux[demuxBucket(host->family, addr, host->localport)];
+    UdpHost *cur;
+    while ((cur = link->load(std::memory_order_relaxed)) != nullptr && cur != host)
+        link = &cur->demuxNext;
+    // 正在遍历的读者仍然可以通过被摘除socket的demuxNext继续向后查找
+    if (cur != nullptr)
+        link->store(host->demuxNext.load(std::memory_order_relaxed), std::memory_order_release);
+    host->bound = false;
+}
+
 struct UdpHost *UdpServerManager::getHostInfoFromIpAndPort(uint32_t dip, uint16_t port, uint8_t proto)
 {
+    // 精确绑定到该地址的socket优先,其次是绑定到INADDR_ANY的socket
+    UdpHost *host = demuxLookup(AF_INET, &dip, port, proto);
+    if (host == nullptr && dip != INADDR_ANY)
+    {
+        const uint32_t any = INADDR_ANY;
+        host = demuxLookup(AF_INET, &any, port, proto);
+    }
+    return host;
+}
+
+unsigned UdpServerManager::getMcastHosts(uint32_t group, uint16_t ifIndex, uint16_t port, UdpHost **hosts, unsigned max)
+{
+    // 成员关系的修改也持有_mutex,组播报文较少,这里加锁读取
     std::lock_guard<std::mutex> lock(_mutex);
-    for (auto &host : _udpHostList)
+    unsigned nb = 0;
+    const uint32_t addrs[2] = {group, INADDR_ANY};
+    for (uint32_t addr : addrs)
     {
-        if (host->localIp == dip && host->localport == port && host->protocal == proto)
+        UdpHost *host = _demux[demuxBucket(AF_INET, &addr, port)].load(std::memory_order_relaxed);
+        for (; host != nullptr && nb < max; host = host->demuxNext.load(std::memory_order_relaxed))
         {
-            return host;
+            if (host->family != AF_INET || host->localport != port || host->protocal != IPPROTO_UDP || host->localIp != addr)
+                continue;
+            for (unsigned i = 0; i < host->nbMcast; i++)
+            {
+                if (host->mcastGroups[i] == group && host->mcastIfs[i] == ifIndex)
+                {
+                    hosts[nb++] = host;
+                    break;
+                }
+            }
         }
     }
-    return nullptr;
+    return nb;
+}
+
+struct UdpHost *UdpServerManager::getHostInfoFromIp6AndPort(const uint8_t *dip, uint16_t port, uint8_t proto)
+{
+    UdpHost *host = demuxLookup(AF_INET6, dip, port, proto);
+    if (host == nullptr && !ipv6IsUnspecified(dip))
+    {
+        const uint8_t any[IPV6_ADDR_LEN] = {0};
+        host = demuxLookup(AF_INET6, any, port, proto);
+    }
+    return host;
 }
 
 int UdpServerManager::nsocket(__attribute__((unused)) int domain, int type, __attribute__((unused)) int protocol)
 {
     SPDLOG_INFO("create udp socket,domain:{}, type: {}, protocol {}", domain, type, protocol);
     int fd = allocFdFromBitMap();
+    if (fd < 0)
+        return -1;
     const int RING_SIZE = ConfigManager::getInstance().getRingSize();
 
     if (type == SOCK_DGRAM)
@@ -33,9 +155,11 @@ int UdpServerManager::nsocket(__attribute__((unused)) int domain, int type, __at
         {
             return -1;
         }
-        memset(udpHost, 0, sizeof(struct UdpHost));
+        // UdpHost含有原子变量和带默认初始化的缓存,值初始化会先把所有字段清零
+        new (udpHost) UdpHost();
         udpHost->fd = fd;
         udpHost->protocal = IPPROTO_UDP;
+        udpHost->family = domain == AF_INET6 ? AF_INET6 : AF_INET;
         udpHost->rcvbuf = rte_ring_create("recv buffer", RING_SIZE, rte_socket_id(), RING_F_SP_ENQ | RING_F_SC_DEQ);
         if (udpHost->rcvbuf == nullptr)
         {
@@ -58,7 +182,10 @@ int UdpServerManager::nsocket(__attribute__((unused)) int domain, int type, __at
         pthread_mutex_t blank_mutex = PTHREAD_MUTEX_INITIALIZER;
         rte_memcpy(&udpHost->mutex, &blank_mutex, sizeof(pthread_mutex_t));
 
-        _udpHostList.emplace_back(udpHost);
+        std::lock_guard<std::mutex> lock(_mutex);
+        _fdHosts[fd].store(udpHost, std::memory_order_release);
+        if (fd >= _fdEnd.load(std::memory_order_relaxed))
+            _fdEnd.store(fd + 1, std::memory_order_release);
 
         SPDLOG_INFO("Add UDP host successed");
     }
@@ -71,42 +198,75 @@ int UdpServerManager::nsocket(__attribute__((unused)) int domain, int type, __at
 
 int UdpServerManager::nbind(int sockfd, const struct sockaddr *addr, __attribute__((unused)) socklen_t addrlen)
 {
-    SPDLOG_INFO("Bind socket fd: {}, addr: {}", sockfd, sockaddr_in_to_string(*(const struct sockaddr_in *)addr));
-    int isExist = searchFdFromBitMap(sockfd);
-    if (isExist == 0)
+    struct UdpHost *host = getHostInfoFromFd(sockfd);
+    if (host == nullptr)
     {
         SPDLOG_ERROR("fd is not exist!");
         return -1; // 文件描述符不存在
     }
-    for (auto &it : _udpHostList)
+    std::lock_guard<std::mutex> lock(_mutex);
+    if (host->bound)
     {
-        if (it->fd == sockfd)
-        {
-            struct UdpHost *host = (struct UdpHost *)it;
-            const struct sockaddr_in *laddr = (const struct sockaddr_in *)addr;
-            host->localport = laddr->sin_port;
-            rte_memcpy(&host->localIp, &laddr->sin_addr.s_addr, sizeof(uint32_t));
-            rte_memcpy(host->localMac, ConfigManager::getInstance().getSrcMac(), RTE_ETHER_ADDR_LEN);
-            return 0; // 成功绑定
-        }
+        SPDLOG_ERROR("Socket fd {} is already bound", sockfd);
+        errno = EINVAL;
+        return -1;
+    }
+    if (host->family == AF_INET6)
+    {
+        const struct sockaddr_in6 *laddr6 = (const struct sockaddr_in6 *)addr;
+        SPDLOG_INFO("Bind socket fd: {}, addr: [{}]:{}", sockfd, ipv6ToString(laddr6->sin6_addr.s6_addr), ntohs(laddr6->sin6_port));
+        host->localport = laddr6->sin6_port;
+        rte_memcpy(host->localIp6, laddr6->sin6_addr.s6_addr, IPV6_ADDR_LEN);
     }
-    return -1;
+    else
+    {
+        const struct sockaddr_in *laddr = (const struct sockaddr_in *)addr;
+        SPDLOG_INFO("Bind socket fd: {}, addr: {}", sockfd, sockaddr_in_to_string(*laddr));
+        host->localport = laddr->sin_port;
+        rte_memcpy(&host->localIp, &laddr->sin_addr.s_addr, sizeof(uint32_t));
+    }
+    rte_memcpy(host->localMac, ConfigManager::getInstance().getSrcMac(), RTE_ETHER_ADDR_LEN);
+    demuxInsertLocked(host);
+    return 0; // 成功绑定
 }
 
 int UdpServerManager::nclose(int fd)
 {
     SPDLOG_INFO("Close fd: {}", fd);
-    void *hostinfo = getHostInfoFromFd(fd);
-    if (hostinfo == nullptr)
+    struct UdpHost *host = getHostInfoFromFd(fd);
+    if (host == nullptr)
         return -1;
-    struct UdpHost *host = (struct UdpHost *)hostinfo;
-    _udpHostList.remove(host);
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        _fdHosts[fd].store(nullptr, std::memory_order_release);
+        if (host->bound)
+            demuxRemoveLocked(host);
+    }
+    // 工作核可能刚查到该socket,等它们都经过一次静止状态后不会再有新的数据报入队
+    if (_rcu != nullptr)
+        rte_rcu_qsbr_synchronize(_rcu, RTE_QSBR_THRID_INVALID);
+    for (unsigned i = 0; i < host->nbMcast; i++)
+        IgmpProcessor::getInstance().leave(host->mcastGroups[i], host->mcastIfs[i]);
+    const uint64_t rcvDrops = host->rcvDrops.load(std::memory_order_relaxed);
+    if (rcvDrops > 0)
+        SPDLOG_INFO("fd {} dropped {} datagrams on a full receive buffer", fd, rcvDrops);
     if (host->rcvbuf)
     {
+        // 未读的数据报可能持有接收mbuf的引用
+        void *entry;
+        while (rte_ring_sc_dequeue(host->rcvbuf, &entry) == 0)
+            freeRxEntry(entry);
         rte_ring_free(host->rcvbuf);
     }
     if (host->sndbuf)
     {
+        // 未发送的数据报由0号工作核消费,宽限期之后不会再被取出
+        struct offload *ol;
+        while (rte_ring_sc_dequeue(host->sndbuf, (void **)&ol) == 0)
+        {
+            rte_free(ol->data);
+            rte_free(ol);
+        }
         rte_ring_free(host->sndbuf);
     }
     rte_free(host);
@@ -128,7 +288,7 @@ int UdpServerManager::udpServer(__attribute__((unused)) void *arg)
     memset(&localaddr, 0, sizeof(struct sockaddr_in));
     localaddr.sin_port = htons(8888);
     localaddr.sin_family = AF_INET;
-    localaddr.sin_addr.s_addr = inet_addr("192.168.0.104");
+    localaddr.sin_addr.s_addr = ConfigManager::getInstance().getLocalAddr();
     nbind(connfd, (struct sockaddr *)&localaddr, sizeof(localaddr));
 
     SPDLOG_INFO("local host: {}", sockaddr_in_to_string(localaddr));
@@ -153,6 +313,36 @@ int UdpServerManager::udpServer(__attribute__((unused)) void *arg)
     return 0;
 }
 
+void *UdpServerManager::waitRx(UdpHost *host)
+{
+    void *entry = nullptr;
+    pthread_mutex_lock(&host->mutex);
+    while (rte_ring_mc_dequeue(host->rcvbuf, &entry) < 0)
+    {
+        pthread_cond_wait(&host->cond, &host->mutex);
+    }
+    pthread_mutex_unlock(&host->mutex);
+    return entry;
+}
+
+void UdpServerManager::writeSrcAddr(const UdpRxMeta *meta, struct sockaddr *src_addr)
+{
+    if (meta->family == AF_INET6)
+    {
+        struct sockaddr_in6 *saddr6 = (struct sockaddr_in6 *)src_addr;
+        saddr6->sin6_family = AF_INET6;
+        saddr6->sin6_port = meta->sport;
+        rte_memcpy(saddr6->sin6_addr.s6_addr, meta->sip6, IPV6_ADDR_LEN);
+    }
+    else
+    {
+        struct sockaddr_in *saddr = (struct sockaddr_in *)src_addr;
+        saddr->sin_family = AF_INET;
+        saddr->sin_port = meta->sport;
+        saddr->sin_addr.s_addr = meta->sip;
+    }
+}
+
 ssize_t UdpServerManager::nrecvfrom(int sockfd, void *buf, size_t len, __attribute__((unused)) int flags,
                                     struct sockaddr *src_addr, __attribute__((unused)) socklen_t *addrlen)
 {
@@ -160,41 +350,217 @@ ssize_t UdpServerManager::nrecvfrom(int sockfd, void *buf, size_t len, __attribu
     if (host == nullptr)
         return -1;
 
-    struct offload *ol = nullptr;
-    unsigned char *ptr = nullptr;
+    if (_rxZeroCopy)
+    {
+        // 负载直接从mbuf拷贝到用户缓冲区,跨分段时由rte_pktmbuf_read拼接
+        struct rte_mbuf *mbuf = (struct rte_mbuf *)waitRx(host);
+        UdpRxMeta *meta = rxMeta(mbuf);
+        writeSrcAddr(meta, src_addr);
+        const uint32_t remain = mbuf->pkt_len - meta->consumed;
+        const uint32_t copied = RTE_MIN((uint32_t)len, remain);
+        const void *payload = rte_pktmbuf_read(mbuf, meta->consumed, copied, buf);
+        if (payload != buf)
+            rte_memcpy(buf, payload, copied);
+        if (copied < remain)
+        {
+            meta->consumed += copied;
+            // 取出后工作核可能已经把队列填满,剩余部分放不回去时只能丢弃
+            if (rte_ring_mp_enqueue(host->rcvbuf, mbuf) < 0)
+            {
+                SPDLOG_INFO("Receive buffer of fd {} is full, drop the rest of the datagram", host->fd);
+                host->rcvDrops.fetch_add(1, std::memory_order_relaxed);
+                rte_pktmbuf_free(mbuf);
+            }
+        }
+        else
+            rte_pktmbuf_free(mbuf);
+        return copied;
+    }
 
-    struct sockaddr_in *saddr = (struct sockaddr_in *)src_addr;
+    struct offload *ol = (struct offload *)waitRx(host);
+    unsigned char *ptr = nullptr;
 
-    int nb = -1;
-    pthread_mutex_lock(&host->mutex);
-    while ((nb = rte_ring_mc_dequeue(host->rcvbuf, (void **)&ol)) < 0)
+    if (ol->family == AF_INET6)
     {
-        pthread_cond_wait(&host->cond, &host->mutex);
+        struct sockaddr_in6 *saddr6 = (struct sockaddr_in6 *)src_addr;
+        saddr6->sin6_family = AF_INET6;
+        saddr6->sin6_port = ol->sport;
+        rte_memcpy(saddr6->sin6_addr.s6_addr, ol->sip6, IPV6_ADDR_LEN);
+    }
+    else
+    {
+        struct sockaddr_in *saddr = (struct sockaddr_in *)src_addr;
+        saddr->sin_port = ol->sport;
+        rte_memcpy(&saddr->sin_addr.s_addr, &ol->sip, sizeof(uint32_t));
     }
-    pthread_mutex_unlock(&host->mutex);
-
-    saddr->sin_port = ol->sport;
-    rte_memcpy(&saddr->sin_addr.s_addr, &ol->sip, sizeof(uint32_t));
 
     if (len < ol->length)
     {
         rte_memcpy(buf, ol->data, len);
-        ptr = (unsigned char *)rte_malloc("unsigned char *", ol->length - len, 0);
-        rte_memcpy(ptr, ol->data + len, ol->length - len);
+        // 负载在mbuf中时只需后移指针,mbuf在整个数据报读完后释放
+        if (ol->mbuf == nullptr)
+        {
+            ptr = (unsigned char *)rte_malloc("unsigned char *", ol->length - len, 0);
+            rte_memcpy(ptr, ol->data + len, ol->length - len);
+            rte_free(ol->data);
+            ol->data = ptr;
+        }
+        else
+        {
+            ol->data += len;
+        }
         ol->length -= len;
-        rte_free(ol->data);
-        ol->data = ptr;
-        rte_ring_mp_enqueue(host->rcvbuf, ol);
+        if (rte_ring_mp_enqueue(host->rcvbuf, ol) < 0)
+        {
+            SPDLOG_INFO("Receive buffer of fd {} is full, drop the rest of the datagram", host->fd);
+            host->rcvDrops.fetch_add(1, std::memory_order_relaxed);
+            rxOffloadFree(ol);
+        }
 
         return len;
     }
     else
     {
+        const ssize_t copied = ol->length;
         rte_memcpy(buf, ol->data, ol->length);
-        rte_free(ol->data);
-        rte_free(ol);
-        return ol->length;
+        rxOffloadFree(ol);
+        return copied;
+    }
+}
+
+ssize_t UdpServerManager::nrecvfromzc(int sockfd, struct iovec *iov, int *iovcnt, struct sockaddr *src_addr,
+                                      __attribute__((unused)) socklen_t *addrlen, void **handle)
+{
+    if (!_rxZeroCopy)
+    {
+        errno = EOPNOTSUPP;
+        return -1;
+    }
+    struct UdpHost *host = getHostInfoFromFd(sockfd);
+    if (host == nullptr)
+    {
+        errno = EBADF;
+        return -1;
+    }
+    if (iov == nullptr || iovcnt == nullptr || *iovcnt <= 0 || handle == nullptr)
+    {
+        errno = EINVAL;
+        return -1;
+    }
+
+    struct rte_mbuf *mbuf = (struct rte_mbuf *)waitRx(host);
+    const UdpRxMeta *meta = rxMeta(mbuf);
+    writeSrcAddr(meta, src_addr);
+    // 跳过之前被nrecvfrom读走的部分
+    uint32_t skip = meta->consumed;
+    ssize_t total = 0;
+    int nb = 0;
+    for (struct rte_mbuf *seg = mbuf; seg != nullptr; seg = seg->next)
+    {
+        if (skip >= seg->data_len)
+        {
+            skip -= seg->data_len;
+            continue;
+        }
+        if (nb == *iovcnt)
+        {
+            rte_pktmbuf_free(mbuf);
+            errno = EMSGSIZE;
+            return -1;
+        }
+        iov[nb].iov_base = rte_pktmbuf_mtod_offset(seg, uint8_t *, skip);
+        iov[nb].iov_len = seg->data_len - skip;
+        total += iov[nb].iov_len;
+        nb++;
+        skip = 0;
+    }
+    *iovcnt = nb;
+    *handle = mbuf;
+    return total;
+}
+
+int UdpServerManager::nrecvfree(void *handle)
+{
+    if (handle == nullptr)
+        return -1;
+    rte_pktmbuf_free((struct rte_mbuf *)handle);
+    return 0;
+}
+
+int UdpServerManager::nsetsockopt(int sockfd, int level, int optname, const void *optval, socklen_t optlen)
+{
+    struct UdpHost *host = getHostInfoFromFd(sockfd);
+    if (host == nullptr)
+    {
+        errno = EBADF;
+        return -1;
+    }
+    const int tosRet = parseTosOption(host->family, level, optname, optval, optlen, &host->tos);
+    if (tosRet <= 0)
+        return tosRet;
+    if (level != IPPROTO_IP || (optname != IP_ADD_MEMBERSHIP && optname != IP_DROP_MEMBERSHIP) || host->family != AF_INET)
+    {
+        errno = ENOPROTOOPT;
+        return -1;
+    }
+    if (optval == nullptr || optlen < sizeof(struct ip_mreq))
+    {
+        errno = EINVAL;
+        return -1;
+    }
+
+    const struct ip_mreq *mreq = (const struct ip_mreq *)optval;
+    const uint32_t group = mreq->imr_multiaddr.s_addr;
+    if (!RTE_IS_IPV4_MCAST(ntohl(group)))
+    {
+        errno = EINVAL;
+        return -1;
+    }
+    // 没有指定接口时加入物理端口上的组,否则使用该本机地址所在的接口,VLAN子接口和隧道接口也可以加入
+    int ifIndex = ConfigManager::getInstance().getDpdkPortId();
+    if (mreq->imr_interface.s_addr != INADDR_ANY)
+        ifIndex = LocalAddrTable::getInstance().getPort(mreq->imr_interface.s_addr);
+    if (ifIndex < 0)
+    {
+        errno = ENODEV;
+        return -1;
     }
+
+    std::lock_guard<std::mutex> lock(_mutex);
+    unsigned idx = 0;
+    while (idx < host->nbMcast && (host->mcastGroups[idx] != group || host->mcastIfs[idx] != ifIndex))
+        idx++;
+    if (optname == IP_ADD_MEMBERSHIP)
+    {
+        if (idx < host->nbMcast)
+        {
+            errno = EADDRINUSE;
+            return -1;
+        }
+        if (host->nbMcast == UDP_MAX_MEMBERSHIPS || IgmpProcessor::getInstance().join(group, ifIndex) < 0)
+        {
+            errno = ENOBUFS;
+            return -1;
+        }
+        host->mcastGroups[host->nbMcast] = group;
+        host->mcastIfs[host->nbMcast] = ifIndex;
+        host->nbMcast++;
+    }
+    else
+    {
+        if (idx == host->nbMcast)
+        {
+            errno = EADDRNOTAVAIL;
+            return -1;
+        }
+        IgmpProcessor::getInstance().leave(group, ifIndex);
+        host->nbMcast--;
+        host->mcastGroups[idx] = host->mcastGroups[host->nbMcast];
+        host->mcastIfs[idx] = host->mcastIfs[host->nbMcast];
+    }
+    SPDLOG_INFO("Socket fd {} {} multicast group {} on interface {}", sockfd, optname == IP_ADD_MEMBERSHIP ? "joined" : "left",
+                convert_uint32_to_ip(group), ifIndex);
+    return 0;
 }
 
 ssize_t UdpServerManager::nsendto(int sockfd, const void *buf, size_t len, __attribute__((unused)) int flags,
@@ -204,21 +570,46 @@ ssize_t UdpServerManager::nsendto(int sockfd, const void *buf, size_t len, __att
     if (host == nullptr)
         return -1;
 
-    const struct sockaddr_in *daddr = (const struct sockaddr_in *)dest_addr;
+    // IPv6不做分片,数据报必须能放进一个链路MTU
+    const size_t maxPayload = host->family == AF_INET6
+                                  ? Ipv6Processor::getInstance().getMtu() - sizeof(struct rte_ipv6_hdr) - sizeof(struct rte_udp_hdr)
+                                  : UDP_MAX_PAYLOAD;
+    if (len > maxPayload)
+    {
+        errno = EMSGSIZE;
+        return -1;
+    }
 
     struct offload *ol = (struct offload *)rte_malloc("offload", sizeof(struct offload), 0);
     if (ol == nullptr)
         return -1;
 
-    ol->dip = daddr->sin_addr.s_addr;
-    ol->dport = daddr->sin_port;
-    ol->sip = host->localIp;
+    ol->family = host->family;
     ol->sport = host->localport;
     ol->length = len;
+    ol->tos = host->tos;
+    if (host->family == AF_INET6)
+    {
+        const struct sockaddr_in6 *daddr6 = (const struct sockaddr_in6 *)dest_addr;
+        rte_memcpy(ol->dip6, daddr6->sin6_addr.s6_addr, IPV6_ADDR_LEN);
+        ol->dport = daddr6->sin6_port;
+        rte_memcpy(ol->sip6, ipv6IsUnspecified(host->localIp6) ? Ipv6Processor::getInstance().getPrimary() : host->localIp6,
+                   IPV6_ADDR_LEN);
+        SPDLOG_INFO("Send packet to [{}]:{}", ipv6ToString(ol->dip6), ntohs(ol->dport));
+    }
+    else
+    {
+        const struct sockaddr_in *daddr = (const struct sockaddr_in *)dest_addr;
+        ol->dip = daddr->sin_addr.s_addr;
+        ol->dport = daddr->sin_port;
+        // 绑定到INADDR_ANY的socket使用端口的主地址作为源地址
+        ol->sip = host->localIp != INADDR_ANY ? host->localIp
+                                              : LocalAddrTable::getInstance().getPrimary(ConfigManager::getInstance().getDpdkPortId());
 
-    struct in_addr addr;
-    addr.s_addr = ol->dip;
-    SPDLOG_INFO("Send packet to {}:{}", inet_ntoa(addr), ntohs(ol->dport));
+        struct in_addr addr;
+        addr.s_addr = ol->dip;
+        SPDLOG_INFO("Send packet to {}:{}", inet_ntoa(addr), ntohs(ol->dport));
+    }
 
     ol->data = (unsigned char *)rte_malloc("unsigned char *", len, 0);
     if (ol->data == nullptr)
@@ -231,18 +622,3 @@ ssize_t UdpServerManager::nsendto(int sockfd, const void *buf, size_t len, __att
 
     return len;
 }
-
-std::list<UdpHost *> &UdpServerManager::getUdpHostList()
-{
-    return _udpHostList;
-}
-
-UdpHost *UdpServerManager::getHostInfoFromFd(int fd)
-{
-    for (UdpHost *it : _udpHostList)
-    {
-        if (it->fd == fd)
-            return it;
-    }
-    return nullptr;
-}
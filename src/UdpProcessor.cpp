@@ -6,12 +6,25 @@
 #include "ArpProcessor.hpp"
 #include "Ring.hpp"
 #include "UdpHost.hpp"
+#include "Reorder.hpp"
+#include "Pmtu.hpp"
+#include "Ipv6.hpp"
+#include "Vlan.hpp"
+#include "Vxlan.hpp"
+#include "LocalAddr.hpp"
+#include <rte_ip_frag.h>
+#include <algorithm>
 
+// PMTU降到最小值且经VXLAN封装发送时,最大数据报也必须能切完,否则发送会在分片阶段失败
+#define UDP_MIN_FRAG_PAYLOAD ((PMTU_MIN - VXLAN_ENCAP_LEN - sizeof(struct rte_ipv4_hdr)) & ~7u)
+static_assert((UDP_MAX_PAYLOAD + sizeof(struct rte_udp_hdr) + UDP_MIN_FRAG_PAYLOAD - 1) / UDP_MIN_FRAG_PAYLOAD <= UDP_MAX_FRAGMENTS,
+              "UDP_MAX_FRAGMENTS too small for a maximum datagram at PMTU_MIN");
 
 int UdpProcessor::udpProcess(struct rte_mbuf *udpMbuf)
 {
     struct rte_ipv4_hdr *iphdr = rte_pktmbuf_mtod_offset(udpMbuf, struct rte_ipv4_hdr *, sizeof(struct rte_ether_hdr));
-    struct rte_udp_hdr *udphdr = (struct rte_udp_hdr *)(iphdr + 1);
+    // 报文可能带有IP选项,按IHL定位UDP头部
+    struct rte_udp_hdr *udphdr = (struct rte_udp_hdr *)((uint8_t *)iphdr + rte_ipv4_hdr_len(iphdr));
 
     struct in_addr addr;
     addr.s_addr = iphdr->src_addr;
@@ -23,74 +36,352 @@ int UdpProcessor::udpProcess(struct rte_mbuf *udpMbuf)
     {
         SPDLOG_INFO("UDP host not found for IP: {}, Port: {}",
                     convert_uint32_to_ip(iphdr->dst_addr), ntohs(udphdr->dst_port));
-        rte_pktmbuf_free(udpMbuf);
+        // 由调用者回复端口不可达后释放
         return -3;
     }
 
+    if (UdpServerManager::getInstance().isRxZeroCopy())
+    {
+        if (prepareRxMbuf(udpMbuf, AF_INET, &iphdr->src_addr, udphdr->src_port, (const uint8_t *)(udphdr + 1),
+                          ntohs(udphdr->dgram_len) - sizeof(struct rte_udp_hdr)) < 0)
+        {
+            rte_pktmbuf_free(udpMbuf);
+            return -2;
+        }
+        deliver(host, udpMbuf);
+        return 0;
+    }
+
+    struct offload *ol = copyRxDatagram(udpMbuf, iphdr, udphdr);
+    rte_pktmbuf_free(udpMbuf);
+    if (ol == nullptr)
+        return -2;
+    deliver(host, ol);
+    return 0;
+}
+
+int UdpProcessor::udpMcastProcess(struct rte_mbuf *udpMbuf)
+{
+    struct rte_ipv4_hdr *iphdr = rte_pktmbuf_mtod_offset(udpMbuf, struct rte_ipv4_hdr *, sizeof(struct rte_ether_hdr));
+    struct rte_udp_hdr *udphdr = (struct rte_udp_hdr *)((uint8_t *)iphdr + rte_ipv4_hdr_len(iphdr));
+
+    UdpHost *hosts[UDP_MCAST_MAX_FANOUT];
+    const unsigned nbHosts = UdpServerManager::getInstance().getMcastHosts(iphdr->dst_addr, udpMbuf->port, udphdr->dst_port,
+                                                                            hosts, UDP_MCAST_MAX_FANOUT);
+    if (nbHosts == 0)
+    {
+        rte_pktmbuf_free(udpMbuf);
+        return 0;
+    }
+
+    // 每个socket需要独立的消费进度,其余socket各使用一个克隆的间接mbuf,负载仍不拷贝
+    if (UdpServerManager::getInstance().isRxZeroCopy())
+    {
+        if (prepareRxMbuf(udpMbuf, AF_INET, &iphdr->src_addr, udphdr->src_port, (const uint8_t *)(udphdr + 1),
+                          ntohs(udphdr->dgram_len) - sizeof(struct rte_udp_hdr)) < 0)
+        {
+            rte_pktmbuf_free(udpMbuf);
+            return 0;
+        }
+        unsigned nbDelivered = 1;
+        for (unsigned i = 1; i < nbHosts; i++)
+        {
+            struct rte_mbuf *clone = rte_pktmbuf_clone(udpMbuf, _indirectPool);
+            if (clone == nullptr)
+                continue;
+            deliver(hosts[i], clone);
+            nbDelivered++;
+        }
+        // 原报文最后交出,之前应用不会释放它
+        deliver(hosts[0], udpMbuf);
+        return nbDelivered;
+    }
+
+    // 重组后的多段数据报负载不连续,仍为每个socket拷贝一份
+    if (udpMbuf->nb_segs != 1)
+    {
+        for (unsigned i = 0; i < nbHosts; i++)
+        {
+            struct offload *ol = copyRxDatagram(udpMbuf, iphdr, udphdr);
+            if (ol != nullptr)
+                deliver(hosts[i], ol);
+        }
+        rte_pktmbuf_free(udpMbuf);
+        return nbHosts;
+    }
+
+    // 每个socket持有mbuf的一个引用,负载原地读取,最后一个读完的socket释放mbuf
+    const uint16_t payloadLen = ntohs(udphdr->dgram_len) - sizeof(struct rte_udp_hdr);
+    rte_mbuf_refcnt_update(udpMbuf, nbHosts - 1);
+    for (unsigned i = 0; i < nbHosts; i++)
+    {
+        struct offload *ol = (struct offload *)rte_malloc("offload", sizeof(struct offload), 0);
+        if (ol == nullptr)
+        {
+            rte_pktmbuf_free(udpMbuf);
+            continue;
+        }
+        ol->family = AF_INET;
+        ol->dip = iphdr->dst_addr;
+        ol->sip = iphdr->src_addr;
+        ol->sport = udphdr->src_port;
+        ol->dport = udphdr->dst_port;
+        ol->protocol = IPPROTO_UDP;
+        ol->length = payloadLen;
+        ol->data = (unsigned char *)(udphdr + 1);
+        ol->mbuf = udpMbuf;
+        deliver(hosts[i], ol);
+    }
+    return nbHosts;
+}
+
+struct offload *UdpProcessor::copyRxDatagram(struct rte_mbuf *udpMbuf, const struct rte_ipv4_hdr *iphdr,
+                                             const struct rte_udp_hdr *udphdr)
+{
     struct offload *ol = (struct offload *)rte_malloc("offload", sizeof(struct offload), 0);
     if (ol == nullptr)
     {
         SPDLOG_INFO("Failed to allocate offload structure for UDP processing");
-        rte_pktmbuf_free(udpMbuf);
-        return -1;
+        return nullptr;
     }
 
+    ol->family = AF_INET;
     ol->dip = iphdr->dst_addr;
     ol->sip = iphdr->src_addr;
     ol->sport = udphdr->src_port;
     ol->dport = udphdr->dst_port;
-
     ol->protocol = IPPROTO_UDP;
-    ol->length = ntohs(udphdr->dgram_len);
+    ol->mbuf = nullptr;
+    // length是交给应用的负载长度,不包括UDP头部
+    ol->length = ntohs(udphdr->dgram_len) - sizeof(struct rte_udp_hdr);
 
-    ol->data = (unsigned char *)rte_malloc("unsigned char*", ol->length - sizeof(struct rte_udp_hdr), 0);
+    ol->data = (unsigned char *)rte_malloc("unsigned char*", ol->length > 0 ? ol->length : 1, 0);
     if (ol->data == nullptr)
     {
-        rte_pktmbuf_free(udpMbuf);
         rte_free(ol);
-        return -2;
+        return nullptr;
+    }
+    // 重组后的数据报是多段mbuf,负载可能跨越多个分段
+    const uint32_t payloadOffset = (const uint8_t *)(udphdr + 1) - rte_pktmbuf_mtod(udpMbuf, uint8_t *);
+    const void *payload = rte_pktmbuf_read(udpMbuf, payloadOffset, ol->length, ol->data);
+    if (payload == nullptr)
+    {
+        SPDLOG_INFO("Truncated UDP datagram, length {}", ol->length);
+        rte_free(ol->data);
+        rte_free(ol);
+        return nullptr;
     }
-    rte_memcpy(ol->data, (unsigned char *)(udphdr + 1), ol->length - sizeof(struct rte_udp_hdr));
+    if (payload != ol->data)
+        rte_memcpy(ol->data, payload, ol->length);
+    return ol;
+}
+
+int UdpProcessor::prepareRxMbuf(struct rte_mbuf *mbuf, int family, const void *sip, uint16_t sport,
+                                const uint8_t *payload, uint16_t payloadLen)
+{
+    // 元数据必须在去掉头部之前写入,sip指向的是报文头部
+    UdpRxMeta *meta = UdpServerManager::getInstance().rxMeta(mbuf);
+    meta->family = family;
+    if (family == AF_INET6)
+        rte_memcpy(meta->sip6, sip, IPV6_ADDR_LEN);
+    else
+        meta->sip = *(const uint32_t *)sip;
+    meta->sport = sport;
+    meta->consumed = 0;
 
-    rte_ring_mp_enqueue(host->rcvbuf, ol); // recv buffer
+    if (rte_pktmbuf_adj(mbuf, payload - rte_pktmbuf_mtod(mbuf, const uint8_t *)) == nullptr)
+        return -1;
+    if (mbuf->pkt_len > payloadLen && rte_pktmbuf_trim(mbuf, mbuf->pkt_len - payloadLen) < 0)
+        return -1;
+    return mbuf->pkt_len == payloadLen ? 0 : -1;
+}
+
+void UdpProcessor::deliver(UdpHost *host, void *entry)
+{
+    if (rte_ring_mp_enqueue(host->rcvbuf, entry) < 0)
+    {
+        SPDLOG_INFO("Receive buffer of fd {} is full, drop datagram", host->fd);
+        host->rcvDrops.fetch_add(1, std::memory_order_relaxed);
+        UdpServerManager::getInstance().freeRxEntry(entry);
+        return;
+    }
 
     pthread_mutex_lock(&host->mutex);
     pthread_cond_signal(&host->cond);
     pthread_mutex_unlock(&host->mutex);
+}
 
-    rte_pktmbuf_free(udpMbuf);
+int UdpProcessor::udp6Process(struct rte_mbuf *udpMbuf)
+{
+    struct rte_ipv6_hdr *ip6 = rte_pktmbuf_mtod_offset(udpMbuf, struct rte_ipv6_hdr *, sizeof(struct rte_ether_hdr));
+    struct rte_udp_hdr *udphdr = (struct rte_udp_hdr *)(ip6 + 1);
+    const uint16_t udpLen = rte_be_to_cpu_16(ip6->payload_len);
+    // IPv6的UDP校验和是必选的(RFC 8200 8.1),0也是非法值
+    if (udpMbuf->nb_segs != 1 || udpLen < sizeof(struct rte_udp_hdr) || rte_be_to_cpu_16(udphdr->dgram_len) != udpLen ||
+        udphdr->dgram_cksum == 0 ||
+        ((udpMbuf->ol_flags & PKT_RX_L4_CKSUM_MASK) != PKT_RX_L4_CKSUM_GOOD && rte_ipv6_udptcp_cksum(ip6, udphdr) != 0xffff))
+    {
+        SPDLOG_INFO("Drop invalid UDP datagram from {}", ipv6ToString(ip6->src_addr));
+        rte_pktmbuf_free(udpMbuf);
+        return -1;
+    }
+
+    struct UdpHost *host = UdpServerManager::getInstance().getHostInfoFromIp6AndPort(ip6->dst_addr, udphdr->dst_port, IPPROTO_UDP);
+    if (host == nullptr)
+    {
+        SPDLOG_INFO("UDP host not found for IP: {}, Port: {}", ipv6ToString(ip6->dst_addr), ntohs(udphdr->dst_port));
+        rte_pktmbuf_free(udpMbuf);
+        return -3;
+    }
 
+    if (UdpServerManager::getInstance().isRxZeroCopy())
+    {
+        if (prepareRxMbuf(udpMbuf, AF_INET6, ip6->src_addr, udphdr->src_port, (const uint8_t *)(udphdr + 1),
+                          udpLen - sizeof(struct rte_udp_hdr)) < 0)
+        {
+            rte_pktmbuf_free(udpMbuf);
+            return -2;
+        }
+        deliver(host, udpMbuf);
+        return 0;
+    }
+
+    struct offload *ol = (struct offload *)rte_malloc("offload", sizeof(struct offload), 0);
+    if (ol == nullptr)
+    {
+        rte_pktmbuf_free(udpMbuf);
+        return -1;
+    }
+    ol->family = AF_INET6;
+    ol->mbuf = nullptr;
+    rte_memcpy(ol->sip6, ip6->src_addr, IPV6_ADDR_LEN);
+    rte_memcpy(ol->dip6, ip6->dst_addr, IPV6_ADDR_LEN);
+    ol->sport = udphdr->src_port;
+    ol->dport = udphdr->dst_port;
+    ol->protocol = IPPROTO_UDP;
+    ol->length = udpLen - sizeof(struct rte_udp_hdr);
+    ol->data = (unsigned char *)rte_malloc("unsigned char*", ol->length > 0 ? ol->length : 1, 0);
+    if (ol->data == nullptr)
+    {
+        rte_pktmbuf_free(udpMbuf);
+        rte_free(ol);
+        return -2;
+    }
+    rte_memcpy(ol->data, udphdr + 1, ol->length);
+    rte_pktmbuf_free(udpMbuf);
+    deliver(host, ol);
     return 0;
 }
 
+void UdpProcessor::udp6Out(struct rte_mempool *mbuf_pool, struct rte_ring *out, UdpHost *host, struct offload *ol)
+{
+    Ipv6Processor &ipv6 = Ipv6Processor::getInstance();
+    const uint8_t *nextHop = ipv6.nextHop(ol->dip6);
+    if (nextHop == nullptr)
+    {
+        SPDLOG_WARN("No route to {}, drop udp datagram", ipv6ToString(ol->dip6));
+        return;
+    }
+    bool hit = ipv6.lookupCached(nextHop, &host->nd6Cache);
+    // 目的MAC在邻居解析完成后由IPv6模块填写
+    uint8_t zeroMac[RTE_ETHER_ADDR_LEN] = {0};
+    struct rte_mbuf *mbuf = udp6Pkt(mbuf_pool, ol, host->localMac, hit ? host->nd6Cache.mac : zeroMac);
+    if (mbuf == nullptr)
+        return;
+    if (hit)
+        EgressReorder::getInstance().enqueueOut(out, &mbuf, 1);
+    else
+        ipv6.queuePending(mbuf_pool, out, nextHop, mbuf);
+}
+
 int UdpProcessor::udpOut(struct rte_mempool *mbuf_pool)
 {
     struct inout_ring *ring = Ring::getSingleton().getRing();
-    std::list<UdpHost*> _udpHostList = UdpServerManager::getInstance().getUdpHostList();
-    for (auto &host : _udpHostList)
+    UdpServerManager &manager = UdpServerManager::getInstance();
+    const int fdEnd = manager.getFdEnd();
+    int fd = 0;
+    while (fd < fdEnd)
     {
-        struct offload *ol;
-        int nbSnd = rte_ring_mc_dequeue(host->sndbuf, (void **)&ol);
-        if (nbSnd < 0)
-            continue;
-
-        uint8_t *dstMac = ArpTable::getInstance().search(ol->dip);
-        if (dstMac == nullptr)
+        // 每个host最多取出一个待发送的数据报,凑成一批后统一解析目的MAC
+        UdpHost *hosts[ARP_BULK_MAX];
+        struct offload *ols[ARP_BULK_MAX];
+        uint32_t dips[ARP_BULK_MAX];
+        ArpCacheEntry *caches[ARP_BULK_MAX];
+        unsigned nb = 0;
+        for (; fd < fdEnd && nb < ARP_BULK_MAX; ++fd)
         {
-            uint8_t *dstMac = new uint8_t[RTE_ETHER_ADDR_LEN];
-            SPDLOG_INFO("MAC not found for IP: {}, Port: {}", convert_uint32_to_ip(ol->dip), ntohs(ol->dport));
-            ArpProcessor::getInstance().getDefaultArpMac(dstMac);
-            struct rte_mbuf *arpBuf = ArpProcessor::getInstance().sendArpPacket(mbuf_pool, RTE_ARP_OP_REQUEST,
-                                                                 ConfigManager::getInstance().getSrcMac(), ol->sip,
-                                                                 dstMac, ol->dip);
-            rte_ring_mp_enqueue_burst(ring->out, (void **)&arpBuf, 1, nullptr);
-            rte_ring_mp_enqueue(host->sndbuf, ol);
+            UdpHost *host = manager.getHostInfoFromFd(fd);
+            struct offload *ol;
+            if (host == nullptr || rte_ring_mc_dequeue(host->sndbuf, (void **)&ol) < 0)
+                continue;
+            // IPv6数据报不参与ARP批量查询,直接发送
+            if (ol->family == AF_INET6)
+            {
+                udp6Out(mbuf_pool, ring->out, host, ol);
+                rte_free(ol->data);
+                rte_free(ol);
+                continue;
+            }
+            // ARP解析的是路由给出的下一跳,路由结果缓存在socket上
+            if (!RouteTable::getInstance().lookupCached(ol->dip, &host->routeCache))
+            {
+                SPDLOG_WARN("No route to {}, drop udp datagram", convert_uint32_to_ip(ol->dip));
+                rte_free(ol->data);
+                rte_free(ol);
+                continue;
+            }
+            // 绑定到INADDR_ANY的socket使用出接口的主地址,发往VLAN的数据报带上子接口的地址
+            if (host->localIp == INADDR_ANY)
+            {
+                uint32_t primary = LocalAddrTable::getInstance().getPrimary(host->routeCache.portId);
+                if (primary != 0)
+                    ol->sip = primary;
+            }
+            hosts[nb] = host;
+            ols[nb] = ol;
+            dips[nb] = host->routeCache.nextHop;
+            caches[nb] = &host->arpCache;
+            nb++;
         }
-        else
+        if (nb == 0)
+            break;
+
+        uint8_t dstMacs[ARP_BULK_MAX][RTE_ETHER_ADDR_LEN];
+        uint64_t hitMask = ArpTable::lookupBulkCached(dips, nb, caches, dstMacs);
+        for (unsigned i = 0; i < nb; i++)
         {
-            struct rte_mbuf *udpbuf = udpPkt(mbuf_pool, ol->sip, ol->dip, ol->sport, ol->dport,
-                                             host->localMac, dstMac, ol->data, ol->length);
-            rte_ring_mp_enqueue_burst(ring->out, (void **)&udpbuf, 1, nullptr);
+            struct offload *ol = ols[i];
+            bool hit = hitMask & (1ULL << i);
+            uint8_t *dstMac = dstMacs[i];
+            if (!hit)
+            {
+                // 目的MAC在解析完成后由ARP模块填写
+                SPDLOG_INFO("MAC not found for IP: {}, Port: {}", convert_uint32_to_ip(ol->dip), ntohs(ol->dport));
+                memset(dstMac, 0, RTE_ETHER_ADDR_LEN);
+            }
+            // 超过路径MTU的数据报切分成IPv4分片发送
+            struct rte_mbuf *pkts[UDP_MAX_FRAGMENTS];
+            unsigned nbPkts = 1;
+            // 经过隧道接口发送时还要留出外层封装的长度
+            uint16_t mtu = VxlanTunnel::getInstance().ifMtu(hosts[i]->routeCache.portId, PmtuCache::getInstance().getCached(ol->dip, &hosts[i]->pmtuCache));
+            const uint32_t frameLen = ol->length + sizeof(struct rte_ether_hdr) + sizeof(struct rte_ipv4_hdr) + sizeof(struct rte_udp_hdr);
+            if (frameLen - sizeof(struct rte_ether_hdr) <= mtu &&
+                frameLen <= (uint32_t)rte_pktmbuf_data_room_size(mbuf_pool) - RTE_PKTMBUF_HEADROOM)
+                pkts[0] = udpPkt(mbuf_pool, ol->sip, ol->dip, ol->sport, ol->dport,
+                                 hosts[i]->localMac, dstMac, ol->data, ol->length, ol->tos);
+            else
+                nbPkts = udpFragmentPkt(mbuf_pool, ol, hosts[i]->localMac, dstMac, mtu, pkts);
+            for (unsigned j = 0; j < nbPkts; j++)
+                VlanTable::getInstance().tagTx(pkts[j], hosts[i]->routeCache.portId);
+            if (hit)
+                EgressReorder::getInstance().enqueueOut(ring->out, pkts, nbPkts);
+            else
+            {
+                for (unsigned j = 0; j < nbPkts; j++)
+                    ArpProcessor::getInstance().queuePending(mbuf_pool, ring->out, dips[i], pkts[j]);
+            }
+            rte_free(ol->data);
+            rte_free(ol);
         }
     }
 
@@ -99,7 +390,7 @@ int UdpProcessor::udpOut(struct rte_mempool *mbuf_pool)
 
 struct rte_mbuf *UdpProcessor::udpPkt(struct rte_mempool *mbuf_pool, uint32_t srcIp, uint32_t dstIp,
                                       uint16_t srcPort, uint16_t dstPort, uint8_t *srcMac, uint8_t *dstMac,
-                                      uint8_t *data, uint16_t length)
+                                      uint8_t *data, uint16_t length, uint8_t tos)
 {
 
     const unsigned total_len = length + 42;
@@ -114,14 +405,142 @@ struct rte_mbuf *UdpProcessor::udpPkt(struct rte_mempool *mbuf_pool, uint32_t sr
 
     uint8_t *pktdata = rte_pktmbuf_mtod(mbuf, uint8_t *);
 
-    encodeUdpApppkt(pktdata, srcIp, dstIp, srcPort, dstPort, srcMac, dstMac, data, total_len);
+    encodeUdpApppkt(pktdata, srcIp, dstIp, srcPort, dstPort, srcMac, dstMac, data, total_len, tos);
+
+    return mbuf;
+}
+
+struct rte_mbuf *UdpProcessor::udp6Pkt(struct rte_mempool *mbuf_pool, struct offload *ol, uint8_t *srcMac, uint8_t *dstMac)
+{
+    const uint16_t udpLen = sizeof(struct rte_udp_hdr) + ol->length;
+    const uint16_t totalLen = sizeof(struct rte_ether_hdr) + sizeof(struct rte_ipv6_hdr) + udpLen;
+    struct rte_mbuf *mbuf = rte_pktmbuf_alloc(mbuf_pool);
+    if (mbuf == nullptr)
+    {
+        SPDLOG_ERROR("Failed to allocate mbuf for UDP datagram");
+        return nullptr;
+    }
+    mbuf->pkt_len = totalLen;
+    mbuf->data_len = totalLen;
+
+    struct rte_ether_hdr *eth = rte_pktmbuf_mtod(mbuf, struct rte_ether_hdr *);
+    rte_memcpy(eth->s_addr.addr_bytes, srcMac, RTE_ETHER_ADDR_LEN);
+    rte_memcpy(eth->d_addr.addr_bytes, dstMac, RTE_ETHER_ADDR_LEN);
+    eth->ether_type = htons(RTE_ETHER_TYPE_IPV6);
 
+    struct rte_ipv6_hdr *ip6 = (struct rte_ipv6_hdr *)(eth + 1);
+    ip6->vtc_flow = htonl(6u << 28 | (uint32_t)ol->tos << 20);
+    ip6->payload_len = htons(udpLen);
+    ip6->proto = IPPROTO_UDP;
+    ip6->hop_limits = IPV6_DEFAULT_HOP_LIMIT;
+    rte_memcpy(ip6->src_addr, ol->sip6, IPV6_ADDR_LEN);
+    rte_memcpy(ip6->dst_addr, ol->dip6, IPV6_ADDR_LEN);
+
+    struct rte_udp_hdr *udp = (struct rte_udp_hdr *)(ip6 + 1);
+    udp->src_port = ol->sport;
+    udp->dst_port = ol->dport;
+    udp->dgram_len = htons(udpLen);
+    rte_memcpy(udp + 1, ol->data, ol->length);
+    udp->dgram_cksum = 0;
+    udp->dgram_cksum = rte_ipv6_udptcp_cksum(ip6, udp);
     return mbuf;
 }
 
+unsigned UdpProcessor::udpFragmentPkt(struct rte_mempool *mbuf_pool, struct offload *ol, uint8_t *srcMac, uint8_t *dstMac,
+                                      uint16_t mtu, struct rte_mbuf **frags)
+{
+    const uint16_t hdrLen = sizeof(struct rte_ipv4_hdr) + sizeof(struct rte_udp_hdr);
+    struct rte_mbuf *head = rte_pktmbuf_alloc(mbuf_pool);
+    if (head == nullptr)
+    {
+        SPDLOG_ERROR("Failed to allocate mbuf for UDP datagram");
+        return 0;
+    }
+
+    // IP头和UDP头,rte_ipv4_fragment_packet要求输入报文从IP头开始
+    struct rte_ipv4_hdr *ip = rte_pktmbuf_mtod(head, struct rte_ipv4_hdr *);
+    ip->version_ihl = 0x45;
+    ip->type_of_service = ol->tos;
+    ip->total_length = htons(hdrLen + ol->length);
+    ip->packet_id = htons(_ipId++);
+    ip->fragment_offset = 0;
+    ip->time_to_live = 64;
+    ip->next_proto_id = IPPROTO_UDP;
+    ip->src_addr = ol->sip;
+    ip->dst_addr = ol->dip;
+    ip->hdr_checksum = 0;
+    struct rte_udp_hdr *udp = (struct rte_udp_hdr *)(ip + 1);
+    udp->src_port = ol->sport;
+    udp->dst_port = ol->dport;
+    udp->dgram_len = htons(sizeof(struct rte_udp_hdr) + ol->length);
+    udp->dgram_cksum = 0;
+    head->data_len = hdrLen;
+    head->pkt_len = hdrLen;
+
+    // 负载超过单个mbuf的容量,写入mbuf链
+    struct rte_mbuf *cur = head;
+    uint32_t copied = 0;
+    while (copied < ol->length)
+    {
+        if (rte_pktmbuf_tailroom(cur) == 0)
+        {
+            struct rte_mbuf *seg = rte_pktmbuf_alloc(mbuf_pool);
+            if (seg == nullptr)
+            {
+                SPDLOG_ERROR("Failed to allocate mbuf for UDP datagram");
+                rte_pktmbuf_free(head);
+                return 0;
+            }
+            cur->next = seg;
+            head->nb_segs++;
+            cur = seg;
+        }
+        uint32_t len = std::min<uint32_t>(ol->length - copied, rte_pktmbuf_tailroom(cur));
+        rte_memcpy(rte_pktmbuf_mtod_offset(cur, uint8_t *, cur->data_len), ol->data + copied, len);
+        cur->data_len += len;
+        head->pkt_len += len;
+        copied += len;
+    }
+
+    // UDP校验和覆盖整个数据报,需要跨分段计算
+    uint16_t raw = 0;
+    rte_raw_cksum_mbuf(head, sizeof(struct rte_ipv4_hdr), sizeof(struct rte_udp_hdr) + ol->length, &raw);
+    uint32_t sum = (uint32_t)rte_ipv4_phdr_cksum(ip, 0) + raw;
+    sum = (sum & 0xffff) + (sum >> 16);
+    sum = (sum & 0xffff) + (sum >> 16);
+    udp->dgram_cksum = (uint16_t)~sum;
+    if (udp->dgram_cksum == 0)
+        udp->dgram_cksum = 0xffff;
+
+    // 除最后一片外,分片负载长度必须是8的整数倍
+    uint16_t fragMtu = ((mtu - sizeof(struct rte_ipv4_hdr)) & ~7) + sizeof(struct rte_ipv4_hdr);
+    int32_t nbFrags = rte_ipv4_fragment_packet(head, frags, UDP_MAX_FRAGMENTS, fragMtu, mbuf_pool, _indirectPool);
+    // 分片通过间接mbuf持有原数据报的引用,这里只释放本函数的引用
+    rte_pktmbuf_free(head);
+    if (nbFrags < 0)
+    {
+        SPDLOG_ERROR("Failed to fragment UDP datagram of {} bytes, error {}", ol->length, nbFrags);
+        return 0;
+    }
+
+    for (int32_t i = 0; i < nbFrags; i++)
+    {
+        struct rte_ether_hdr *eth = (struct rte_ether_hdr *)rte_pktmbuf_prepend(frags[i], sizeof(struct rte_ether_hdr));
+        rte_memcpy(eth->s_addr.addr_bytes, srcMac, RTE_ETHER_ADDR_LEN);
+        rte_memcpy(eth->d_addr.addr_bytes, dstMac, RTE_ETHER_ADDR_LEN);
+        eth->ether_type = htons(RTE_ETHER_TYPE_IPV4);
+        struct rte_ipv4_hdr *fragIp = (struct rte_ipv4_hdr *)(eth + 1);
+        fragIp->hdr_checksum = 0;
+        fragIp->hdr_checksum = rte_ipv4_cksum(fragIp);
+    }
+    SPDLOG_INFO("UDP datagram of {} bytes to {} split into {} fragments, mtu {}",
+                ol->length, convert_uint32_to_ip(ol->dip), nbFrags, mtu);
+    return nbFrags;
+}
+
 int UdpProcessor::encodeUdpApppkt(uint8_t *msg, uint32_t srcIp, uint32_t dstIp,
                                   uint16_t srcPort, uint16_t dstPort, uint8_t *srcMac, uint8_t *dstMac,
-                                  unsigned char *data, uint16_t total_len)
+                                  unsigned char *data, uint16_t total_len, uint8_t tos)
 {
     SPDLOG_INFO("encodeUdpApppkt: srcIp: {}, dstIp: {}, srcPort: {}, dstPort: {}, total_len: {}",
                 convert_uint32_to_ip(srcIp), convert_uint32_to_ip(dstIp), ntohs(srcPort), ntohs(dstPort), total_len);
@@ -135,7 +554,7 @@ int UdpProcessor::encodeUdpApppkt(uint8_t *msg, uint32_t srcIp, uint32_t dstIp,
     // 2 iphdr
     struct rte_ipv4_hdr *ip = (struct rte_ipv4_hdr *)(msg + sizeof(struct rte_ether_hdr));
     ip->version_ihl = 0x45;
-    ip->type_of_service = 0;
+    ip->type_of_service = tos;
     ip->total_length = htons(total_len - sizeof(struct rte_ether_hdr));
     ip->packet_id = 0;
     ip->fragment_offset = 0;
@@ -153,7 +572,7 @@ int UdpProcessor::encodeUdpApppkt(uint8_t *msg, uint32_t srcIp, uint32_t dstIp,
     uint16_t udplen = total_len - sizeof(struct rte_ether_hdr) - sizeof(struct rte_ipv4_hdr);
     udp->dgram_len = htons(udplen);
 
-    rte_memcpy((uint8_t *)(udp + 1), data, udplen);
+    rte_memcpy((uint8_t *)(udp + 1), data, udplen - sizeof(struct rte_udp_hdr));
 
     udp->dgram_cksum = 0;
     udp->dgram_cksum = rte_ipv4_udptcp_cksum(ip, udp);
@@ -0,0 +1,138 @@
+#include "Vlan.hpp"
+#include <rte_ether.h>
+#include <arpa/inet.h>
+#include <cstdlib>
+#include "Route.hpp"
+#include "Logger.hpp"
+#include "Utils.hpp"
+
+VlanTable::VlanTable()
+{
+    for (unsigned i = 0; i < VLAN_ID_COUNT; i++)
+        _ifOfVlan[i] = VLAN_IF_NONE;
+}
+
+int VlanTable::init(uint16_t portId, bool hwStrip, bool hwInsert)
+{
+    if (portId >= VLAN_IF_BASE)
+    {
+        SPDLOG_ERROR("Port {} conflicts with VLAN interface numbers starting at {}", portId, VLAN_IF_BASE);
+        return -1;
+    }
+    _portId = portId;
+    _hwInsert = hwInsert;
+    // 只带优先级的报文(VLAN ID为0)属于物理端口
+    _ifOfVlan[0] = portId;
+    SPDLOG_INFO("VLAN on port {}: hardware strip {}, hardware insert {}", portId, hwStrip, hwInsert);
+    return 0;
+}
+
+int VlanTable::addVlan(uint16_t vlanId, const std::string &cidr)
+{
+    if (vlanId == 0 || vlanId >= VLAN_ID_MASK)
+    {
+        SPDLOG_ERROR("Invalid VLAN ID {}", vlanId);
+        return -1;
+    }
+    if (_ifOfVlan[vlanId] != VLAN_IF_NONE)
+    {
+        SPDLOG_ERROR("VLAN {} is already configured", vlanId);
+        return -1;
+    }
+    if (_count >= VLAN_MAX_IFS)
+    {
+        SPDLOG_ERROR("Too many VLAN interfaces, VLAN {} ignored", vlanId);
+        return -1;
+    }
+    size_t slash = cidr.find('/');
+    std::string addrStr = cidr.substr(0, slash);
+    int depth = slash == std::string::npos ? 32 : atoi(cidr.c_str() + slash + 1);
+    struct in_addr addr;
+    if (inet_pton(AF_INET, addrStr.c_str(), &addr) != 1 || depth <= 0 || depth > 32)
+    {
+        SPDLOG_ERROR("Invalid address {} for VLAN {}", cidr, vlanId);
+        return -1;
+    }
+
+    const uint16_t ifIndex = VLAN_IF_BASE + _count;
+    if (LocalAddrTable::getInstance().add(addr.s_addr, ifIndex) < 0)
+        return -1;
+    // 子接口所在网段的直连路由指向子接口,发往该网段的报文带上它的标签
+    if (RouteTable::getInstance().addRoute(addr.s_addr, (uint8_t)depth, ROUTE_ON_LINK, ifIndex) < 0)
+    {
+        LocalAddrTable::getInstance().remove(addr.s_addr);
+        return -1;
+    }
+    _vlanOfIf[ifIndex] = vlanId;
+    _ifOfVlan[vlanId] = ifIndex;
+    _count++;
+    SPDLOG_INFO("VLAN {} interface {} address {}", vlanId, ifIndex, cidr);
+    return ifIndex;
+}
+
+unsigned VlanTable::addVlans(const std::vector<std::pair<uint16_t, std::string>> &vlans)
+{
+    unsigned added = 0;
+    for (const auto &[vlanId, cidr] : vlans)
+    {
+        if (addVlan(vlanId, cidr) >= 0)
+            added++;
+    }
+    return added;
+}
+
+std::vector<uint16_t> VlanTable::listIfs() const
+{
+    std::vector<uint16_t> ifs(1, _portId);
+    for (unsigned i = 0; i < _count; i++)
+        ifs.push_back(VLAN_IF_BASE + i);
+    return ifs;
+}
+
+unsigned VlanTable::rxBurst(struct rte_mbuf **mbufs, unsigned nbPkts)
+{
+    unsigned kept = 0;
+    for (unsigned i = 0; i < nbPkts; i++)
+    {
+        struct rte_mbuf *mbuf = mbufs[i];
+        // rte_vlan_strip把两个MAC地址后移4字节覆盖标签,负载留在原处
+        if (!(mbuf->ol_flags & PKT_RX_VLAN_STRIPPED) &&
+            rte_pktmbuf_mtod(mbuf, struct rte_ether_hdr *)->ether_type == rte_cpu_to_be_16(RTE_ETHER_TYPE_VLAN))
+            rte_vlan_strip(mbuf);
+        const uint16_t ifIndex = rxIf(mbuf);
+        if (ifIndex == VLAN_IF_NONE)
+        {
+            _unknownDropped++;
+            rte_pktmbuf_free(mbuf);
+            continue;
+        }
+        mbuf->port = ifIndex;
+        mbufs[kept++] = mbuf;
+    }
+    return kept;
+}
+
+unsigned VlanTable::txBurst(struct rte_mbuf **mbufs, unsigned nbPkts)
+{
+    unsigned kept = 0;
+    for (unsigned i = 0; i < nbPkts; i++)
+    {
+        struct rte_mbuf *mbuf = mbufs[i];
+        // 插入时以太网头前移4字节占用headroom,同样只移动MAC地址
+        if ((mbuf->ol_flags & PKT_TX_VLAN_PKT) && rte_vlan_insert(&mbuf) != 0)
+        {
+            _insertFailed++;
+            rte_pktmbuf_free(mbuf);
+            continue;
+        }
+        mbufs[kept++] = mbuf;
+    }
+    return kept;
+}
+
+void VlanTable::dumpStats() const
+{
+    if (_count == 0)
+        return;
+    SPDLOG_INFO("VLAN interfaces {}: unknown VLAN dropped {}, software insert failed {}", _count, _unknownDropped, _insertFailed);
+}
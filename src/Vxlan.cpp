@@ -0,0 +1,263 @@
+#include "Vxlan.hpp"
+#include <rte_jhash.h>
+#include <rte_memcpy.h>
+#include <arpa/inet.h>
+#include <cstdlib>
+#include "Vlan.hpp"
+#include "ArpProcessor.hpp"
+#include "Qos.hpp"
+#include "Logger.hpp"
+#include "Utils.hpp"
+
+void VxlanTunnel::init(struct rte_mempool *mbufPool, struct rte_ring *out, uint16_t udpPort, uint16_t linkMtu, const uint8_t *srcMac)
+{
+    _mbufPool = mbufPool;
+    _out = out;
+    _udpPort = rte_cpu_to_be_16(udpPort);
+    _linkMtu = linkMtu;
+    rte_memcpy(_srcMac, srcMac, RTE_ETHER_ADDR_LEN);
+}
+
+int VxlanTunnel::addTunnel(uint32_t vni, const std::string &cidr, const std::string &remote)
+{
+    if (vni == 0 || vni > 0xFFFFFF)
+    {
+        SPDLOG_ERROR("Invalid VNI {}", vni);
+        return -1;
+    }
+    if (_count >= VXLAN_MAX_IFS)
+    {
+        SPDLOG_ERROR("Too many VXLAN tunnels, VNI {} ignored", vni);
+        return -1;
+    }
+    const uint32_t vniField = rte_cpu_to_be_32(vni << 8);
+    for (unsigned i = 0; i < _count; i++)
+    {
+        if (_tunnels[i].vni == vniField)
+        {
+            SPDLOG_ERROR("VNI {} is already configured", vni);
+            return -1;
+        }
+    }
+    size_t slash = cidr.find('/');
+    std::string addrStr = cidr.substr(0, slash);
+    int depth = slash == std::string::npos ? 32 : atoi(cidr.c_str() + slash + 1);
+    struct in_addr addr, remoteAddr;
+    if (inet_pton(AF_INET, addrStr.c_str(), &addr) != 1 || depth <= 0 || depth > 32 ||
+        inet_pton(AF_INET, remote.c_str(), &remoteAddr) != 1)
+    {
+        SPDLOG_ERROR("Invalid VXLAN tunnel VNI {} address {} remote {}", vni, cidr, remote);
+        return -1;
+    }
+
+    const uint16_t ifIndex = VXLAN_IF_BASE + _count;
+    if (LocalAddrTable::getInstance().add(addr.s_addr, ifIndex) < 0)
+        return -1;
+    // 隧道网段的直连路由指向隧道接口,发往该网段的报文在发送前被封装
+    if (RouteTable::getInstance().addRoute(addr.s_addr, (uint8_t)depth, ROUTE_ON_LINK, ifIndex) < 0)
+    {
+        LocalAddrTable::getInstance().remove(addr.s_addr);
+        return -1;
+    }
+    Tunnel &tunnel = _tunnels[_count];
+    tunnel.vni = vniField;
+    tunnel.remote = remoteAddr.s_addr;
+    _count++;
+    SPDLOG_INFO("VXLAN VNI {} interface {} address {} remote VTEP {}", vni, ifIndex, cidr, remote);
+    return ifIndex;
+}
+
+unsigned VxlanTunnel::addTunnels(const std::vector<std::tuple<uint32_t, std::string, std::string>> &tunnels)
+{
+    unsigned added = 0;
+    for (const auto &[vni, cidr, remote] : tunnels)
+    {
+        if (addTunnel(vni, cidr, remote) >= 0)
+            added++;
+    }
+    return added;
+}
+
+int VxlanTunnel::decap(struct rte_mbuf *mbuf)
+{
+    const struct rte_ipv4_hdr *iphdr = rte_pktmbuf_mtod_offset(mbuf, const struct rte_ipv4_hdr *, sizeof(struct rte_ether_hdr));
+    const uint16_t ihl = (iphdr->version_ihl & RTE_IPV4_HDR_IHL_MASK) * RTE_IPV4_IHL_MULTIPLIER;
+    const uint16_t outerLen = sizeof(struct rte_ether_hdr) + ihl + sizeof(struct rte_udp_hdr) + sizeof(struct rte_vxlan_hdr);
+    // 内层帧至少要有以太网头;隧道接口收到的报文不再解封装
+    if (rte_pktmbuf_data_len(mbuf) < outerLen + sizeof(struct rte_ether_hdr) || isTunnelIf(mbuf->port))
+    {
+        rte_pktmbuf_free(mbuf);
+        return -1;
+    }
+    const struct rte_vxlan_hdr *vxlan = (const struct rte_vxlan_hdr *)((const uint8_t *)iphdr + ihl + sizeof(struct rte_udp_hdr));
+    unsigned i = 0;
+    if (vxlan->vx_flags & rte_cpu_to_be_32(VXLAN_FLAG_VNI))
+    {
+        while (i < _count && (_tunnels[i].vni != vxlan->vx_vni || _tunnels[i].remote != iphdr->src_addr))
+            i++;
+    }
+    else
+        i = _count;
+    if (i == _count)
+    {
+        _unknownVni.fetch_add(1, std::memory_order_relaxed);
+        rte_pktmbuf_free(mbuf);
+        return -1;
+    }
+
+    mbuf->port = VXLAN_IF_BASE + i;
+    // 网卡识别出隧道时校验和标志描述的是内层头部;否则描述的是外层头部,对内层没有意义
+    if (mbuf->packet_type & RTE_PTYPE_TUNNEL_MASK)
+        mbuf->packet_type = 0;
+    else
+        mbuf->ol_flags &= ~(PKT_RX_IP_CKSUM_MASK | PKT_RX_L4_CKSUM_MASK);
+    // 外层的VLAN标签不属于内层帧,应答报文不能带上它
+    mbuf->ol_flags &= ~(PKT_RX_VLAN | PKT_RX_VLAN_STRIPPED);
+    rte_pktmbuf_adj(mbuf, outerLen);
+    _tunnels[i].decapPkts.fetch_add(1, std::memory_order_relaxed);
+    return 0;
+}
+
+uint16_t VxlanTunnel::entropyPort(const struct rte_mbuf *mbuf)
+{
+    const struct rte_ether_hdr *ehdr = rte_pktmbuf_mtod(mbuf, const struct rte_ether_hdr *);
+    const struct rte_ipv4_hdr *iphdr = (const struct rte_ipv4_hdr *)(ehdr + 1);
+    uint32_t hash;
+    if (ehdr->ether_type == rte_cpu_to_be_16(RTE_ETHER_TYPE_IPV4) &&
+        rte_pktmbuf_data_len(mbuf) >= sizeof(struct rte_ether_hdr) + sizeof(struct rte_ipv4_hdr) + sizeof(uint32_t))
+    {
+        // 非首片分片和其他协议没有端口,只按地址和协议号计算
+        const uint16_t ihl = (iphdr->version_ihl & RTE_IPV4_HDR_IHL_MASK) * RTE_IPV4_IHL_MULTIPLIER;
+        uint32_t ports = iphdr->next_proto_id;
+        if ((iphdr->next_proto_id == IPPROTO_TCP || iphdr->next_proto_id == IPPROTO_UDP) &&
+            (iphdr->fragment_offset & rte_cpu_to_be_16(RTE_IPV4_HDR_OFFSET_MASK)) == 0 &&
+            rte_pktmbuf_data_len(mbuf) >= sizeof(struct rte_ether_hdr) + ihl + sizeof(uint32_t))
+            ports = *(const uint32_t *)((const uint8_t *)iphdr + ihl);
+        hash = rte_jhash_3words(iphdr->src_addr, iphdr->dst_addr, ports, 0);
+    }
+    else
+        hash = rte_jhash(ehdr, 2 * RTE_ETHER_ADDR_LEN, 0);
+    return rte_cpu_to_be_16(VXLAN_SRC_PORT_MIN + hash % (65536 - VXLAN_SRC_PORT_MIN));
+}
+
+void VxlanTunnel::writeOuter(uint8_t *hdr, const Tunnel &tunnel, uint32_t srcIp, uint16_t innerLen, uint16_t srcPort, uint8_t tos)
+{
+    struct rte_ether_hdr *eth = (struct rte_ether_hdr *)hdr;
+    rte_memcpy(eth->s_addr.addr_bytes, _srcMac, RTE_ETHER_ADDR_LEN);
+    eth->ether_type = rte_cpu_to_be_16(RTE_ETHER_TYPE_IPV4);
+
+    struct rte_ipv4_hdr *ip = (struct rte_ipv4_hdr *)(eth + 1);
+    ip->version_ihl = 0x45;
+    ip->type_of_service = tos;
+    ip->total_length = rte_cpu_to_be_16(sizeof(struct rte_ipv4_hdr) + sizeof(struct rte_udp_hdr) +
+                                        sizeof(struct rte_vxlan_hdr) + innerLen);
+    ip->packet_id = rte_cpu_to_be_16(_ipId++);
+    // RFC 7348: VTEP不对封装后的报文分片
+    ip->fragment_offset = rte_cpu_to_be_16(RTE_IPV4_HDR_DF_FLAG);
+    ip->time_to_live = 64;
+    ip->next_proto_id = IPPROTO_UDP;
+    ip->src_addr = srcIp;
+    ip->dst_addr = tunnel.remote;
+    ip->hdr_checksum = 0;
+    if (!_hwIpCksum)
+        ip->hdr_checksum = rte_ipv4_cksum(ip);
+
+    struct rte_udp_hdr *udp = (struct rte_udp_hdr *)(ip + 1);
+    udp->src_port = srcPort;
+    udp->dst_port = _udpPort;
+    udp->dgram_len = rte_cpu_to_be_16(sizeof(struct rte_udp_hdr) + sizeof(struct rte_vxlan_hdr) + innerLen);
+    udp->dgram_cksum = 0;
+
+    struct rte_vxlan_hdr *vxlan = (struct rte_vxlan_hdr *)(udp + 1);
+    vxlan->vx_flags = rte_cpu_to_be_32(VXLAN_FLAG_VNI);
+    vxlan->vx_vni = tunnel.vni;
+}
+
+unsigned VxlanTunnel::encapBurst(struct rte_mbuf **mbufs, unsigned nbPkts)
+{
+    VlanTable &vlan = VlanTable::getInstance();
+    unsigned kept = 0;
+    for (unsigned i = 0; i < nbPkts; i++)
+    {
+        struct rte_mbuf *mbuf = mbufs[i];
+        if (!isTunnelIf(mbuf->port))
+        {
+            mbufs[kept++] = mbuf;
+            continue;
+        }
+        Tunnel &tunnel = _tunnels[mbuf->port - VXLAN_IF_BASE];
+        const uint32_t innerLen = rte_pktmbuf_pkt_len(mbuf);
+        if (innerLen + VXLAN_ENCAP_LEN - sizeof(struct rte_ether_hdr) > _linkMtu)
+        {
+            _oversize++;
+            rte_pktmbuf_free(mbuf);
+            continue;
+        }
+        if (!RouteTable::getInstance().lookupCached(tunnel.remote, &tunnel.route))
+        {
+            _noRoute++;
+            rte_pktmbuf_free(mbuf);
+            continue;
+        }
+
+        const uint16_t srcPort = entropyPort(mbuf);
+        // 外层头部沿用内层的DSCP,出口调度和下层网络按同样的优先级处理隧道报文
+        const uint8_t tos = EgressScheduler::dscpOf(mbuf) << 2;
+        uint8_t *hdr;
+        if (RTE_MBUF_DIRECT(mbuf) && rte_mbuf_refcnt_read(mbuf) == 1 && rte_pktmbuf_headroom(mbuf) >= VXLAN_ENCAP_LEN)
+            hdr = (uint8_t *)rte_pktmbuf_prepend(mbuf, VXLAN_ENCAP_LEN);
+        else
+        {
+            // 共享的报文(如等待重传的TCP报文段)不能改写headroom,外层头部放在单独的mbuf中
+            struct rte_mbuf *head = rte_pktmbuf_alloc(_mbufPool);
+            if (head == nullptr || rte_pktmbuf_chain(head, mbuf) < 0)
+            {
+                _noMbuf++;
+                rte_pktmbuf_free(head);
+                rte_pktmbuf_free(mbuf);
+                continue;
+            }
+            hdr = (uint8_t *)rte_pktmbuf_prepend(head, VXLAN_ENCAP_LEN);
+            mbuf = head;
+        }
+        writeOuter(hdr, tunnel, LocalAddrTable::getInstance().getPrimary(tunnel.route.portId), innerLen, srcPort, tos);
+
+        // 外层是普通的IPv4/UDP报文,按外层的出接口打VLAN标签,之后不会再被封装
+        mbuf->ol_flags &= ~PKT_TX_VLAN_PKT;
+        if (_hwIpCksum)
+        {
+            mbuf->ol_flags |= PKT_TX_IPV4 | PKT_TX_IP_CKSUM;
+            mbuf->l2_len = sizeof(struct rte_ether_hdr);
+            mbuf->l3_len = sizeof(struct rte_ipv4_hdr);
+        }
+        vlan.tagTx(mbuf, tunnel.route.portId);
+        tunnel.encapPkts++;
+        struct rte_ether_hdr *eth = (struct rte_ether_hdr *)hdr;
+        if (ArpTable::lookupCached(tunnel.route.nextHop, &tunnel.arp))
+        {
+            rte_memcpy(eth->d_addr.addr_bytes, tunnel.arp.mac, RTE_ETHER_ADDR_LEN);
+            mbufs[kept++] = mbuf;
+        }
+        else
+        {
+            // 目的MAC在解析完成后由ARP模块填写
+            memset(eth->d_addr.addr_bytes, 0, RTE_ETHER_ADDR_LEN);
+            ArpProcessor::getInstance().queuePending(_mbufPool, _out, tunnel.route.nextHop, mbuf);
+        }
+    }
+    return kept;
+}
+
+void VxlanTunnel::dumpStats() const
+{
+    for (unsigned i = 0; i < _count; i++)
+    {
+        SPDLOG_INFO("VXLAN VNI {}: encap {}, decap {}", rte_be_to_cpu_32(_tunnels[i].vni) >> 8, _tunnels[i].encapPkts,
+                    _tunnels[i].decapPkts.load(std::memory_order_relaxed));
+    }
+    if (_count > 0)
+    {
+        SPDLOG_INFO("VXLAN drops: unknown VNI {}, oversize {}, no route {}, no mbuf {}",
+                    _unknownVni.load(std::memory_order_relaxed), _oversize, _noRoute, _noMbuf);
+    }
+}
@@ -10,14 +10,42 @@
 #include "Ring.hpp"
 #include "PktProcess.hpp"
 #include "UdpHost.hpp"
+#include "UdpProcessor.hpp"
 #include "Arp.hpp"
+#include "ArpProcessor.hpp"
+#include "IcmpProcessor.hpp"
+#include "Pmtu.hpp"
+#include "Route.hpp"
+#include "LocalAddr.hpp"
+#include "Ipv6.hpp"
+#include "Vlan.hpp"
+#include "Vxlan.hpp"
+#include "IgmpProcessor.hpp"
+#include "McastFilter.hpp"
+#include "Qos.hpp"
+#include "Forward.hpp"
+#include "Nat.hpp"
+#include <rte_timer.h>
 #include "TcpProcessor.hpp"
 #include "KniProcessor.hpp"
-#include "DDosDetect.hpp"
+#include "Rps.hpp"
+#include "Reorder.hpp"
+#include "Reassembly.hpp"
+#include "Datapath.hpp"
+#include <csignal>
+#include <atomic>
 
 static const struct rte_eth_conf port_conf_default = {
     .rxmode = {.max_rx_pkt_len = RTE_ETHER_MAX_LEN}};
 
+static std::atomic<bool> forceQuit{false};
+
+static void signalHandler(int signum)
+{
+    if (signum == SIGINT || signum == SIGTERM)
+        forceQuit.store(true, std::memory_order_relaxed);
+}
+
 int main(int argc, char **argv)
 {
     initLogger();
@@ -35,6 +63,7 @@ int main(int argc, char **argv)
     const int RING_SIZE = configManager.getRingSize();
     const int BURST_SIZE = configManager.getBurstSize();
     const bool ENABLE_KNI = configManager.isKniEnabled();
+    unsigned RPS_WORKERS = configManager.getRpsWorkers();
     // const uint32_t LOCAL_ADDR = configManager.getLocalAddr();
 
     // ArpTable::getInstance();
@@ -93,63 +122,246 @@ int main(int argc, char **argv)
         return -1;
     }
 
+    uint16_t linkMtu = RTE_ETHER_MTU;
+    if (rte_eth_dev_get_mtu(DPDK_PORT_ID, &linkMtu) != 0)
+    {
+        SPDLOG_WARN("Failed to get MTU of port {}, use {}", DPDK_PORT_ID, linkMtu);
+    }
+    PmtuCache::getInstance().init(linkMtu, configManager.getPmtuExpireMs());
+    // LOCAL_IP是端口的主地址,LOCAL_IPS中的VIP同样由本机应答ARP和接收报文
+    if (LocalAddrTable::getInstance().add(configManager.getLocalAddr(), (uint16_t)DPDK_PORT_ID) < 0)
+    {
+        rte_exit(EXIT_FAILURE, "Invalid LOCAL_IP %s\n", configManager.getLocalIp().c_str());
+    }
+    LocalAddrTable::getInstance().addAddrs(configManager.getLocalIps(), (uint16_t)DPDK_PORT_ID);
+
+    // 本机所在网段是直连路由,其他目的地址按配置的静态路由交给网关
+    RouteTable &routeTable = RouteTable::getInstance();
+    if (routeTable.init(configManager.getRouteMaxRules(), configManager.getRouteNumberTbl8(), rte_socket_id()) < 0)
+    {
+        rte_exit(EXIT_FAILURE, "Route table init failed\n");
+    }
+    if (routeTable.addRoute(configManager.getLocalAddr(), (uint8_t)configManager.getLocalPrefixLen(),
+                            ROUTE_ON_LINK, (uint16_t)DPDK_PORT_ID) < 0)
+    {
+        rte_exit(EXIT_FAILURE, "Failed to add connected route\n");
+    }
+    routeTable.addRoutes(configManager.getRoutes(), (uint16_t)DPDK_PORT_ID);
+    // VLAN子接口的地址和直连路由使用子接口自己的编号,只在对应的VLAN上应答ARP和接收报文
+    const auto &VLANS = configManager.getVlans();
+    if (VlanTable::getInstance().addVlans(VLANS) != VLANS.size())
+    {
+        rte_exit(EXIT_FAILURE, "Invalid VLANS\n");
+    }
+    IcmpProcessor::getInstance().initErrorGenerator(configManager.getIcmpErrorRate(), configManager.getIcmpErrorBurst(),
+                                                    configManager.getIcmpErrorSrcRate(), configManager.getIcmpErrorSrcBurst());
+
+    // 分片负载通过间接mbuf引用原数据报,间接mbuf不需要数据区
+    struct rte_mempool *indirectPool = rte_pktmbuf_pool_create("indirect pool", NUM_MBUFS, 256, 0, 0, rte_socket_id());
+    if (indirectPool == nullptr)
+    {
+        SPDLOG_ERROR("Could not create indirect mbuf pool");
+        rte_exit(EXIT_FAILURE, "Could not create indirect mbuf pool\n");
+    }
+    UdpProcessor::getInstance().setIndirectPool(indirectPool);
+
     Ring::getSingleton().setRingSize(RING_SIZE);
     struct inout_ring *ring = Ring::getSingleton().getRing();
 
-    unsigned lcore_id = rte_lcore_id();
-    lcore_id = rte_get_next_lcore(lcore_id, 1, 0);
-    struct PktProcessParams pktParams = {
-        .mbufPool = dpdkManager->getMbufPool(),
-        .ring = ring};
-
-    rte_eal_remote_launch(pkt_process, &pktParams, lcore_id);
+    // 隧道接口同样有自己的地址和直连路由,发往隧道网段的报文在主核发送前封装
+    const auto &VXLANS = configManager.getVxlans();
+    VxlanTunnel::getInstance().init(dpdkManager->getMbufPool(), ring->out, configManager.getVxlanUdpPort(), linkMtu,
+                                    configManager.getSrcMac());
+    if (VxlanTunnel::getInstance().addTunnels(VXLANS) != VXLANS.size())
+    {
+        rte_exit(EXIT_FAILURE, "Invalid VXLANS\n");
+    }
 
-    // 启动UDP服务
-    lcore_id = rte_get_next_lcore(lcore_id, 1, 0);
-    rte_eal_remote_launch(udp_server, &pktParams, lcore_id);
+    // ARP邻居状态机由主核上的定时器驱动
+    rte_timer_subsystem_init();
+    ArpTimers arpTimers;
+    arpTimers.reachableMs = configManager.getArpReachableMs();
+    arpTimers.delayMs = configManager.getArpDelayMs();
+    arpTimers.retransMs = configManager.getArpRetransMs();
+    arpTimers.retransMaxMs = configManager.getArpRetransMaxMs();
+    arpTimers.staleGcMs = configManager.getArpStaleGcMs();
+    arpTimers.ucastProbes = configManager.getArpUcastProbes();
+    arpTimers.mcastProbes = configManager.getArpMcastProbes();
+    ArpTable::setTimers(arpTimers);
+    ArpProcessor::getInstance().setPendingDepth(configManager.getArpPendingDepth());
+    // IPv4组播组和IPv6邻居发现的组播MAC都经McastFilter写入网卡,避免互相覆盖
+    McastFilter::getInstance().init((uint16_t)DPDK_PORT_ID);
+    // IPv6链路本地地址由端口MAC生成,邻居发现与ARP共用待发送报文的缓存深度
+    if (configManager.isIpv6Enabled() &&
+        Ipv6Processor::getInstance().init((uint16_t)DPDK_PORT_ID, configManager.getSrcMac(), configManager.getLocalIpv6(),
+                                          configManager.getIpv6Gateway(), linkMtu, configManager.getArpPendingDepth()) < 0)
+    {
+        rte_exit(EXIT_FAILURE, "IPv6 init failed\n");
+    }
+    if (ArpProcessor::getInstance().startTimer(dpdkManager->getMbufPool(), ring->out, configManager.getArpTimerMs()) < 0)
+    {
+        rte_exit(EXIT_FAILURE, "ARP timer init failed\n");
+    }
+    // 组播成员关系报告与ARP共用定时器周期
+    IgmpProcessor::getInstance().init(configManager.getSrcMac(), configManager.getIgmpVersion());
+    if (IgmpProcessor::getInstance().startTimer(dpdkManager->getMbufPool(), ring->out, configManager.getArpTimerMs()) < 0)
+    {
+        rte_exit(EXIT_FAILURE, "IGMP timer init failed\n");
+    }
 
-    // 启动TCP服务
-    lcore_id = rte_get_next_lcore(lcore_id, 1, 0);
-    rte_eal_remote_launch(tcp_server, &pktParams, lcore_id);
+    // 预热ARP表:先加入静态条目,再加载上次退出时保存的快照,最后发送免费ARP让对端刷新缓存
+    ArpProcessor::getInstance().addStaticEntries(configManager.getArpStaticEntries());
+    const std::string &ARP_SNAPSHOT_PATH = configManager.getArpSnapshotPath();
+    if (!ARP_SNAPSHOT_PATH.empty() && ArpTable::loadSnapshot(ARP_SNAPSHOT_PATH) < 0)
+    {
+        SPDLOG_WARN("No usable ARP snapshot at {}, start with an empty table", ARP_SNAPSHOT_PATH);
+    }
+    ArpProcessor::getInstance().announce(configManager.getGarpCount(), configManager.getGarpIntervalMs());
 
-    DDosDetect ddosDetect;
-    uint32_t i;
-    // 设置接收队列和发送队列
-    while (1)
+    // 主核负责收发包,另外还需要给UDP服务和TCP服务各留一个核
+    const unsigned RESERVED_LCORES = 3;
+    if (rte_lcore_count() < RESERVED_LCORES + 1)
+    {
+        SPDLOG_ERROR("At least {} lcores are required, current {}", RESERVED_LCORES + 1, rte_lcore_count());
+        rte_exit(EXIT_FAILURE, "Not enough lcores\n");
+    }
+    if (RPS_WORKERS > rte_lcore_count() - RESERVED_LCORES)
+    {
+        SPDLOG_ERROR("RPS_WORKERS {} exceeds available lcores, fallback to {}", RPS_WORKERS, rte_lcore_count() - RESERVED_LCORES);
+        RPS_WORKERS = rte_lcore_count() - RESERVED_LCORES;
+    }
+    // 出口调度只在主核上运行,必须在主循环启动前创建类别队列
+    if (configManager.isQosEnabled() &&
+        EgressScheduler::getInstance().init(configManager.getQosQueueSize(), configManager.getQosWrrWeights()) < 0)
     {
-        // 接收数据包
-        struct rte_mbuf *rx[BURST_SIZE];
-        unsigned num_recvd = rte_eth_rx_burst(DPDK_PORT_ID, 0, rx, BURST_SIZE);
-        if (num_recvd > BURST_SIZE)
+        rte_exit(EXIT_FAILURE, "Egress QoS init failed\n");
+    }
+    // 转发状态由各工作核独占,开关在工作核启动前确定
+    if (configManager.isIpForwardEnabled())
+        Ipv4Forwarder::getInstance().init(configManager.getSrcMac());
+    // 多个工作核并行处理时才需要出口保序,必须在工作核启动之前完成初始化
+    if (configManager.isReorderEnabled() && RPS_WORKERS > 1)
+    {
+        if (EgressReorder::getInstance().init(RPS_WORKERS, configManager.getReorderBufferSize(),
+                                              configManager.getReorderMaxHoldUs()) < 0)
         {
-            SPDLOG_ERROR("Received more packets than burst size");
-            rte_exit(EXIT_FAILURE, "Received more packets than burst size\n");
+            rte_exit(EXIT_FAILURE, "Egress reorder init failed\n");
         }
-        else if (num_recvd > 0)
+    }
+    // 每个工作核的分片表最多持有 条目数×RTE_LIBRTE_IP_FRAG_MAX_FRAG 个mbuf
+    const uint32_t REASSEMBLY_MAX_ENTRIES = configManager.getReassemblyMaxEntries();
+    if (REASSEMBLY_MAX_ENTRIES > 0)
+    {
+        if ((uint64_t)REASSEMBLY_MAX_ENTRIES * RTE_LIBRTE_IP_FRAG_MAX_FRAG * RPS_WORKERS > (uint64_t)NUM_MBUFS / 2)
         {
-            for (i = 0; i < num_recvd; i++)
-            {
-                ddosDetect.ddosDetect(rx[i]);
-            }
-            rte_ring_sp_enqueue_burst(ring->in, (void **)rx, num_recvd, nullptr);
-            SPDLOG_INFO("Received {} packets from port {}", num_recvd, DPDK_PORT_ID);
+            SPDLOG_WARN("Reassembly may hold more than half of the {} mbufs", NUM_MBUFS);
         }
-        // 发送数据包
-
-        struct rte_mbuf *tx[BURST_SIZE];
-        unsigned nb_tx = rte_ring_sc_dequeue_burst(ring->out, (void **)tx, BURST_SIZE, nullptr);
-        if (nb_tx > 0)
+        if (IpReassembly::getInstance().init(RPS_WORKERS, REASSEMBLY_MAX_ENTRIES, configManager.getReassemblyBucketEntries(),
+                                             configManager.getReassemblyTimeoutMs()) < 0)
+        {
+            rte_exit(EXIT_FAILURE, "IPv4 reassembly init failed\n");
+        }
+    }
+    // NAT会话按工作核分片,回程报文必须按外部端口分发到创建会话的工作核
+    bool RPS_SPRAY = configManager.getRpsMode() == "spray";
+    if (configManager.isNatEnabled())
+    {
+        if (!configManager.isIpForwardEnabled())
+        {
+            rte_exit(EXIT_FAILURE, "NAT_ENABLE requires IP_FORWARD\n");
+        }
+        if (RPS_SPRAY)
+        {
+            SPDLOG_WARN("RPS_MODE spray is not supported with NAT, fallback to hash");
+            RPS_SPRAY = false;
+        }
+        NatParams natParams;
+        natParams.externalIps = configManager.getNatExternalIps();
+        natParams.internalNets = configManager.getNatInternalNets();
+        natParams.portMin = configManager.getNatPortMin();
+        natParams.portMax = configManager.getNatPortMax();
+        natParams.maxSessions = configManager.getNatMaxSessions();
+        natParams.udpTimeoutMs = configManager.getNatUdpTimeoutMs();
+        natParams.tcpEstTimeoutMs = configManager.getNatTcpEstTimeoutMs();
+        natParams.tcpTransTimeoutMs = configManager.getNatTcpTransTimeoutMs();
+        if (Nat44::getInstance().init(RPS_WORKERS, natParams) < 0)
         {
-            SPDLOG_INFO("Send packets with port {} ", DPDK_PORT_ID);
-            rte_eth_tx_burst(DPDK_PORT_ID, 0, tx, nb_tx);
-            unsigned i = 0;
-            for (i = 0; i < nb_tx; i++)
-            {
-                SPDLOG_INFO("t[{}] pkt_len: {}, data_len: {}", i, tx[i]->pkt_len, tx[i]->data_len);
-                rte_pktmbuf_free(tx[i]);
-            }
+            rte_exit(EXIT_FAILURE, "NAT init failed\n");
         }
     }
+    if (RPS_SPRAY && !EgressReorder::getInstance().isEnabled())
+    {
+        SPDLOG_WARN("RPS_MODE spray without REORDER_ENABLE may reorder packets within a flow");
+    }
+    if (RpsDispatcher::getInstance().init(RPS_WORKERS, RPS_SPRAY) < 0)
+    {
+        rte_exit(EXIT_FAILURE, "RPS init failed\n");
+    }
+    // 接收队列中存放的类型在创建socket之前确定
+    if (configManager.isUdpRxZeroCopy() && UdpServerManager::getInstance().enableRxZeroCopy() < 0)
+    {
+        rte_exit(EXIT_FAILURE, "UDP zero-copy receive init failed\n");
+    }
+    // 工作核不加锁查找UDP socket,关闭socket时等待所有工作核的宽限期
+    if (UdpServerManager::getInstance().initRcu(RPS_WORKERS) < 0)
+    {
+        rte_exit(EXIT_FAILURE, "UDP demux RCU init failed\n");
+    }
+
+    unsigned lcore_id = rte_lcore_id();
+    struct PktProcessParams pktParams[RING_MAX_WORKERS];
+    unsigned workerLcores[RING_MAX_WORKERS];
+    for (unsigned worker = 0; worker < RPS_WORKERS; worker++)
+    {
+        pktParams[worker] = {
+            .mbufPool = dpdkManager->getMbufPool(),
+            .ring = Ring::getSingleton().getRing(worker),
+            .workerId = worker,
+            .quit = &forceQuit};
+        lcore_id = rte_get_next_lcore(lcore_id, 1, 0);
+        workerLcores[worker] = lcore_id;
+        rte_eal_remote_launch(pkt_process, &pktParams[worker], lcore_id);
+    }
+
+    // 启动UDP服务
+    lcore_id = rte_get_next_lcore(lcore_id, 1, 0);
+    rte_eal_remote_launch(udp_server, &pktParams[0], lcore_id);
+
+    // 启动TCP服务
+    lcore_id = rte_get_next_lcore(lcore_id, 1, 0);
+    rte_eal_remote_launch(tcp_server, &pktParams[0], lcore_id);
+
+    // burst大小和功能开关在启动时确定,之后主核只运行对应的特化循环
+    const unsigned DATAPATH_BURST = datapathBurstSize(BURST_SIZE);
+    if ((int)DATAPATH_BURST != BURST_SIZE)
+    {
+        SPDLOG_WARN("BURST_SIZE {} is not specialized, use {} instead", BURST_SIZE, DATAPATH_BURST);
+    }
+    MainLoopFn mainLoop = selectMainLoop(DATAPATH_BURST, configManager.isDdosDetectEnabled(),
+                                         VlanTable::getInstance().isEnabled());
+    if (mainLoop == nullptr)
+    {
+        rte_exit(EXIT_FAILURE, "No datapath for burst size %u\n", DATAPATH_BURST);
+    }
+    struct MainLoopParams mainParams = {
+        .portId = (uint16_t)DPDK_PORT_ID,
+        .ring = ring,
+        .statsCycles = configManager.getRpsStatsIntervalSec() * rte_get_timer_hz(),
+        .timerCycles = configManager.getTimerResolutionCycles(),
+        .quit = &forceQuit};
+    signal(SIGINT, signalHandler);
+    signal(SIGTERM, signalHandler);
+    mainLoop(&mainParams);
 
-    rte_eal_wait_lcore(lcore_id);
+    // 工作核看到同一个退出标志后返回,等它们都退出后才能保存快照和析构各模块的单例
+    SPDLOG_INFO("Signal received, shutting down");
+    for (unsigned worker = 0; worker < RPS_WORKERS; worker++)
+    {
+        rte_eal_wait_lcore(workerLcores[worker]);
+    }
+    if (!ARP_SNAPSHOT_PATH.empty())
+    {
+        ArpTable::saveSnapshot(ARP_SNAPSHOT_PATH);
+    }
+    return 0;
 }
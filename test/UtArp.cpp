@@ -1,6 +1,7 @@
 #include <gtest/gtest.h>
 #include "Arp.hpp"
 #include <thread>
+#include <cstdio>
 
 /**
  * @brief  ARP 测试的测试类
@@ -116,6 +117,203 @@ TEST_F(ArpTest, ArpTableThreadSafety)
     t2.join();
 }
 
+/**
+ * @brief 测试 ArpTable 的 lookup 拷贝MAC地址以及重复插入时更新MAC地址
+ */
+TEST_F(ArpTest, ArpTableLookupUpdate)
+{
+    ArpHeader header = {
+        .hardware_type = 1,
+        .sender_hwaddr = {0x00, 0x01, 0x02, 0x03, 0x04, 0x05},
+        .sender_protoaddr = 0xC0A80001,
+    };
+    uint8_t mac[RTE_ETHER_ADDR_LEN] = {0};
+
+    EXPECT_FALSE(ArpTable::lookup(header.sender_protoaddr, mac));
+    EXPECT_EQ(ArpTable::pushBack(header), 0);
+    EXPECT_TRUE(ArpTable::lookup(header.sender_protoaddr, mac));
+    EXPECT_TRUE(std::equal(mac, mac + RTE_ETHER_ADDR_LEN, header.sender_hwaddr));
+
+    // 同一个IP再次插入只更新MAC地址,不新增条目
+    header.sender_hwaddr[5] = 0x55;
+    EXPECT_EQ(ArpTable::pushBack(header), 0);
+    EXPECT_EQ(ArpTable::size(), 1u);
+    EXPECT_TRUE(ArpTable::lookup(header.sender_protoaddr, mac));
+    EXPECT_EQ(mac[5], 0x55);
+}
+
+/**
+ * @brief 测试大量条目插入、删除一半之后剩余条目依然可以查到,以及批量查找的命中掩码
+ */
+TEST_F(ArpTest, ArpTableBulkAfterRemove)
+{
+    const uint32_t count = 2000;
+    auto makeHeader = [](uint32_t i)
+    {
+        ArpHeader header = {
+            .hardware_type = 1,
+            .sender_hwaddr = {0x02, 0x00, 0x00, 0x00, (uint8_t)(i >> 8), (uint8_t)i},
+            .sender_protoaddr = 0x0A000000 + i,
+        };
+        return header;
+    };
+
+    for (uint32_t i = 0; i < count; i++)
+        ASSERT_EQ(ArpTable::pushBack(makeHeader(i)), 0);
+    for (uint32_t i = 0; i < count; i += 2)
+        ASSERT_EQ(ArpTable::remove(makeHeader(i)), 0);
+    EXPECT_EQ(ArpTable::size(), count / 2);
+
+    uint32_t dips[ARP_BULK_MAX];
+    uint8_t macs[ARP_BULK_MAX][RTE_ETHER_ADDR_LEN];
+    for (uint32_t base = 0; base + ARP_BULK_MAX <= count; base += ARP_BULK_MAX)
+    {
+        for (uint32_t i = 0; i < ARP_BULK_MAX; i++)
+            dips[i] = 0x0A000000 + base + i;
+        uint64_t hitMask = ArpTable::lookupBulk(dips, ARP_BULK_MAX, macs);
+        // 偶数下标已删除,奇数下标应全部命中
+        EXPECT_EQ(hitMask, 0xAAAAAAAAAAAAAAAAULL);
+        for (uint32_t i = 1; i < ARP_BULK_MAX; i += 2)
+            EXPECT_EQ(macs[i][5], (uint8_t)(base + i));
+    }
+}
+
+/**
+ * @brief 测试邻居状态机: REACHABLE -> STALE -> DELAY -> PROBE -> 删除,以及INCOMPLETE条目的解析
+ */
+TEST_F(ArpTest, ArpTableStateMachine)
+{
+    ArpTimers timers;
+    timers.reachableMs = 100;
+    timers.delayMs = 50;
+    timers.retransMs = 10;
+    timers.staleGcMs = 1000;
+    timers.ucastProbes = 2;
+    timers.mcastProbes = 2;
+    ArpTable::setTimers(timers);
+
+    ArpProbe probes[4];
+    const uint32_t ip = 0xC0A80001;
+    ArpHeader header = {
+        .hardware_type = 1,
+        .sender_hwaddr = {0x00, 0x01, 0x02, 0x03, 0x04, 0x05},
+        .sender_protoaddr = ip,
+    };
+    uint8_t mac[RTE_ETHER_ADDR_LEN];
+
+    EXPECT_EQ(ArpTable::tick(0, probes, 4), 0u);
+    ASSERT_EQ(ArpTable::pushBack(header), 0);
+    EXPECT_EQ(ArpTable::getState(ip), (int)ARP_STATE::ARP_STATE_REACHABLE);
+
+    ArpTable::tick(100, probes, 4);
+    EXPECT_EQ(ArpTable::getState(ip), (int)ARP_STATE::ARP_STATE_STALE);
+
+    // 过期条目仍然可以使用,使用后进入DELAY
+    EXPECT_TRUE(ArpTable::lookup(ip, mac));
+    ArpTable::tick(101, probes, 4);
+    EXPECT_EQ(ArpTable::getState(ip), (int)ARP_STATE::ARP_STATE_DELAY);
+
+    // DELAY超时后向缓存的MAC地址发送单播确认
+    ASSERT_EQ(ArpTable::tick(151, probes, 4), 1u);
+    EXPECT_TRUE(probes[0].unicast);
+    EXPECT_EQ(probes[0].ip, ip);
+    EXPECT_TRUE(std::equal(probes[0].mac, probes[0].mac + RTE_ETHER_ADDR_LEN, header.sender_hwaddr));
+    EXPECT_EQ(ArpTable::getState(ip), (int)ARP_STATE::ARP_STATE_PROBE);
+    EXPECT_EQ(ArpTable::tick(161, probes, 4), 1u);
+
+    // 单播确认次数用完仍没有应答,条目被删除
+    EXPECT_EQ(ArpTable::tick(171, probes, 4), 0u);
+    EXPECT_EQ(ArpTable::getState(ip), -1);
+
+    // 解析新地址: 只有第一次需要调用者发出请求,INCOMPLETE条目查找不到
+    EXPECT_EQ(ArpTable::resolve(ip), 0);
+    EXPECT_EQ(ArpTable::resolve(ip), 1);
+    EXPECT_FALSE(ArpTable::lookup(ip, mac));
+    ASSERT_EQ(ArpTable::tick(181, probes, 4), 1u);
+    EXPECT_FALSE(probes[0].unicast);
+    // 广播解析按指数退避,第二次重传间隔加倍
+    EXPECT_EQ(ArpTable::tick(191, probes, 4), 0u);
+    EXPECT_EQ(ArpTable::getState(ip), (int)ARP_STATE::ARP_STATE_INCOMPLETE);
+    ASSERT_EQ(ArpTable::pushBack(header), 0);
+    EXPECT_TRUE(ArpTable::lookup(ip, mac));
+    EXPECT_EQ(ArpTable::getState(ip), (int)ARP_STATE::ARP_STATE_REACHABLE);
+
+    ArpTable::setTimers(ArpTimers());
+}
+
+/**
+ * @brief 测试 ArpCacheEntry: 新增其他条目不影响缓存,MAC地址变化和删除条目会使缓存失效
+ */
+TEST_F(ArpTest, ArpTableCachedLookup)
+{
+    ArpHeader header = {
+        .hardware_type = 1,
+        .sender_hwaddr = {0x00, 0x01, 0x02, 0x03, 0x04, 0x05},
+        .sender_protoaddr = 0xC0A80001,
+    };
+    ArpHeader other = header;
+    other.sender_protoaddr = 0xC0A80002;
+    ArpCacheEntry cache;
+
+    EXPECT_FALSE(ArpTable::lookupCached(header.sender_protoaddr, &cache));
+    ASSERT_EQ(ArpTable::pushBack(header), 0);
+    ASSERT_TRUE(ArpTable::lookupCached(header.sender_protoaddr, &cache));
+    EXPECT_EQ(cache.mac[5], 0x05);
+    uint32_t generation = cache.generation;
+
+    ASSERT_EQ(ArpTable::pushBack(other), 0);
+    ASSERT_TRUE(ArpTable::lookupCached(header.sender_protoaddr, &cache));
+    EXPECT_EQ(cache.generation, generation);
+
+    header.sender_hwaddr[5] = 0x55;
+    ASSERT_EQ(ArpTable::pushBack(header), 0);
+    ASSERT_TRUE(ArpTable::lookupCached(header.sender_protoaddr, &cache));
+    EXPECT_NE(cache.generation, generation);
+    EXPECT_EQ(cache.mac[5], 0x55);
+
+    ASSERT_EQ(ArpTable::remove(header), 0);
+    EXPECT_FALSE(ArpTable::lookupCached(header.sender_protoaddr, &cache));
+}
+
+/**
+ * @brief 测试静态条目不被学习覆盖也不老化,以及快照只保存学习到的条目并以STALE状态恢复
+ */
+TEST_F(ArpTest, ArpTableStaticAndSnapshot)
+{
+    ArpHeader fixed = {
+        .hardware_type = 1,
+        .sender_hwaddr = {0x00, 0x01, 0x02, 0x03, 0x04, 0x05},
+        .sender_protoaddr = 0xC0A80001,
+    };
+    ArpHeader learned = fixed;
+    learned.sender_protoaddr = 0xC0A80002;
+    uint8_t mac[RTE_ETHER_ADDR_LEN];
+    ArpProbe probes[4];
+
+    // 静态条目不会被学习到的地址覆盖,也不会老化
+    ASSERT_EQ(ArpTable::addStatic(fixed), 0);
+    ArpHeader spoofed = fixed;
+    spoofed.sender_hwaddr[5] = 0x55;
+    EXPECT_EQ(ArpTable::pushBack(spoofed), 0);
+    ASSERT_TRUE(ArpTable::lookup(fixed.sender_protoaddr, mac));
+    EXPECT_EQ(mac[5], 0x05);
+    ArpTable::tick(1000000, probes, 4);
+    EXPECT_EQ(ArpTable::getState(fixed.sender_protoaddr), (int)ARP_STATE::ARP_STATE_PERMANENT);
+
+    // 快照只保存学习到的条目,重新加载后处于STALE状态
+    ASSERT_EQ(ArpTable::pushBack(learned), 0);
+    const std::string path = testing::TempDir() + "arp.snapshot";
+    ASSERT_EQ(ArpTable::saveSnapshot(path), 1);
+    ArpTable::clear();
+    ASSERT_EQ(ArpTable::loadSnapshot(path), 1);
+    EXPECT_EQ(ArpTable::getState(learned.sender_protoaddr), (int)ARP_STATE::ARP_STATE_STALE);
+    EXPECT_EQ(ArpTable::getState(fixed.sender_protoaddr), -1);
+    ASSERT_TRUE(ArpTable::lookup(learned.sender_protoaddr, mac));
+    EXPECT_EQ(mac[5], 0x05);
+    std::remove(path.c_str());
+    EXPECT_EQ(ArpTable::loadSnapshot(path), -1);
+}
+
 // 主函数，用于运行测试
 int main(int argc, char **argv)
 {
@@ -0,0 +1,183 @@
+#include <gtest/gtest.h>
+#include "Ipv4Validate.hpp"
+#include <rte_eal.h>
+#include <arpa/inet.h>
+#include <cstring>
+
+static struct rte_mempool *g_pool = nullptr; ///< 构造报文使用的内存池
+
+/**
+ * @brief IPv4入站校验的测试类
+ */
+class Ipv4ValidateTest : public ::testing::Test
+{
+protected:
+    /**
+     * @brief 构造一个UDP报文,校验和正确
+     * @param optLen IP选项长度,必须是4的整数倍
+     * @param payload UDP负载长度
+     * @param padding IP报文之后的以太网填充长度
+     */
+    static struct rte_mbuf *udpPacket(uint8_t optLen = 0, uint16_t payload = 8, uint16_t padding = 0)
+    {
+        const uint16_t ipLen = sizeof(struct rte_ipv4_hdr) + optLen + sizeof(struct rte_udp_hdr) + payload;
+        struct rte_mbuf *mbuf = rte_pktmbuf_alloc(g_pool);
+        if (mbuf == nullptr)
+            return nullptr;
+        uint8_t *data = (uint8_t *)rte_pktmbuf_append(mbuf, sizeof(struct rte_ether_hdr) + ipLen + padding);
+        memset(data, 0, sizeof(struct rte_ether_hdr) + ipLen + padding);
+        struct rte_ether_hdr *eth = (struct rte_ether_hdr *)data;
+        eth->ether_type = rte_cpu_to_be_16(RTE_ETHER_TYPE_IPV4);
+        struct rte_ipv4_hdr *iphdr = (struct rte_ipv4_hdr *)(eth + 1);
+        iphdr->version_ihl = (4 << 4) | ((sizeof(struct rte_ipv4_hdr) + optLen) / RTE_IPV4_IHL_MULTIPLIER);
+        iphdr->total_length = rte_cpu_to_be_16(ipLen);
+        iphdr->time_to_live = 64;
+        iphdr->next_proto_id = IPPROTO_UDP;
+        iphdr->src_addr = rte_cpu_to_be_32(RTE_IPV4(192, 168, 1, 2));
+        iphdr->dst_addr = rte_cpu_to_be_32(RTE_IPV4(192, 168, 1, 1));
+        // 选项全部填为NOP
+        memset(iphdr + 1, 1, optLen);
+        struct rte_udp_hdr *udphdr = (struct rte_udp_hdr *)((uint8_t *)iphdr + sizeof(struct rte_ipv4_hdr) + optLen);
+        udphdr->src_port = rte_cpu_to_be_16(5000);
+        udphdr->dst_port = rte_cpu_to_be_16(8888);
+        udphdr->dgram_len = rte_cpu_to_be_16(sizeof(struct rte_udp_hdr) + payload);
+        refreshChecksum(mbuf);
+        return mbuf;
+    }
+
+    static struct rte_ipv4_hdr *ipHdr(struct rte_mbuf *mbuf)
+    {
+        return rte_pktmbuf_mtod_offset(mbuf, struct rte_ipv4_hdr *, sizeof(struct rte_ether_hdr));
+    }
+
+    /**
+     * @brief 修改首部字段后重新计算首部校验和,覆盖IP选项
+     */
+    static void refreshChecksum(struct rte_mbuf *mbuf)
+    {
+        struct rte_ipv4_hdr *iphdr = ipHdr(mbuf);
+        iphdr->hdr_checksum = 0;
+        iphdr->hdr_checksum = (uint16_t)~rte_raw_cksum(iphdr, (iphdr->version_ihl & RTE_IPV4_HDR_IHL_MASK) * RTE_IPV4_IHL_MULTIPLIER);
+    }
+
+    /**
+     * @brief 把单个报文作为一批校验,非法报文已被释放
+     */
+    template <bool OFFLOAD = false>
+    static bool valid(struct rte_mbuf *mbuf) { return Ipv4Validator::getInstance().validateBurst<OFFLOAD>(0, &mbuf, 1) == 1; }
+};
+
+/**
+ * @brief 测试合法报文通过校验,带选项的报文按IHL定位传输层头部,末尾的以太网填充被裁掉
+ */
+TEST_F(Ipv4ValidateTest, ValidPacketWithOptionsAndPadding)
+{
+    struct rte_mbuf *mbuf = udpPacket(8, 8, 6);
+    const uint32_t ipLen = rte_be_to_cpu_16(ipHdr(mbuf)->total_length);
+    ASSERT_TRUE(valid(mbuf));
+    EXPECT_EQ(rte_pktmbuf_pkt_len(mbuf), sizeof(struct rte_ether_hdr) + ipLen);
+    rte_pktmbuf_free(mbuf);
+}
+
+/**
+ * @brief 测试各种首部错误都被丢弃
+ */
+TEST_F(Ipv4ValidateTest, MalformedHeadersDropped)
+{
+    struct rte_mbuf *mbuf = udpPacket();
+    ipHdr(mbuf)->version_ihl = (6 << 4) | 5;
+    refreshChecksum(mbuf);
+    EXPECT_FALSE(valid(mbuf));
+
+    mbuf = udpPacket();
+    ipHdr(mbuf)->version_ihl = (4 << 4) | 4;
+    refreshChecksum(mbuf);
+    EXPECT_FALSE(valid(mbuf));
+
+    mbuf = udpPacket();
+    ipHdr(mbuf)->time_to_live = 0;
+    refreshChecksum(mbuf);
+    EXPECT_FALSE(valid(mbuf));
+
+    mbuf = udpPacket();
+    ipHdr(mbuf)->src_addr = rte_cpu_to_be_32(RTE_IPV4(224, 0, 0, 1));
+    refreshChecksum(mbuf);
+    EXPECT_FALSE(valid(mbuf));
+
+    mbuf = udpPacket();
+    ipHdr(mbuf)->hdr_checksum ^= 0x0101;
+    EXPECT_FALSE(valid(mbuf));
+
+    // 总长度超过报文长度
+    mbuf = udpPacket();
+    ipHdr(mbuf)->total_length = rte_cpu_to_be_16(rte_be_to_cpu_16(ipHdr(mbuf)->total_length) + 1);
+    refreshChecksum(mbuf);
+    EXPECT_FALSE(valid(mbuf));
+
+    // UDP长度超过IP负载
+    mbuf = udpPacket();
+    struct rte_udp_hdr *udphdr = (struct rte_udp_hdr *)(ipHdr(mbuf) + 1);
+    udphdr->dgram_len = rte_cpu_to_be_16(rte_be_to_cpu_16(udphdr->dgram_len) + 1);
+    EXPECT_FALSE(valid(mbuf));
+}
+
+/**
+ * @brief 测试整批校验把合法报文按原顺序压缩到数组前部,非IPv4报文原样保留
+ */
+TEST_F(Ipv4ValidateTest, BurstCompaction)
+{
+    struct rte_mbuf *mbufs[4];
+    mbufs[0] = udpPacket();
+    mbufs[1] = udpPacket();
+    ipHdr(mbufs[1])->hdr_checksum ^= 0x0101;
+    mbufs[2] = rte_pktmbuf_alloc(g_pool);
+    struct rte_ether_hdr *eth = (struct rte_ether_hdr *)rte_pktmbuf_append(mbufs[2], 60);
+    memset(eth, 0, 60);
+    eth->ether_type = rte_cpu_to_be_16(RTE_ETHER_TYPE_ARP);
+    mbufs[3] = udpPacket(4);
+    struct rte_mbuf *expected[3] = {mbufs[0], mbufs[2], mbufs[3]};
+
+    ASSERT_EQ(Ipv4Validator::getInstance().validateBurst<false>(0, mbufs, 4), 3u);
+    for (unsigned i = 0; i < 3; i++)
+    {
+        EXPECT_EQ(mbufs[i], expected[i]);
+        rte_pktmbuf_free(mbufs[i]);
+    }
+}
+
+/**
+ * @brief 测试网卡给出校验结果时以网卡为准,没有结果时仍用软件计算
+ */
+TEST_F(Ipv4ValidateTest, HardwareChecksumFlags)
+{
+    struct rte_mbuf *mbuf = udpPacket();
+    ipHdr(mbuf)->hdr_checksum ^= 0x0101;
+    mbuf->ol_flags = PKT_RX_IP_CKSUM_GOOD;
+    ASSERT_TRUE(valid<true>(mbuf));
+    rte_pktmbuf_free(mbuf);
+
+    mbuf = udpPacket();
+    mbuf->ol_flags = PKT_RX_IP_CKSUM_BAD;
+    EXPECT_FALSE(valid<true>(mbuf));
+
+    mbuf = udpPacket();
+    ipHdr(mbuf)->hdr_checksum ^= 0x0101;
+    mbuf->ol_flags = PKT_RX_IP_CKSUM_UNKNOWN;
+    EXPECT_FALSE(valid<true>(mbuf));
+}
+
+// 主函数,报文需要EAL的内存管理,不使用大页和网卡
+int main(int argc, char **argv)
+{
+    testing::InitGoogleTest(&argc, argv);
+    char *ealArgs[] = {argv[0], (char *)"--no-huge", (char *)"--no-pci", (char *)"-l", (char *)"0",
+                       (char *)"--log-level=error"};
+    if (rte_eal_init(sizeof(ealArgs) / sizeof(ealArgs[0]), ealArgs) < 0)
+        return 1;
+    g_pool = rte_pktmbuf_pool_create("ut ipv4 pool", 255, 0, 0, RTE_MBUF_DEFAULT_BUF_SIZE, SOCKET_ID_ANY);
+    if (g_pool == nullptr)
+        return 1;
+    int ret = RUN_ALL_TESTS();
+    rte_eal_cleanup();
+    return ret;
+}
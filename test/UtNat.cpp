@@ -0,0 +1,281 @@
+#include <gtest/gtest.h>
+#include "Nat.hpp"
+#include <rte_eal.h>
+#include <rte_cycles.h>
+#include <rte_tcp.h>
+#include <arpa/inet.h>
+#include <cstring>
+#include <set>
+
+#define UT_NAT_PORT_MIN 20000 ///< 测试使用的外部端口下限
+#define UT_NAT_PORT_MAX 20063 ///< 测试使用的外部端口上限,两个工作核每种协议各32个端口
+#define UT_NAT_WORKERS 2      ///< 测试使用的工作核数量
+#define UT_NAT_UDP_MS 10000   ///< 测试使用的UDP会话超时(毫秒)
+
+static struct rte_mempool *g_pool = nullptr; ///< 构造报文使用的内存池
+static uint64_t g_now = 0;                   ///< 模拟的TSC时间,只增不减,所有测试共用
+
+/**
+ * @brief 把点分十进制字符串转成网络字节序地址
+ */
+static uint32_t ip(const char *str)
+{
+    struct in_addr addr;
+    inet_pton(AF_INET, str, &addr);
+    return addr.s_addr;
+}
+
+/**
+ * @brief NAT44会话表测试的测试类
+ *
+ * NAT是单例,只在main中初始化一次,各测试使用不同的内部地址或工作核互不干扰。
+ */
+class NatTest : public ::testing::Test
+{
+protected:
+    /**
+     * @brief 构造一个不带负载的UDP报文或TCP SYN报文,校验和都正确
+     * @param port 主机字节序
+     */
+    static struct rte_mbuf *packet(uint8_t proto, uint32_t sip, uint16_t sport, uint32_t dip, uint16_t dport)
+    {
+        const uint16_t l4Len = proto == IPPROTO_TCP ? sizeof(struct rte_tcp_hdr) : sizeof(struct rte_udp_hdr);
+        const uint16_t length = sizeof(struct rte_ether_hdr) + sizeof(struct rte_ipv4_hdr) + l4Len;
+        struct rte_mbuf *mbuf = rte_pktmbuf_alloc(g_pool);
+        if (mbuf == nullptr)
+            return nullptr;
+        uint8_t *data = (uint8_t *)rte_pktmbuf_append(mbuf, length);
+        memset(data, 0, length);
+        struct rte_ether_hdr *eth = (struct rte_ether_hdr *)data;
+        eth->ether_type = rte_cpu_to_be_16(RTE_ETHER_TYPE_IPV4);
+        struct rte_ipv4_hdr *iphdr = (struct rte_ipv4_hdr *)(eth + 1);
+        iphdr->version_ihl = RTE_IPV4_VHL_DEF;
+        iphdr->total_length = rte_cpu_to_be_16(sizeof(struct rte_ipv4_hdr) + l4Len);
+        iphdr->time_to_live = 64;
+        iphdr->next_proto_id = proto;
+        iphdr->src_addr = sip;
+        iphdr->dst_addr = dip;
+        iphdr->hdr_checksum = rte_ipv4_cksum(iphdr);
+        if (proto == IPPROTO_TCP)
+        {
+            struct rte_tcp_hdr *tcphdr = (struct rte_tcp_hdr *)(iphdr + 1);
+            tcphdr->src_port = rte_cpu_to_be_16(sport);
+            tcphdr->dst_port = rte_cpu_to_be_16(dport);
+            tcphdr->data_off = (sizeof(struct rte_tcp_hdr) / 4) << 4;
+            tcphdr->tcp_flags = RTE_TCP_SYN_FLAG;
+            tcphdr->rx_win = rte_cpu_to_be_16(65535);
+            tcphdr->cksum = rte_ipv4_udptcp_cksum(iphdr, tcphdr);
+        }
+        else
+        {
+            struct rte_udp_hdr *udphdr = (struct rte_udp_hdr *)(iphdr + 1);
+            udphdr->src_port = rte_cpu_to_be_16(sport);
+            udphdr->dst_port = rte_cpu_to_be_16(dport);
+            udphdr->dgram_len = rte_cpu_to_be_16(l4Len);
+            udphdr->dgram_cksum = rte_ipv4_udptcp_cksum(iphdr, udphdr);
+        }
+        return mbuf;
+    }
+
+    static struct rte_ipv4_hdr *ipHdr(struct rte_mbuf *mbuf)
+    {
+        return rte_pktmbuf_mtod_offset(mbuf, struct rte_ipv4_hdr *, sizeof(struct rte_ether_hdr));
+    }
+
+    /**
+     * @brief TCP和UDP头部的前4个字节都是源端口和目的端口
+     */
+    static struct rte_udp_hdr *portHdr(struct rte_mbuf *mbuf) { return (struct rte_udp_hdr *)(ipHdr(mbuf) + 1); }
+
+    /**
+     * @brief 改写后的IP和UDP校验和是否仍然正确
+     */
+    static bool checksumValid(struct rte_mbuf *mbuf)
+    {
+        struct rte_ipv4_hdr *iphdr = ipHdr(mbuf);
+        struct rte_udp_hdr *udphdr = portHdr(mbuf);
+        const uint16_t cksum = udphdr->dgram_cksum;
+        udphdr->dgram_cksum = 0;
+        const bool l4Valid = rte_ipv4_udptcp_cksum(iphdr, udphdr) == cksum;
+        udphdr->dgram_cksum = cksum;
+        return rte_ipv4_cksum(iphdr) == 0 && l4Valid;
+    }
+
+    /**
+     * @brief 推进模拟时间并让工作核记录当前时间
+     */
+    static void advance(unsigned workerId, uint64_t ms)
+    {
+        g_now += rte_get_tsc_hz() / 1000 * ms;
+        Nat44::getInstance().maintain(workerId, g_now);
+    }
+
+    /**
+     * @brief 出方向翻译一个UDP报文,返回分配的外部端口(主机字节序),失败返回0
+     */
+    static uint16_t translateOut(unsigned workerId, uint32_t sip, uint16_t sport)
+    {
+        struct rte_mbuf *mbuf = packet(IPPROTO_UDP, sip, sport, ip("198.51.100.1"), 53);
+        uint16_t port = 0;
+        if (Nat44::getInstance().translateOutbound(workerId, mbuf) == NAT_TRANSLATED)
+        {
+            EXPECT_EQ(ipHdr(mbuf)->src_addr, ip("203.0.113.1"));
+            EXPECT_TRUE(checksumValid(mbuf));
+            port = rte_be_to_cpu_16(portHdr(mbuf)->src_port);
+        }
+        rte_pktmbuf_free(mbuf);
+        return port;
+    }
+
+    /**
+     * @brief 入方向翻译外部端口上的回程UDP报文,命中会话时返回内部地址,否则返回0
+     */
+    static uint32_t translateIn(unsigned workerId, uint16_t port, uint16_t *innerPort = nullptr)
+    {
+        struct rte_mbuf *mbuf = packet(IPPROTO_UDP, ip("198.51.100.1"), 53, ip("203.0.113.1"), port);
+        uint32_t addr = 0;
+        if (Nat44::getInstance().translateInbound(workerId, mbuf) == NAT_TRANSLATED)
+        {
+            EXPECT_TRUE(checksumValid(mbuf));
+            addr = ipHdr(mbuf)->dst_addr;
+            if (innerPort != nullptr)
+                *innerPort = rte_be_to_cpu_16(portHdr(mbuf)->dst_port);
+        }
+        rte_pktmbuf_free(mbuf);
+        return addr;
+    }
+};
+
+/**
+ * @brief 测试每个工作核只分配自己拥有的外部端口,回程报文按端口分发回建立会话的工作核
+ */
+TEST_F(NatTest, PortOwnershipAndSteering)
+{
+    for (unsigned w = 0; w < UT_NAT_WORKERS; w++)
+    {
+        advance(w, 1);
+        for (unsigned i = 0; i < 4; i++)
+        {
+            const uint32_t inner = rte_cpu_to_be_32(RTE_IPV4(10, 1, w, i + 1));
+            const uint16_t port = translateOut(w, inner, 5000 + i);
+            ASSERT_NE(port, 0);
+            EXPECT_GE(port, UT_NAT_PORT_MIN);
+            EXPECT_LE(port, UT_NAT_PORT_MAX);
+            EXPECT_EQ((port - UT_NAT_PORT_MIN) % UT_NAT_WORKERS, w);
+
+            struct rte_mbuf *reply = packet(IPPROTO_UDP, ip("198.51.100.1"), 53, ip("203.0.113.1"), port);
+            EXPECT_EQ(Nat44::getInstance().steerWorker(reply), (int)w);
+            rte_pktmbuf_free(reply);
+            uint16_t innerPort = 0;
+            EXPECT_EQ(translateIn(w, port, &innerPort), inner);
+            EXPECT_EQ(innerPort, 5000 + i);
+        }
+    }
+}
+
+/**
+ * @brief 测试分片和NAT端口范围以外的回程报文不指定工作核
+ */
+TEST_F(NatTest, SteerOnlyUnfragmentedNatPorts)
+{
+    struct rte_mbuf *mbuf = packet(IPPROTO_UDP, ip("198.51.100.1"), 53, ip("203.0.113.1"), UT_NAT_PORT_MIN);
+    EXPECT_EQ(Nat44::getInstance().steerWorker(mbuf), 0);
+    ipHdr(mbuf)->fragment_offset = rte_cpu_to_be_16(RTE_IPV4_HDR_MF_FLAG);
+    EXPECT_EQ(Nat44::getInstance().steerWorker(mbuf), -1);
+    ipHdr(mbuf)->fragment_offset = 0;
+    portHdr(mbuf)->dst_port = rte_cpu_to_be_16(UT_NAT_PORT_MAX + 1);
+    EXPECT_EQ(Nat44::getInstance().steerWorker(mbuf), -1);
+    rte_pktmbuf_free(mbuf);
+}
+
+/**
+ * @brief 测试端口池耗尽后新的流被丢弃,TCP和UDP的端口池互相独立
+ */
+TEST_F(NatTest, PortPoolExhaustion)
+{
+    const unsigned w = 1;
+    const unsigned owned = (UT_NAT_PORT_MAX - UT_NAT_PORT_MIN + 1) / UT_NAT_WORKERS;
+    advance(w, 1);
+    std::set<uint16_t> ports;
+    for (unsigned i = 0; i < owned; i++)
+    {
+        struct rte_mbuf *mbuf = packet(IPPROTO_TCP, rte_cpu_to_be_32(RTE_IPV4(10, 2, 0, i + 1)), 6000, ip("198.51.100.2"), 80);
+        ASSERT_EQ(Nat44::getInstance().translateOutbound(w, mbuf), NAT_TRANSLATED);
+        ports.insert(rte_be_to_cpu_16(portHdr(mbuf)->src_port));
+        rte_pktmbuf_free(mbuf);
+    }
+    EXPECT_EQ(ports.size(), owned);
+    struct rte_mbuf *mbuf = packet(IPPROTO_TCP, ip("10.2.1.1"), 6000, ip("198.51.100.2"), 80);
+    EXPECT_EQ(Nat44::getInstance().translateOutbound(w, mbuf), NAT_DROP);
+    rte_pktmbuf_free(mbuf);
+    // UDP端口池不受影响
+    EXPECT_NE(translateOut(w, ip("10.2.1.1"), 6000), 0);
+}
+
+/**
+ * @brief 测试会话超时删除采用向后搬移,删除一部分会话后其余会话仍能从两个方向查到,且刚释放的端口不会立即复用
+ */
+TEST_F(NatTest, ExpireKeepsOtherSessions)
+{
+    const unsigned w = 0;
+    const unsigned nbFlows = 24;
+    uint16_t ports[nbFlows];
+    advance(w, 1);
+    for (unsigned i = 0; i < nbFlows; i++)
+    {
+        ports[i] = translateOut(w, rte_cpu_to_be_32(RTE_IPV4(10, 3, 0, i + 1)), 7000);
+        ASSERT_NE(ports[i], 0);
+    }
+    // 超时前刷新偶数编号的会话
+    advance(w, UT_NAT_UDP_MS / 2);
+    for (unsigned i = 0; i < nbFlows; i += 2)
+        ASSERT_NE(translateIn(w, ports[i]), 0u);
+    // 奇数编号的会话超时,分段扫描一遍整张会话表
+    advance(w, UT_NAT_UDP_MS / 2 + 500);
+    for (unsigned n = 0; n < NAT_SWEEPS_PER_SEC; n++)
+        advance(w, 1000 / NAT_SWEEPS_PER_SEC);
+
+    std::set<uint16_t> freed;
+    for (unsigned i = 0; i < nbFlows; i++)
+    {
+        const uint32_t inner = rte_cpu_to_be_32(RTE_IPV4(10, 3, 0, i + 1));
+        if (i % 2 == 0)
+        {
+            EXPECT_EQ(translateIn(w, ports[i]), inner);
+            // 出方向的键同样要能查到,不会重新分配端口
+            EXPECT_EQ(translateOut(w, inner, 7000), ports[i]);
+        }
+        else
+        {
+            EXPECT_EQ(translateIn(w, ports[i]), 0u);
+            freed.insert(ports[i]);
+        }
+    }
+    const uint16_t port = translateOut(w, ip("10.3.1.1"), 7000);
+    ASSERT_NE(port, 0);
+    EXPECT_EQ(freed.count(port), 0u);
+}
+
+// 主函数,NAT的会话表和报文需要EAL的内存管理,不使用大页和网卡
+int main(int argc, char **argv)
+{
+    testing::InitGoogleTest(&argc, argv);
+    char *ealArgs[] = {argv[0], (char *)"--no-huge", (char *)"--no-pci", (char *)"-l", (char *)"0",
+                       (char *)"--log-level=error"};
+    if (rte_eal_init(sizeof(ealArgs) / sizeof(ealArgs[0]), ealArgs) < 0)
+        return 1;
+    g_pool = rte_pktmbuf_pool_create("ut nat pool", 1023, 0, 0, RTE_MBUF_DEFAULT_BUF_SIZE, SOCKET_ID_ANY);
+    NatParams params;
+    params.externalIps = {"203.0.113.1"};
+    params.internalNets = {"10.0.0.0/8"};
+    params.portMin = UT_NAT_PORT_MIN;
+    params.portMax = UT_NAT_PORT_MAX;
+    params.maxSessions = 64;
+    params.udpTimeoutMs = UT_NAT_UDP_MS;
+    if (g_pool == nullptr || Nat44::getInstance().init(UT_NAT_WORKERS, params) < 0)
+        return 1;
+    g_now = rte_get_tsc_hz() * 100;
+    int ret = RUN_ALL_TESTS();
+    rte_eal_cleanup();
+    return ret;
+}
@@ -0,0 +1,121 @@
+#include <gtest/gtest.h>
+#include "Pmtu.hpp"
+#include <rte_eal.h>
+#include <arpa/inet.h>
+#include <thread>
+#include <chrono>
+
+/**
+ * @brief 把点分十进制字符串转成网络字节序地址
+ */
+static uint32_t ip(const char *str)
+{
+    struct in_addr addr;
+    inet_pton(AF_INET, str, &addr);
+    return addr.s_addr;
+}
+
+/**
+ * @brief 路径MTU缓存测试的测试类
+ */
+class PmtuTest : public ::testing::Test
+{
+protected:
+    /**
+     * @brief 每个测试之前清空缓存,链路MTU为1500,有效期足够长
+     */
+    void SetUp() override
+    {
+        PmtuCache::getInstance().init(1500, 600000);
+    }
+};
+
+/**
+ * @brief 测试没有缓存的目的地址使用链路MTU,PMTU只降不升
+ */
+TEST_F(PmtuTest, OnlyLowered)
+{
+    PmtuCache &cache = PmtuCache::getInstance();
+    const uint32_t dst = ip("10.0.0.1");
+    EXPECT_EQ(cache.get(dst), 1500);
+    EXPECT_EQ(cache.getMss(dst), 1500 - TCP_IPV4_HDR_LEN);
+
+    EXPECT_EQ(cache.update(dst, 1400, 1500), 0);
+    EXPECT_EQ(cache.get(dst), 1400);
+    EXPECT_EQ(cache.getMss(dst), 1400 - TCP_IPV4_HDR_LEN);
+    EXPECT_EQ(cache.update(dst, 1450, 1500), -1);
+    EXPECT_EQ(cache.get(dst), 1400);
+    EXPECT_EQ(cache.update(dst, 1500, 1500), -1);
+    EXPECT_EQ(cache.get(ip("10.0.0.2")), 1500);
+}
+
+/**
+ * @brief 测试过小的PMTU被限制到PMTU_MIN,旧路由器不带下一跳MTU时按原始报文长度选择平台值
+ */
+TEST_F(PmtuTest, ClampAndPlateau)
+{
+    PmtuCache &cache = PmtuCache::getInstance();
+    EXPECT_EQ(cache.update(ip("10.0.0.1"), 68, 1500), 0);
+    EXPECT_EQ(cache.get(ip("10.0.0.1")), PMTU_MIN);
+
+    EXPECT_EQ(cache.update(ip("10.0.0.2"), 0, 1500), 0);
+    EXPECT_EQ(cache.get(ip("10.0.0.2")), 1492);
+
+    // 比1006小的平台值低于PMTU_MIN
+    EXPECT_EQ(cache.update(ip("10.0.0.3"), 0, 1000), 0);
+    EXPECT_EQ(cache.get(ip("10.0.0.3")), PMTU_MIN);
+}
+
+/**
+ * @brief 测试学习到的PMTU过期后恢复为链路MTU
+ */
+TEST_F(PmtuTest, Expire)
+{
+    PmtuCache &cache = PmtuCache::getInstance();
+    cache.init(1500, 20);
+    const uint32_t dst = ip("10.0.0.1");
+    ASSERT_EQ(cache.update(dst, 1280, 1500), 0);
+    EXPECT_EQ(cache.get(dst), 1280);
+    std::this_thread::sleep_for(std::chrono::milliseconds(50));
+    EXPECT_EQ(cache.get(dst), 1500);
+}
+
+/**
+ * @brief 测试带缓存的查询在PMTU降低、缓存清空和学习到的PMTU过期后都重新查询
+ */
+TEST_F(PmtuTest, CachedLookup)
+{
+    PmtuCache &cache = PmtuCache::getInstance();
+    cache.init(1500, 20);
+    const uint32_t dst = ip("10.0.0.1");
+    PmtuCacheEntry entry;
+    EXPECT_EQ(cache.getCached(dst, &entry), 1500);
+    EXPECT_EQ(entry.expireMs, 0u);
+
+    ASSERT_EQ(cache.update(dst, 1400, 1500), 0);
+    EXPECT_EQ(cache.getCached(dst, &entry), 1400);
+    // 其他目的地址的缓存项不会被误用
+    EXPECT_EQ(cache.getCached(ip("10.0.0.2"), &entry), 1500);
+    EXPECT_EQ(cache.getCached(dst, &entry), 1400);
+
+    std::this_thread::sleep_for(std::chrono::milliseconds(50));
+    EXPECT_EQ(cache.getCached(dst, &entry), 1500);
+
+    ASSERT_EQ(cache.update(dst, 1280, 1500), 0);
+    EXPECT_EQ(cache.getCached(dst, &entry), 1280);
+    cache.clear();
+    EXPECT_EQ(cache.getCached(dst, &entry), 1500);
+}
+
+// 主函数,过期时间使用EAL的时钟,不使用大页和网卡
+int main(int argc, char **argv)
+{
+    testing::InitGoogleTest(&argc, argv);
+    char *ealArgs[] = {argv[0], (char *)"--no-huge", (char *)"--no-pci", (char *)"-l", (char *)"0",
+                       (char *)"--log-level=error"};
+    if (rte_eal_init(sizeof(ealArgs) / sizeof(ealArgs[0]), ealArgs) < 0)
+        return 1;
+    int ret = RUN_ALL_TESTS();
+    rte_eal_cleanup();
+    return ret;
+}
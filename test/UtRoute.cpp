@@ -0,0 +1,144 @@
+#include <gtest/gtest.h>
+#include "Route.hpp"
+#include <rte_eal.h>
+#include <arpa/inet.h>
+#include <vector>
+
+/**
+ * @brief 把点分十进制字符串转成网络字节序地址
+ */
+static uint32_t ip(const char *str)
+{
+    struct in_addr addr;
+    inet_pton(AF_INET, str, &addr);
+    return addr.s_addr;
+}
+
+/**
+ * @brief 路由表测试的测试类
+ */
+class RouteTest : public ::testing::Test
+{
+protected:
+    /**
+     * @brief 路由表是单例,每个测试之前确保LPM表已创建
+     */
+    void SetUp() override
+    {
+        ASSERT_EQ(RouteTable::getInstance().init(64, 16, SOCKET_ID_ANY), 0);
+    }
+
+    /**
+     * @brief 删除本测试添加的路由,不影响后续测试
+     */
+    void TearDown() override
+    {
+        for (const auto &[prefix, depth] : _added)
+            RouteTable::getInstance().delRoute(prefix, depth);
+    }
+
+    /**
+     * @brief 添加路由并记录下来,测试结束时删除
+     */
+    int add(const char *prefix, uint8_t depth, uint32_t gateway, uint16_t portId)
+    {
+        _added.emplace_back(ip(prefix), depth);
+        return RouteTable::getInstance().addRoute(ip(prefix), depth, gateway, portId);
+    }
+
+    std::vector<std::pair<uint32_t, uint8_t>> _added; ///< 本测试添加的路由
+};
+
+/**
+ * @brief 测试最长前缀匹配,以及直连路由的下一跳是目的地址本身
+ */
+TEST_F(RouteTest, LongestPrefixMatch)
+{
+    ASSERT_EQ(add("10.0.0.0", 8, ip("192.168.1.1"), 0), 0);
+    ASSERT_EQ(add("10.1.2.0", 24, ROUTE_ON_LINK, 1), 0);
+
+    RouteCacheEntry entry;
+    ASSERT_TRUE(RouteTable::getInstance().lookup(ip("10.1.2.3"), &entry));
+    EXPECT_EQ(entry.nextHop, ip("10.1.2.3"));
+    EXPECT_EQ(entry.portId, 1);
+
+    ASSERT_TRUE(RouteTable::getInstance().lookup(ip("10.9.9.9"), &entry));
+    EXPECT_EQ(entry.nextHop, ip("192.168.1.1"));
+    EXPECT_EQ(entry.portId, 0);
+
+    EXPECT_FALSE(RouteTable::getInstance().lookup(ip("172.16.0.1"), &entry));
+}
+
+/**
+ * @brief 测试默认路由0.0.0.0/0能够添加、替换和删除,且只在没有更具体的路由时生效
+ */
+TEST_F(RouteTest, DefaultRoute)
+{
+    RouteCacheEntry entry;
+    EXPECT_FALSE(RouteTable::getInstance().lookup(ip("8.8.8.8"), &entry));
+    EXPECT_EQ(RouteTable::getInstance().delRoute(ip("0.0.0.0"), 0), -1);
+
+    ASSERT_EQ(add("0.0.0.0", 0, ip("192.168.1.254"), 0), 0);
+    ASSERT_EQ(add("192.168.1.0", 24, ROUTE_ON_LINK, 0), 0);
+    ASSERT_TRUE(RouteTable::getInstance().lookup(ip("8.8.8.8"), &entry));
+    EXPECT_EQ(entry.nextHop, ip("192.168.1.254"));
+    ASSERT_TRUE(RouteTable::getInstance().lookup(ip("192.168.1.7"), &entry));
+    EXPECT_EQ(entry.nextHop, ip("192.168.1.7"));
+
+    // 再次添加替换默认网关
+    ASSERT_EQ(add("0.0.0.0", 0, ip("192.168.1.253"), 1), 0);
+    ASSERT_TRUE(RouteTable::getInstance().lookup(ip("8.8.8.8"), &entry));
+    EXPECT_EQ(entry.nextHop, ip("192.168.1.253"));
+    EXPECT_EQ(entry.portId, 1);
+
+    EXPECT_EQ(RouteTable::getInstance().delRoute(ip("0.0.0.0"), 0), 0);
+    EXPECT_FALSE(RouteTable::getInstance().lookup(ip("8.8.8.8"), &entry));
+    EXPECT_TRUE(RouteTable::getInstance().lookup(ip("192.168.1.7"), &entry));
+}
+
+/**
+ * @brief 测试配置格式的路由,前缀长度为0的条目作为默认路由添加
+ */
+TEST_F(RouteTest, AddRoutesFromConfig)
+{
+    _added = {{ip("0.0.0.0"), 0}, {ip("10.0.0.0"), 8}};
+    EXPECT_EQ(RouteTable::getInstance().addRoutes({{"0.0.0.0/0", "192.168.1.1"},
+                                                   {"10.0.0.0/8", ""},
+                                                   {"10.0.0.0/33", ""},
+                                                   {"bad", ""}},
+                                                  0),
+              2u);
+    RouteCacheEntry entry;
+    ASSERT_TRUE(RouteTable::getInstance().lookup(ip("1.1.1.1"), &entry));
+    EXPECT_EQ(entry.nextHop, ip("192.168.1.1"));
+}
+
+/**
+ * @brief 测试路由表变化后缓存失效,重新查询得到新的结果
+ */
+TEST_F(RouteTest, CacheInvalidation)
+{
+    ASSERT_EQ(add("0.0.0.0", 0, ip("192.168.1.1"), 0), 0);
+    RouteCacheEntry cache;
+    ASSERT_TRUE(RouteTable::getInstance().lookupCached(ip("10.0.0.1"), &cache));
+    EXPECT_EQ(cache.nextHop, ip("192.168.1.1"));
+    const uint32_t generation = cache.generation;
+
+    ASSERT_EQ(add("10.0.0.0", 8, ip("192.168.1.2"), 0), 0);
+    ASSERT_TRUE(RouteTable::getInstance().lookupCached(ip("10.0.0.1"), &cache));
+    EXPECT_EQ(cache.nextHop, ip("192.168.1.2"));
+    EXPECT_NE(cache.generation, generation);
+}
+
+// 主函数,LPM表需要EAL的内存管理,不使用大页和网卡
+int main(int argc, char **argv)
+{
+    testing::InitGoogleTest(&argc, argv);
+    char *ealArgs[] = {argv[0], (char *)"--no-huge", (char *)"--no-pci", (char *)"-l", (char *)"0",
+                       (char *)"--log-level=error"};
+    if (rte_eal_init(sizeof(ealArgs) / sizeof(ealArgs[0]), ealArgs) < 0)
+        return 1;
+    int ret = RUN_ALL_TESTS();
+    rte_eal_cleanup();
+    return ret;
+}
@@ -0,0 +1,121 @@
+#include <gtest/gtest.h>
+#include "TcpHost.hpp"
+#include <arpa/inet.h>
+#include <new>
+
+/**
+ * @brief 把点分十进制字符串转成网络字节序地址
+ */
+static uint32_t ip(const char *str)
+{
+    struct in_addr addr;
+    inet_pton(AF_INET, str, &addr);
+    return addr.s_addr;
+}
+
+/**
+ * @brief TCP流表查找的测试类
+ *
+ * 流表是单例且不提供清空接口,每个测试使用不同的端口互不干扰。
+ */
+class TcpTableTest : public ::testing::Test
+{
+protected:
+    /**
+     * @brief 创建一个IPv4 socket并加入流表
+     */
+    TcpStream *addStream(int fd, uint32_t localIp, uint16_t localPort, uint32_t peerIp, uint16_t peerPort,
+                         TCP_STATUS status)
+    {
+        TcpStream *ts = &_streams[_nbStreams++];
+        new (ts) TcpStream();
+        ts->fd = fd;
+        ts->family = AF_INET;
+        ts->dstIp = localIp;
+        ts->dstPort = htons(localPort);
+        ts->srcIp = peerIp;
+        ts->srcPort = htons(peerPort);
+        ts->status = status;
+        EXPECT_EQ(TcpTable::getInstance().addTcpStream(ts), 0);
+        return ts;
+    }
+
+    /**
+     * @brief 创建一个IPv6 socket并加入流表,local为nullptr表示任意地址
+     */
+    TcpStream *addStream6(int fd, const char *local, uint16_t localPort, TCP_STATUS status)
+    {
+        TcpStream *ts = &_streams[_nbStreams++];
+        new (ts) TcpStream();
+        ts->fd = fd;
+        ts->family = AF_INET6;
+        if (local != nullptr)
+            inet_pton(AF_INET6, local, ts->dstIp6);
+        ts->dstPort = htons(localPort);
+        ts->status = status;
+        EXPECT_EQ(TcpTable::getInstance().addTcpStream(ts), 0);
+        return ts;
+    }
+
+    static TcpStream _streams[16]; ///< 测试使用的流,流表保存指针,生命周期需要覆盖所有测试
+    static int _nbStreams;         ///< 已使用的流数量
+};
+
+TcpStream TcpTableTest::_streams[16];
+int TcpTableTest::_nbStreams = 0;
+
+/**
+ * @brief 测试绑定具体地址的监听socket优先于INADDR_ANY,与加入流表的顺序无关
+ */
+TEST_F(TcpTableTest, ExactListenerPreferred)
+{
+    TcpStream *any = addStream(3, INADDR_ANY, 8001, 0, 0, TCP_STATUS::TCP_STATUS_LISTEN);
+    TcpStream *exact = addStream(4, ip("192.168.1.10"), 8001, 0, 0, TCP_STATUS::TCP_STATUS_LISTEN);
+
+    EXPECT_EQ(TcpTable::getInstance().getTcpStream(ip("10.0.0.1"), ip("192.168.1.10"), htons(40000), htons(8001)),
+              exact);
+    // 发往其他本机地址的连接交给INADDR_ANY的监听socket
+    EXPECT_EQ(TcpTable::getInstance().getTcpStream(ip("10.0.0.1"), ip("192.168.1.11"), htons(40000), htons(8001)),
+              any);
+    // 端口不匹配时找不到
+    EXPECT_EQ(TcpTable::getInstance().getTcpStream(ip("10.0.0.1"), ip("192.168.1.10"), htons(40000), htons(8002)),
+              nullptr);
+}
+
+/**
+ * @brief 测试已建立的连接优先于监听socket
+ */
+TEST_F(TcpTableTest, EstablishedBeforeListener)
+{
+    addStream(5, ip("192.168.1.10"), 8003, 0, 0, TCP_STATUS::TCP_STATUS_LISTEN);
+    TcpStream *conn = addStream(6, ip("192.168.1.10"), 8003, ip("10.0.0.2"), 40001,
+                                TCP_STATUS::TCP_STATUS_ESTABLISHED);
+
+    EXPECT_EQ(TcpTable::getInstance().getTcpStream(ip("10.0.0.2"), ip("192.168.1.10"), htons(40001), htons(8003)),
+              conn);
+    EXPECT_NE(TcpTable::getInstance().getTcpStream(ip("10.0.0.3"), ip("192.168.1.10"), htons(40001), htons(8003)),
+              conn);
+}
+
+/**
+ * @brief 测试IPv6的监听socket查找规则与IPv4相同
+ */
+TEST_F(TcpTableTest, ExactListenerPreferred6)
+{
+    TcpStream *any = addStream6(7, nullptr, 8004, TCP_STATUS::TCP_STATUS_LISTEN);
+    TcpStream *exact = addStream6(8, "2001:db8::10", 8004, TCP_STATUS::TCP_STATUS_LISTEN);
+
+    uint8_t peer[IPV6_ADDR_LEN], local[IPV6_ADDR_LEN], other[IPV6_ADDR_LEN];
+    inet_pton(AF_INET6, "2001:db8::1", peer);
+    inet_pton(AF_INET6, "2001:db8::10", local);
+    inet_pton(AF_INET6, "2001:db8::11", other);
+    EXPECT_EQ(TcpTable::getInstance().getTcpStream6(peer, local, htons(40000), htons(8004)), exact);
+    EXPECT_EQ(TcpTable::getInstance().getTcpStream6(peer, other, htons(40000), htons(8004)), any);
+}
+
+// 主函数，用于运行测试
+int main(int argc, char **argv)
+{
+    testing::InitGoogleTest(&argc, argv);
+    return RUN_ALL_TESTS();
+}